@@ -33,6 +33,7 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "lib.h"
 #include "allocate.h"
@@ -43,6 +44,10 @@
 #include "expression.h"
 #include "linearize.h"
 
+struct blob_stats blob_stats;
+
+struct allocator_struct allocators[ALLOCATOR_NR];
+
 void protect_allocations(struct allocator_struct *desc)
 {
 	desc->blobs = NULL;
@@ -54,9 +59,12 @@ void drop_all_allocations(struct allocator_struct *desc)
 
 	desc->blobs = NULL;
 	desc->allocations = 0;
+	desc->reused = 0;
 	desc->total_bytes = 0;
 	desc->useful_bytes = 0;
-	desc->freelist = NULL;
+	desc->peak_bytes = 0;
+	desc->free_bytes = 0;
+	memset(desc->freelist, 0, sizeof(desc->freelist));
 	while (blob) {
 		struct allocation_blob *next = blob->next;
 		blob_free(blob, desc->chunking);
@@ -64,11 +72,113 @@ void drop_all_allocations(struct allocator_struct *desc)
 	}
 }
 
-void free_one_entry(struct allocator_struct *desc, void *entry)
+/*
+ * Remember the current position of the allocator so that
+ * release_allocations() can later free, all at once, everything
+ * allocated after it. The freelists are put aside meanwhile so
+ * that the entries freed in between can't be reused later.
+ * Marks must be released in the reverse order they were taken.
+ *
+ * The number of allocations & their bytes are not rewound: they
+ * count everything that has been allocated, the memory the blobs
+ * took at most being given by their peak size.
+ */
+void mark_allocations(struct allocator_struct *desc, struct allocator_mark *mark)
+{
+	struct allocation_blob *blob = desc->blobs;
+
+	mark->blob = blob;
+	if (blob) {
+		mark->left = blob->left;
+		mark->offset = blob->offset;
+	}
+	memcpy(mark->freelist, desc->freelist, sizeof(desc->freelist));
+	memset(desc->freelist, 0, sizeof(desc->freelist));
+	mark->free_bytes = desc->free_bytes;
+}
+
+void release_allocations(struct allocator_struct *desc, struct allocator_mark *mark)
+{
+	struct allocation_blob *blob = desc->blobs;
+
+	while (blob != mark->blob) {
+		struct allocation_blob *next = blob->next;
+		blob_free(blob, desc->chunking);
+		desc->total_bytes -= desc->chunking;
+		blob = next;
+	}
+	desc->blobs = blob;
+	if (blob) {
+		/* allocate() expects fresh memory to be zeroed */
+		memset(blob->data + mark->offset, 0, blob->offset - mark->offset);
+		blob->left = mark->left;
+		blob->offset = mark->offset;
+	}
+	memcpy(desc->freelist, mark->freelist, sizeof(desc->freelist));
+	desc->free_bytes = mark->free_bytes;
+}
+
+/*
+ * The smallest size of the entries of the class 'cls'.
+ */
+static inline unsigned int class_size(int cls)
+{
+	if (cls < ALLOC_SMALL_CLASSES)
+		return cls * ALLOC_GRANULE;
+	return (ALLOC_SMALL_CLASSES * ALLOC_GRANULE) << (cls - ALLOC_SMALL_CLASSES);
+}
+
+/*
+ * The class where to put a freed entry of 'size' bytes:
+ * all the entries of a class are at least as big as the class.
+ */
+static int lower_class(unsigned int size)
+{
+	int cls;
+
+	if (size < ALLOC_SMALL_CLASSES * ALLOC_GRANULE)
+		return size / ALLOC_GRANULE;
+	for (cls = ALLOC_SMALL_CLASSES; cls < ALLOC_SIZE_CLASSES - 1; cls++) {
+		if (size < class_size(cls + 1))
+			break;
+	}
+	return cls;
+}
+
+/*
+ * The class where to find an entry of at least 'size' bytes.
+ */
+static int upper_class(unsigned int size)
 {
-	void **p = entry;
-	*p = desc->freelist;
-	desc->freelist = p;
+	int cls = lower_class(size);
+
+	if (class_size(cls) < size)
+		cls++;
+	return cls;
+}
+
+/*
+ * The entries can be of any size and alignment, so the
+ * link is read & written with memcpy().
+ */
+static inline void *get_link(void *entry)
+{
+	void *next;
+
+	memcpy(&next, entry, sizeof(next));
+	return next;
+}
+
+void free_one_entry(struct allocator_struct *desc, void *entry, unsigned int size)
+{
+	int cls = lower_class(size);
+
+	/* too small to hold the link */
+	if (size < sizeof(void *))
+		return;
+	memcpy(entry, &desc->freelist[cls], sizeof(void *));
+	desc->freelist[cls] = entry;
+	desc->free_bytes += class_size(cls);
 }
 
 void *allocate(struct allocator_struct *desc, unsigned int size)
@@ -76,22 +186,19 @@ void *allocate(struct allocator_struct *desc, unsigned int size)
 	unsigned long alignment = desc->alignment;
 	struct allocation_blob *blob = desc->blobs;
 	void *retval;
+	int cls;
 
 	/*
-	 * NOTE! The freelist only works with things that are
-	 *  (a) sufficiently aligned
-	 *  (b) use a constant size
-	 * Don't try to free allocators that don't follow
-	 * these rules.
+	 * NOTE! The freelists only work with entries of the same
+	 * allocator: they all have its alignment.
 	 */
-	if (desc->freelist) {
-		void **p = desc->freelist;
-		retval = p;
-		desc->freelist = *p;
-		do {
-			*p = NULL;
-			p++;
-		} while ((size -= sizeof(void *)) > 0);
+	cls = upper_class(size);
+	if (cls < ALLOC_SIZE_CLASSES && desc->freelist[cls]) {
+		retval = desc->freelist[cls];
+		desc->freelist[cls] = get_link(retval);
+		desc->free_bytes -= class_size(cls);
+		desc->reused++;
+		memset(retval, 0, size);
 		return retval;
 	}
 
@@ -104,6 +211,8 @@ void *allocate(struct allocator_struct *desc, unsigned int size)
 		if (!newblob)
 			die("out of memory");
 		desc->total_bytes += chunking;
+		if (desc->total_bytes > desc->peak_bytes)
+			desc->peak_bytes = desc->total_bytes;
 		newblob->next = blob;
 		blob = newblob;
 		desc->blobs = newblob;
@@ -118,36 +227,42 @@ void *allocate(struct allocator_struct *desc, unsigned int size)
 	return retval;
 }
 
-void show_allocations(struct allocator_struct *x)
+void get_allocator_stats(enum allocator_id id, const struct allocator_struct *desc, struct allocator_stats *s)
 {
-	fprintf(stderr, "%s: %d allocations, %lu bytes (%lu total bytes, "
-			"%6.2f%% usage, %6.2f average size)\n",
-		x->name, x->allocations, x->useful_bytes, x->total_bytes,
-		100 * (double) x->useful_bytes / x->total_bytes,
-		(double) x->useful_bytes / x->allocations);
-}
+	struct allocator_struct *x = &allocators[id];
 
-void get_allocator_stats(struct allocator_struct *x, struct allocator_stats *s)
-{
-	s->name = x->name;
+	s->name = desc->name;
 	s->allocations = x->allocations;
+	s->reused = x->reused;
 	s->useful_bytes = x->useful_bytes;
 	s->total_bytes = x->total_bytes;
+	s->peak_bytes = x->peak_bytes;
+	s->free_bytes = x->free_bytes;
+}
+
+void show_allocations(enum allocator_id id, const struct allocator_struct *desc)
+{
+	struct allocator_stats x;
+
+	get_allocator_stats(id, desc, &x);
+	fprintf(stderr, "%s: %d allocations, %lu bytes (%lu total bytes, "
+			"%6.2f%% usage, %6.2f average size)\n",
+		x.name, x.allocations, x.useful_bytes, x.peak_bytes,
+		100 * (double) x.useful_bytes / x.peak_bytes,
+		(double) x.useful_bytes / x.allocations);
 }
 
 ALLOCATOR(ident, "identifiers");
-ALLOCATOR(token, "tokens");
+ALLOCATOR_CHUNK(token, "tokens", BIG_CHUNK);
 ALLOCATOR(context, "contexts");
 ALLOCATOR(symbol, "symbols");
 ALLOCATOR(expression, "expressions");
 ALLOCATOR(statement, "statements");
 ALLOCATOR(string, "strings");
 ALLOCATOR(scope, "scopes");
-__DO_ALLOCATOR(void, 0, 1, "bytes", bytes);
+__DO_ALLOCATOR(void, 0, 1, "bytes", bytes, CHUNK);
 ALLOCATOR(basic_block, "basic_block");
 ALLOCATOR(entrypoint, "entrypoint");
-ALLOCATOR(instruction, "instruction");
+ALLOCATOR_CHUNK(instruction, "instruction", BIG_CHUNK);
 ALLOCATOR(multijmp, "multijmp");
 ALLOCATOR(pseudo, "pseudo");
-
-
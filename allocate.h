@@ -2,6 +2,7 @@
 #define ALLOCATE_H
 
 #include "compat.h"
+#include "ptrlist.h"
 
 struct allocation_blob {
 	struct allocation_blob *next;
@@ -9,74 +10,176 @@ struct allocation_blob {
 	unsigned char data[];
 };
 
+/*
+ * The freed entries are kept in freelists by size class: exact
+ * sizes, by step of ALLOC_GRANULE bytes, for the small ones then
+ * by powers of two, up to 32KB.
+ */
+#define ALLOC_GRANULE		8
+#define ALLOC_SMALL_CLASSES	16
+#define ALLOC_SIZE_CLASSES	(ALLOC_SMALL_CLASSES + 9)
+
 struct allocator_struct {
 	const char *name;
 	struct allocation_blob *blobs;
 	unsigned int alignment;
 	unsigned int chunking;
-	void *freelist;
-	/* statistics */
-	unsigned int allocations;
+	void *freelist[ALLOC_SIZE_CLASSES];
+	/*
+	 * statistics: the allocations are counted since the start, the
+	 * bytes of the blobs as they are now and at their peak
+	 */
+	unsigned int allocations, reused;
 	unsigned long total_bytes, useful_bytes;
+	unsigned long peak_bytes;
+	unsigned long free_bytes;	/* on the freelists */
+};
+
+/*
+ * A position in an allocator, to be able to free in one go
+ * everything allocated after it (see mark_allocations()).
+ */
+struct allocator_mark {
+	struct allocation_blob *blob;
+	unsigned int left, offset;
+	void *freelist[ALLOC_SIZE_CLASSES];
+	unsigned long free_bytes;
 };
 
 struct allocator_stats {
 	const char *name;
-	unsigned int allocations;
-	unsigned long total_bytes, useful_bytes;
+	unsigned int allocations, reused;
+	unsigned long total_bytes, useful_bytes, peak_bytes, free_bytes;
 };
 
+/*
+ * All the allocators, indexed by their id.
+ */
+enum allocator_id {
+	ALLOCATOR_ident,
+	ALLOCATOR_token,
+	ALLOCATOR_context,
+	ALLOCATOR_symbol,
+	ALLOCATOR_expression,
+	ALLOCATOR_statement,
+	ALLOCATOR_string,
+	ALLOCATOR_scope,
+	ALLOCATOR_bytes,
+	ALLOCATOR_basic_block,
+	ALLOCATOR_entrypoint,
+	ALLOCATOR_instruction,
+	ALLOCATOR_multijmp,
+	ALLOCATOR_pseudo,
+	ALLOCATOR_pseudo_user,
+	ALLOCATOR_asm_rules,
+	ALLOCATOR_asm_constraint,
+	ALLOCATOR_storage,
+	ALLOCATOR_storage_hash,
+	ALLOCATOR_bitset,
+	ALLOCATOR_ptrlist,		/* one for each of the PTR_LIST_ORDERS */
+	ALLOCATOR_NR = ALLOCATOR_ptrlist + PTR_LIST_ORDERS,
+};
+
+extern struct allocator_struct allocators[ALLOCATOR_NR];
+
+/*
+ * Return the allocator 'id', 'desc' giving its name, alignment
+ * & chunking when it's used for the first time.
+ */
+static inline struct allocator_struct *get_allocator(enum allocator_id id, const struct allocator_struct *desc)
+{
+	struct allocator_struct *allocator = &allocators[id];
+
+	if (!allocator->name) {
+		allocator->name = desc->name;
+		allocator->alignment = desc->alignment;
+		allocator->chunking = desc->chunking;
+	}
+	return allocator;
+}
+
 extern void protect_allocations(struct allocator_struct *desc);
 extern void drop_all_allocations(struct allocator_struct *desc);
+extern void mark_allocations(struct allocator_struct *desc, struct allocator_mark *mark);
+extern void release_allocations(struct allocator_struct *desc, struct allocator_mark *mark);
 extern void *allocate(struct allocator_struct *desc, unsigned int size);
-extern void free_one_entry(struct allocator_struct *desc, void *entry);
-extern void show_allocations(struct allocator_struct *);
-extern void get_allocator_stats(struct allocator_struct *, struct allocator_stats *);
+extern void free_one_entry(struct allocator_struct *desc, void *entry, unsigned int size);
+extern void show_allocations(enum allocator_id id, const struct allocator_struct *desc);
+extern void get_allocator_stats(enum allocator_id id, const struct allocator_struct *desc, struct allocator_stats *);
 extern void show_allocation_stats(void);
 
 #define __DECLARE_ALLOCATOR(type, x)		\
 	extern type *__alloc_##x(int);		\
 	extern void __free_##x(type *);		\
+	extern void __free_sized_##x(type *, int);	\
 	extern void show_##x##_alloc(void);	\
 	extern void get_##x##_stats(struct allocator_stats *);		\
 	extern void clear_##x##_alloc(void);	\
-	extern void protect_##x##_alloc(void);
+	extern void protect_##x##_alloc(void);	\
+	extern void mark_##x##_alloc(struct allocator_mark *);		\
+	extern void release_##x##_alloc(struct allocator_mark *);
 #define DECLARE_ALLOCATOR(x) __DECLARE_ALLOCATOR(struct x, x)
 
-#define __DO_ALLOCATOR(type, objsize, objalign, objname, x)	\
-	static struct allocator_struct x##_allocator = {	\
+/*
+ * The size of the blobs can be chosen for each type: only the types
+ * allocated by the hundreds of thousands, like the tokens and the
+ * instructions, are better served by bigger blobs (BIG_CHUNK); the
+ * others keep CHUNK so that a small file doesn't reserve megabytes.
+ * It must be a multiple of CHUNK and at most 2MB.
+ */
+#define BIG_CHUNK	(8 * CHUNK)
+
+#define __DO_ALLOCATOR(type, objsize, objalign, objname, x, chunk) \
+	static const struct allocator_struct x##_allocator = {	\
 		.name = objname,				\
 		.alignment = objalign,				\
-		.chunking = CHUNK };				\
+		.chunking = chunk };				\
+	static inline struct allocator_struct *x##_desc(void)	\
+	{							\
+		return get_allocator(ALLOCATOR_##x, &x##_allocator); \
+	}							\
 	type *__alloc_##x(int extra)				\
 	{							\
-		return allocate(&x##_allocator, objsize+extra);	\
+		return allocate(x##_desc(), objsize+extra);	\
 	}							\
 	void __free_##x(type *entry)				\
 	{							\
-		free_one_entry(&x##_allocator, entry);		\
+		free_one_entry(x##_desc(), entry, objsize);	\
+	}							\
+	void __free_sized_##x(type *entry, int extra)		\
+	{							\
+		free_one_entry(x##_desc(), entry, objsize+extra); \
 	}							\
 	void show_##x##_alloc(void)				\
 	{							\
-		show_allocations(&x##_allocator);		\
+		show_allocations(ALLOCATOR_##x, &x##_allocator); \
 	}							\
 	void get_##x##_stats(struct allocator_stats *s)		\
 	{							\
-		get_allocator_stats(&x##_allocator, s);		\
+		get_allocator_stats(ALLOCATOR_##x, &x##_allocator, s); \
 	}							\
 	void clear_##x##_alloc(void)				\
 	{							\
-		drop_all_allocations(&x##_allocator);		\
+		drop_all_allocations(x##_desc());		\
 	}							\
 	void protect_##x##_alloc(void)				\
 	{							\
-		protect_allocations(&x##_allocator);		\
+		protect_allocations(x##_desc());		\
+	}							\
+	void mark_##x##_alloc(struct allocator_mark *mark)	\
+	{							\
+		mark_allocations(x##_desc(), mark);		\
+	}							\
+	void release_##x##_alloc(struct allocator_mark *mark)	\
+	{							\
+		release_allocations(x##_desc(), mark);		\
 	}
 
-#define __ALLOCATOR(t, n, x) 					\
-	__DO_ALLOCATOR(t, sizeof(t), __alignof__(t), n, x)
+#define __ALLOCATOR(t, n, x, chunk)				\
+	__DO_ALLOCATOR(t, sizeof(t), __alignof__(t), n, x, chunk)
 
-#define ALLOCATOR(x, n) __ALLOCATOR(struct x, n, x)
+#define ALLOCATOR(x, n) __ALLOCATOR(struct x, n, x, CHUNK)
+#define ALLOCATOR_CHUNK(x, n, chunk) __ALLOCATOR(struct x, n, x, chunk)
 
 DECLARE_ALLOCATOR(ident);
 DECLARE_ALLOCATOR(token);
@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: MIT
+//
+// bitmap.c - allocation of the bitsets
+//
+
+#include <stdlib.h>
+
+#include "lib.h"
+#include "allocate.h"
+#include "bitmap.h"
+
+/*
+ * The bitsets of a big function can be big: up to a million bits.
+ * Those too big for a blob are allocated on the heap.
+ */
+ALLOCATOR_CHUNK(bitset, "bitsets", BIG_CHUNK);
+
+static inline int big_bitset(unsigned int nr_words)
+{
+	return nr_words * sizeof(unsigned long) > BIG_CHUNK / 2;
+}
+
+struct bitset *alloc_bitset(unsigned int nr_bits)
+{
+	unsigned int nr_words = BITSET_WORDS(nr_bits);
+	struct bitset *set;
+
+	if (big_bitset(nr_words)) {
+		set = calloc(1, sizeof(*set) + nr_words * sizeof(unsigned long));
+		if (!set)
+			die("out of memory");
+	} else {
+		set = __alloc_bitset(nr_words * sizeof(unsigned long));
+	}
+	set->nr_words = nr_words;
+	return set;
+}
+
+void free_bitset(struct bitset *set)
+{
+	if (big_bitset(set->nr_words))
+		free(set);
+	else
+		__free_sized_bitset(set, set->nr_words * sizeof(unsigned long));
+}
@@ -1,6 +1,9 @@
 #ifndef BITMAP_H
 #define BITMAP_H
 
+#include <string.h>
+#include "allocate.h"
+
 #define BITS_IN_LONG	(sizeof(unsigned long)*8)
 #define LONGS(x)	((x + BITS_IN_LONG - 1) & -BITS_IN_LONG)
 
@@ -48,4 +51,213 @@ static inline int test_and_clear_bit(unsigned int nr, unsigned long *bitmap)
 	return (old & mask) != 0;
 }
 
+/*
+ * Bitsets: heap allocated bitmaps, sized at runtime (typically one
+ * bit per basic block or per pseudo of a function), for the
+ * dataflow analyses.
+ *
+ * The set operations work a whole word at a time, in plain loops
+ * the compiler can vectorize. Those modifying their destination
+ * return non-zero if it has changed, which is what the iterations
+ * up to a fixed point need to know. All the sets given to an
+ * operation must have the same size.
+ *
+ * The bitsets come from their own allocator, freed bitsets being
+ * recycled for the next ones of the same size.
+ */
+struct bitset {
+	unsigned int nr_words;
+	unsigned long words[];
+};
+
+#define BITSET_WORDS(nr)	(((nr) + BITS_IN_LONG - 1) / BITS_IN_LONG)
+
+DECLARE_ALLOCATOR(bitset);
+
+extern struct bitset *alloc_bitset(unsigned int nr_bits);
+extern void free_bitset(struct bitset *set);
+
+static inline unsigned int bitset_size(const struct bitset *set)
+{
+	return set->nr_words * BITS_IN_LONG;
+}
+
+static inline int bitset_test(const struct bitset *set, unsigned int nr)
+{
+	return test_bit(nr, (unsigned long *)set->words);
+}
+
+static inline void bitset_set(struct bitset *set, unsigned int nr)
+{
+	set_bit(nr, set->words);
+}
+
+static inline void bitset_clear(struct bitset *set, unsigned int nr)
+{
+	clear_bit(nr, set->words);
+}
+
+static inline int bitset_test_and_set(struct bitset *set, unsigned int nr)
+{
+	return test_and_set_bit(nr, set->words);
+}
+
+static inline void bitset_zero(struct bitset *set)
+{
+	memset(set->words, 0, set->nr_words * sizeof(unsigned long));
+}
+
+static inline int bitset_empty(const struct bitset *set)
+{
+	unsigned long bits = 0;
+	unsigned int i;
+
+	for (i = 0; i < set->nr_words; i++)
+		bits |= set->words[i];
+	return !bits;
+}
+
+static inline int bitset_equal(const struct bitset *a, const struct bitset *b)
+{
+	unsigned long diff = 0;
+	unsigned int i;
+
+	for (i = 0; i < a->nr_words; i++)
+		diff |= a->words[i] ^ b->words[i];
+	return !diff;
+}
+
+/* dst = src */
+static inline int bitset_copy(struct bitset *dst, const struct bitset *src)
+{
+	unsigned long changed = 0;
+	unsigned int i;
+
+	for (i = 0; i < dst->nr_words; i++) {
+		changed |= dst->words[i] ^ src->words[i];
+		dst->words[i] = src->words[i];
+	}
+	return changed != 0;
+}
+
+/* dst |= src */
+static inline int bitset_or(struct bitset *dst, const struct bitset *src)
+{
+	unsigned long changed = 0;
+	unsigned int i;
+
+	for (i = 0; i < dst->nr_words; i++) {
+		unsigned long old = dst->words[i];
+		unsigned long new = old | src->words[i];
+
+		changed |= old ^ new;
+		dst->words[i] = new;
+	}
+	return changed != 0;
+}
+
+/* dst &= src */
+static inline int bitset_and(struct bitset *dst, const struct bitset *src)
+{
+	unsigned long changed = 0;
+	unsigned int i;
+
+	for (i = 0; i < dst->nr_words; i++) {
+		unsigned long old = dst->words[i];
+		unsigned long new = old & src->words[i];
+
+		changed |= old ^ new;
+		dst->words[i] = new;
+	}
+	return changed != 0;
+}
+
+/* dst &= ~src */
+static inline int bitset_andnot(struct bitset *dst, const struct bitset *src)
+{
+	unsigned long changed = 0;
+	unsigned int i;
+
+	for (i = 0; i < dst->nr_words; i++) {
+		unsigned long old = dst->words[i];
+		unsigned long new = old & ~src->words[i];
+
+		changed |= old ^ new;
+		dst->words[i] = new;
+	}
+	return changed != 0;
+}
+
+/*
+ * dst |= a & ~b: the usual transfer function of the backward
+ * analyses (in = use | (out & ~def)) in a single pass.
+ */
+static inline int bitset_or_andnot(struct bitset *dst, const struct bitset *a, const struct bitset *b)
+{
+	unsigned long changed = 0;
+	unsigned int i;
+
+	for (i = 0; i < dst->nr_words; i++) {
+		unsigned long old = dst->words[i];
+		unsigned long new = old | (a->words[i] & ~b->words[i]);
+
+		changed |= old ^ new;
+		dst->words[i] = new;
+	}
+	return changed != 0;
+}
+
+static inline unsigned int bitset_count(const struct bitset *set)
+{
+	unsigned int nr = 0;
+	unsigned int i;
+
+	for (i = 0; i < set->nr_words; i++)
+		nr += __builtin_popcountl(set->words[i]);
+	return nr;
+}
+
+/*
+ * The first bit set at or after 'nr', or -1 if none.
+ */
+static inline int bitset_next(const struct bitset *set, unsigned int nr)
+{
+	unsigned int i = nr / BITS_IN_LONG;
+	unsigned long bits;
+
+	if (i >= set->nr_words)
+		return -1;
+	bits = set->words[i] & (~0UL << (nr & (BITS_IN_LONG-1)));
+	while (!bits) {
+		if (++i >= set->nr_words)
+			return -1;
+		bits = set->words[i];
+	}
+	return i * BITS_IN_LONG + __builtin_ctzl(bits);
+}
+
+/*
+ * Walk the bits set, in increasing order, skipping the zero words.
+ * 'break' & 'continue' work as expected. The bits changed during
+ * the walk in the current word are not seen, those in the next
+ * words are.
+ */
+#define FOR_EACH_BIT(set, nr) do {					\
+	const struct bitset *__set = (set);				\
+	unsigned int __w = 0;						\
+	unsigned long __bits = __set->nr_words ? __set->words[0] : 0;	\
+	for (;;) {							\
+		if (!__bits) {						\
+			if (++__w >= __set->nr_words)			\
+				break;					\
+			__bits = __set->words[__w];			\
+			continue;					\
+		}							\
+		nr = __w * BITS_IN_LONG + __builtin_ctzl(__bits);	\
+		__bits &= __bits - 1;
+
+#define END_FOR_EACH_BIT(nr)						\
+	}								\
+} while (0)
+
 #endif /* BITMAP_H */
@@ -41,6 +41,9 @@ void *blob_alloc(unsigned long size)
 		ptr = NULL;	
 	else	
 		memset(ptr, 0, size);	
+	blob_stats.maps++;
+	blob_stats.mapped_bytes += size;
+	blob_stats.blobs++;
 	return ptr;	
 }	
 	
@@ -48,6 +51,7 @@ void blob_free(void *addr, unsigned long size)
 {	
 	size = (size + 4095) & ~4095;	
 	munmap(addr, size);	
+	blob_stats.unmaps++;
 }	
 	
 long double string_to_ld(const char *nptr, char **endptr) 	
@@ -39,12 +39,16 @@ void *blob_alloc(unsigned long size)
 	ptr = malloc(size);	
 	if (ptr != NULL)	
 		memset(ptr, 0, size);	
+	blob_stats.maps++;
+	blob_stats.mapped_bytes += size;
+	blob_stats.blobs++;
 	return ptr;	
 }	
 	
 void blob_free(void *addr, unsigned long size)	
 {	
 	free(addr);	
+	blob_stats.unmaps++;
 }	
 	
 long double string_to_ld(const char *nptr, char **endptr) 	
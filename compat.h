@@ -23,6 +23,16 @@ struct stat;
 
 void *blob_alloc(unsigned long size);
 void blob_free(void *addr, unsigned long size);
+
+/*
+ * What the blob allocator asked to the system, for -fmem-report.
+ */
+struct blob_stats {
+	unsigned long maps, unmaps;	/* mmap()/munmap() or malloc()/free() */
+	unsigned long mapped_bytes;
+	unsigned long blobs, reused;	/* blobs allocated, from the cache */
+};
+extern struct blob_stats blob_stats;
 long double string_to_ld(const char *nptr, char **endptr);
 
 #endif
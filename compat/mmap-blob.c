@@ -1,5 +1,6 @@
 #include <sys/mman.h>
 #include <sys/types.h>
+#include <string.h>
 
 /*
  * Allow old BSD naming too, it would be a pity to have to make a
@@ -10,27 +11,97 @@
 #endif
 
 /*
- * Our blob allocator enforces the strict CHUNK size
- * requirement, as a portability check.
+ * The blobs are carved out of big regions, mapped once and never
+ * unmapped: the freed blobs are kept in a cache, by size, to be
+ * reused. This saves a lot of system calls and, with the regions
+ * backed by huge pages when possible, a lot of TLB misses too.
  */
-void *blob_alloc(unsigned long size)
+#define REGION_SIZE	(2UL << 20)
+#define BLOB_SIZES	(REGION_SIZE / CHUNK)
+
+static char *region;
+static unsigned long region_left;
+static void *blob_cache[BLOB_SIZES + 1];
+
+/*
+ * Map a new region, aligned on its size for the huge pages.
+ */
+static char *map_region(void)
 {
-	void *ptr;
+	unsigned long size = 2 * REGION_SIZE;
+	unsigned long head;
+	char *ptr;
 
-	if (size & ~CHUNK)
-		die("internal error: bad allocation size (%lu bytes)", size);
 	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 	if (ptr == MAP_FAILED)
-		ptr = NULL;
+		return NULL;
+	blob_stats.maps++;
+
+	head = -(unsigned long)ptr & (REGION_SIZE - 1);
+	if (head) {
+		munmap(ptr, head);
+		blob_stats.unmaps++;
+	}
+	munmap(ptr + head + REGION_SIZE, REGION_SIZE - head);
+	blob_stats.unmaps++;
+	ptr += head;
+
+#ifdef MADV_HUGEPAGE
+	madvise(ptr, REGION_SIZE, MADV_HUGEPAGE);
+#endif
+	blob_stats.mapped_bytes += REGION_SIZE;
+	return ptr;
+}
+
+static void cache_blob(void *addr, unsigned long size)
+{
+	void **blob = addr;
+
+	*blob = blob_cache[size / CHUNK];
+	blob_cache[size / CHUNK] = blob;
+}
+
+/*
+ * Our blob allocator enforces the blobs to be a multiple of
+ * CHUNK bytes, as a portability check.
+ */
+void *blob_alloc(unsigned long size)
+{
+	void **ptr;
+
+	if (!size || (size & (CHUNK - 1)) || size > REGION_SIZE)
+		die("internal error: bad allocation size (%lu bytes)", size);
+
+	blob_stats.blobs++;
+	ptr = blob_cache[size / CHUNK];
+	if (ptr) {
+		blob_cache[size / CHUNK] = *ptr;
+		blob_stats.reused++;
+		memset(ptr, 0, size);
+		return ptr;
+	}
+
+	if (region_left < size) {
+		/* don't waste what's left of the current region */
+		for (; region_left; region_left -= CHUNK, region += CHUNK)
+			cache_blob(region, CHUNK);
+		region = map_region();
+		if (!region)
+			return NULL;
+		region_left = REGION_SIZE;
+	}
+	ptr = (void **)region;
+	region += size;
+	region_left -= size;
 	return ptr;
 }
 
 void blob_free(void *addr, unsigned long size)
 {
-	if (!size || (size & ~CHUNK) || ((unsigned long) addr & 512))
+	if (!size || (size & (CHUNK - 1)) || ((unsigned long) addr & (CHUNK - 1)))
 		die("internal error: bad blob free (%lu bytes at %p)", size, addr);
 #ifndef DEBUG
-	munmap(addr, size);
+	cache_blob(addr, size);
 #else
 	mprotect(addr, size, PROT_NONE);
 #endif
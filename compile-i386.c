@@ -43,7 +43,6 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
-#include <unistd.h>
 #include <fcntl.h>
 #include <assert.h>
 
@@ -58,13 +57,7 @@
 #include "compile.h"
 #include "bitmap.h"
 #include "version.h"
-
-struct textbuf {
-	unsigned int	len;	/* does NOT include terminating null */
-	char		*text;
-	struct textbuf	*next;
-	struct textbuf	*prev;
-};
+#include "outbuf.h"
 
 struct loop_stack {
 	int		continue_lbl;
@@ -74,16 +67,21 @@ struct loop_stack {
 
 struct atom;
 struct storage;
-DECLARE_PTR_LIST(str_list, struct atom);
-DECLARE_PTR_LIST(atom_list, struct atom);
 DECLARE_PTR_LIST(storage_list, struct storage);
 
+/* growable array of atoms, in place */
+struct atom_array {
+	struct atom *atoms;
+	unsigned int nr, size;
+};
+
 struct function {
 	int stack_size;
 	int pseudo_nr;
 	struct storage_list *pseudo_list;
-	struct atom_list *atom_list;
-	struct str_list *str_list;
+	struct atom_array atom_list;
+	struct atom_array str_list;
+	struct outbuf text;	/* the text of the ATOM_TEXT */
 	struct loop_stack *loop_stack;
 	struct symbol **argv;
 	unsigned int argc;
@@ -163,10 +161,10 @@ enum atom_type {
 struct atom {
 	enum atom_type type;
 	union {
-		/* stuff for text */
+		/* stuff for text: where it is in the function's text */
 		struct {
-			char *text;
-			unsigned int text_len;  /* w/o terminating null */
+			size_t text_offset;
+			size_t text_len;
 		};
 
 		/* stuff for insns */
@@ -187,7 +185,8 @@ struct atom {
 
 
 static struct function *current_func = NULL;
-static struct textbuf *unit_post_text = NULL;
+static struct outbuf unit_post_text;
+static struct outbuf out;
 static const char *current_section;
 
 static void emit_comment(const char * fmt, ...) FORMAT_ATTR(1);
@@ -405,16 +404,11 @@ static inline unsigned int arg_offset(struct storage *s)
 	return current_func->stack_size + ((1 + s->idx) * 4);
 }
 
-static const char *pretty_offset(int ofs)
+static void put_offset(int ofs)
 {
-	static char esp_buf[64];
-
 	if (ofs)
-		sprintf(esp_buf, "%d(%%esp)", ofs);
-	else
-		strcpy(esp_buf, "(%esp)");
-
-	return esp_buf;
+		outbuf_int(&out, ofs);
+	outbuf_puts(&out, "(%esp)");
 }
 
 static void stor_sym_init(struct symbol *sym)
@@ -433,47 +427,50 @@ static void stor_sym_init(struct symbol *sym)
 	stor->sym = sym;
 }
 
-static const char *stor_op_name(struct storage *s)
+static void put_stor_op(struct storage *s)
 {
-	static char name[32];
-
 	switch (s->type) {
 	case STOR_PSEUDO:
-		strcpy(name, pretty_offset((int) pseudo_offset(s)));
+		put_offset((int) pseudo_offset(s));
 		break;
 	case STOR_ARG:
-		strcpy(name, pretty_offset((int) arg_offset(s)));
+		put_offset((int) arg_offset(s));
 		break;
 	case STOR_SYM:
-		strcpy(name, show_ident(s->sym->ident));
+		outbuf_puts(&out, show_ident(s->sym->ident));
 		break;
 	case STOR_REG:
-		strcpy(name, s->reg->name);
+		outbuf_puts(&out, s->reg->name);
 		break;
 	case STOR_VALUE:
-		sprintf(name, "$%lld", s->value);
+		outbuf_putc(&out, '$');
+		outbuf_int(&out, s->value);
 		break;
 	case STOR_LABEL:
-		sprintf(name, "%s.L%d", s->flags & STOR_LABEL_VAL ? "$" : "",
-			s->label);
+		if (s->flags & STOR_LABEL_VAL)
+			outbuf_putc(&out, '$');
+		outbuf_write(&out, ".L", 2);
+		outbuf_int(&out, s->label);
 		break;
 	case STOR_LABELSYM:
-		sprintf(name, "%s.LS%p", s->flags & STOR_LABEL_VAL ? "$" : "",
+		outbuf_printf(&out, "%s.LS%p", s->flags & STOR_LABEL_VAL ? "$" : "",
 			s->labelsym);
 		break;
 	}
-
-	return name;
 }
 
-static struct atom *new_atom(enum atom_type type)
+static struct atom *new_atom(struct atom_array *list, enum atom_type type)
 {
 	struct atom *atom;
 
-	atom = calloc(1, sizeof(*atom));	/* TODO: chunked alloc */
-	if (!atom)
-		die("nuclear OOM");
-
+	if (list->nr == list->size) {
+		list->size = list->size ? list->size * 2 : 64;
+		list->atoms = realloc(list->atoms, list->size * sizeof(*atom));
+		if (!list->atoms)
+			die("nuclear OOM");
+	}
+	atom = &list->atoms[list->nr++];
+	memset(atom, 0, sizeof(*atom));
 	atom->type = type;
 
 	return atom;
@@ -484,26 +481,43 @@ static inline void push_cstring(struct function *f, struct string *str,
 {
 	struct atom *atom;
 
-	atom = new_atom(ATOM_CSTR);
+	atom = new_atom(&f->str_list, ATOM_CSTR);	/* note: _not_ atom_list */
 	atom->string = str;
 	atom->label = label;
-
-	add_ptr_list(&f->str_list, atom);	/* note: _not_ atom_list */
 }
 
-static inline void push_atom(struct function *f, struct atom *atom)
+/* the function's text from 'start' on becomes an atom */
+static void close_text_atom(struct function *f, size_t start)
 {
-	add_ptr_list(&f->atom_list, atom);
+	struct atom_array *list = &f->atom_list;
+	struct atom *atom = list->nr ? &list->atoms[list->nr - 1] : NULL;
+
+	if (atom && atom->type == ATOM_TEXT) {
+		atom->text_len = f->text.len - atom->text_offset;
+		return;
+	}
+	atom = new_atom(list, ATOM_TEXT);
+	atom->text_offset = start;
+	atom->text_len = f->text.len - start;
 }
 
 static void push_text_atom(struct function *f, const char *text)
 {
-	struct atom *atom = new_atom(ATOM_TEXT);
+	size_t start = f->text.len;
 
-	atom->text = strdup(text);
-	atom->text_len = strlen(text);
+	outbuf_puts(&f->text, text);
+	close_text_atom(f, start);
+}
 
-	push_atom(f, atom);
+static void FORMAT_ATTR(2) push_text_atomf(struct function *f, const char *fmt, ...)
+{
+	size_t start = f->text.len;
+	va_list args;
+
+	va_start(args, fmt);
+	outbuf_vprintf(&f->text, fmt, args);
+	va_end(args);
+	close_text_atom(f, start);
 }
 
 static struct storage *new_storage(enum storage_type type)
@@ -573,61 +587,11 @@ static int new_label(void)
 	return ++label;
 }
 
-static void textbuf_push(struct textbuf **buf_p, const char *text)
-{
-	struct textbuf *tmp, *list = *buf_p;
-	unsigned int text_len = strlen(text);
-	unsigned int alloc_len = text_len + 1 + sizeof(*list);
-
-	tmp = calloc(1, alloc_len);
-	if (!tmp)
-		die("OOM on textbuf alloc");
-
-	tmp->text = ((void *) tmp) + sizeof(*tmp);
-	memcpy(tmp->text, text, text_len + 1);
-	tmp->len = text_len;
-
-	/* add to end of list */
-	if (!list) {
-		list = tmp;
-		tmp->prev = tmp;
-	} else {
-		tmp->prev = list->prev;
-		tmp->prev->next = tmp;
-		list->prev = tmp;
-	}
-	tmp->next = list;
-
-	*buf_p = list;
-}
-
-static void textbuf_emit(struct textbuf **buf_p)
-{
-	struct textbuf *tmp, *list = *buf_p;
-
-	while (list) {
-		tmp = list;
-		if (tmp->next == tmp)
-			list = NULL;
-		else {
-			tmp->prev->next = tmp->next;
-			tmp->next->prev = tmp->prev;
-			list = tmp->next;
-		}
-
-		fputs(tmp->text, stdout);
-
-		free(tmp);
-	}
-
-	*buf_p = list;
-}
-
 static void insn(const char *insn, struct storage *op1, struct storage *op2,
 		 const char *comment_in)
 {
 	struct function *f = current_func;
-	struct atom *atom = new_atom(ATOM_INSN);
+	struct atom *atom = new_atom(&f->atom_list, ATOM_INSN);
 
 	assert(insn != NULL);
 
@@ -638,60 +602,55 @@ static void insn(const char *insn, struct storage *op1, struct storage *op2,
 
 	atom->op1 = op1;
 	atom->op2 = op2;
-
-	push_atom(f, atom);
 }
 
 static void emit_comment(const char *fmt, ...)
 {
 	struct function *f = current_func;
-	static char tmpbuf[100] = "\t# ";
+	size_t start = f->text.len;
 	va_list args;
-	int i;
 
+	outbuf_write(&f->text, "\t# ", 3);
 	va_start(args, fmt);
-	i = vsnprintf(tmpbuf+3, sizeof(tmpbuf)-4, fmt, args);
+	outbuf_vprintf(&f->text, fmt, args);
 	va_end(args);
-	tmpbuf[i+3] = '\n';
-	tmpbuf[i+4] = '\0';
-	push_text_atom(f, tmpbuf);
+	outbuf_putc(&f->text, '\n');
+	close_text_atom(f, start);
 }
 
 static void emit_label (int label, const char *comment)
 {
 	struct function *f = current_func;
-	char s[64];
 
 	if (!comment)
-		sprintf(s, ".L%d:\n", label);
+		push_text_atomf(f, ".L%d:\n", label);
 	else
-		sprintf(s, ".L%d:\t\t\t\t\t# %s\n", label, comment);
-
-	push_text_atom(f, s);
+		push_text_atomf(f, ".L%d:\t\t\t\t\t# %s\n", label, comment);
 }
 
 static void emit_labelsym (struct symbol *sym, const char *comment)
 {
 	struct function *f = current_func;
-	char s[64];
 
 	if (!comment)
-		sprintf(s, ".LS%p:\n", sym);
+		push_text_atomf(f, ".LS%p:\n", sym);
 	else
-		sprintf(s, ".LS%p:\t\t\t\t# %s\n", sym, comment);
-
-	push_text_atom(f, s);
+		push_text_atomf(f, ".LS%p:\t\t\t\t# %s\n", sym, comment);
 }
 
 void emit_unit_begin(const char *basename)
 {
-	printf("\t.file\t\"%s\"\n", basename);
+	outbuf_printf(&out, "\t.file\t\"%s\"\n", basename);
+	outbuf_flush(&out, stdout);
 }
 
 void emit_unit_end(void)
 {
-	textbuf_emit(&unit_post_text);
-	printf("\t.ident\t\"sparse silly x86 backend (version %s)\"\n", SPARSE_VERSION);
+	if (unit_post_text.len)
+		outbuf_write(&out, unit_post_text.buf, unit_post_text.len);
+	outbuf_free(&unit_post_text);
+	outbuf_printf(&out, "\t.ident\t\"sparse silly x86 backend (version %s)\"\n", SPARSE_VERSION);
+	outbuf_flush(&out, stdout);
 }
 
 /* conditionally switch sections */
@@ -702,51 +661,42 @@ static void emit_section(const char *s)
 	if (current_section && (!strcmp(s, current_section)))
 		return;
 
-	printf("\t%s\n", s);
+	outbuf_printf(&out, "\t%s\n", s);
 	current_section = s;
 }
 
 static void emit_insn_atom(struct function *f, struct atom *atom)
 {
-	char s[128];
-	char comment[64];
 	struct storage *op1 = atom->op1;
 	struct storage *op2 = atom->op2;
 
-	if (atom->comment[0])
-		sprintf(comment, "\t\t# %s", atom->comment);
-	else
-		comment[0] = 0;
-
-	if (atom->op2) {
-		char tmp[16];
-		strcpy(tmp, stor_op_name(op1));
-		sprintf(s, "\t%s\t%s, %s%s\n",
-			atom->insn, tmp, stor_op_name(op2), comment);
-	} else if (atom->op1)
-		sprintf(s, "\t%s\t%s%s%s\n",
-			atom->insn, stor_op_name(op1),
-			comment[0] ? "\t" : "", comment);
-	else
-		sprintf(s, "\t%s\t%s%s\n",
-			atom->insn,
-			comment[0] ? "\t\t" : "", comment);
-
-	if (write(STDOUT_FILENO, s, strlen(s)) < 0)
-		die("can't write to stdout");
+	outbuf_putc(&out, '\t');
+	outbuf_puts(&out, atom->insn);
+	outbuf_putc(&out, '\t');
+	if (op1)
+		put_stor_op(op1);
+	if (op2) {
+		outbuf_write(&out, ", ", 2);
+		put_stor_op(op2);
+	}
+	if (atom->comment[0]) {
+		outbuf_puts(&out, op2 ? "\t\t# " : op1 ? "\t\t\t# " : "\t\t\t\t# ");
+		outbuf_puts(&out, atom->comment);
+	}
+	outbuf_putc(&out, '\n');
 }
 
 static void emit_atom_list(struct function *f)
 {
-	struct atom *atom;
+	unsigned int i;
+
+	for (i = 0; i < f->atom_list.nr; i++) {
+		struct atom *atom = &f->atom_list.atoms[i];
 
-	FOR_EACH_PTR(f->atom_list, atom) {
 		switch (atom->type) {
-		case ATOM_TEXT: {
-			if (write(STDOUT_FILENO, atom->text, atom->text_len) < 0)
-				die("can't write to stdout");
+		case ATOM_TEXT:
+			outbuf_write(&out, f->text.buf + atom->text_offset, atom->text_len);
 			break;
-		}
 		case ATOM_INSN:
 			emit_insn_atom(f, atom);
 			break;
@@ -754,38 +704,42 @@ static void emit_atom_list(struct function *f)
 			assert(0);
 			break;
 		}
-	} END_FOR_EACH_PTR(atom);
+	}
 }
 
 static void emit_string_list(struct function *f)
 {
-	struct atom *atom;
+	unsigned int i;
 
 	emit_section(".section\t.rodata");
 
-	FOR_EACH_PTR(f->str_list, atom) {
-		/* FIXME: escape " in string */
-		printf(".L%d:\n", atom->label);
-		printf("\t.string\t%s\n", show_string(atom->string));
+	for (i = 0; i < f->str_list.nr; i++) {
+		struct atom *atom = &f->str_list.atoms[i];
 
-		free(atom);
-	} END_FOR_EACH_PTR(atom);
+		/* FIXME: escape " in string */
+		outbuf_printf(&out, ".L%d:\n", atom->label);
+		outbuf_printf(&out, "\t.string\t%s\n", show_string(atom->string));
+	}
 }
 
 static void func_cleanup(struct function *f)
 {
 	struct storage *stor;
-	struct atom *atom;
+	unsigned int i;
 
-	FOR_EACH_PTR(f->atom_list, atom) {
-		if ((atom->type == ATOM_TEXT) && (atom->text))
-			free(atom->text);
+	for (i = 0; i < f->atom_list.nr; i++) {
+		struct atom *atom = &f->atom_list.atoms[i];
+
+		if (atom->type != ATOM_INSN)
+			continue;
 		if (atom->op1 && (atom->op1->flags & STOR_WANTS_FREE))
 			free(atom->op1);
 		if (atom->op2 && (atom->op2->flags & STOR_WANTS_FREE))
 			free(atom->op2);
-		free(atom);
-	} END_FOR_EACH_PTR(atom);
+	}
+	free(f->atom_list.atoms);
+	free(f->str_list.atoms);
+	outbuf_free(&f->text);
 
 	FOR_EACH_PTR(f->pseudo_list, stor) {
 		free(stor);
@@ -851,22 +805,18 @@ static void emit_func_post(struct symbol *sym)
 	struct function *f = current_func;
 	int stack_size = f->stack_size;
 
-	if (f->str_list)
+	if (f->str_list.nr)
 		emit_string_list(f);
 
 	/* function prologue */
 	emit_section(".text");
 	if ((sym->ctype.modifiers & MOD_STATIC) == 0)
-		printf(".globl %s\n", name);
-	printf("\t.type\t%s, @function\n", name);
-	printf("%s:\n", name);
-
-	if (stack_size) {
-		char pseudo_const[16];
+		outbuf_printf(&out, ".globl %s\n", name);
+	outbuf_printf(&out, "\t.type\t%s, @function\n", name);
+	outbuf_printf(&out, "%s:\n", name);
 
-		sprintf(pseudo_const, "$%d", stack_size);
-		printf("\tsubl\t%s, %%esp\n", pseudo_const);
-	}
+	if (stack_size)
+		outbuf_printf(&out, "\tsubl\t$%d, %%esp\n", stack_size);
 
 	/* function epilogue */
 
@@ -885,13 +835,11 @@ static void emit_func_post(struct symbol *sym)
 
 	insn("ret", NULL, NULL, NULL);
 
-	/* output everything to stdout */
-	fflush(stdout);		/* paranoia; needed? */
 	emit_atom_list(f);
 
 	/* function footer */
 	name = show_ident(sym->ident);
-	printf("\t.size\t%s, .-%s\n", name, name);
+	outbuf_printf(&out, "\t.size\t%s, .-%s\n", name, name);
 
 	func_cleanup(f);
 	current_func = NULL;
@@ -902,13 +850,13 @@ static void emit_object_pre(const char *name, unsigned long modifiers,
 			    unsigned long alignment, unsigned int byte_size)
 {
 	if ((modifiers & MOD_STATIC) == 0)
-		printf(".globl %s\n", name);
+		outbuf_printf(&out, ".globl %s\n", name);
 	emit_section(".data");
 	if (alignment)
-		printf("\t.align %lu\n", alignment);
-	printf("\t.type\t%s, @object\n", name);
-	printf("\t.size\t%s, %d\n", name, byte_size);
-	printf("%s:\n", name);
+		outbuf_printf(&out, "\t.align %lu\n", alignment);
+	outbuf_printf(&out, "\t.type\t%s, @object\n", name);
+	outbuf_printf(&out, "\t.size\t%s, %d\n", name, byte_size);
+	outbuf_printf(&out, "%s:\n", name);
 }
 
 /* emit value (only) for an initializer scalar */
@@ -920,7 +868,7 @@ static void emit_scalar(struct expression *expr, unsigned int bit_size)
 	assert(expr->type == EXPR_VALUE);
 
 	if (expr->value == 0ULL) {
-		printf("\t.zero\t%d\n", bit_size / 8);
+		outbuf_printf(&out, "\t.zero\t%d\n", bit_size / 8);
 		return;
 	}
 
@@ -936,23 +884,18 @@ static void emit_scalar(struct expression *expr, unsigned int bit_size)
 
 	assert(type != NULL);
 
-	printf("\t.%s\t%lld\n", type, ll);
+	outbuf_printf(&out, "\t.%s\t%lld\n", type, ll);
 }
 
 static void emit_global_noinit(const char *name, unsigned long modifiers,
 			       unsigned long alignment, unsigned int byte_size)
 {
-	char s[64];
-
-	if (modifiers & MOD_STATIC) {
-		sprintf(s, "\t.local\t%s\n", name);
-		textbuf_push(&unit_post_text, s);
-	}
+	if (modifiers & MOD_STATIC)
+		outbuf_printf(&unit_post_text, "\t.local\t%s\n", name);
 	if (alignment)
-		sprintf(s, "\t.comm\t%s,%d,%lu\n", name, byte_size, alignment);
+		outbuf_printf(&unit_post_text, "\t.comm\t%s,%d,%lu\n", name, byte_size, alignment);
 	else
-		sprintf(s, "\t.comm\t%s,%d\n", name, byte_size);
-	textbuf_push(&unit_post_text, s);
+		outbuf_printf(&unit_post_text, "\t.comm\t%s,%d\n", name, byte_size);
 }
 
 static int ea_current, ea_last;
@@ -963,7 +906,7 @@ static void emit_initializer(struct symbol *sym,
 	int distance = ea_current - ea_last - 1;
 
 	if (distance > 0)
-		printf("\t.zero\t%d\n", (sym->bit_size / 8) * distance);
+		outbuf_printf(&out, "\t.zero\t%d\n", (sym->bit_size / 8) * distance);
 
 	if (expr->type == EXPR_VALUE) {
 		struct symbol *base_type = sym->ctype.base_type;
@@ -1082,6 +1025,7 @@ static void emit_array(struct symbol *sym)
 void emit_one_symbol(struct symbol *sym)
 {
 	x86_symbol(sym);
+	outbuf_flush(&out, stdout);
 }
 
 static void emit_copy(struct storage *dest, struct storage *src,
@@ -1115,7 +1059,7 @@ static void emit_store(struct expression *dest_expr, struct storage *dest,
 		       struct storage *src, int bits)
 {
 	/* FIXME: Bitfield store! */
-	printf("\tst.%d\t\tv%d,[v%d]\n", bits, src->pseudo, dest->pseudo);
+	outbuf_printf(&out, "\tst.%d\t\tv%d,[v%d]\n", bits, src->pseudo, dest->pseudo);
 }
 
 static void emit_scalar_noinit(struct symbol *sym)
@@ -1793,8 +1737,8 @@ static void emit_switch_statement(struct statement *stmt)
 
 static void x86_struct_member(struct symbol *sym)
 {
-	printf("\t%s:%d:%ld at offset %ld.%d", show_ident(sym->ident), sym->bit_size, sym->ctype.alignment, sym->offset, sym->bit_offset);
-	printf("\n");
+	outbuf_printf(&out, "\t%s:%d:%ld at offset %ld.%d", show_ident(sym->ident), sym->bit_size, sym->ctype.alignment, sym->offset, sym->bit_offset);
+	outbuf_printf(&out, "\n");
 }
 
 static void x86_symbol(struct symbol *sym)
@@ -1836,11 +1780,11 @@ static void x86_symbol(struct symbol *sym)
 	case SYM_UNION: {
 		struct symbol *member;
 
-		printf(" {\n");
+		outbuf_printf(&out, " {\n");
 		FOR_EACH_PTR(type->symbol_list, member) {
 			x86_struct_member(member);
 		} END_FOR_EACH_PTR(member);
-		printf("}\n");
+		outbuf_printf(&out, "}\n");
 		break;
 	}
 
@@ -1860,7 +1804,7 @@ static void x86_symbol(struct symbol *sym)
 
 	if (sym->initializer && (type->type != SYM_BASETYPE) &&
 	    (type->type != SYM_ARRAY)) {
-		printf(" = \n");
+		outbuf_printf(&out, " = \n");
 		x86_expression(sym->initializer);
 	}
 }
@@ -2032,14 +1976,14 @@ static struct storage *x86_statement(struct statement *stmt)
 		break;
 
 	case STMT_LABEL:
-		printf(".L%p:\n", stmt->label_identifier);
+		outbuf_printf(&out, ".L%p:\n", stmt->label_identifier);
 		x86_statement(stmt->label_statement);
 		break;
 
 	case STMT_GOTO:
 		if (stmt->goto_expression) {
 			struct storage *val = x86_expression(stmt->goto_expression);
-			printf("\tgoto *v%d\n", val->pseudo);
+			outbuf_printf(&out, "\tgoto *v%d\n", val->pseudo);
 		} else if (!strcmp("break", show_ident(stmt->goto_label->ident))) {
 			struct storage *lbv = new_storage(STOR_LABEL);
 			lbv->label = loopstk_break();
@@ -2056,7 +2000,7 @@ static struct storage *x86_statement(struct statement *stmt)
 		}
 		break;
 	case STMT_ASM:
-		printf("\tasm( .... )\n");
+		outbuf_printf(&out, "\tasm( .... )\n");
 		break;
 	}
 	return NULL;
@@ -2069,7 +2013,6 @@ static struct storage *x86_call_expression(struct expression *expr)
 	struct expression *arg, *fn;
 	struct storage *retval, *fncall;
 	int framesize;
-	char s[64];
 
 	if (!expr->ctype) {
 		warning(expr->pos, "\tcall with no type!");
@@ -2116,8 +2059,7 @@ static struct storage *x86_call_expression(struct expression *expr)
 		fncall = x86_expression(fn);
 		emit_move(fncall, REG_EAX, fn->ctype, NULL);
 
-		strcpy(s, "\tcall\t*%eax\n");
-		push_text_atom(f, s);
+		push_text_atom(f, "\tcall\t*%eax\n");
 	}
 
 	/* FIXME: pay attention to BITS_IN_POINTER */
@@ -2139,7 +2081,6 @@ static struct storage *x86_address_gen(struct expression *expr)
 	struct function *f = current_func;
 	struct storage *addr;
 	struct storage *new;
-	char s[32];
 
 	addr = x86_expression(expr->unop);
 	if (expr->unop->type == EXPR_SYMBOL)
@@ -2148,8 +2089,7 @@ static struct storage *x86_address_gen(struct expression *expr)
 	emit_move(addr, REG_EAX, NULL, "begin deref ..");
 
 	/* FIXME: operand size */
-	strcpy(s, "\tmovl\t(%eax), %ecx\n");
-	push_text_atom(f, s);
+	push_text_atom(f, "\tmovl\t(%eax), %ecx\n");
 
 	new = stack_alloc(4);
 	emit_move(REG_ECX, new, NULL, ".... end deref");
@@ -2231,14 +2171,14 @@ static struct storage *x86_symbol_expr(struct symbol *sym)
 	struct storage *new = stack_alloc(4);
 
 	if (sym->ctype.modifiers & (MOD_TOPLEVEL | MOD_EXTERN | MOD_STATIC)) {
-		printf("\tmovi.%d\t\tv%d,$%s\n", bits_in_pointer, new->pseudo, show_ident(sym->ident));
+		outbuf_printf(&out, "\tmovi.%d\t\tv%d,$%s\n", bits_in_pointer, new->pseudo, show_ident(sym->ident));
 		return new;
 	}
 	if (sym->ctype.modifiers & MOD_ADDRESSABLE) {
-		printf("\taddi.%d\t\tv%d,vFP,$%lld\n", bits_in_pointer, new->pseudo, 0LL);
+		outbuf_printf(&out, "\taddi.%d\t\tv%d,vFP,$%lld\n", bits_in_pointer, new->pseudo, 0LL);
 		return new;
 	}
-	printf("\taddi.%d\t\tv%d,vFP,$offsetof(%s:%p)\n", bits_in_pointer, new->pseudo, show_ident(sym->ident), sym);
+	outbuf_printf(&out, "\taddi.%d\t\tv%d,vFP,$offsetof(%s:%p)\n", bits_in_pointer, new->pseudo, show_ident(sym->ident), sym);
 	return new;
 }
 
@@ -2266,7 +2206,7 @@ static void x86_symbol_init(struct symbol *sym)
 static struct storage *x86_label_expr(struct expression *expr)
 {
 	struct storage *new = stack_alloc(4);
-	printf("\tmovi.%d\t\tv%d,.L%p\n", bits_in_pointer, new->pseudo, expr->label_symbol);
+	outbuf_printf(&out, "\tmovi.%d\t\tv%d,.L%p\n", bits_in_pointer, new->pseudo, expr->label_symbol);
 	return new;
 }
 
@@ -2280,7 +2220,7 @@ static int x86_position_expr(struct expression *expr, struct symbol *base)
 	struct storage *new = x86_expression(expr->init_expr);
 	struct symbol *ctype = expr->init_expr->ctype;
 
-	printf("\tinsert v%d at [%d:%d] of %s\n", new->pseudo,
+	outbuf_printf(&out, "\tinsert v%d at [%d:%d] of %s\n", new->pseudo,
 		expr->init_offset, ctype->bit_offset,
 		show_ident(base->ident));
 	return 0;
@@ -2321,7 +2261,7 @@ static struct storage *x86_expression(struct expression *expr)
 
 	if (!expr->ctype) {
 		struct position *pos = &expr->pos;
-		printf("\tno type at %s:%d:%d\n",
+		outbuf_printf(&out, "\tno type at %s:%d:%d\n",
 			stream_name(pos->stream),
 			pos->line, pos->pos);
 		return NULL;
@@ -0,0 +1,2847 @@
+// SPDX-License-Identifier: MIT
+//
+// compile-x86_64.c - x86-64 code generation from the linearized IR
+//
+// The functions are linearized (and thus optimized) and taken out
+// of SSA form with unssa(). The instructions are then covered with
+// simple tree patterns: a value used only once, shortly after its
+// definition and in the same block, can be folded into its user
+// instead of being computed on its own:
+//	- a load as a memory operand,
+//	- additions of constants, of symbols & of scaled indexes into
+//	  the address of a load or a store,
+//	- a comparison into the conditional branch or the select
+//	  using it.
+// The patterns are chosen first, walking each function backward,
+// then the instructions which are left are emitted in order.
+//
+// The integer pseudos are kept in registers, given by a greedy scan
+// of their live ranges, or else in stack slots. The floating-point
+// values always live in memory and go through %xmm0 & %xmm1 only
+// for the operations needing them.
+// %rax, %rcx, %rdx (for the values) and %r10, %r11 (for the
+// addresses) are the scratch registers; they're never given to a
+// pseudo.
+//
+// The code follows the System V ABI and can be linked with the
+// code of other compilers, but the structures passed or returned
+// by value, long double, the thread-local variables and the asm
+// statements with operands aren't supported.
+//
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include "lib.h"
+#include "allocate.h"
+#include "token.h"
+#include "parse.h"
+#include "symbol.h"
+#include "expression.h"
+#include "linearize.h"
+#include "liveness.h"
+#include "target.h"
+#include "outbuf.h"
+#include "compile.h"
+#include "version.h"
+
+////////////////////////////////////////////////////////////////////////
+// The output is buffered and written once per symbol.
+
+static struct outbuf out;
+
+static void emit(const char *fmt, ...) FORMAT_ATTR(1);
+static void emit(const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	outbuf_vprintf(&out, fmt, args);
+	va_end(args);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Registers & operands
+
+enum reg {
+	RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15,
+	NR_REGS,
+	RIP = NR_REGS,
+	NOREG = -1,
+};
+
+static const char *reg_names[4][NR_REGS + 1] = {
+	{ "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+	  "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b", },
+	{ "ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+	  "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w", },
+	{ "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+	  "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d", },
+	{ "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+	  "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15", "rip", },
+};
+
+// Given to the pseudos: the callee-saved ones, and the caller-saved
+// ones for the pseudos not live across a call.
+static const int callee_saved[] = { RBX, R12, R13, R14, R15 };
+static const int caller_saved[] = { RSI, RDI, R8, R9 };
+
+static int is_callee_saved(int reg)
+{
+	return reg == RBX || reg >= R12;
+}
+
+static const int int_arg_regs[] ={ RDI, RSI, RDX, RCX, R8, R9 };
+#define NR_INT_ARGS	6
+#define NR_SSE_ARGS	8
+
+static const int addr_scratch[] = { R11, R10 };
+
+static inline int size_index(int size)
+{
+	return size <= 8 ? 0 : size <= 16 ? 1 : size <= 32 ? 2 : 3;
+}
+
+static inline const char *reg_name(int reg, int size)
+{
+	return reg_names[size_index(size)][reg];
+}
+
+static inline char suffix(int size)
+{
+	return "bwlq"[size_index(size)];
+}
+
+// The size at which a value of 'bits' is handled.
+static inline int opsize(int bits)
+{
+	return bits <= 8 ? 8 : bits <= 16 ? 16 : bits <= 32 ? 32 : 64;
+}
+
+static inline int fits_imm32(long long val)
+{
+	return val == (int) val;
+}
+
+static long long sign_extend(long long val, int bits)
+{
+	if (bits >= 64)
+		return val;
+	return (long long)((unsigned long long)val << (64 - bits)) >> (64 - bits);
+}
+
+static long long zero_extend(long long val, int bits)
+{
+	if (bits >= 64)
+		return val;
+	return val & ((1ULL << bits) - 1);
+}
+
+enum operand_type {
+	OPND_NONE,
+	OPND_REG,
+	OPND_IMM,
+	OPND_MEM,
+};
+
+struct operand {
+	enum operand_type type;
+	int reg;				// OPND_REG
+	int base, index, scale;			// OPND_MEM
+	long long value;			// OPND_IMM, or displacement
+	struct symbol *sym;			// OPND_MEM: %rip-relative
+	struct basic_block *label;		// OPND_MEM: %rip-relative
+	int got;				// via the GOT
+};
+
+static inline struct operand reg_operand(int reg)
+{
+	struct operand op = { .type = OPND_REG, .reg = reg };
+	return op;
+}
+
+static inline struct operand imm_operand(long long value)
+{
+	struct operand op = { .type = OPND_IMM, .value = value };
+	return op;
+}
+
+static inline struct operand mem_operand(int base, long long disp)
+{
+	struct operand op = {
+		.type = OPND_MEM, .base = base, .index = NOREG, .scale = 1,
+		.value = disp,
+	};
+	return op;
+}
+
+// The condition codes, in pairs of opposite conditions.
+enum cc {
+	CC_E, CC_NE, CC_L, CC_GE, CC_LE, CC_G, CC_B, CC_AE,
+	CC_BE, CC_A, CC_P, CC_NP,
+};
+
+static const char *cc_names[] = {
+	"e", "ne", "l", "ge", "le", "g", "b", "ae", "be", "a", "p", "np",
+};
+
+static inline enum cc invert_cc(enum cc cc)
+{
+	return cc ^ 1;
+}
+
+static enum cc swap_cc(enum cc cc)
+{
+	switch (cc) {
+	case CC_L:	return CC_G;
+	case CC_G:	return CC_L;
+	case CC_LE:	return CC_GE;
+	case CC_GE:	return CC_LE;
+	case CC_B:	return CC_A;
+	case CC_A:	return CC_B;
+	case CC_BE:	return CC_AE;
+	case CC_AE:	return CC_BE;
+	default:	return cc;
+	}
+}
+
+static enum cc compare_cc(int opcode)
+{
+	switch (opcode) {
+	case OP_SET_EQ:	return CC_E;
+	case OP_SET_NE:	return CC_NE;
+	case OP_SET_LT:	return CC_L;
+	case OP_SET_GE:	return CC_GE;
+	case OP_SET_LE:	return CC_LE;
+	case OP_SET_GT:	return CC_G;
+	case OP_SET_B:	return CC_B;
+	case OP_SET_AE:	return CC_AE;
+	case OP_SET_BE:	return CC_BE;
+	case OP_SET_A:	return CC_A;
+	}
+	return CC_NE;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Per-function state
+
+struct value {
+	unsigned int size;		// in bits
+	unsigned char fp;		// a floating-point value
+	unsigned char folded;		// computed by its (only) user
+	signed char reg;		// its register, or NOREG
+	int offset;			// else its stack slot
+	int defs, uses;
+	int pos;			// where it's defined, if only once
+	int at;				// if folded, where its user is
+	int start, end;			// its live range
+	struct instruction *def;	// if defined only once
+	struct instruction *user;	// if used only once
+};
+
+static struct entrypoint *cur_ep;
+static struct value *values;		// by pseudo id
+static struct instruction **insns;	// by position
+static int nr_insns;
+static int *clobbers;			// calls before each position
+static int *frame_offsets;		// of the local symbols
+static int frame_size;
+static int saved_regs[NR_REGS];		// their save slot, if used
+static struct basic_block *next_bb;	// the block emitted next
+static int cur_pos;
+
+static struct value *value_of(pseudo_t p)
+{
+	if (!p || (p->type != PSEUDO_REG && p->type != PSEUDO_ARG))
+		return NULL;
+	if (!pseudo_numbered(cur_ep, p))
+		return NULL;
+	return &values[p->id];
+}
+
+static int is_folded(struct instruction *insn)
+{
+	struct value *v = value_of(insn->target);
+
+	return v && v->folded && v->def == insn;
+}
+
+static struct instruction *folded_def(pseudo_t p)
+{
+	struct value *v = value_of(p);
+
+	return v && v->folded ? v->def : NULL;
+}
+
+static int pseudo_size(pseudo_t p, int size)
+{
+	struct value *v = value_of(p);
+
+	return v && v->size ? v->size : size;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Symbols
+
+// Not a ptr_list: the IR arena, and its lists, are released after
+// each function.
+static struct symbol **pending_data;
+static int nr_pending, max_pending;
+static int nr_local_labels;
+
+static int is_frame_symbol(struct symbol *sym)
+{
+	return !(sym->ctype.modifiers & (MOD_STATIC | MOD_NONLOCAL));
+}
+
+static int is_static(struct symbol *sym)
+{
+	return sym->ctype.modifiers & MOD_STATIC;
+}
+
+// The functions which may be elsewhere are called via the PLT and
+// have their address taken via the GOT.
+static int is_global_function(struct symbol *sym)
+{
+	return is_func_type(sym) && !is_static(sym);
+}
+
+// The local statics & the string literals get a local label and are
+// emitted after the function (or the data) using them.
+static const char *symbol_name(struct symbol *sym)
+{
+	char buf[256];
+
+	if (sym->aux)
+		return sym->aux;
+
+	if (sym->ctype.modifiers & MOD_NONLOCAL)
+		snprintf(buf, sizeof(buf), "%s", show_ident(sym->ident));
+	else if (sym->ident)
+		snprintf(buf, sizeof(buf), "%s.%d", show_ident(sym->ident), nr_local_labels++);
+	else
+		snprintf(buf, sizeof(buf), ".LC%d", nr_local_labels++);
+	sym->aux = strdup(buf);
+	if (!sym->aux)
+		die("out of memory");
+	if (sym->ctype.modifiers & MOD_NONLOCAL)
+		return sym->aux;
+	if (nr_pending == max_pending) {
+		max_pending = max_pending ? 2 * max_pending : 16;
+		pending_data = realloc(pending_data, max_pending * sizeof(*pending_data));
+		if (!pending_data)
+			die("out of memory");
+	}
+	pending_data[nr_pending++] = sym;
+	return sym->aux;
+}
+
+static int frame_offset(pseudo_t sym)
+{
+	return *(int *)sym->priv;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Operands
+
+static inline void put_reg(int reg, int size)
+{
+	outbuf_putc(&out, '%');
+	outbuf_puts(&out, reg_name(reg, size));
+}
+
+static void put_operand(const struct operand *op, int size)
+{
+	switch (op->type) {
+	case OPND_REG:
+		put_reg(op->reg, size);
+		return;
+	case OPND_IMM:
+		outbuf_putc(&out, '$');
+		outbuf_int(&out, op->value);
+		return;
+	case OPND_MEM:
+		break;
+	default:
+		return;
+	}
+
+	if (op->sym) {
+		outbuf_puts(&out, symbol_name(op->sym));
+		if (op->got) {
+			outbuf_puts(&out, "@GOTPCREL(%rip)");
+			return;
+		}
+		if (op->value > 0)
+			outbuf_putc(&out, '+');
+		if (op->value)
+			outbuf_int(&out, op->value);
+		outbuf_puts(&out, "(%rip)");
+		return;
+	}
+	if (op->label) {
+		outbuf_puts(&out, ".L");
+		outbuf_int(&out, op->label->nr);
+		outbuf_puts(&out, "(%rip)");
+		return;
+	}
+	if (op->value || (op->base == NOREG && op->index == NOREG))
+		outbuf_int(&out, op->value);
+	if (op->base == NOREG && op->index == NOREG)
+		return;
+	outbuf_putc(&out, '(');
+	if (op->base != NOREG)
+		put_reg(op->base, 64);
+	if (op->index != NOREG) {
+		outbuf_putc(&out, ',');
+		put_reg(op->index, 64);
+		outbuf_putc(&out, ',');
+		outbuf_putc(&out, '0' + op->scale);
+	}
+	outbuf_putc(&out, ')');
+}
+
+// The mnemonic, with the suffix for 'size' unless it's zero.
+static void put_mnemonic(const char *name, int size)
+{
+	outbuf_putc(&out, '\t');
+	outbuf_puts(&out, name);
+	if (size)
+		outbuf_putc(&out, suffix(size));
+	outbuf_putc(&out, '\t');
+}
+
+static inline void put_separator(void)
+{
+	outbuf_write(&out, ", ", 2);
+}
+
+static inline void put_newline(void)
+{
+	outbuf_putc(&out, '\n');
+}
+
+static void emit_op2(const char *name, int size, const struct operand *src, const struct operand *dst)
+{
+	put_mnemonic(name, size);
+	put_operand(src, size);
+	put_separator();
+	put_operand(dst, size);
+	put_newline();
+}
+
+static void emit_op1(const char *name, int size, const struct operand *op)
+{
+	put_mnemonic(name, size);
+	put_operand(op, size);
+	put_newline();
+}
+
+// 'src', of 'from' bits, to 'reg', of 'to' bits; 'name' is complete
+static void emit_extend(const char *name, const struct operand *src, int from, int reg, int to)
+{
+	put_mnemonic(name, 0);
+	put_operand(src, from);
+	put_separator();
+	put_reg(reg, to);
+	put_newline();
+}
+
+static void emit_to_reg(const char *name, int size, const struct operand *src, int reg)
+{
+	put_mnemonic(name, size);
+	put_operand(src, size);
+	put_separator();
+	put_reg(reg, size);
+	put_newline();
+}
+
+static void emit_from_reg(const char *name, int size, int reg, const struct operand *dst)
+{
+	put_mnemonic(name, size);
+	put_reg(reg, size);
+	put_separator();
+	put_operand(dst, size);
+	put_newline();
+}
+
+static void emit_reg_move(int src, int dst, int size)
+{
+	if (src == dst)
+		return;
+	size = size > 32 ? 64 : 32;
+	put_mnemonic("mov", size);
+	put_reg(src, size);
+	put_separator();
+	put_reg(dst, size);
+	put_newline();
+}
+
+static void emit_move_imm(long long value, int reg, int size)
+{
+	struct operand imm;
+
+	if (size <= 32) {
+		imm = imm_operand((int) value);
+		emit_to_reg("mov", 32, &imm, reg);
+		return;
+	}
+	imm = imm_operand(value);
+	emit_to_reg(fits_imm32(value) ? "mov" : "movabs", 64, &imm, reg);
+}
+
+static void emit_lea(const struct operand *addr, int reg)
+{
+	emit_to_reg(addr->got ? "mov" : "lea", 64, addr, reg);
+}
+
+static void symbol_operand(pseudo_t sym, struct operand *op)
+{
+	if (is_frame_symbol(sym->sym)) {
+		*op = mem_operand(RBP, frame_offset(sym));
+		return;
+	}
+	*op = mem_operand(NOREG, 0);
+	op->sym = sym->sym;
+	op->got = is_global_function(sym->sym);
+}
+
+static void emit_symbol_address(pseudo_t sym, int reg)
+{
+	struct operand addr;
+
+	symbol_operand(sym, &addr);
+	emit_lea(&addr, reg);
+}
+
+static void home_operand(struct value *v, struct operand *op)
+{
+	if (v->reg != NOREG)
+		*op = reg_operand(v->reg);
+	else
+		*op = mem_operand(RBP, v->offset);
+}
+
+////////////////////////////////////////////////////////////////////////
+// 1) Tree-pattern matching: choose the values folded in their user.
+
+// Don't look for patterns spanning too many instructions.
+#define FOLD_WINDOW	32
+
+// Would the value of 'insn' be the same if computed at 'to'?
+// Its operands mustn't be redefined in between, nor the memory
+// be written if it's a load.
+static int can_move(struct instruction *insn, int from, int to)
+{
+	int i;
+
+	for (i = from + 1; i < to; i++) {
+		struct instruction *other = insns[i];
+		pseudo_t target = other->target;
+
+		switch (other->opcode) {
+		case OP_ASM:
+			return 0;
+		case OP_STORE:
+			if (insn->opcode == OP_LOAD)
+				return 0;
+			continue;
+		case OP_CALL:
+			if (insn->opcode == OP_LOAD)
+				return 0;
+			break;
+		}
+		if (!target)
+			continue;
+		switch (insn->opcode) {
+		case OP_BINARY ... OP_BINARY_END:
+		case OP_BINCMP ... OP_BINCMP_END:
+			if (target == insn->src1 || target == insn->src2)
+				return 0;
+			break;
+		case OP_LOAD:
+		case OP_CAST: case OP_SCAST: case OP_PTRCAST:
+			if (target == insn->src)
+				return 0;
+			break;
+		}
+	}
+	return 1;
+}
+
+static int is_volatile(struct symbol *type)
+{
+	if (!type)
+		return 0;
+	if (type->ctype.modifiers & MOD_VOLATILE)
+		return 1;
+	return type->type == SYM_NODE && type->ctype.base_type &&
+		(type->ctype.base_type->ctype.modifiers & MOD_VOLATILE);
+}
+
+// The definition of 'p' if it can be folded into 'user', at 'upos',
+// itself at or folded into the instruction at 'root'.
+static struct instruction *fold_candidate(pseudo_t p, struct instruction *user, int upos, int root)
+{
+	struct value *v = value_of(p);
+	struct instruction *def;
+
+	if (!v || v->fp || v->defs != 1 || v->uses != 1 || v->user != user)
+		return NULL;
+	def = v->def;
+	if (def->bb != insns[root]->bb || v->pos >= upos || root - v->pos > FOLD_WINDOW)
+		return NULL;
+	if (def->opcode == OP_LOAD && is_volatile(def->type))
+		return NULL;
+	if (!can_move(def, v->pos, root))
+		return NULL;
+	return def;
+}
+
+static void fold(struct instruction *def, int root, int mark)
+{
+	struct value *v = value_of(def->target);
+
+	if (!mark)
+		return;
+	v->folded = 1;
+	v->at = root;
+}
+
+static inline int def_pos(struct instruction *def)
+{
+	return value_of(def->target)->pos;
+}
+
+static int cast_size(struct instruction *insn)
+{
+	return insn->orig_type ? insn->orig_type->bit_size : 0;
+}
+
+static int is_int_cast(struct instruction *insn)
+{
+	switch (insn->opcode) {
+	case OP_CAST: case OP_SCAST: case OP_PTRCAST:
+		return insn->orig_type && !is_float_type(insn->orig_type);
+	}
+	return 0;
+}
+
+static int index_scale(struct instruction *def)
+{
+	long long k;
+
+	if (def->size != 64 || def->src2->type != PSEUDO_VAL)
+		return 0;
+	k = def->src2->value;
+	if (def->opcode == OP_SHL) {
+		if (k < 0 || k > 3)
+			return 0;
+		k = 1 << k;
+	}
+	return (k == 1 || k == 2 || k == 4 || k == 8) ? k : 0;
+}
+
+// What an address needs: at most two registers (%rbp for a local,
+// a register holding a global if there is some other register),
+// one of them scaled. A load is only folded in an address if it's
+// its only register, the two scratch registers being needed by the
+// load's own address.
+struct shape {
+	int regs, scaled, syms, globals, loads;
+	int adds;			// how many additions can still be folded
+};
+
+static int valid_shape(const struct shape *s)
+{
+	int regs = s->regs;
+
+	if (s->syms > 1 || s->scaled > 1)
+		return 0;
+	if (s->syms && (!s->globals || s->regs))
+		regs++;
+	if (regs > 2)
+		return 0;
+	return !s->loads || s->regs == 1;
+}
+
+static int match_address(pseudo_t p, struct instruction *user, int upos, int root, int mark);
+
+static void match_term(pseudo_t p, struct instruction *user, int upos, int root, int scale, struct shape *s, int mark)
+{
+	struct instruction *def;
+	int k;
+
+	switch (p->type) {
+	case PSEUDO_VAL:
+		return;
+	case PSEUDO_SYM:
+		if (scale == 1) {
+			s->syms++;
+			s->globals += !is_frame_symbol(p->sym);
+			return;
+		}
+		goto reg;
+	case PSEUDO_REG:
+	case PSEUDO_ARG:
+		break;
+	default:
+		return;
+	}
+
+	def = fold_candidate(p, user, upos, root);
+	if (!def)
+		goto reg;
+	switch (def->opcode) {
+	case OP_ADD:
+		if (def->size != 64 || scale != 1 || !s->adds)
+			break;
+		s->adds--;
+		fold(def, root, mark);
+		match_term(def->src1, def, def_pos(def), root, 1, s, mark);
+		match_term(def->src2, def, def_pos(def), root, 1, s, mark);
+		return;
+	case OP_MUL:
+	case OP_SHL:
+		k = index_scale(def);
+		if (!k || scale != 1)
+			break;
+		fold(def, root, mark);
+		match_term(def->src1, def, def_pos(def), root, k, s, mark);
+		return;
+	case OP_SYMADDR:
+		if (scale != 1)
+			break;
+		fold(def, root, mark);
+		match_term(def->symbol, def, def_pos(def), root, 1, s, mark);
+		return;
+	case OP_CAST:
+	case OP_SCAST:
+	case OP_PTRCAST:
+		if (def->size != 64 || !is_int_cast(def))
+			break;
+		fold(def, root, mark);
+		if (cast_size(def) == 64) {
+			match_term(def->src, def, def_pos(def), root, scale, s, mark);
+			return;
+		}
+		goto reg;		// extended in a scratch register
+	case OP_LOAD:
+		if (def->size != 64 || !match_address(def->src, def, def_pos(def), root, 0))
+			break;
+		if (mark)
+			match_address(def->src, def, def_pos(def), root, 1);
+		fold(def, root, mark);
+		s->loads++;
+		goto reg;
+	}
+reg:
+	s->regs++;
+	if (scale != 1)
+		s->scaled++;
+}
+
+// If the whole tree doesn't fit in an address, the additions near
+// its root are folded, the others being computed in a register.
+static int match_address(pseudo_t p, struct instruction *user, int upos, int root, int mark)
+{
+	static const int adds[] = { INT_MAX, 1, 0 };
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(adds); i++) {
+		struct shape s = { .adds = adds[i] };
+
+		match_term(p, user, upos, root, 1, &s, 0);
+		if (!valid_shape(&s))
+			continue;
+		if (mark) {
+			s = (struct shape) { .adds = adds[i] };
+			match_term(p, user, upos, root, 1, &s, 1);
+		}
+		return 1;
+	}
+	return 0;
+}
+
+// Values used as operands: loads become memory operands.
+static void match_value(pseudo_t p, struct instruction *user, int upos, int root)
+{
+	struct instruction *def = fold_candidate(p, user, upos, root);
+
+	if (!def)
+		return;
+	switch (def->opcode) {
+	case OP_LOAD:
+		if (def->size > 64)
+			return;
+		if (!match_address(def->src, def, def_pos(def), root, 1))
+			return;
+		fold(def, root, 1);
+		return;
+	case OP_SYMADDR:
+		fold(def, root, 1);
+		return;
+	}
+}
+
+static void match_condition(pseudo_t cond, struct instruction *user, int pos)
+{
+	struct instruction *def = fold_candidate(cond, user, pos, pos);
+
+	if (def && def->opcode >= OP_BINCMP && def->opcode <= OP_BINCMP_END) {
+		fold(def, pos, 1);
+		match_value(def->src1, def, def_pos(def), pos);
+		match_value(def->src2, def, def_pos(def), pos);
+		return;
+	}
+	match_value(cond, user, pos, pos);
+}
+
+static void select_insn(struct instruction *insn, int pos)
+{
+	struct value *v = value_of(insn->target);
+	struct instruction *def;
+	pseudo_t arg;
+
+	switch (insn->opcode) {
+	case OP_LOAD:
+		match_address(insn->src, insn, pos, pos, 1);
+		break;
+	case OP_STORE:
+		v = value_of(insn->target);
+		if (v && v->size > 64) {
+			// an aggregate copied from memory to memory
+			def = fold_candidate(insn->target, insn, pos, pos);
+			if (def && def->opcode == OP_LOAD) {
+				fold(def, pos, 1);
+				match_address(def->src, def, def_pos(def), pos, 1);
+			}
+		} else {
+			match_value(insn->target, insn, pos, pos);
+		}
+		match_address(insn->src, insn, pos, pos, 1);
+		break;
+	case OP_BINARY ... OP_BINARY_END:
+	case OP_BINCMP ... OP_BINCMP_END:
+		if (v && v->fp)
+			break;
+		match_value(insn->src1, insn, pos, pos);
+		match_value(insn->src2, insn, pos, pos);
+		break;
+	case OP_NOT: case OP_NEG:
+	case OP_CAST: case OP_SCAST: case OP_PTRCAST:
+	case OP_COPY: case OP_RET: case OP_COMPUTEDGOTO:
+		match_value(insn->src, insn, pos, pos);
+		break;
+	case OP_CBR:
+		match_condition(insn->cond, insn, pos);
+		break;
+	case OP_SWITCH:
+		match_value(insn->cond, insn, pos, pos);
+		break;
+	case OP_SEL:
+		match_condition(insn->src1, insn, pos);
+		match_value(insn->src2, insn, pos, pos);
+		match_value(insn->src3, insn, pos, pos);
+		break;
+	case OP_CALL:
+		FOR_EACH_PTR(insn->arguments, arg) {
+			match_value(arg, insn, pos, pos);
+		} END_FOR_EACH_PTR(arg);
+		match_value(insn->func, insn, pos, pos);
+		break;
+	}
+}
+
+static void select_patterns(void)
+{
+	int pos;
+
+	for (pos = nr_insns - 1; pos >= 0; pos--) {
+		struct instruction *insn = insns[pos];
+
+		if (!is_folded(insn))
+			select_insn(insn, pos);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////
+// 2) Number the instructions & give a size and a type to the pseudos
+
+static struct instruction *cur_insn;
+
+static void count_def(struct basic_block *bb, pseudo_t p)
+{
+	struct value *v = value_of(p);
+
+	if (!v)
+		return;
+	v->defs++;
+	v->def = cur_insn;
+	v->pos = cur_pos;
+}
+
+static void count_use(struct basic_block *bb, pseudo_t p)
+{
+	struct value *v = value_of(p);
+
+	// their address is relative to %fs, which isn't supported
+	if (p && p->type == PSEUDO_SYM && (p->sym->ctype.modifiers & MOD_TLS))
+		sparse_error(cur_insn->pos, "thread-local variables are not supported");
+	if (!v)
+		return;
+	v->uses++;
+	v->user = cur_insn;
+}
+
+static void set_type(struct value *v, struct instruction *insn)
+{
+	if (!v->size)
+		v->size = insn->size;
+	switch (insn->opcode) {
+	case OP_FADD: case OP_FSUB: case OP_FMUL: case OP_FDIV:
+	case OP_FNEG: case OP_SETFVAL: case OP_FPCAST:
+		v->fp = 1;
+		break;
+	case OP_FPCMP ... OP_FPCMP_END:
+	case OP_BINCMP ... OP_BINCMP_END:
+	case OP_SYMADDR:
+		break;
+	default:
+		if (insn->type && is_float_type(insn->type))
+			v->fp = 1;
+	}
+}
+
+static struct symbol *function_type(struct symbol *sym)
+{
+	if (sym->type == SYM_NODE)
+		sym = sym->ctype.base_type;
+	if (sym && sym->type == SYM_PTR)
+		sym = sym->ctype.base_type;
+	if (sym && sym->type == SYM_NODE)
+		sym = sym->ctype.base_type;
+	return sym;
+}
+
+static void number_instructions(struct entrypoint *ep)
+{
+	struct symbol *fntype = function_type(ep->name);
+	struct basic_block *bb;
+	struct symbol *type;
+	pseudo_t arg;
+	int max = 0;
+
+	FOR_EACH_PTR(ep->bbs, bb) {
+		max += instruction_list_size(bb->insns);
+	} END_FOR_EACH_PTR(bb);
+	insns = calloc(max + 1, sizeof(*insns));
+	clobbers = calloc(max + 2, sizeof(*clobbers));
+	if (!insns || !clobbers)
+		die("out of memory");
+
+	nr_insns = 0;
+	FOR_EACH_PTR(ep->bbs, bb) {
+		struct instruction *insn;
+
+		FOR_EACH_PTR(bb->insns, insn) {
+			if (!insn->bb)
+				continue;
+			cur_insn = insn;
+			cur_pos = nr_insns;
+			track_instruction_usage(bb, insn, count_def, count_use);
+			insns[nr_insns++] = insn;
+		} END_FOR_EACH_PTR(insn);
+	} END_FOR_EACH_PTR(bb);
+
+	for (cur_pos = 0; cur_pos < nr_insns; cur_pos++) {
+		struct instruction *insn = insns[cur_pos];
+		struct value *v;
+
+		if (insn->opcode == OP_STORE || insn->opcode == OP_ASM)
+			continue;
+		v = value_of(insn->target);
+		if (v)
+			set_type(v, insn);
+	}
+
+	PREPARE_PTR_LIST(fntype->arguments, type);
+	FOR_EACH_PTR(ep->entry->arg_list, arg) {
+		struct value *v = value_of(arg);
+
+		if (v && type) {
+			v->size = type->bit_size;
+			v->fp = is_float_type(type);
+		}
+		NEXT_PTR_LIST(type);
+	} END_FOR_EACH_PTR(arg);
+	FINISH_PTR_LIST(type);
+}
+
+////////////////////////////////////////////////////////////////////////
+// 3) Live ranges, registers & stack slots
+
+static int clobbers_regs(struct instruction *insn)
+{
+	switch (insn->opcode) {
+	case OP_CALL:
+		return 1;
+	case OP_LOAD:
+	case OP_STORE:
+	case OP_COPY:
+		return insn->size > 64;		// done with rep movsb
+	}
+	return 0;
+}
+
+static void extend_range(pseudo_t p, int pos)
+{
+	struct value *v = value_of(p);
+
+	if (!v)
+		return;
+	if (pos < v->start)
+		v->start = pos;
+	if (pos > v->end)
+		v->end = pos;
+}
+
+static void range_def(struct basic_block *bb, pseudo_t p)
+{
+	struct value *v = value_of(p);
+
+	if (v && !v->folded)
+		extend_range(p, cur_pos);
+}
+
+static void range_use(struct basic_block *bb, pseudo_t p)
+{
+	extend_range(p, cur_pos);
+}
+
+// The live ranges are the hulls of the positions where the pseudos
+// are defined, used, or live at the boundaries of the blocks. The
+// uses in a folded instruction are where it's folded.
+static void build_ranges(struct entrypoint *ep)
+{
+	struct basic_block *bb;
+	pseudo_t arg;
+	int pos = 0, i;
+
+	for (i = 0; i < ep->nr_pseudos; i++) {
+		values[i].start = INT_MAX;
+		values[i].end = -1;
+		values[i].reg = NOREG;
+	}
+	FOR_EACH_PTR(ep->entry->arg_list, arg) {
+		extend_range(arg, 0);
+	} END_FOR_EACH_PTR(arg);
+
+	FOR_EACH_PTR(ep->bbs, bb) {
+		struct basic_block *child;
+		int start = pos;
+		pseudo_t p;
+
+		while (pos < nr_insns && insns[pos]->bb == bb) {
+			struct instruction *insn = insns[pos];
+			struct value *v = value_of(insn->target);
+
+			cur_pos = pos;
+			if (v && v->folded && v->def == insn)
+				cur_pos = v->at;
+			track_instruction_usage(bb, insn, range_def, range_use);
+			clobbers[pos + 1] = clobbers[pos] + (clobbers_regs(insn) && !is_folded(insn));
+			pos++;
+		}
+		if (pos == start)
+			continue;
+		FOR_EACH_PTR(bb->needs, p) {
+			extend_range(p, start);
+		} END_FOR_EACH_PTR(p);
+		FOR_EACH_PTR(bb->children, child) {
+			FOR_EACH_PTR(child->needs, p) {
+				extend_range(p, pos - 1);
+			} END_FOR_EACH_PTR(p);
+		} END_FOR_EACH_PTR(child);
+	} END_FOR_EACH_PTR(bb);
+}
+
+// The ranges given to a register, disjoint & in order.
+struct range {
+	int start, end;
+};
+
+static struct reg_ranges {
+	struct range *ranges;
+	int nr, max;
+} reg_ranges[NR_REGS];
+
+static int take_register(int reg, struct value *v)
+{
+	struct reg_ranges *rr = &reg_ranges[reg];
+	int lo = 0, hi = rr->nr;
+
+	// the first range ending at or after our start
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (rr->ranges[mid].end < v->start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < rr->nr && rr->ranges[lo].start <= v->end)
+		return 0;
+
+	if (rr->nr == rr->max) {
+		rr->max = rr->max ? 2 * rr->max : 16;
+		rr->ranges = realloc(rr->ranges, rr->max * sizeof(struct range));
+		if (!rr->ranges)
+			die("out of memory");
+	}
+	memmove(rr->ranges + lo + 1, rr->ranges + lo, (rr->nr - lo) * sizeof(struct range));
+	rr->ranges[lo].start = v->start;
+	rr->ranges[lo].end = v->end;
+	rr->nr++;
+	v->reg = reg;
+	return 1;
+}
+
+static int allocatable(struct value *v)
+{
+	return !v->folded && !v->fp && v->size <= 64 && v->end >= 0;
+}
+
+static int by_weight(const void *a, const void *b)
+{
+	const struct value *va = &values[*(const int *)a];
+	const struct value *vb = &values[*(const int *)b];
+	int wa = va->defs + va->uses, wb = vb->defs + vb->uses;
+
+	if (wa != wb)
+		return wb - wa;
+	if (va->end - va->start != vb->end - vb->start)
+		return (va->end - va->start) - (vb->end - vb->start);
+	return *(const int *)a - *(const int *)b;
+}
+
+static void allocate_registers(struct entrypoint *ep)
+{
+	int *order = calloc(ep->nr_pseudos + 1, sizeof(int));
+	int nr = 0, i, j;
+
+	if (!order)
+		die("out of memory");
+	for (i = 0; i < ep->nr_pseudos; i++) {
+		if (allocatable(&values[i]))
+			order[nr++] = i;
+	}
+	qsort(order, nr, sizeof(int), by_weight);
+
+	for (i = 0; i < nr; i++) {
+		struct value *v = &values[order[i]];
+		int crosses = clobbers[v->end + 1] - clobbers[v->start];
+		int done = 0;
+
+		if (!crosses && ep->pseudos[order[i]]->type != PSEUDO_ARG) {
+			for (j = 0; !done && j < ARRAY_SIZE(caller_saved); j++)
+				done = take_register(caller_saved[j], v);
+		}
+		for (j = 0; !done && j < ARRAY_SIZE(callee_saved); j++)
+			done = take_register(callee_saved[j], v);
+	}
+	free(order);
+
+	for (i = 0; i < NR_REGS; i++)
+		reg_ranges[i].nr = 0;
+}
+
+static int frame_alloc(int bytes, int align)
+{
+	frame_size += bytes;
+	if (align > 1)
+		frame_size = (frame_size + align - 1) & ~(align - 1);
+	return -frame_size;
+}
+
+// The incoming arguments passed on the stack are kept there.
+static void set_arg_homes(struct entrypoint *ep)
+{
+	struct symbol *fntype = function_type(ep->name);
+	int nint = 0, nsse = 0, offset = 16;
+	struct symbol *type;
+	pseudo_t arg;
+
+	PREPARE_PTR_LIST(fntype->arguments, type);
+	FOR_EACH_PTR(ep->entry->arg_list, arg) {
+		struct value *v = value_of(arg);
+		int fp = type && is_float_type(type);
+		int stack = fp ? nsse++ >= NR_SSE_ARGS : nint++ >= NR_INT_ARGS;
+
+		if (stack) {
+			if (v && v->reg == NOREG)
+				v->offset = offset;
+			offset += 8;
+		}
+		NEXT_PTR_LIST(type);
+	} END_FOR_EACH_PTR(arg);
+	FINISH_PTR_LIST(type);
+}
+
+static void layout_frame(struct entrypoint *ep)
+{
+	pseudo_t sym;
+	int i, n = 0;
+
+	frame_size = 0;
+	for (i = 0; i < NR_REGS; i++)
+		saved_regs[i] = 0;
+	for (i = 0; i < ep->nr_pseudos; i++) {
+		int reg = values[i].reg;
+
+		if (reg != NOREG && !saved_regs[reg] && is_callee_saved(reg))
+			saved_regs[reg] = frame_alloc(8, 8);
+	}
+
+	frame_offsets = calloc(pseudo_list_size(ep->accesses) + 1, sizeof(int));
+	if (!frame_offsets)
+		die("out of memory");
+	FOR_EACH_PTR(ep->accesses, sym) {
+		struct symbol *s = sym->sym;
+
+		sym->priv = &frame_offsets[n];
+		if (is_frame_symbol(s)) {
+			int align = s->ctype.alignment;
+			int bytes = bits_to_bytes(s->bit_size);
+
+			if (bytes <= 0) {
+				sparse_error(s->pos, "variable-length arrays are not supported");
+				bytes = 0;
+			}
+			frame_offsets[n] = frame_alloc(bytes, align > 8 ? align : 8);
+		}
+		n++;
+	} END_FOR_EACH_PTR(sym);
+
+	set_arg_homes(ep);
+	for (i = 0; i < ep->nr_pseudos; i++) {
+		struct value *v = &values[i];
+
+		if (v->reg != NOREG || v->folded || v->end < 0 || v->offset)
+			continue;
+		v->offset = frame_alloc(v->size > 64 ? bits_to_bytes(v->size) : 8, 8);
+	}
+	frame_size = (frame_size + 15) & ~15;
+}
+
+////////////////////////////////////////////////////////////////////////
+// 4) Emission
+
+static int emit_compute(struct instruction *insn, int dst);
+
+static int next_scratch(int *n)
+{
+	if (*n >= ARRAY_SIZE(addr_scratch))
+		die("x86-64: out of scratch registers");
+	return addr_scratch[(*n)++];
+}
+
+static void add_register(struct operand *op, int reg, int scale)
+{
+	if (scale == 1 && op->base == NOREG) {
+		op->base = reg;
+	} else if (op->index == NOREG) {
+		op->index = reg;
+		op->scale = scale;
+	} else if (op->scale == 1 && op->base == NOREG) {
+		op->base = op->index;
+		op->index = reg;
+		op->scale = scale;
+	} else {
+		die("x86-64: too many registers in an address");
+	}
+}
+
+static void address_term(pseudo_t p, int scale, struct operand *op, int *scratch)
+{
+	struct instruction *def;
+	struct value *v;
+	int reg;
+
+	switch (p->type) {
+	case PSEUDO_VAL:
+		op->value += p->value * scale;
+		return;
+	case PSEUDO_SYM:
+		if (scale == 1 && is_frame_symbol(p->sym)) {
+			add_register(op, RBP, 1);
+			op->value += frame_offset(p);
+			return;
+		}
+		if (scale == 1 && !op->sym && !is_global_function(p->sym)) {
+			op->sym = p->sym;
+			return;
+		}
+		reg = next_scratch(scratch);
+		emit_symbol_address(p, reg);
+		add_register(op, reg, scale);
+		return;
+	case PSEUDO_REG:
+	case PSEUDO_ARG:
+		break;
+	default:
+		return;
+	}
+
+	v = value_of(p);
+	if (!v)
+		return;
+	def = folded_def(p);
+	if (def) {
+		switch (def->opcode) {
+		case OP_ADD:
+			address_term(def->src1, scale, op, scratch);
+			address_term(def->src2, scale, op, scratch);
+			return;
+		case OP_MUL:
+		case OP_SHL:
+			address_term(def->src1, scale * index_scale(def), op, scratch);
+			return;
+		case OP_SYMADDR:
+			address_term(def->symbol, scale, op, scratch);
+			return;
+		case OP_CAST: case OP_SCAST: case OP_PTRCAST:
+			if (cast_size(def) == 64) {
+				address_term(def->src, scale, op, scratch);
+				return;
+			}
+			break;
+		}
+		reg = emit_compute(def, next_scratch(scratch));
+		add_register(op, reg, scale);
+		return;
+	}
+	if (v->reg != NOREG) {
+		add_register(op, v->reg, scale);
+		return;
+	}
+	reg = next_scratch(scratch);
+	emit("\tmovq\t%d(%%rbp), %%%s\n", v->offset, reg_name(reg, 64));
+	add_register(op, reg, scale);
+}
+
+// The memory operand at 'offset' from the address 'p'.
+static void get_address(pseudo_t p, long long offset, struct operand *op)
+{
+	int scratch = 0;
+
+	*op = mem_operand(NOREG, offset);
+	address_term(p, 1, op, &scratch);
+
+	if (op->sym && (op->base != NOREG || op->index != NOREG)) {
+		struct operand sym = mem_operand(NOREG, 0);
+		int reg = next_scratch(&scratch);
+
+		sym.sym = op->sym;
+		emit_lea(&sym, reg);
+		op->sym = NULL;
+		add_register(op, reg, 1);
+	}
+	if (!op->sym && op->base == NOREG && op->index == NOREG && !fits_imm32(op->value)) {
+		int reg = next_scratch(&scratch);
+
+		emit_move_imm(op->value, reg, 64);
+		op->base = reg;
+		op->value = 0;
+	}
+}
+
+// An operand giving the value of 'p' at 'size': an immediate, a
+// register or a memory operand, using 'scratch' if needed.
+static void get_operand(pseudo_t p, int size, struct operand *op, int scratch)
+{
+	struct instruction *def;
+	struct value *v;
+
+	switch (p->type) {
+	case PSEUDO_VAL:
+		*op = imm_operand(sign_extend(p->value, opsize(size)));
+		if (fits_imm32(op->value))
+			return;
+		emit_move_imm(op->value, scratch, 64);
+		*op = reg_operand(scratch);
+		return;
+	case PSEUDO_SYM:
+		emit_symbol_address(p, scratch);
+		*op = reg_operand(scratch);
+		return;
+	case PSEUDO_REG:
+	case PSEUDO_ARG:
+		break;
+	default:
+		*op = imm_operand(0);
+		return;
+	}
+
+	v = value_of(p);
+	if (!v) {
+		*op = imm_operand(0);	// undefined
+		return;
+	}
+	def = folded_def(p);
+	if (def) {
+		if (def->opcode == OP_LOAD) {
+			get_address(def->src, def->offset, op);
+			return;
+		}
+		*op = reg_operand(emit_compute(def, scratch));
+		return;
+	}
+	home_operand(v, op);
+}
+
+static const char *extend_insn(int from, int to, int is_signed)
+{
+	static char buf[8];
+
+	snprintf(buf, sizeof(buf), "mov%c%c%c", is_signed ? 's' : 'z',
+		suffix(from), suffix(to));
+	return buf;
+}
+
+// Load the value of 'p', of 'size' bits, in 'reg', extended to 32 or
+// 64 bits. Without extension, the bits above 'size' are undefined.
+static void load_extended(pseudo_t p, int size, int to, int is_signed, int reg)
+{
+	struct operand op;
+	int from = opsize(size);
+
+	if (to < 32)
+		to = 32;
+	get_operand(p, from, &op, reg);
+	if (op.type == OPND_IMM) {
+		long long val = op.value;
+
+		if (size < 64)
+			val = is_signed ? sign_extend(val, size) : zero_extend(val, size);
+		emit_move_imm(val, reg, to);
+		return;
+	}
+
+	if (from == 64 || (from == 32 && (to == 32 || !is_signed))) {
+		if (op.type == OPND_REG)
+			emit_reg_move(op.reg, reg, from);
+		else
+			emit_to_reg("mov", from, &op, reg);
+	} else if (from == 32) {
+		emit_extend("movslq", &op, 32, reg, 64);
+	} else {
+		emit_extend(extend_insn(from, to, is_signed), &op, from, reg, to);
+	}
+
+	// the bitfields
+	if (size != from && size < to) {
+		if (is_signed) {
+			emit("\tshl%c\t$%d, %%%s\n", suffix(to), to - size, reg_name(reg, to));
+			emit("\tsar%c\t$%d, %%%s\n", suffix(to), to - size, reg_name(reg, to));
+		} else if (size < 32) {
+			emit("\tandl\t$%lld, %%%s\n", (1LL << size) - 1, reg_name(reg, 32));
+		} else {
+			emit("\tshlq\t$%d, %%%s\n", 64 - size, reg_name(reg, 64));
+			emit("\tshrq\t$%d, %%%s\n", 64 - size, reg_name(reg, 64));
+		}
+	}
+}
+
+static void load_value(pseudo_t p, int size, int reg)
+{
+	size = opsize(size);
+	load_extended(p, size, size, 0, reg);
+}
+
+// The operand 'p' in a register, if not already in one.
+static int value_register(pseudo_t p, int size, int scratch)
+{
+	struct value *v = value_of(p);
+
+	if (v && v->reg != NOREG && !v->folded)
+		return v->reg;
+	load_value(p, size, scratch);
+	return scratch;
+}
+
+static void store_home(struct value *v, int reg, int size)
+{
+	struct operand home;
+
+	if (v->reg != NOREG) {
+		emit_reg_move(reg, v->reg, size);
+		return;
+	}
+	size = opsize(size);
+	home = mem_operand(RBP, v->offset);
+	emit_from_reg("mov", size, reg, &home);
+}
+
+static int fp_size(struct instruction *insn, int size)
+{
+	if (size != 32 && size != 64) {
+		sparse_error(insn->pos, "long double is not supported");
+		return 64;
+	}
+	return size;
+}
+
+static inline char fp_suffix(int size)
+{
+	return size == 32 ? 's' : 'd';
+}
+
+static inline const char *fp_move(int size)
+{
+	return size == 32 ? "movss" : "movsd";
+}
+
+static inline void put_xmm(int xmm)
+{
+	outbuf_puts(&out, "%xmm");
+	outbuf_uint(&out, xmm);
+}
+
+static void load_fp(pseudo_t p, int size, int xmm)
+{
+	struct operand op;
+
+	get_operand(p, size, &op, RAX);
+	switch (op.type) {
+	case OPND_MEM:
+		put_mnemonic(fp_move(size), 0);
+		put_operand(&op, size);
+		put_separator();
+		put_xmm(xmm);
+		put_newline();
+		return;
+	case OPND_IMM:
+		emit_move_imm(op.value, RAX, size);
+		op = reg_operand(RAX);
+		/* fall through */
+	default:
+		emit("\tmov%c\t%%%s, %%xmm%d\n", size == 32 ? 'd' : 'q', reg_name(op.reg, size), xmm);
+	}
+}
+
+static int fp_result(int size, int dst)
+{
+	emit("\tmov%c\t%%xmm0, %%%s\n", size == 32 ? 'd' : 'q', reg_name(dst, size));
+	return dst;
+}
+
+// Does the value of 'p' depend on 'target'?
+static int tree_uses(pseudo_t p, pseudo_t target)
+{
+	struct instruction *def;
+
+	if (p == target)
+		return 1;
+	def = folded_def(p);
+	if (!def)
+		return 0;
+	switch (def->opcode) {
+	case OP_BINARY ... OP_BINARY_END:
+	case OP_BINCMP ... OP_BINCMP_END:
+		return tree_uses(def->src1, target) || tree_uses(def->src2, target);
+	case OP_LOAD:
+	case OP_CAST: case OP_SCAST: case OP_PTRCAST:
+		return tree_uses(def->src, target);
+	}
+	return 0;
+}
+
+// Set the flags for a comparison and return its condition.
+static enum cc emit_compare(struct instruction *insn)
+{
+	pseudo_t src1 = insn->src1, src2 = insn->src2;
+	enum cc cc = compare_cc(insn->opcode);
+	struct operand op;
+	int size, reg;
+
+	size = opsize(pseudo_size(src1, pseudo_size(src2, 64)));
+	if (src1->type == PSEUDO_VAL && src2->type != PSEUDO_VAL) {
+		pseudo_t tmp = src1;
+		src1 = src2;
+		src2 = tmp;
+		cc = swap_cc(cc);
+	}
+	reg = value_register(src1, size, RAX);
+	get_operand(src2, size, &op, RCX);
+	emit_to_reg("cmp", size, &op, reg);
+	return cc;
+}
+
+// Set the flags for a test of 'cond' against zero.
+static enum cc emit_test(pseudo_t cond)
+{
+	struct instruction *def = folded_def(cond);
+	struct operand op;
+	int size;
+
+	if (def && def->opcode >= OP_BINCMP && def->opcode <= OP_BINCMP_END)
+		return emit_compare(def);
+
+	size = opsize(pseudo_size(cond, 32));
+	get_operand(cond, size, &op, RAX);
+	if (op.type == OPND_REG)
+		emit("\ttest%c\t%%%s, %%%s\n", suffix(size), reg_name(op.reg, size), reg_name(op.reg, size));
+	else if (op.type == OPND_MEM) {
+		struct operand zero = imm_operand(0);
+		emit_op2("cmp", size, &zero, &op);
+	} else
+		return op.value ? -1 : -2;	// always, never
+	return CC_NE;
+}
+
+static int emit_setcc(enum cc cc, int dst)
+{
+	emit("\tset%s\t%%al\n", cc_names[cc]);
+	emit("\tmovzbl\t%%al, %%%s\n", reg_name(dst, 32));
+	return dst;
+}
+
+static int emit_fp_compare(struct instruction *insn, int dst)
+{
+	int size = fp_size(insn, pseudo_size(insn->src1, pseudo_size(insn->src2, 64)));
+	int swap = 0, second = -1;
+	enum cc cc = CC_E;
+
+	switch (insn->opcode) {
+	case OP_FCMP_ORD: cc = CC_NP; break;
+	case OP_FCMP_UNO: cc = CC_P; break;
+	case OP_FCMP_OEQ: cc = CC_E; second = CC_NP; break;
+	case OP_FCMP_UNE: cc = CC_NE; second = CC_P; break;
+	case OP_FCMP_ONE: cc = CC_NE; break;
+	case OP_FCMP_UEQ: cc = CC_E; break;
+	case OP_FCMP_OGT: cc = CC_A; break;
+	case OP_FCMP_OGE: cc = CC_AE; break;
+	case OP_FCMP_OLT: cc = CC_A; swap = 1; break;
+	case OP_FCMP_OLE: cc = CC_AE; swap = 1; break;
+	case OP_FCMP_UGT: cc = CC_B; swap = 1; break;
+	case OP_FCMP_UGE: cc = CC_BE; swap = 1; break;
+	case OP_FCMP_ULT: cc = CC_B; break;
+	case OP_FCMP_ULE: cc = CC_BE; break;
+	}
+	load_fp(insn->src1, size, swap);
+	load_fp(insn->src2, size, !swap);
+	emit("\tucomis%c\t%%xmm1, %%xmm0\n", fp_suffix(size));
+	emit("\tset%s\t%%al\n", cc_names[cc]);
+	if (second >= 0) {
+		emit("\tset%s\t%%cl\n", cc_names[second]);
+		emit("\t%sb\t%%cl, %%al\n", insn->opcode == OP_FCMP_OEQ ? "and" : "or");
+	}
+	emit("\tmovzbl\t%%al, %%%s\n", reg_name(dst, 32));
+	return dst;
+}
+
+static const char *binop_name(int opcode)
+{
+	switch (opcode) {
+	case OP_ADD:	return "add";
+	case OP_SUB:	return "sub";
+	case OP_MUL:	return "imul";
+	case OP_AND:	return "and";
+	case OP_OR:	return "or";
+	case OP_XOR:	return "xor";
+	case OP_SHL:	return "shl";
+	case OP_LSR:	return "shr";
+	case OP_ASR:	return "sar";
+	case OP_FADD:	return "add";
+	case OP_FSUB:	return "sub";
+	case OP_FMUL:	return "mul";
+	case OP_FDIV:	return "div";
+	}
+	return NULL;
+}
+
+static int is_commutative(int opcode)
+{
+	switch (opcode) {
+	case OP_ADD: case OP_MUL: case OP_AND: case OP_OR: case OP_XOR:
+		return 1;
+	}
+	return 0;
+}
+
+static int emit_binop(struct instruction *insn, int dst)
+{
+	pseudo_t src1 = insn->src1, src2 = insn->src2;
+	int size = opsize(insn->size);
+	struct operand op;
+
+	if (is_commutative(insn->opcode) && (src2 == insn->target || src1->type == PSEUDO_VAL)) {
+		pseudo_t tmp = src1;
+		src1 = src2;
+		src2 = tmp;
+	}
+	load_value(src1, size, dst);
+	if (size < 32) {
+		// done on 32 bits, with the operand in a register
+		size = 32;
+		if (src2->type != PSEUDO_VAL)
+			load_value(src2, insn->size, RCX);
+		op = src2->type == PSEUDO_VAL ? imm_operand(src2->value) : reg_operand(RCX);
+	} else {
+		get_operand(src2, size, &op, RCX);
+	}
+	emit_to_reg(binop_name(insn->opcode), size, &op, dst);
+	return dst;
+}
+
+static int emit_shift(struct instruction *insn, int dst)
+{
+	int is_signed = insn->opcode == OP_ASR;
+	int size = opsize(insn->size);
+	pseudo_t src2 = insn->src2;
+
+	if (src2->type != PSEUDO_VAL)
+		load_value(src2, pseudo_size(src2, 32), RCX);
+	load_extended(insn->src1, size, size, is_signed, dst);
+	if (size < 32)
+		size = 32;
+	if (src2->type == PSEUDO_VAL)
+		emit("\t%s%c\t$%lld, %%%s\n", binop_name(insn->opcode), suffix(size),
+			src2->value & (size - 1), reg_name(dst, size));
+	else
+		emit("\t%s%c\t%%cl, %%%s\n", binop_name(insn->opcode), suffix(size),
+			reg_name(dst, size));
+	return dst;
+}
+
+static int emit_divide(struct instruction *insn)
+{
+	int is_signed = insn->opcode == OP_DIVS || insn->opcode == OP_MODS;
+	int size = opsize(insn->size);
+	pseudo_t src2 = insn->src2;
+	struct operand op;
+
+	load_extended(insn->src1, size, size, is_signed, RAX);
+	if (size < 32 || src2->type == PSEUDO_VAL) {
+		load_extended(src2, size, size, is_signed, RCX);
+		op = reg_operand(RCX);
+	} else {
+		get_operand(src2, size, &op, RCX);
+	}
+	if (size < 32)
+		size = 32;
+	if (is_signed)
+		emit("\t%s\n", size == 64 ? "cqto" : "cltd");
+	else
+		emit("\txorl\t%%edx, %%edx\n");
+	emit_op1(is_signed ? "idiv" : "div", size, &op);
+	return (insn->opcode == OP_MODU || insn->opcode == OP_MODS) ? RDX : RAX;
+}
+
+static int emit_logical(struct instruction *insn, int dst)
+{
+	enum cc cc;
+
+	cc = emit_test(insn->src1);
+	emit("\tset%s\t%%dl\n", cc < 0 ? (cc == -1 ? "e" : "ne") : cc_names[cc]);
+	if ((int) cc < 0)
+		emit("\tcmpb\t%%dl, %%dl\n");
+	cc = emit_test(insn->src2);
+	if ((int) cc < 0) {
+		emit("\tmovb\t$%d, %%al\n", cc == -1);
+	} else {
+		emit("\tset%s\t%%al\n", cc_names[cc]);
+	}
+	emit("\t%sb\t%%dl, %%al\n", insn->opcode == OP_AND_BOOL ? "and" : "or");
+	emit("\tmovzbl\t%%al, %%%s\n", reg_name(dst, 32));
+	return dst;
+}
+
+static int emit_select(struct instruction *insn, int dst)
+{
+	int size = opsize(insn->size);
+	struct operand op;
+	enum cc cc;
+
+	cc = emit_test(insn->src1);
+	if ((int) cc < 0) {
+		load_value(cc == -1 ? insn->src2 : insn->src3, size, dst);
+		return dst;
+	}
+	if (size < 32) {
+		size = 32;
+		load_value(insn->src2, insn->size, RCX);
+		op = reg_operand(RCX);
+	} else {
+		get_operand(insn->src2, size, &op, RCX);
+		if (op.type == OPND_IMM) {
+			emit_move_imm(op.value, RCX, size);
+			op = reg_operand(RCX);
+		}
+	}
+	load_value(insn->src3, insn->size, dst);
+	outbuf_puts(&out, "\tcmov");
+	outbuf_puts(&out, cc_names[cc]);
+	outbuf_putc(&out, suffix(size));
+	outbuf_putc(&out, '\t');
+	put_operand(&op, size);
+	put_separator();
+	put_reg(dst, size);
+	put_newline();
+	return dst;
+}
+
+static int emit_load(struct instruction *insn, int dst)
+{
+	int size = opsize(insn->size);
+	struct operand addr;
+
+	get_address(insn->src, insn->offset, &addr);
+	if (size < 32)
+		emit_extend(extend_insn(size, 32, 0), &addr, size, dst, 32);
+	else
+		emit_to_reg("mov", size, &addr, dst);
+	return dst;
+}
+
+static int emit_int_to_fp(struct instruction *insn, int dst)
+{
+	struct symbol *orig = insn->orig_type;
+	int size = fp_size(insn, insn->size);
+	int is_signed = is_signed_type(orig);
+	char s = fp_suffix(size);
+
+	load_extended(insn->src, orig->bit_size, 64, is_signed, RAX);
+	if (is_signed || orig->bit_size < 64) {
+		emit("\tcvtsi2s%cq\t%%rax, %%xmm0\n", s);
+	} else {
+		emit("\ttestq\t%%rax, %%rax\n");
+		emit("\tjs\t1f\n");
+		emit("\tcvtsi2s%cq\t%%rax, %%xmm0\n", s);
+		emit("\tjmp\t2f\n");
+		emit("1:\n");
+		emit("\tmovq\t%%rax, %%rcx\n");
+		emit("\tshrq\t%%rcx\n");
+		emit("\tandl\t$1, %%eax\n");
+		emit("\torq\t%%rax, %%rcx\n");
+		emit("\tcvtsi2s%cq\t%%rcx, %%xmm0\n", s);
+		emit("\tadds%c\t%%xmm0, %%xmm0\n", s);
+		emit("2:\n");
+	}
+	return fp_result(size, dst);
+}
+
+static int emit_fpcast(struct instruction *insn, int dst)
+{
+	struct symbol *orig = insn->orig_type;
+	int size = fp_size(insn, insn->size);
+	int from;
+
+	if (!orig || !is_float_type(orig))
+		return emit_int_to_fp(insn, dst);
+	from = fp_size(insn, orig->bit_size);
+	load_fp(insn->src, from, 0);
+	if (from != size)
+		emit("\tcvts%c2s%c\t%%xmm0, %%xmm0\n", fp_suffix(from), fp_suffix(size));
+	return fp_result(size, dst);
+}
+
+static int emit_cast(struct instruction *insn, int dst)
+{
+	struct symbol *orig = insn->orig_type;
+	int size = insn->size;
+	int from = orig ? orig->bit_size : size;
+
+	if (orig && is_float_type(orig)) {
+		from = fp_size(insn, from);
+		load_fp(insn->src, from, 0);
+		emit("\tcvtts%c2siq\t%%xmm0, %%rax\n", fp_suffix(from));
+		emit_reg_move(RAX, dst, 64);
+		return dst;
+	}
+	if (from <= 0)
+		from = pseudo_size(insn->src, 64);
+	if (size <= from) {
+		// a truncation: just the low bits are used
+		load_value(insn->src, size, dst);
+		return dst;
+	}
+	load_extended(insn->src, from, opsize(size), insn->opcode == OP_SCAST, dst);
+	return dst;
+}
+
+static int emit_slice(struct instruction *insn, int dst)
+{
+	struct value *base = value_of(insn->base);
+
+	if (base && base->size > 64 && !base->folded && base->reg == NOREG) {
+		struct operand op = mem_operand(RBP, base->offset + insn->from / 8);
+		int shift = insn->from % 8;
+		int len = opsize(insn->len + shift);
+
+		emit_to_reg("mov", len, &op, dst);
+		if (shift)
+			emit("\tshr%c\t$%d, %%%s\n", suffix(len), shift, reg_name(dst, len));
+		return dst;
+	}
+	load_value(insn->base, pseudo_size(insn->base, 64), dst);
+	if (insn->from)
+		emit("\tshrq\t$%d, %%%s\n", insn->from, reg_name(dst, 64));
+	return dst;
+}
+
+static int emit_setval(struct instruction *insn, int dst)
+{
+	struct expression *val = insn->val;
+
+	if (val->type == EXPR_LABEL) {
+		struct operand op = mem_operand(NOREG, 0);
+
+		op.label = val->label_symbol->bb_target;
+		emit_lea(&op, dst);
+		return dst;
+	}
+	sparse_error(insn->pos, "unsupported value in set");
+	return dst;
+}
+
+static int emit_setfval(struct instruction *insn, int dst)
+{
+	int size = fp_size(insn, insn->size);
+	union {
+		float f;
+		double d;
+		unsigned int i;
+		unsigned long long l;
+	} u;
+
+	if (size == 32) {
+		u.f = insn->fvalue;
+		emit_move_imm(u.i, dst, 32);
+	} else {
+		u.d = insn->fvalue;
+		emit_move_imm(u.l, dst, 64);
+	}
+	return dst;
+}
+
+// Compute the value of 'insn' in a register, 'dst' if possible, and
+// return this register.
+static int emit_compute(struct instruction *insn, int dst)
+{
+	int size = opsize(insn->size);
+
+	switch (insn->opcode) {
+	case OP_ADD: case OP_SUB: case OP_MUL:
+	case OP_AND: case OP_OR: case OP_XOR:
+		return emit_binop(insn, dst);
+	case OP_SHL: case OP_LSR: case OP_ASR:
+		return emit_shift(insn, dst);
+	case OP_DIVU: case OP_DIVS: case OP_MODU: case OP_MODS:
+		return emit_divide(insn);
+	case OP_AND_BOOL: case OP_OR_BOOL:
+		return emit_logical(insn, dst);
+	case OP_BINCMP ... OP_BINCMP_END:
+		return emit_setcc(emit_compare(insn), dst);
+	case OP_FPCMP ... OP_FPCMP_END:
+		return emit_fp_compare(insn, dst);
+	case OP_FADD: case OP_FSUB: case OP_FMUL: case OP_FDIV:
+		size = fp_size(insn, insn->size);
+		load_fp(insn->src1, size, 0);
+		load_fp(insn->src2, size, 1);
+		emit("\t%ss%c\t%%xmm1, %%xmm0\n", binop_name(insn->opcode), fp_suffix(size));
+		return fp_result(size, dst);
+	case OP_FNEG:
+		size = fp_size(insn, insn->size);
+		load_value(insn->src, size, dst);
+		emit("\tbtc%c\t$%d, %%%s\n", suffix(size), size - 1, reg_name(dst, size));
+		return dst;
+	case OP_NOT:
+	case OP_NEG:
+		load_value(insn->src, size, dst);
+		emit("\t%s%c\t%%%s\n", insn->opcode == OP_NOT ? "not" : "neg",
+			suffix(size < 32 ? 32 : size), reg_name(dst, size < 32 ? 32 : size));
+		return dst;
+	case OP_SEL:
+		return emit_select(insn, dst);
+	case OP_LOAD:
+		return emit_load(insn, dst);
+	case OP_SETVAL:
+		return emit_setval(insn, dst);
+	case OP_SETFVAL:
+		return emit_setfval(insn, dst);
+	case OP_SYMADDR:
+		emit_symbol_address(insn->symbol, dst);
+		return dst;
+	case OP_CAST: case OP_SCAST: case OP_PTRCAST:
+		return emit_cast(insn, dst);
+	case OP_FPCAST:
+		return emit_fpcast(insn, dst);
+	case OP_COPY:
+		load_value(insn->src, size, dst);
+		return dst;
+	case OP_SLICE:
+		return emit_slice(insn, dst);
+	}
+	sparse_error(insn->pos, "unsupported instruction '%s'", show_instruction(insn));
+	return dst;
+}
+
+// Copy 'bytes' of memory, with %rsi, %rdi & %rcx.
+static void emit_memcpy(const struct operand *dst, const struct operand *src, int bytes)
+{
+	emit_to_reg("lea", 64, src, RSI);
+	emit_to_reg("lea", 64, dst, RDI);
+	emit("\tmovl\t$%d, %%ecx\n", bytes);
+	emit("\trep movsb\n");
+}
+
+static void emit_aggregate(struct instruction *insn, struct value *v)
+{
+	struct operand home = mem_operand(RBP, v->offset);
+	struct operand src;
+	struct value *s;
+
+	switch (insn->opcode) {
+	case OP_LOAD:
+		get_address(insn->src, insn->offset, &src);
+		emit_memcpy(&home, &src, bits_to_bytes(insn->size));
+		return;
+	case OP_COPY:
+		s = value_of(insn->src);
+		if (!s || s->reg != NOREG)
+			break;
+		src = mem_operand(RBP, s->offset);
+		emit_memcpy(&home, &src, bits_to_bytes(insn->size));
+		return;
+	}
+	sparse_error(insn->pos, "unsupported aggregate value");
+}
+
+static void emit_def(struct instruction *insn)
+{
+	pseudo_t target = insn->target;
+	struct value *v = value_of(target);
+	int dst = RAX, reg;
+
+	if (!v)
+		return;
+	if (v->size > 64 && !v->fp) {
+		emit_aggregate(insn, v);
+		return;
+	}
+	if (v->reg != NOREG) {
+		dst = v->reg;
+		switch (insn->opcode) {
+		case OP_BINARY ... OP_BINARY_END:
+			if (!tree_uses(insn->src2, target))
+				break;
+			if (is_commutative(insn->opcode) && insn->src1 != target)
+				break;
+			dst = RAX;
+			break;
+		case OP_SEL:
+			if (tree_uses(insn->src2, target))
+				dst = RAX;
+			break;
+		}
+	}
+	reg = emit_compute(insn, dst);
+	store_home(v, reg, insn->size);
+}
+
+static void emit_store(struct instruction *insn)
+{
+	struct value *v = value_of(insn->target);
+	int size = insn->size;
+	struct operand addr, op;
+
+	if (v && v->size > 64 && !v->fp) {
+		struct instruction *def = folded_def(insn->target);
+
+		if (def) {
+			get_address(def->src, def->offset, &op);
+		} else if (v->reg == NOREG) {
+			op = mem_operand(RBP, v->offset);
+		} else {
+			sparse_error(insn->pos, "unsupported aggregate store");
+			return;
+		}
+		emit_to_reg("lea", 64, &op, RSI);
+		get_address(insn->src, insn->offset, &addr);
+		emit_to_reg("lea", 64, &addr, RDI);
+		emit("\tmovl\t$%d, %%ecx\n", bits_to_bytes(size));
+		emit("\trep movsb\n");
+		return;
+	}
+
+	size = opsize(size);
+	get_operand(insn->target, size, &op, RAX);
+	if (op.type == OPND_MEM) {
+		emit_to_reg("mov", size, &op, RAX);
+		op = reg_operand(RAX);
+	}
+	get_address(insn->src, insn->offset, &addr);
+	emit_op2("mov", size, &op, &addr);
+}
+
+struct call_arg {
+	pseudo_t pseudo;
+	struct symbol *type;
+	int size, fp, reg;
+};
+
+static struct call_arg *call_args;
+static int max_call_args;
+
+static void emit_call(struct instruction *insn)
+{
+	struct symbol *fntype = function_type(first_ptr_list((struct ptr_list *)insn->fntypes));
+	int nint = 0, nsse = 0, nstack = 0, adjust = 0, nr = 0, i;
+	struct value *v = value_of(insn->target);
+	pseudo_t arg, func = insn->func;
+	struct symbol *type;
+	struct operand op;
+
+	PREPARE_PTR_LIST(insn->fntypes, type);
+	NEXT_PTR_LIST(type);
+	FOR_EACH_PTR(insn->arguments, arg) {
+		struct call_arg *a;
+
+		if (nr == max_call_args) {
+			max_call_args = max_call_args ? 2 * max_call_args : 16;
+			call_args = realloc(call_args, max_call_args * sizeof(*call_args));
+			if (!call_args)
+				die("out of memory");
+		}
+		a = &call_args[nr++];
+		a->pseudo = arg;
+		a->type = type;
+		a->size = type ? type->bit_size : pseudo_size(arg, 64);
+		a->fp = type ? is_float_type(type) : 0;
+		if (a->size > 64 || (type && !a->fp && !is_int_type(type) && !is_ptr_type(type) && !is_enum_type(type)))
+			sparse_error(insn->pos, "passing structures or long double is not supported");
+		if (a->fp)
+			a->reg = nsse < NR_SSE_ARGS ? nsse++ : -1;
+		else
+			a->reg = nint < NR_INT_ARGS ? int_arg_regs[nint++] : -1;
+		if (a->reg < 0)
+			nstack++;
+		NEXT_PTR_LIST(type);
+	} END_FOR_EACH_PTR(arg);
+	FINISH_PTR_LIST(type);
+
+	if (nstack) {
+		int slot = 0;
+
+		adjust = (nstack * 8 + 15) & ~15;
+		emit("\tsubq\t$%d, %%rsp\n", adjust);
+		for (i = 0; i < nr; i++) {
+			struct call_arg *a = &call_args[i];
+
+			if (a->reg >= 0)
+				continue;
+			load_extended(a->pseudo, opsize(a->size), 64,
+				!a->fp && a->type && is_signed_type(a->type), RAX);
+			emit("\tmovq\t%%rax, %d(%%rsp)\n", slot);
+			slot += 8;
+		}
+	}
+	for (i = 0; i < nr; i++) {
+		struct call_arg *a = &call_args[i];
+
+		if (a->reg < 0 || a->fp)
+			continue;
+		load_extended(a->pseudo, a->size, opsize(a->size),
+			a->type && is_signed_type(a->type), a->reg);
+	}
+	for (i = 0; i < nr; i++) {
+		struct call_arg *a = &call_args[i];
+
+		if (a->reg >= 0 && a->fp)
+			load_fp(a->pseudo, fp_size(insn, a->size), a->reg);
+	}
+
+	if (func->type == PSEUDO_SYM && !is_frame_symbol(func->sym) && is_func_type(func->sym)) {
+		if (fntype && (fntype->variadic || !fntype->arguments))
+			emit("\tmovl\t$%d, %%eax\n", nsse);
+		emit("\tcall\t%s%s\n", symbol_name(func->sym),
+			is_static(func->sym) ? "" : "@PLT");
+	} else {
+		get_operand(func, 64, &op, R11);
+		if (op.type == OPND_IMM) {
+			emit_move_imm(op.value, R11, 64);
+			op = reg_operand(R11);
+		}
+		if (fntype && (fntype->variadic || !fntype->arguments))
+			emit("\tmovl\t$%d, %%eax\n", nsse);
+		outbuf_puts(&out, "\tcall\t*");
+		put_operand(&op, 64);
+		put_newline();
+	}
+	if (adjust)
+		emit("\taddq\t$%d, %%rsp\n", adjust);
+
+	if (!v || v->folded)
+		return;
+	if (v->size > 64)
+		sparse_error(insn->pos, "returning structures or long double is not supported");
+	else if (v->fp)
+		store_home(v, fp_result(v->size, RAX), v->size);
+	else
+		store_home(v, RAX, v->size);
+}
+
+static struct symbol *return_type(void)
+{
+	struct symbol *fntype = function_type(cur_ep->name);
+
+	return fntype ? fntype->ctype.base_type : NULL;
+}
+
+static void emit_epilogue(void)
+{
+	int reg;
+
+	for (reg = 0; reg < NR_REGS; reg++) {
+		if (saved_regs[reg])
+			emit("\tmovq\t%d(%%rbp), %%%s\n", saved_regs[reg], reg_name(reg, 64));
+	}
+	emit("\tleave\n");
+	emit("\tret\n");
+}
+
+static void emit_ret(struct instruction *insn)
+{
+	struct symbol *type = return_type();
+	pseudo_t src = insn->src;
+
+	if (src && src != VOID && insn->size) {
+		if (type && is_float_type(type)) {
+			load_fp(src, fp_size(insn, insn->size), 0);
+		} else if (insn->size > 64) {
+			sparse_error(insn->pos, "returning structures is not supported");
+		} else {
+			int size = insn->size;
+
+			load_extended(src, size, opsize(size), type && is_signed_type(type), RAX);
+		}
+	}
+	emit_epilogue();
+}
+
+static inline void put_label(struct basic_block *bb)
+{
+	outbuf_write(&out, ".L", 2);
+	outbuf_uint(&out, bb->nr);
+}
+
+// 'j<cc>' to 'target'
+static void emit_jcc(const char *cc, struct basic_block *target)
+{
+	outbuf_write(&out, "\tj", 2);
+	outbuf_puts(&out, cc);
+	outbuf_putc(&out, '\t');
+	put_label(target);
+	put_newline();
+}
+
+static void emit_jump(struct basic_block *target)
+{
+	if (target == next_bb)
+		return;
+	outbuf_write(&out, "\tjmp\t", 5);
+	put_label(target);
+	put_newline();
+}
+
+static void emit_branch(struct instruction *insn)
+{
+	struct basic_block *bb_true = insn->bb_true;
+	struct basic_block *bb_false = insn->bb_false;
+	enum cc cc = emit_test(insn->cond);
+
+	if ((int) cc < 0) {
+		emit_jump(cc == -1 ? bb_true : bb_false);
+		return;
+	}
+	if (bb_true == next_bb) {
+		emit_jcc(cc_names[invert_cc(cc)], bb_false);
+		return;
+	}
+	emit_jcc(cc_names[cc], bb_true);
+	emit_jump(bb_false);
+}
+
+static void emit_switch(struct instruction *insn)
+{
+	int size = opsize(pseudo_size(insn->cond, 32));
+	struct basic_block *def = NULL;
+	struct multijmp *jmp;
+	int reg;
+
+	if (size < 32)
+		size = 32;
+	reg = value_register(insn->cond, size, RAX);
+	FOR_EACH_PTR(insn->multijmp_list, jmp) {
+		long long begin = jmp->begin, end = jmp->end;
+
+		if (begin > end) {
+			def = jmp->target;
+			continue;
+		}
+		if (begin == end) {
+			if (fits_imm32(begin)) {
+				emit("\tcmp%c\t$%lld, %%%s\n", suffix(size), begin, reg_name(reg, size));
+			} else {
+				emit_move_imm(begin, RDX, size);
+				emit("\tcmp%c\t%%%s, %%%s\n", suffix(size), reg_name(RDX, size), reg_name(reg, size));
+			}
+			emit_jcc("e", jmp->target);
+			continue;
+		}
+		emit_reg_move(reg, RCX, size);
+		emit_move_imm(begin, RDX, size);
+		emit("\tsub%c\t%%%s, %%%s\n", suffix(size), reg_name(RDX, size), reg_name(RCX, size));
+		emit_move_imm(end - begin, RDX, size);
+		emit("\tcmp%c\t%%%s, %%%s\n", suffix(size), reg_name(RDX, size), reg_name(RCX, size));
+		emit_jcc("be", jmp->target);
+	} END_FOR_EACH_PTR(jmp);
+	if (def)
+		emit_jump(def);
+}
+
+static void emit_asm(struct instruction *insn)
+{
+	struct asm_rules *rules = insn->asm_rules;
+
+	if (rules->inputs || rules->outputs) {
+		sparse_error(insn->pos, "asm operands are not supported");
+		return;
+	}
+	emit("\t%s\n", insn->string);
+}
+
+static void emit_insn(struct instruction *insn)
+{
+	struct operand op;
+
+	switch (insn->opcode) {
+	case OP_ENTRY:
+	case OP_NOP:
+	case OP_DEATHNOTE:
+	case OP_CONTEXT:
+	case OP_RANGE:
+	case OP_INLINED_CALL:
+		return;
+	case OP_RET:
+		emit_ret(insn);
+		return;
+	case OP_BR:
+		emit_jump(insn->bb_true);
+		return;
+	case OP_CBR:
+		emit_branch(insn);
+		return;
+	case OP_SWITCH:
+		emit_switch(insn);
+		return;
+	case OP_COMPUTEDGOTO:
+		get_operand(insn->src, 64, &op, RAX);
+		outbuf_puts(&out, "\tjmp\t*");
+		put_operand(&op, 64);
+		put_newline();
+		return;
+	case OP_STORE:
+		emit_store(insn);
+		return;
+	case OP_CALL:
+		emit_call(insn);
+		return;
+	case OP_ASM:
+		emit_asm(insn);
+		return;
+	default:
+		emit_def(insn);
+	}
+}
+
+static void emit_block(struct basic_block *bb, struct basic_block *next)
+{
+	struct instruction *insn;
+
+	next_bb = next;
+	put_label(bb);
+	outbuf_write(&out, ":\n", 2);
+	FOR_EACH_PTR(bb->insns, insn) {
+		if (!insn->bb || is_folded(insn))
+			continue;
+		emit_insn(insn);
+	} END_FOR_EACH_PTR(insn);
+}
+
+static void emit_prologue(struct entrypoint *ep)
+{
+	struct symbol *fntype = function_type(ep->name);
+	int nint = 0, nsse = 0, reg;
+	struct symbol *type;
+	pseudo_t arg;
+
+	emit("\tpushq\t%%rbp\n");
+	emit("\tmovq\t%%rsp, %%rbp\n");
+	if (frame_size)
+		emit("\tsubq\t$%d, %%rsp\n", frame_size);
+	for (reg = 0; reg < NR_REGS; reg++) {
+		if (saved_regs[reg])
+			emit("\tmovq\t%%%s, %d(%%rbp)\n", reg_name(reg, 64), saved_regs[reg]);
+	}
+
+	PREPARE_PTR_LIST(fntype->arguments, type);
+	FOR_EACH_PTR(ep->entry->arg_list, arg) {
+		struct value *v = value_of(arg);
+		int fp = type && is_float_type(type);
+		int size = type ? type->bit_size : 64;
+		struct operand home;
+
+		if (size > 64 || (type && !fp && !is_int_type(type) && !is_ptr_type(type) && !is_enum_type(type)))
+			sparse_error(ep->name->pos, "structures or long double as arguments are not supported");
+		if (fp) {
+			if (nsse < NR_SSE_ARGS && v && v->end >= 0) {
+				home_operand(v, &home);
+				put_mnemonic(fp_move(size), 0);
+				put_xmm(nsse);
+				put_separator();
+				put_operand(&home, size);
+				put_newline();
+			}
+			nsse++;
+		} else {
+			if (nint < NR_INT_ARGS && v && v->end >= 0)
+				store_home(v, int_arg_regs[nint], size);
+			else if (nint >= NR_INT_ARGS && v && v->reg != NOREG)
+				emit("\tmovq\t%d(%%rbp), %%%s\n", 16 + 8 * (nint + nsse - NR_INT_ARGS), reg_name(v->reg, 64));
+			nint++;
+		}
+		NEXT_PTR_LIST(type);
+	} END_FOR_EACH_PTR(arg);
+	FINISH_PTR_LIST(type);
+}
+
+static void emit_function(struct symbol *sym, struct entrypoint *ep)
+{
+	const char *name = symbol_name(sym);
+	struct basic_block *bb, *prev = NULL;
+
+	cur_ep = ep;
+	unssa(ep);
+	clear_liveness(ep);
+	number_pseudos(ep);
+	track_pseudo_liveness(ep);
+
+	values = alloc_pseudo_table(ep, struct value);
+	number_instructions(ep);
+	select_patterns();
+	build_ranges(ep);
+	allocate_registers(ep);
+	layout_frame(ep);
+
+	emit("\t.text\n");
+	if (!is_static(sym))
+		emit("\t.globl\t%s\n", name);
+	emit("\t.type\t%s, @function\n", name);
+	emit("%s:\n", name);
+	emit_prologue(ep);
+	FOR_EACH_PTR(ep->bbs, bb) {
+		if (prev)
+			emit_block(prev, bb);
+		prev = bb;
+	} END_FOR_EACH_PTR(bb);
+	if (prev)
+		emit_block(prev, NULL);
+	emit("\t.size\t%s, .-%s\n", name, name);
+
+	free_pseudo_table(values);
+	free(insns);
+	free(clobbers);
+	free(frame_offsets);
+	values = NULL;
+	cur_ep = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Data
+
+// The initializer is laid out in a byte image, with the addresses
+// of the symbols as relocations.
+struct reloc {
+	unsigned long offset;
+	struct symbol *sym;
+	struct basic_block *label;	// or the address of a label
+	long long addend;
+};
+
+struct image {
+	unsigned char *bytes;
+	unsigned long size;
+	struct reloc *relocs;
+	int nr_relocs, max_relocs;
+};
+
+static int address_constant(struct expression *expr, struct symbol **sym, long long *addend)
+{
+	switch (expr->type) {
+	case EXPR_SYMBOL:
+		if (*sym || (expr->symbol->ctype.modifiers & MOD_TLS))
+			return 0;
+		*sym = expr->symbol;
+		return 1;
+	case EXPR_VALUE:
+		*addend += expr->value;
+		return 1;
+	case EXPR_CAST:
+	case EXPR_IMPLIED_CAST:
+	case EXPR_FORCE_CAST:
+		return address_constant(expr->cast_expression, sym, addend);
+	case EXPR_PREOP:
+		if (expr->op != '*' && expr->op != '&')
+			return 0;
+		return address_constant(expr->unop, sym, addend);
+	case EXPR_BINOP:
+		if (expr->op == '+')
+			return address_constant(expr->left, sym, addend) &&
+			       address_constant(expr->right, sym, addend);
+		if (expr->op == '-' && expr->right->type == EXPR_VALUE) {
+			*addend -= expr->right->value;
+			return address_constant(expr->left, sym, addend);
+		}
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+static void put_bits(struct image *img, unsigned long bit, int bits, unsigned long long val)
+{
+	int i;
+
+	if (bit / 8 + bits_to_bytes(bits) > img->size)
+		return;
+	if (!(bit % 8) && !(bits % 8)) {
+		for (i = 0; i < bits / 8; i++)
+			img->bytes[bit / 8 + i] = val >> (8 * i);
+		return;
+	}
+	for (i = 0; i < bits; i++, bit++) {
+		unsigned char mask = 1 << (bit % 8);
+
+		if ((val >> i) & 1)
+			img->bytes[bit / 8] |= mask;
+		else
+			img->bytes[bit / 8] &= ~mask;
+	}
+}
+
+static void add_reloc(struct image *img, unsigned long offset, struct symbol *sym, struct basic_block *label, long long addend)
+{
+	struct reloc *rel;
+
+	if (img->nr_relocs == img->max_relocs) {
+		img->max_relocs = img->max_relocs ? 2 * img->max_relocs : 8;
+		img->relocs = realloc(img->relocs, img->max_relocs * sizeof(struct reloc));
+		if (!img->relocs)
+			die("out of memory");
+	}
+	rel = &img->relocs[img->nr_relocs++];
+	rel->offset = offset;
+	rel->sym = sym;
+	rel->label = label;
+	rel->addend = addend;
+}
+
+static void put_string(struct image *img, struct string *string, unsigned long offset, unsigned long max)
+{
+	unsigned long len = string->length;
+
+	if (offset >= img->size)
+		return;
+	if (len > max)
+		len = max;
+	if (len > img->size - offset)
+		len = img->size - offset;
+	memcpy(img->bytes + offset, string->data, len);
+}
+
+// The string symbol of an array initialized by a string: *"..."
+static struct expression *array_string(struct expression *expr)
+{
+	struct symbol *sym;
+
+	if (expr->op != '*' || expr->unop->type != EXPR_SYMBOL)
+		return NULL;
+	sym = expr->unop->symbol;
+	if (!sym->initializer || sym->initializer->type != EXPR_STRING)
+		return NULL;
+	return sym->initializer;
+}
+
+static void fill_scalar(struct image *img, struct expression *expr, unsigned long offset)
+{
+	struct symbol *type = expr->ctype;
+	struct expression *string;
+	struct symbol *sym = NULL;
+	long long addend = 0;
+	int bits = type ? type->bit_size : 0;
+	union {
+		float f;
+		double d;
+		long double ld;
+		unsigned int i;
+		unsigned long long l;
+		unsigned char b[16];
+	} u;
+
+	switch (expr->type) {
+	case EXPR_VALUE:
+		put_bits(img, offset * 8 + type->bit_offset, bits, expr->value);
+		return;
+	case EXPR_FVALUE:
+		memset(&u, 0, sizeof(u));
+		if (bits == 32) {
+			u.f = expr->fvalue;
+			put_bits(img, offset * 8, 32, u.i);
+		} else if (bits == 64) {
+			u.d = expr->fvalue;
+			put_bits(img, offset * 8, 64, u.l);
+		} else if (offset + bits_to_bytes(bits) <= img->size) {
+			u.ld = expr->fvalue;
+			memcpy(img->bytes + offset, u.b, bits_to_bytes(bits) < 16 ? bits_to_bytes(bits) : 16);
+		}
+		return;
+	case EXPR_STRING:
+		put_string(img, expr->string, offset, img->size);
+		return;
+	case EXPR_PREOP:
+		string = array_string(expr);
+		if (string) {
+			put_string(img, string->string, offset, bits_to_bytes(bits));
+			return;
+		}
+		break;
+	case EXPR_LABEL:
+		add_reloc(img, offset, NULL, expr->label_symbol->bb_target, 0);
+		return;
+	default:
+		break;
+	}
+
+	if (!address_constant(expr, &sym, &addend) || !sym || bits != 64) {
+		sparse_error(expr->pos, "unsupported initializer");
+		return;
+	}
+	add_reloc(img, offset, sym, NULL, addend);
+}
+
+static void fill_initializer(struct image *img, struct expression *expr, unsigned long offset)
+{
+	struct expression *entry;
+
+	switch (expr->type) {
+	case EXPR_INITIALIZER:
+		FOR_EACH_PTR(expr->expr_list, entry) {
+			fill_initializer(img, entry, offset);
+		} END_FOR_EACH_PTR(entry);
+		return;
+	case EXPR_POS: {
+		unsigned long stride = bits_to_bytes(expr->ctype ? expr->ctype->bit_size : 0);
+		unsigned int i;
+
+		for (i = 0; i < expr->init_nr; i++)
+			fill_initializer(img, expr->init_expr, offset + expr->init_offset + i * stride);
+		return;
+	}
+	default:
+		fill_scalar(img, expr, offset);
+	}
+}
+
+static int reloc_cmp(const void *a, const void *b)
+{
+	const struct reloc *ra = a, *rb = b;
+
+	return ra->offset < rb->offset ? -1 : ra->offset > rb->offset;
+}
+
+static void emit_bytes(const unsigned char *bytes, unsigned long nr)
+{
+	unsigned long i;
+
+	emit("\t.byte\t");
+	for (i = 0; i < nr; i++)
+		emit(i ? ",%u" : "%u", bytes[i]);
+	emit("\n");
+}
+
+static void emit_image(struct image *img)
+{
+	unsigned long pos = 0;
+	int r = 0;
+
+	if (img->nr_relocs)
+		qsort(img->relocs, img->nr_relocs, sizeof(struct reloc), reloc_cmp);
+	while (pos < img->size) {
+		unsigned long end = r < img->nr_relocs ? img->relocs[r].offset : img->size;
+		unsigned long zeros = 0, n;
+
+		if (r < img->nr_relocs && pos == end) {
+			struct reloc *rel = &img->relocs[r++];
+
+			if (rel->label)
+				emit("\t.quad\t.L%d\n", rel->label->nr);
+			else if (rel->addend)
+				emit("\t.quad\t%s%+lld\n", symbol_name(rel->sym), rel->addend);
+			else
+				emit("\t.quad\t%s\n", symbol_name(rel->sym));
+			pos += 8;
+			continue;
+		}
+		while (pos + zeros < end && !img->bytes[pos + zeros])
+			zeros++;
+		if (zeros >= 8 || pos + zeros == end) {
+			if (zeros) {
+				emit("\t.zero\t%lu\n", zeros);
+				pos += zeros;
+				continue;
+			}
+		}
+		for (n = 0; n < 16 && pos + n < end; n++) {
+			if (n + 8 <= end - pos && !memcmp(img->bytes + pos + n, "\0\0\0\0\0\0\0\0", 8))
+				break;
+		}
+		if (!n)
+			n = 1;
+		emit_bytes(img->bytes + pos, n);
+		pos += n;
+	}
+}
+
+static void emit_data(struct symbol *sym)
+{
+	unsigned long modifiers = sym->ctype.modifiers;
+	const char *name = symbol_name(sym);
+	int align = sym->ctype.alignment;
+	struct image img = { };
+
+	if (sym->bit_size <= 0) {
+		sparse_error(sym->pos, "unknown size for '%s'", show_ident(sym->ident));
+		return;
+	}
+	if (modifiers & MOD_TLS) {
+		sparse_error(sym->pos, "thread-local variables are not supported");
+		return;
+	}
+	img.size = bits_to_bytes(sym->bit_size);
+	if (align < 1)
+		align = 1;
+
+	if (!sym->initializer) {
+		if (is_static(sym))
+			emit("\t.local\t%s\n", name);
+		emit("\t.comm\t%s,%lu,%d\n", name, img.size, align);
+		return;
+	}
+
+	img.bytes = calloc(img.size, 1);
+	if (!img.bytes)
+		die("out of memory");
+	fill_initializer(&img, sym->initializer, 0);
+
+	if ((sym->string || (modifiers & MOD_CONST)) && !img.nr_relocs)
+		emit("\t.section\t.rodata\n");
+	else
+		emit("\t.data\n");
+	if (!is_static(sym) && !(modifiers & MOD_EXTERN))
+		emit("\t.globl\t%s\n", name);
+	if (align > 1)
+		emit("\t.align\t%d\n", align);
+	emit("\t.type\t%s, @object\n", name);
+	emit("\t.size\t%s, %lu\n", name, img.size);
+	emit("%s:\n", name);
+	emit_image(&img);
+
+	free(img.bytes);
+	free(img.relocs);
+}
+
+static void emit_pending_data(void)
+{
+	int i;
+
+	// emitting them may add some more
+	for (i = 0; i < nr_pending; i++)
+		emit_data(pending_data[i]);
+	nr_pending = 0;
+}
+
+////////////////////////////////////////////////////////////////////////
+
+static void emit_symbol(struct symbol *sym)
+{
+	unsigned long modifiers = sym->ctype.modifiers;
+	struct symbol *base = sym->ctype.base_type;
+
+	if (sym->type != SYM_NODE || !base || (modifiers & MOD_TYPE))
+		return;
+	if (base->type == SYM_FN) {
+		struct entrypoint *ep;
+
+		if (!base->stmt)
+			return;
+		if ((modifiers & (MOD_EXTERN | MOD_INLINE)) == (MOD_EXTERN | MOD_INLINE))
+			return;
+		ep = linearize_symbol(sym);
+		if (ep) {
+			emit_function(sym, ep);
+			// the local statics may hold the addresses of its labels
+			emit_pending_data();
+			free_entrypoint(ep);
+		}
+	} else {
+		if ((modifiers & MOD_EXTERN) && !sym->initializer)
+			return;
+		if (!sym->ident)
+			return;
+		emit_data(sym);
+	}
+	emit_pending_data();
+}
+
+void x86_64_emit_symbol(struct symbol *sym)
+{
+	int had_error = die_if_error;
+
+	die_if_error = 0;
+	emit_symbol(sym);
+	// nothing of a symbol which couldn't be compiled
+	if (die_if_error)
+		out.len = 0;
+	die_if_error |= had_error;
+	outbuf_flush(&out, stdout);
+}
+
+void x86_64_emit_unit_begin(const char *basename)
+{
+	emit("\t.file\t\"%s\"\n", basename);
+	outbuf_flush(&out, stdout);
+}
+
+void x86_64_emit_unit_end(void)
+{
+	emit("\t.ident\t\"sparse x86-64 backend (version %s)\"\n", SPARSE_VERSION);
+	emit("\t.section\t.note.GNU-stack,\"\",@progbits\n");
+	outbuf_flush(&out, stdout);
+}
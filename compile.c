@@ -39,6 +39,7 @@
 #include "parse.h"
 #include "symbol.h"
 #include "expression.h"
+#include "target.h"
 #include "compile.h"
 
 static void clean_up_symbols(struct symbol_list *list)
@@ -47,7 +48,10 @@ static void clean_up_symbols(struct symbol_list *list)
 
 	FOR_EACH_PTR(list, sym) {
 		expand_symbol(sym);
-		emit_one_symbol(sym);
+		if (bits_in_pointer == 64)
+			x86_64_emit_symbol(sym);
+		else
+			emit_one_symbol(sym);
 	} END_FOR_EACH_PTR(sym);
 }
 
@@ -67,9 +71,15 @@ int main(int argc, char **argv)
 		list = sparse(file);
 
 		// Do type evaluation and simplification
-		emit_unit_begin(basename);
+		if (bits_in_pointer == 64)
+			x86_64_emit_unit_begin(basename);
+		else
+			emit_unit_begin(basename);
 		clean_up_symbols(list);
-		emit_unit_end();
+		if (bits_in_pointer == 64)
+			x86_64_emit_unit_end();
+		else
+			emit_unit_end();
 	} END_FOR_EACH_PTR_NOTAG(file);
 
 #if 0
@@ -82,5 +92,5 @@ int main(int argc, char **argv)
 	show_string_alloc();
 	show_bytes_alloc();
 #endif
-	return 0;
+	return die_if_error;
 }
@@ -7,4 +7,8 @@ extern void emit_one_symbol(struct symbol *);
 extern void emit_unit_begin(const char *);
 extern void emit_unit_end(void);
 
+extern void x86_64_emit_symbol(struct symbol *);
+extern void x86_64_emit_unit_begin(const char *);
+extern void x86_64_emit_unit_end(void);
+
 #endif /* COMPILE_H */
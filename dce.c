@@ -0,0 +1,133 @@
+// SPDX-License-Identifier: MIT
+//
+// dce.c - aggressive dead code elimination
+//
+// Instead of removing instructions one at a time when the
+// number of their users drops to zero, assume everything is
+// dead, mark as live what is needed by instructions with
+// side-effects and remove in one sweep everything else.
+// This also removes dead cycles, like phi-nodes only used
+// by themselves in loops.
+//
+// An instruction without side-effects is marked live by setting
+// the 'priv' field of the pseudo it defines.
+
+#include "linearize.h"
+#include "flow.h"
+#include "dce.h"
+
+static struct instruction_list *worklist;
+
+/*
+ * Does 'insn' need to be kept even if its result is unused?
+ */
+static int has_side_effects(struct instruction *insn)
+{
+	switch (insn->opcode) {
+	case OP_BINARY ... OP_BINARY_END:
+	case OP_FPCMP ... OP_FPCMP_END:
+	case OP_BINCMP ... OP_BINCMP_END:
+	case OP_NOT: case OP_NEG: case OP_FNEG:
+	case OP_SEL:
+	case OP_SETVAL:
+	case OP_SETFVAL:
+	case OP_SYMADDR:
+	case OP_PHI:
+	case OP_PHISOURCE:
+	case OP_CAST:
+	case OP_SCAST:
+	case OP_FPCAST:
+	case OP_PTRCAST:
+	case OP_SLICE:
+	case OP_COPY:
+		return 0;
+
+	case OP_LOAD:
+		return insn->type->ctype.modifiers & MOD_VOLATILE;
+
+	case OP_CALL:
+		/* a "pure" function can be removed too */
+		if (insn->func->type != PSEUDO_SYM)
+			return 1;
+		return !(insn->func->sym->ctype.modifiers & MOD_PURE);
+
+	default:
+		return 1;
+	}
+}
+
+static inline int is_live(struct instruction *insn)
+{
+	return insn->target && insn->target->priv;
+}
+
+static void mark_use(pseudo_t *pp)
+{
+	pseudo_t pseudo = *pp;
+	struct instruction *def;
+
+	if (!pseudo)
+		return;
+	if (pseudo->type != PSEUDO_REG && pseudo->type != PSEUDO_PHI)
+		return;
+	def = pseudo->def;
+	if (!def || !def->bb || has_side_effects(def))
+		return;
+	if (is_live(def))
+		return;
+	def->target->priv = def;
+	add_instruction(&worklist, def);
+}
+
+static void mark_live(struct entrypoint *ep)
+{
+	struct basic_block *bb;
+	struct instruction *insn;
+
+	FOR_EACH_PTR(ep->bbs, bb) {
+		FOR_EACH_PTR(bb->insns, insn) {
+			if (!insn->bb)
+				continue;
+			if (has_side_effects(insn))
+				for_each_use(insn, mark_use);
+		} END_FOR_EACH_PTR(insn);
+	} END_FOR_EACH_PTR(bb);
+
+	while ((insn = delete_ptr_list_last((struct ptr_list **)&worklist)))
+		for_each_use(insn, mark_use);
+}
+
+static void remove_dead_use(pseudo_t *pp)
+{
+	if (*pp)
+		remove_use(pp);
+}
+
+static int sweep(struct entrypoint *ep)
+{
+	struct basic_block *bb;
+	int changed = 0;
+
+	FOR_EACH_PTR(ep->bbs, bb) {
+		struct instruction *insn;
+
+		FOR_EACH_PTR(bb->insns, insn) {
+			if (!insn->bb || has_side_effects(insn))
+				continue;
+			if (is_live(insn)) {
+				insn->target->priv = NULL;
+				continue;
+			}
+			for_each_use(insn, remove_dead_use);
+			insn->bb = NULL;
+			changed = REPEAT_CSE;
+		} END_FOR_EACH_PTR(insn);
+	} END_FOR_EACH_PTR(bb);
+	return changed;
+}
+
+int dce(struct entrypoint *ep)
+{
+	mark_live(ep);
+	return sweep(ep);
+}
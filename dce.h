@@ -0,0 +1,9 @@
+#ifndef DCE_H
+#define DCE_H
+
+struct entrypoint;
+
+/* dce.c */
+int dce(struct entrypoint *ep);
+
+#endif
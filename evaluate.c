@@ -41,6 +41,7 @@
 #include "symbol.h"
 #include "target.h"
 #include "expression.h"
+#include "timer.h"
 
 struct symbol *current_fn;
 
@@ -3372,11 +3373,13 @@ void evaluate_symbol_list(struct symbol_list *list)
 {
 	struct symbol *sym;
 
+	timer_start(PASS__EVALUATE);
 	FOR_EACH_PTR(list, sym) {
 		has_error &= ~ERROR_CURR_PHASE;
 		evaluate_symbol(sym);
 		check_duplicates(sym);
 	} END_FOR_EACH_PTR(sym);
+	timer_stop(PASS__EVALUATE);
 }
 
 static struct symbol *evaluate_return_expression(struct statement *stmt)
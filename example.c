@@ -5,14 +5,18 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <limits.h>
 #include <assert.h>
 
 #include "symbol.h"
 #include "expression.h"
 #include "linearize.h"
 #include "flow.h"
+#include "liveness.h"
+#include "bitmap.h"
 #include "storage.h"
 #include "target.h"
+#include "outbuf.h"
 
 static const char *opcodes[] = {
 	[OP_BADOP] = "bad_op",
@@ -88,27 +92,17 @@ static const char *opcodes[] = {
 	[OP_CONTEXT] = "context",
 };
 
-static int last_reg, stack_offset;
+
+static int stack_offset;
 
 struct hardreg {
 	const char *name;
-	struct pseudo_list *contains;
-	unsigned busy:16,
-		 dead:8,
-		 used:1;
 };
 
-#define TAG_DEAD 1
-#define TAG_DIRTY 2
-
-/* Our "switch" generation is very very stupid. */
-#define SWITCH_REG (1)
-
-static void output_bb(struct basic_block *bb, unsigned long generation);
-
 /*
- * We only know about the caller-clobbered registers
- * right now.
+ * The registers we know about. %ecx is never allocated: it's kept
+ * as scratch register for the operands which must be in a register
+ * but have been spilled.
  */
 static struct hardreg hardregs[] = {
 	{ .name = "%eax" },
@@ -122,17 +116,39 @@ static struct hardreg hardregs[] = {
 	{ .name = "%esp" },
 };
 #define REGNO 6
+#define REG_EAX 0
+#define REG_EDX 1
+#define REG_SCRATCH 2
 #define REG_EBP 6
 #define REG_ESP 7
 
-struct bb_state {
-	struct position pos;
-	struct storage_hash_list *inputs;
-	struct storage_hash_list *outputs;
-	struct storage_hash_list *internal;
+/* The registers clobbered by a call, besides the scratch one */
+static const int call_clobbered[] = { REG_EAX, REG_EDX };
 
-	/* CC cache.. */
-	int cc_opcode, cc_dead;
+static inline int allocatable(int reg)
+{
+	return reg >= 0 && reg < REGNO && reg != REG_SCRATCH;
+}
+
+/*
+ * The number of loads & stores of the pseudos from & to the stack
+ * and of moves between registers added by the register allocation.
+ */
+static struct regalloc_stats {
+	unsigned long loads, stores, moves;
+} regalloc_stats;
+
+struct bb_state {
+	int pos;			/* position of the current instruction */
+	int pushed;			/* bytes pushed since the start of the function */
+	unsigned int busy;		/* registers used by the current instruction */
+	unsigned int scratch;		/* scratch registers in use */
+	int borrowed[REGNO], nr_borrowed;
+	struct instruction *next;	/* the next instruction */
+	struct basic_block *next_bb;	/* the next block in the output */
+
+	/* CC cache: the flags set for the instruction at cc_pos */
+	int cc_opcode, cc_pos;
 	pseudo_t cc_target;
 };
 
@@ -142,6 +158,7 @@ enum optype {
 	OP_VAL,
 	OP_MEM,
 	OP_ADDR,
+	OP_IMM,
 };
 
 struct operand {
@@ -150,7 +167,7 @@ struct operand {
 	union {
 		struct hardreg *reg;
 		long long value;
-		struct /* OP_MEM and OP_ADDR */ {
+		struct /* OP_MEM, OP_ADDR and OP_IMM */ {
 			unsigned int offset;
 			unsigned int scale;
 			struct symbol *sym;
@@ -162,7 +179,7 @@ struct operand {
 
 static const char *show_op(struct bb_state *state, struct operand *op)
 {
-	static char buf[256][4];
+	static char buf[4][256];
 	static int bufnr;
 	char *p, *ret;
 	int nr;
@@ -179,6 +196,9 @@ static const char *show_op(struct bb_state *state, struct operand *op)
 	case OP_VAL:
 		sprintf(p, "$%lld", op->value);
 		break;
+	case OP_IMM:
+		*p++ = '$';
+		/* Fall through */
 	case OP_MEM:
 	case OP_ADDR:
 		if (op->offset)
@@ -202,61 +222,40 @@ static const char *show_op(struct bb_state *state, struct operand *op)
 	return ret;
 }
 
-static struct storage_hash *find_storage_hash(pseudo_t pseudo, struct storage_hash_list *list)
-{
-	struct storage_hash *entry;
-	FOR_EACH_PTR(list, entry) {
-		if (entry->pseudo == pseudo)
-			return entry;
-	} END_FOR_EACH_PTR(entry);
-	return NULL;
-}
-
-static struct storage_hash *find_or_create_hash(pseudo_t pseudo, struct storage_hash_list **listp)
-{
-	struct storage_hash *entry;
-
-	entry = find_storage_hash(pseudo, *listp);
-	if (!entry) {
-		entry = alloc_storage_hash(alloc_storage());
-		entry->pseudo = pseudo;
-		add_ptr_list(listp, entry);
-	}
-	return entry;
-}
+/*
+ * The code of a function is built up in memory
+ * and written at once, when it's complete.
+ */
+static struct outbuf out;
 
-/* Eventually we should just build it up in memory */
 static void FORMAT_ATTR(2) output_line(struct bb_state *state, const char *fmt, ...)
 {
 	va_list args;
 
 	va_start(args, fmt);
-	vprintf(fmt, args);
+	outbuf_vprintf(&out, fmt, args);
 	va_end(args);
 }
 
 static void FORMAT_ATTR(2) output_label(struct bb_state *state, const char *fmt, ...)
 {
-	static char buffer[512];
 	va_list args;
 
 	va_start(args, fmt);
-	vsnprintf(buffer, sizeof(buffer), fmt, args);
+	outbuf_vprintf(&out, fmt, args);
 	va_end(args);
-
-	output_line(state, "%s:\n", buffer);
+	outbuf_write(&out, ":\n", 2);
 }
 
 static void FORMAT_ATTR(2) output_insn(struct bb_state *state, const char *fmt, ...)
 {
-	static char buffer[512];
 	va_list args;
 
+	outbuf_putc(&out, '\t');
 	va_start(args, fmt);
-	vsnprintf(buffer, sizeof(buffer), fmt, args);
+	outbuf_vprintf(&out, fmt, args);
 	va_end(args);
-
-	output_line(state, "\t%s\n", buffer);
+	outbuf_putc(&out, '\n');
 }
 
 #define output_insn(state, fmt, arg...) \
@@ -264,37 +263,15 @@ static void FORMAT_ATTR(2) output_insn(struct bb_state *state, const char *fmt,
 
 static void FORMAT_ATTR(2) output_comment(struct bb_state *state, const char *fmt, ...)
 {
-	static char buffer[512];
 	va_list args;
 
 	if (!verbose)
 		return;
+	outbuf_write(&out, "\t# ", 3);
 	va_start(args, fmt);
-	vsnprintf(buffer, sizeof(buffer), fmt, args);
+	outbuf_vprintf(&out, fmt, args);
 	va_end(args);
-
-	output_line(state, "\t# %s\n", buffer);
-}
-
-static const char *show_memop(struct storage *storage)
-{
-	static char buffer[1000];
-
-	if (!storage)
-		return "undef";
-	switch (storage->type) {
-	case REG_FRAME:
-		sprintf(buffer, "%d(FP)", storage->offset);
-		break;
-	case REG_STACK:
-		sprintf(buffer, "%d(SP)", storage->offset);
-		break;
-	case REG_REG:
-		return hardregs[storage->regno].name;
-	default:
-		return show_storage(storage);
-	}
-	return buffer;
+	outbuf_putc(&out, '\n');
 }
 
 static int alloc_stack_offset(int size)
@@ -304,443 +281,891 @@ static int alloc_stack_offset(int size)
 	return ret;
 }
 
-static void alloc_stack(struct bb_state *state, struct storage *storage)
+static int get_sym_frame_offset(struct bb_state *state, pseudo_t pseudo)
 {
-	storage->type = REG_STACK;
-	storage->offset = alloc_stack_offset(4);
+	int offset = pseudo->nr;
+	if (offset < 0) {
+		offset = alloc_stack_offset(4);
+		pseudo->nr = offset;
+	}
+	return offset;
 }
 
 /*
- * Can we re-generate the pseudo, so that we don't need to
- * flush it to memory? We can regenerate:
- *  - immediates and symbol addresses
- *  - pseudos we got as input in non-registers
- *  - pseudos we've already saved off earlier..
+ * Register allocation: a linear scan over the whole function, after
+ * "Linear Scan Register Allocation on SSA Form", C. Wimmer & M. Franz,
+ * CGO'10 (minus the SSA part, since it's done after unssa()):
+ *  - the blocks are put in reverse postorder and their instructions
+ *    numbered two by two: the operands of the instruction at 'pos'
+ *    are read at 'pos', its result is written at 'pos + 1';
+ *  - the liveness gives, for each pseudo, an interval: the ranges of
+ *    positions where its value is needed;
+ *  - the copies between two pseudos with disjoint intervals (like the
+ *    ones made by unssa() for the phi-nodes) are coalesced: both
+ *    pseudos then share the same interval, and thus the same place;
+ *  - the intervals are then taken by increasing start, each one
+ *    getting a register free until its end, or only up to where
+ *    the register is needed again, by a call or another interval:
+ *    the interval is then split there and its rest handled later.
+ *    If no register is free, the one of the active interval ending
+ *    last is taken, this one being spilled from there to the stack.
+ *  - finally, moves are added where an interval is split inside a
+ *    block and on the edges where a pseudo isn't at the same place
+ *    at the end of the parent and at the start of the child.
  */
-static int can_regenerate(struct bb_state *state, pseudo_t pseudo)
+struct range {
+	int from, to;			/* the positions [from, to) */
+};
+
+struct interval {
+	struct range *ranges;		/* in increasing order */
+	int nr, max;
+	int seq;
+	struct interval *parent;	/* the whole interval, before any split */
+	struct interval *prev, *next;	/* the parts of a split interval */
+	struct storage *storage;	/* where this part is */
+
+	/* Only valid for the parent */
+	pseudo_t pseudo;
+	struct interval *leader;	/* the interval it's coalesced into */
+	struct interval *hint;		/* prefer the register of this one */
+	int hint_reg;			/* .. or this one, -1 if none */
+	struct storage *slot;		/* the stack slot, once spilled */
+};
+
+DECLARE_PTR_LIST(interval_list, struct interval);
+
+static struct entrypoint *cur_ep;
+static struct interval **intervals;	/* by pseudo->id */
+static struct interval_list *all_intervals;
+static int nr_intervals;
+static struct interval fixed[REGNO];	/* where the registers are clobbered */
+
+static struct interval **unhandled;	/* a heap, by start */
+static int nr_unhandled, max_unhandled;
+static struct interval_list *active, *inactive;
+
+static void *grow_array(void *array, int *max, size_t size)
 {
-	struct storage_hash *in;
+	*max = *max ? 2 * *max : 16;
+	array = realloc(array, *max * size);
+	if (!array)
+		die("out of memory");
+	return array;
+}
 
-	switch (pseudo->type) {
-	case PSEUDO_VAL:
-	case PSEUDO_SYM:
-		return 1;
+static struct interval *new_interval(struct interval *parent)
+{
+	struct interval *it = calloc(1, sizeof(*it));
 
-	default:
-		in = find_storage_hash(pseudo, state->inputs);
-		if (in && in->storage->type != REG_REG)
-			return 1;
-		in = find_storage_hash(pseudo, state->internal);
-		if (in)
-			return 1;
+	if (!it)
+		die("out of memory");
+	it->parent = parent ? parent : it;
+	it->hint_reg = -1;
+	it->seq = nr_intervals++;
+	add_ptr_list(&all_intervals, it);
+	return it;
+}
+
+static struct interval *leader(struct interval *it)
+{
+	while (it->leader) {
+		if (it->leader->leader)
+			it->leader = it->leader->leader;
+		it = it->leader;
 	}
-	return 0;
+	return it;
 }
 
-static void flush_one_pseudo(struct bb_state *state, struct hardreg *hardreg, pseudo_t pseudo)
+static inline int interval_start(const struct interval *it)
 {
-	struct storage_hash *out;
-	struct storage *storage;
+	return it->ranges[0].from;
+}
 
-	if (can_regenerate(state, pseudo))
-		return;
+static inline int interval_end(struct interval *it)
+{
+	return it->ranges[it->nr - 1].to;
+}
+
+static inline int interval_reg(struct interval *it)
+{
+	return it->storage->regno;
+}
 
-	output_comment(state, "flushing %s from %s", show_pseudo(pseudo), hardreg->name);
-	out = find_storage_hash(pseudo, state->internal);
-	if (!out) {
-		out = find_storage_hash(pseudo, state->outputs);
-		if (!out)
-			out = find_or_create_hash(pseudo, &state->internal);
+static struct interval *pseudo_interval(pseudo_t pseudo)
+{
+	struct interval *it;
+
+	if (!pseudo || (pseudo->type != PSEUDO_REG && pseudo->type != PSEUDO_ARG))
+		return NULL;
+	if (!pseudo_numbered(cur_ep, pseudo))
+		return NULL;
+	it = intervals[pseudo->id];
+	if (!it) {
+		it = new_interval(NULL);
+		it->pseudo = pseudo;
+		intervals[pseudo->id] = it;
 	}
-	storage = out->storage;
-	switch (storage->type) {
-	default:
-		/*
-		 * Aieee - the next user wants it in a register, but we
-		 * need to flush it to memory in between. Which means that
-		 * we need to allocate an internal one, dammit..
-		 */
-		out = find_or_create_hash(pseudo, &state->internal);
-		storage = out->storage;
-		/* Fall through */
-	case REG_UDEF:
-		alloc_stack(state, storage);
-		/* Fall through */
-	case REG_STACK:
-		output_insn(state, "movl %s,%s", hardreg->name, show_memop(storage));
-		break;
+	return leader(it);
+}
+
+/*
+ * The intervals are built backward, so the ranges are added
+ * in decreasing order, then reversed by finish_ranges().
+ */
+static void add_range(struct interval *it, int from, int to)
+{
+	struct range *r = it->nr ? &it->ranges[it->nr - 1] : NULL;
+
+	if (r && to >= r->from) {
+		if (from < r->from)
+			r->from = from;
+		if (to > r->to)
+			r->to = to;
+		return;
 	}
+	if (it->nr == it->max)
+		it->ranges = grow_array(it->ranges, &it->max, sizeof(struct range));
+	it->ranges[it->nr].from = from;
+	it->ranges[it->nr].to = to;
+	it->nr++;
 }
 
-/* Flush a hardreg out to the storage it has.. */
-static void flush_reg(struct bb_state *state, struct hardreg *reg)
+/* A definition: the value isn't needed before */
+static void set_from(struct interval *it, int pos)
 {
-	pseudo_t pseudo;
+	struct range *r = it->nr ? &it->ranges[it->nr - 1] : NULL;
 
-	if (reg->busy)
-		output_comment(state, "reg %s flushed while busy is %d!", reg->name, reg->busy);
-	if (!reg->contains)
+	if (r && r->from <= pos && pos < r->to) {
+		r->from = pos;
 		return;
-	reg->dead = 0;
-	reg->used = 1;
-	FOR_EACH_PTR(reg->contains, pseudo) {
-		if (CURRENT_TAG(pseudo) & TAG_DEAD)
-			continue;
-		if (!(CURRENT_TAG(pseudo) & TAG_DIRTY))
-			continue;
-		flush_one_pseudo(state, reg, pseudo);
-	} END_FOR_EACH_PTR(pseudo);
-	free_ptr_list(&reg->contains);
+	}
+	add_range(it, pos, pos + 1);
 }
 
-static struct storage_hash *find_pseudo_storage(struct bb_state *state, pseudo_t pseudo, struct hardreg *reg)
+static void finish_ranges(struct interval *it)
 {
-	struct storage_hash *src;
+	int i, j;
 
-	src = find_storage_hash(pseudo, state->internal);
-	if (!src) {
-		src = find_storage_hash(pseudo, state->inputs);
-		if (!src) {
-			src = find_storage_hash(pseudo, state->outputs);
-			/* Undefined? Screw it! */
-			if (!src)
-				return NULL;
+	for (i = 0, j = it->nr - 1; i < j; i++, j--) {
+		struct range r = it->ranges[i];
+		it->ranges[i] = it->ranges[j];
+		it->ranges[j] = r;
+	}
+}
 
-			/*
-			 * If we found output storage, it had better be local stack
-			 * that we flushed to earlier..
-			 */
-			if (src->storage->type != REG_STACK)
-				return NULL;
-		}
+static int covers(struct interval *it, int pos)
+{
+	int lo = 0, hi = it->nr;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (pos < it->ranges[mid].from)
+			hi = mid;
+		else if (pos >= it->ranges[mid].to)
+			lo = mid + 1;
+		else
+			return 1;
 	}
+	return 0;
+}
 
-	/*
-	 * Incoming pseudo with out any pre-set storage allocation?
-	 * We can make up our own, and obviously prefer to get it
-	 * in the register we already selected (if it hasn't been
-	 * used yet).
-	 */
-	if (src->storage->type == REG_UDEF) {
-		if (reg && !reg->used) {
-			src->storage->type = REG_REG;
-			src->storage->regno = reg - hardregs;
-			return NULL;
-		}
-		alloc_stack(state, src->storage);
+/*
+ * The first position covered by both intervals, INT_MAX if none.
+ */
+static int next_intersection(struct interval *a, struct interval *b)
+{
+	int i = 0, j = 0, lo, hi;
+
+	if (!a->nr || !b->nr)
+		return INT_MAX;
+
+	// skip the ranges of 'a' ending before 'b'
+	lo = 0;
+	hi = a->nr;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (a->ranges[mid].to <= b->ranges[0].from)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	i = lo;
+
+	while (i < a->nr && j < b->nr) {
+		struct range *r = &a->ranges[i];
+		struct range *s = &b->ranges[j];
+		int from = r->from > s->from ? r->from : s->from;
+
+		if (from < r->to && from < s->to)
+			return from;
+		if (r->to <= s->to)
+			i++;
+		else
+			j++;
 	}
-	return src;
+	return INT_MAX;
 }
 
-static void mark_reg_dead(struct bb_state *state, pseudo_t pseudo, struct hardreg *reg)
+/*
+ * Split an interval at 'pos': the ranges after it go to a new part,
+ * linked after this one.
+ */
+static struct interval *split_interval(struct interval *it, int pos)
 {
-	pseudo_t p;
+	struct interval *child = new_interval(it->parent);
+	int i, n;
 
-	FOR_EACH_PTR(reg->contains, p) {
-		if (p != pseudo)
-			continue;
-		if (CURRENT_TAG(p) & TAG_DEAD)
-			continue;
-		output_comment(state, "marking pseudo %s in reg %s dead", show_pseudo(pseudo), reg->name);
-		TAG_CURRENT(p, TAG_DEAD);
-		reg->dead++;
-	} END_FOR_EACH_PTR(p);
+	for (i = 0; i < it->nr; i++) {
+		if (it->ranges[i].to > pos)
+			break;
+	}
+	n = it->nr - i;
+	child->max = n;
+	child->ranges = malloc(n * sizeof(struct range));
+	if (!child->ranges)
+		die("out of memory");
+	memcpy(child->ranges, it->ranges + i, n * sizeof(struct range));
+	child->nr = n;
+
+	it->nr = i;
+	if (child->ranges[0].from < pos) {
+		it->ranges[i].to = pos;
+		it->nr++;
+		child->ranges[0].from = pos;
+	}
+
+	child->prev = it;
+	child->next = it->next;
+	if (it->next)
+		it->next->prev = child;
+	it->next = child;
+	return child;
 }
 
-static void add_pseudo_reg(struct bb_state *state, pseudo_t pseudo, struct hardreg *reg)
+static int interval_before(struct interval *a, struct interval *b)
 {
-	output_comment(state, "added pseudo %s to reg %s", show_pseudo(pseudo), reg->name);
-	add_ptr_list_tag(&reg->contains, pseudo, TAG_DIRTY);
+	int sa = interval_start(a), sb = interval_start(b);
+
+	if (sa != sb)
+		return sa < sb;
+	return a->seq < b->seq;
 }
 
-static struct hardreg *preferred_reg(struct bb_state *state, pseudo_t target)
+static void push_unhandled(struct interval *it)
 {
-	struct storage_hash *dst;
+	int i;
+
+	if (nr_unhandled == max_unhandled)
+		unhandled = grow_array(unhandled, &max_unhandled, sizeof(*unhandled));
+	i = nr_unhandled++;
+	while (i > 0) {
+		int parent = (i - 1) / 2;
 
-	dst = find_storage_hash(target, state->outputs);
-	if (dst) {
-		struct storage *storage = dst->storage;
-		if (storage->type == REG_REG)
-			return hardregs + storage->regno;
+		if (!interval_before(it, unhandled[parent]))
+			break;
+		unhandled[i] = unhandled[parent];
+		i = parent;
 	}
-	return NULL;
+	unhandled[i] = it;
 }
 
-static struct hardreg *empty_reg(struct bb_state *state)
+static struct interval *pop_unhandled(void)
 {
-	int i;
-	struct hardreg *reg = hardregs;
+	struct interval *first = unhandled[0];
+	struct interval *last = unhandled[--nr_unhandled];
+	int i = 0;
 
-	for (i = 0; i < REGNO; i++, reg++) {
-		if (!reg->contains)
-			return reg;
+	for (;;) {
+		int child = 2 * i + 1;
+
+		if (child >= nr_unhandled)
+			break;
+		if (child + 1 < nr_unhandled && interval_before(unhandled[child + 1], unhandled[child]))
+			child++;
+		if (!interval_before(unhandled[child], last))
+			break;
+		unhandled[i] = unhandled[child];
+		i = child;
 	}
-	return NULL;
+	unhandled[i] = last;
+	return first;
 }
 
-static struct hardreg *target_reg(struct bb_state *state, pseudo_t pseudo, pseudo_t target)
+static struct storage *reg_storage(int reg)
 {
-	int i;
-	int unable_to_find_reg = 0;
-	struct hardreg *reg;
+	struct storage *storage = alloc_storage();
 
-	/* First, see if we have a preferred target register.. */
-	reg = preferred_reg(state, target);
-	if (reg && !reg->contains)
-		goto found;
+	storage->type = REG_REG;
+	storage->regno = reg;
+	return storage;
+}
 
-	reg = empty_reg(state);
-	if (reg)
-		goto found;
+static struct storage *spill_slot(struct interval *it)
+{
+	struct interval *parent = it->parent;
 
-	i = last_reg;
-	do {
-		i++;
-		if (i >= REGNO)
-			i = 0;
-		reg = hardregs + i;
-		if (!reg->busy) {
-			flush_reg(state, reg);
-			last_reg = i;
-			goto found;
-		}
-	} while (i != last_reg);
-	assert(unable_to_find_reg);
+	if (!parent->slot) {
+		struct storage *slot = alloc_storage();
 
-found:
-	add_pseudo_reg(state, pseudo, reg);
-	return reg;
+		slot->type = REG_STACK;
+		slot->offset = alloc_stack_offset(4);
+		parent->slot = slot;
+	}
+	return parent->slot;
 }
 
-static struct hardreg *find_in_reg(struct bb_state *state, pseudo_t pseudo)
+static inline int is_reg(struct storage *storage)
 {
-	int i;
-	struct hardreg *reg;
+	return storage && storage->type == REG_REG;
+}
 
-	for (i = 0; i < REGNO; i++) {
-		pseudo_t p;
-
-		reg = hardregs + i;
-		FOR_EACH_PTR(reg->contains, p) {
-			if (p == pseudo) {
-				last_reg = i;
-				output_comment(state, "found pseudo %s in reg %s (busy=%d)", show_pseudo(pseudo), reg->name, reg->busy);
-				return reg;
-			}
-		} END_FOR_EACH_PTR(p);
+static int preferred_reg(struct interval *cur)
+{
+	int pos = interval_start(cur);
+	struct interval *it;
+	int reg = -1;
+
+	// the rest of a split interval: stay where we were
+	if (cur->prev)
+		return is_reg(cur->prev->storage) ? interval_reg(cur->prev) : -1;
+	if (cur->hint_reg >= 0)
+		return cur->hint_reg;
+	if (!cur->hint || leader(cur->hint) == cur)
+		return -1;
+	for (it = leader(cur->hint); it; it = it->next) {
+		if (!it->nr || interval_start(it) >= pos)
+			break;
+		if (it->storage)
+			reg = is_reg(it->storage) ? interval_reg(it) : -1;
 	}
-	return NULL;
+	return reg;
 }
 
-static void flush_pseudo(struct bb_state *state, pseudo_t pseudo, struct storage *storage)
+/*
+ * Up to where can 'cur' have the register 'reg', which is free now?
+ */
+static int blocked_until(int reg, struct interval *cur)
 {
-	struct hardreg *reg = find_in_reg(state, pseudo);
+	int until = next_intersection(&fixed[reg], cur);
+	struct interval *it;
 
-	if (reg)
-		flush_reg(state, reg);
+	FOR_EACH_PTR(inactive, it) {
+		int next;
+
+		if (interval_reg(it) != reg)
+			continue;
+		next = next_intersection(it, cur);
+		if (next < until)
+			until = next;
+	} END_FOR_EACH_PTR(it);
+	return until;
 }
 
-static void flush_cc_cache_to_reg(struct bb_state *state, pseudo_t pseudo, struct hardreg *reg)
+/*
+ * No register is free at the start of 'cur': take the one of the
+ * active interval ending last, which is spilled from there, if it
+ * ends after 'cur'. Otherwise, spill 'cur' itself.
+ */
+static void spill_interval(struct interval *cur)
 {
-	int opcode = state->cc_opcode;
+	int pos = interval_start(cur), end = interval_end(cur);
+	int split = pos & ~1;
+	struct interval *it, *victim = NULL;
+	int victim_end = end, until = INT_MAX;
+	int reg;
+
+	FOR_EACH_PTR(active, it) {
+		int blocked;
+
+		if (interval_end(it) <= victim_end)
+			continue;
+		if (interval_start(it) >= split)
+			continue;
+		blocked = blocked_until(interval_reg(it), cur);
+		if ((blocked & ~1) <= pos)
+			continue;
+		victim = it;
+		victim_end = interval_end(it);
+		until = blocked;
+	} END_FOR_EACH_PTR(it);
+
+	if (!victim) {
+		cur->storage = spill_slot(cur);
+		return;
+	}
 
-	state->cc_opcode = 0;
-	state->cc_target = NULL;
-	output_insn(state, "%s %s", opcodes[opcode], reg->name);
+	reg = interval_reg(victim);
+	it = split_interval(victim, split);
+	it->storage = spill_slot(it);
+	delete_ptr_list_entry((struct ptr_list **)&active, victim, 1);
+
+	if (until < end)
+		push_unhandled(split_interval(cur, until & ~1));
+	cur->storage = reg_storage(reg);
+	add_ptr_list(&active, cur);
 }
 
-static void flush_cc_cache(struct bb_state *state)
+static void allocate_interval(struct interval *cur)
 {
-	pseudo_t pseudo = state->cc_target;
+	int pos = interval_start(cur), end = interval_end(cur);
+	int free_until[REGNO];
+	struct interval *it;
+	int reg, i;
 
-	if (pseudo) {
-		struct hardreg *dst;
+	FOR_EACH_PTR(active, it) {
+		if (interval_end(it) <= pos) {
+			DELETE_CURRENT_PTR(it);
+		} else if (!covers(it, pos)) {
+			DELETE_CURRENT_PTR(it);
+			add_ptr_list(&inactive, it);
+		}
+	} END_FOR_EACH_PTR(it);
+	PACK_PTR_LIST(&active);
+	FOR_EACH_PTR(inactive, it) {
+		if (interval_end(it) <= pos) {
+			DELETE_CURRENT_PTR(it);
+		} else if (covers(it, pos)) {
+			DELETE_CURRENT_PTR(it);
+			add_ptr_list(&active, it);
+		}
+	} END_FOR_EACH_PTR(it);
+	PACK_PTR_LIST(&inactive);
 
-		state->cc_target = NULL;
+	for (i = 0; i < REGNO; i++)
+		free_until[i] = allocatable(i) ? INT_MAX : 0;
+	FOR_EACH_PTR(active, it) {
+		free_until[interval_reg(it)] = 0;
+	} END_FOR_EACH_PTR(it);
+	FOR_EACH_PTR(inactive, it) {
+		int next;
+
+		reg = interval_reg(it);
+		if (!free_until[reg])
+			continue;
+		next = next_intersection(it, cur);
+		if (next < free_until[reg])
+			free_until[reg] = next;
+	} END_FOR_EACH_PTR(it);
+	for (i = 0; i < REGNO; i++) {
+		int next;
 
-		if (!state->cc_dead) {
-			dst = target_reg(state, pseudo, pseudo);
-			flush_cc_cache_to_reg(state, pseudo, dst);
+		if (!free_until[i])
+			continue;
+		next = next_intersection(&fixed[i], cur);
+		if (next < free_until[i])
+			free_until[i] = next;
+	}
+
+	reg = preferred_reg(cur);
+	if (!allocatable(reg) || free_until[reg] < end) {
+		reg = -1;
+		for (i = 0; i < REGNO; i++) {
+			if (!allocatable(i))
+				continue;
+			if (reg < 0 || free_until[i] > free_until[reg])
+				reg = i;
 		}
 	}
+
+	if (free_until[reg] < end) {
+		int split = free_until[reg] & ~1;
+
+		if (split <= pos) {
+			spill_interval(cur);
+			return;
+		}
+		push_unhandled(split_interval(cur, split));
+	}
+	cur->storage = reg_storage(reg);
+	add_ptr_list(&active, cur);
 }
 
-static void add_cc_cache(struct bb_state *state, int opcode, pseudo_t pseudo)
+static void linear_scan(void)
 {
-	assert(!state->cc_target);
-	state->cc_target = pseudo;
-	state->cc_opcode = opcode;
-	state->cc_dead = 0;
-	output_comment(state, "caching %s", opcodes[opcode]);
+	while (nr_unhandled)
+		allocate_interval(pop_unhandled());
+	free_ptr_list(&active);
+	free_ptr_list(&inactive);
 }
 
-/* Fill a hardreg with the pseudo it has */
-static struct hardreg *fill_reg(struct bb_state *state, struct hardreg *hardreg, pseudo_t pseudo)
+/*
+ * Where is the pseudo at this position? NULL if its value isn't
+ * needed there (or is undefined).
+ */
+static struct storage *location(pseudo_t pseudo, int pos)
 {
-	struct storage_hash *src;
-	struct instruction *def;
+	struct interval *it;
 
-	if (state->cc_target == pseudo) {
-		flush_cc_cache_to_reg(state, pseudo, hardreg);
-		return hardreg;
+	if (!pseudo || (pseudo->type != PSEUDO_REG && pseudo->type != PSEUDO_ARG))
+		return NULL;
+	if (!pseudo_numbered(cur_ep, pseudo) || !intervals[pseudo->id])
+		return NULL;
+	for (it = leader(intervals[pseudo->id]); it; it = it->next) {
+		if (covers(it, pos))
+			return it->storage;
 	}
+	return NULL;
+}
 
-	switch (pseudo->type) {
-	case PSEUDO_VAL:
-		output_insn(state, "movl $%lld,%s", pseudo->value, hardreg->name);
-		break;
-	case PSEUDO_SYM:
-		src = find_pseudo_storage(state, pseudo, NULL);
-		/* Static thing? */
-		if (!src) {
-			output_insn(state, "movl $<%s>,%s", show_pseudo(pseudo), hardreg->name);
-			break;
-		}
-		switch (src->storage->type) {
-		case REG_REG:
-			/* Aiaiaiaiaii! Need to flush it to temporary memory */
-			src = find_or_create_hash(pseudo, &state->internal);
-			/* Fall through */
-		default:
-			alloc_stack(state, src->storage);
-			/* Fall through */
-		case REG_STACK:
-		case REG_FRAME:
-			flush_pseudo(state, pseudo, src->storage);
-			output_insn(state, "leal %s,%s", show_memop(src->storage), hardreg->name);
-			break;
-		}
-		break;
-	case PSEUDO_ARG:
-	case PSEUDO_REG:
-		def = pseudo->def;
-		if (def && def->opcode == OP_SETVAL) {
-			output_insn(state, "movl $<%s>,%s", show_pseudo(def->target), hardreg->name);
-			break;
-		}
-		src = find_pseudo_storage(state, pseudo, hardreg);
-		if (!src)
-			break;
-		if (src->flags & TAG_DEAD)
-			mark_reg_dead(state, pseudo, hardreg);
-		output_insn(state, "mov.%d %s,%s", 32, show_memop(src->storage), hardreg->name);
-		break;
-	default:
-		output_insn(state, "reload %s from %s", hardreg->name, show_pseudo(pseudo));
-		break;
+static int same_storage(struct storage *a, struct storage *b)
+{
+	if (!a || !b)
+		return 0;
+	return a == b || (a->type == b->type && a->regno == b->regno);
+}
+
+/*
+ * The blocks, in reverse postorder, and where their instructions are.
+ */
+static struct basic_block **blocks;
+static int nr_blocks, max_blocks;
+static int *block_from, *block_to;
+
+/* The parts of the intervals split inside a block, by position */
+static struct interval **splits;
+static int nr_splits, max_splits;
+
+static inline int numbered_insn(struct instruction *insn)
+{
+	return insn->bb && insn->opcode != OP_DEATHNOTE;
+}
+
+static void postorder(struct basic_block *bb, unsigned long generation)
+{
+	struct basic_block *child;
+
+	bb->generation = generation;
+	FOR_EACH_PTR_REVERSE(bb->children, child) {
+		if (child->generation != generation)
+			postorder(child, generation);
+	} END_FOR_EACH_PTR_REVERSE(child);
+	if (nr_blocks == max_blocks)
+		blocks = grow_array(blocks, &max_blocks, sizeof(*blocks));
+	blocks[nr_blocks++] = bb;
+}
+
+static void order_blocks(struct entrypoint *ep)
+{
+	unsigned long generation = ++bb_generation;
+	struct basic_block *bb;
+	int i, j, pos;
+
+	nr_blocks = 0;
+	postorder(ep->entry->bb, generation);
+	for (i = 0, j = nr_blocks - 1; i < j; i++, j--) {
+		bb = blocks[i];
+		blocks[i] = blocks[j];
+		blocks[j] = bb;
+	}
+	// the unreachable blocks, if any, are put at the end
+	FOR_EACH_PTR(ep->bbs, bb) {
+		if (bb->generation == generation)
+			continue;
+		bb->generation = generation;
+		if (nr_blocks == max_blocks)
+			blocks = grow_array(blocks, &max_blocks, sizeof(*blocks));
+		blocks[nr_blocks++] = bb;
+	} END_FOR_EACH_PTR(bb);
+
+	block_from = calloc(nr_blocks + 1, sizeof(int));
+	block_to = calloc(nr_blocks + 1, sizeof(int));
+	if (!block_from || !block_to)
+		die("out of memory");
+	pos = 0;
+	for (i = 0; i < nr_blocks; i++) {
+		struct instruction *insn;
+
+		block_from[i] = pos;
+		FOR_EACH_PTR(blocks[i]->insns, insn) {
+			if (numbered_insn(insn))
+				pos += 2;
+		} END_FOR_EACH_PTR(insn);
+		block_to[i] = pos;
 	}
-	return hardreg;
 }
 
-static struct hardreg *getreg(struct bb_state *state, pseudo_t pseudo, pseudo_t target)
+static int build_from, build_pos;
+
+static void build_def(struct basic_block *bb, pseudo_t pseudo)
 {
-	struct hardreg *reg;
+	struct interval *it = pseudo_interval(pseudo);
 
-	reg = find_in_reg(state, pseudo);
-	if (reg)
-		return reg;
-	reg = target_reg(state, pseudo, target);
-	return fill_reg(state, reg, pseudo);
+	if (it)
+		set_from(it, build_pos + 1);
 }
 
-static void move_reg(struct bb_state *state, struct hardreg *src, struct hardreg *dst)
+static void build_use(struct basic_block *bb, pseudo_t pseudo)
 {
-	output_insn(state, "movl %s,%s", src->name, dst->name);
+	struct interval *it = pseudo_interval(pseudo);
+
+	if (it)
+		add_range(it, build_from, build_pos + 1);
 }
 
-static struct hardreg *copy_reg(struct bb_state *state, struct hardreg *src, pseudo_t target)
+static void ignore_pseudo(struct basic_block *bb, pseudo_t pseudo)
 {
-	int i;
-	struct hardreg *reg;
+}
 
-	/* If the container has been killed off, just re-use it */
-	if (!src->contains)
-		return src;
+static void build_intervals(struct entrypoint *ep)
+{
+	struct bitset *live = alloc_bitset(ep->nr_pseudos);
+	struct interval *it;
+	int i, r;
 
-	/* If "src" only has one user, and the contents are dead, we can re-use it */
-	if (src->busy == 1 && src->dead == 1)
-		return src;
+	for (i = nr_blocks - 1; i >= 0; i--) {
+		struct basic_block *bb = blocks[i], *child;
+		struct instruction *insn;
+		pseudo_t pseudo;
 
-	reg = preferred_reg(state, target);
-	if (reg && !reg->contains) {
-		output_comment(state, "copying %s to preferred target %s", show_pseudo(target), reg->name);
-		move_reg(state, src, reg);
-		return reg;
+		build_from = block_from[i];
+		build_pos = block_to[i];
+		if (build_from == build_pos)
+			continue;
+
+		bitset_zero(live);
+		FOR_EACH_PTR(bb->children, child) {
+			FOR_EACH_PTR(child->needs, pseudo) {
+				it = pseudo_interval(pseudo);
+				if (!it || bitset_test_and_set(live, pseudo->id))
+					continue;
+				add_range(it, build_from, build_pos);
+			} END_FOR_EACH_PTR(pseudo);
+		} END_FOR_EACH_PTR(child);
+
+		FOR_EACH_PTR_REVERSE(bb->insns, insn) {
+			if (!numbered_insn(insn))
+				continue;
+			build_pos -= 2;
+			track_instruction_usage(bb, insn, build_def, ignore_pseudo);
+			if (insn->opcode == OP_CALL) {
+				for (r = 0; r < ARRAY_SIZE(call_clobbered); r++)
+					add_range(&fixed[call_clobbered[r]], build_pos + 1, build_pos + 2);
+			}
+			track_instruction_usage(bb, insn, ignore_pseudo, build_use);
+		} END_FOR_EACH_PTR_REVERSE(insn);
 	}
+	free_bitset(live);
 
-	for (i = 0; i < REGNO; i++) {
-		reg = hardregs + i;
-		if (!reg->contains) {
-			output_comment(state, "copying %s to %s", show_pseudo(target), reg->name);
-			output_insn(state, "movl %s,%s", src->name, reg->name);
-			return reg;
+	FOR_EACH_PTR(all_intervals, it) {
+		finish_ranges(it);
+	} END_FOR_EACH_PTR(it);
+	for (r = 0; r < REGNO; r++)
+		finish_ranges(&fixed[r]);
+}
+
+/*
+ * Put the ranges of 'b' in 'a'; they mustn't intersect.
+ */
+static void merge_intervals(struct interval *a, struct interval *b)
+{
+	int max = a->nr + b->nr;
+	struct range *ranges = malloc(max * sizeof(*ranges));
+	int i = 0, j = 0, n = 0;
+
+	if (!ranges)
+		die("out of memory");
+	while (i < a->nr || j < b->nr) {
+		struct range r;
+
+		if (j >= b->nr || (i < a->nr && a->ranges[i].from < b->ranges[j].from))
+			r = a->ranges[i++];
+		else
+			r = b->ranges[j++];
+		if (n && ranges[n - 1].to >= r.from) {
+			if (r.to > ranges[n - 1].to)
+				ranges[n - 1].to = r.to;
+			continue;
 		}
+		ranges[n++] = r;
 	}
+	free(a->ranges);
+	a->ranges = ranges;
+	a->nr = n;
+	a->max = max;
+	free(b->ranges);
+	b->ranges = NULL;
+	b->nr = b->max = 0;
 
-	flush_reg(state, src);
-	return src;
+	b->leader = a;
+	if (a->hint_reg < 0)
+		a->hint_reg = b->hint_reg;
+	if (!a->hint)
+		a->hint = b->hint;
 }
 
-static void put_operand(struct bb_state *state, struct operand *op)
+/*
+ * Give the same interval to the source & the target of the copies
+ * when their values are never needed at the same time. Otherwise,
+ * at least try to have them in the same register.
+ */
+static void coalesce_copies(void)
 {
-	switch (op->type) {
-	case OP_REG:
-		op->reg->busy--;
-		break;
-	case OP_ADDR:
-	case OP_MEM:
-		if (op->base)
-			op->base->busy--;
-		if (op->index)
-			op->index->busy--;
-		break;
-	default:
-		break;
+	int i;
+
+	for (i = 0; i < nr_blocks; i++) {
+		struct instruction *insn;
+
+		FOR_EACH_PTR(blocks[i]->insns, insn) {
+			struct interval *a, *b;
+
+			if (!insn->bb || insn->opcode != OP_COPY)
+				continue;
+			a = pseudo_interval(insn->src);
+			b = pseudo_interval(insn->target);
+			if (!a || !b || a == b || !a->nr || !b->nr)
+				continue;
+			if (next_intersection(a, b) != INT_MAX) {
+				if (!b->hint)
+					b->hint = a;
+				continue;
+			}
+			merge_intervals(a, b);
+		} END_FOR_EACH_PTR(insn);
 	}
 }
 
-static struct operand *alloc_op(void)
+static int split_cmp(const void *a, const void *b)
 {
-	struct operand *op = malloc(sizeof(*op));
-	memset(op, 0, sizeof(*op));
-	return op;
+	const struct interval *x = *(const struct interval **)a;
+	const struct interval *y = *(const struct interval **)b;
+
+	if (interval_start(x) != interval_start(y))
+		return interval_start(x) < interval_start(y) ? -1 : 1;
+	return x->seq - y->seq;
 }
 
-static struct operand *get_register_operand(struct bb_state *state, pseudo_t pseudo, pseudo_t target)
+/*
+ * The parts needing a move from the previous one before the
+ * instruction where they start: the ones starting by an use,
+ * since at a definition nothing needs to be moved.
+ */
+static void collect_splits(void)
 {
-	struct operand *op = alloc_op();
-	op->type = OP_REG;
-	op->reg = getreg(state, pseudo, target);
-	op->reg->busy++;
-	return op;
+	struct interval *it;
+
+	nr_splits = 0;
+	FOR_EACH_PTR(all_intervals, it) {
+		if (!it->prev || !it->nr || (interval_start(it) & 1))
+			continue;
+		if (same_storage(it->prev->storage, it->storage))
+			continue;
+		if (nr_splits == max_splits)
+			splits = grow_array(splits, &max_splits, sizeof(*splits));
+		splits[nr_splits++] = it;
+	} END_FOR_EACH_PTR(it);
+	qsort(splits, nr_splits, sizeof(*splits), split_cmp);
 }
 
-static int get_sym_frame_offset(struct bb_state *state, pseudo_t pseudo)
+/*
+ * Record where the pseudos are on entry & on exit of each block.
+ * The incoming arguments are already set up by set_up_arch_entry().
+ */
+static void set_up_bb_storage(struct entrypoint *ep)
 {
-	int offset = pseudo->nr;
-	if (offset < 0) {
-		offset = alloc_stack_offset(4);
-		pseudo->nr = offset;
+	struct bitset *seen = alloc_bitset(ep->nr_pseudos);
+	int i;
+
+	for (i = 0; i < nr_blocks; i++) {
+		struct basic_block *bb = blocks[i], *child;
+		struct storage *storage;
+		pseudo_t pseudo;
+
+		if (block_from[i] == block_to[i])
+			continue;
+		if (bb != ep->entry->bb) {
+			FOR_EACH_PTR(bb->needs, pseudo) {
+				storage = location(pseudo, block_from[i]);
+				if (storage)
+					add_storage(storage, bb, pseudo, STOR_IN);
+			} END_FOR_EACH_PTR(pseudo);
+		}
+
+		bitset_zero(seen);
+		FOR_EACH_PTR(bb->children, child) {
+			FOR_EACH_PTR(child->needs, pseudo) {
+				storage = location(pseudo, block_to[i] - 1);
+				if (!storage || bitset_test_and_set(seen, pseudo->id))
+					continue;
+				add_storage(storage, bb, pseudo, STOR_OUT);
+			} END_FOR_EACH_PTR(pseudo);
+		} END_FOR_EACH_PTR(child);
 	}
-	return offset;
+	free_bitset(seen);
 }
 
-static struct operand *get_generic_operand(struct bb_state *state, pseudo_t pseudo)
+static void free_intervals(void)
 {
-	struct hardreg *reg;
-	struct storage *src;
-	struct storage_hash *hash;
-	struct operand *op = malloc(sizeof(*op));
+	struct interval *it;
+	int r;
 
+	FOR_EACH_PTR(all_intervals, it) {
+		free(it->ranges);
+		free(it);
+	} END_FOR_EACH_PTR(it);
+	free_ptr_list(&all_intervals);
+	nr_intervals = 0;
+	for (r = 0; r < REGNO; r++) {
+		free(fixed[r].ranges);
+		memset(&fixed[r], 0, sizeof(fixed[r]));
+	}
+	free_pseudo_table(intervals);
+	intervals = NULL;
+	free(block_from);
+	free(block_to);
+}
+
+/*
+ * Code generation.
+ */
+static void storage_operand(struct bb_state *state, struct storage *storage, struct operand *op)
+{
 	memset(op, 0, sizeof(*op));
+	if (!storage)
+		return;
+	switch (storage->type) {
+	case REG_REG:
+		op->type = OP_REG;
+		op->reg = hardregs + storage->regno;
+		break;
+	case REG_STACK:
+		op->type = OP_MEM;
+		op->base = hardregs + REG_ESP;
+		op->offset = storage->offset + state->pushed;
+		break;
+	case REG_FRAME:
+		op->type = OP_MEM;
+		op->base = hardregs + REG_EBP;
+		op->offset = storage->offset;
+		break;
+	default:
+		break;
+	}
+}
+
+static const char *show_storage_op(struct bb_state *state, struct storage *storage)
+{
+	struct operand op;
+
+	storage_operand(state, storage, &op);
+	return show_op(state, &op);
+}
+
+static void pseudo_operand(struct bb_state *state, pseudo_t pseudo, int pos, struct operand *op)
+{
+	struct symbol *sym;
+
 	switch (pseudo->type) {
 	case PSEUDO_VAL:
+		memset(op, 0, sizeof(*op));
 		op->type = OP_VAL;
 		op->value = pseudo->value;
 		break;
-
-	case PSEUDO_SYM: {
-		struct symbol *sym = pseudo->sym;
+	case PSEUDO_SYM:
+		memset(op, 0, sizeof(*op));
+		sym = pseudo->sym;
 		op->type = OP_ADDR;
 		if (sym->ctype.modifiers & MOD_NONLOCAL) {
 			op->sym = sym;
@@ -749,304 +1174,453 @@ static struct operand *get_generic_operand(struct bb_state *state, pseudo_t pseu
 		op->base = hardregs + REG_EBP;
 		op->offset = get_sym_frame_offset(state, pseudo);
 		break;
+	default:
+		storage_operand(state, location(pseudo, pos), op);
+		break;
 	}
+}
 
-	default:
-		reg = find_in_reg(state, pseudo);
-		if (reg) {
-			op->type = OP_REG;
-			op->reg = reg;
-			reg->busy++;
-			break;
-		}
-		hash = find_pseudo_storage(state, pseudo, NULL);
-		if (!hash)
-			break;
-		src = hash->storage;
-		switch (src->type) {
-		case REG_REG:
-			op->type = OP_REG;
-			op->reg = hardregs + src->regno;
-			op->reg->busy++;
-			break;
-		case REG_FRAME:
-			op->type = OP_MEM;
-			op->offset = src->offset;
-			op->base = hardregs + REG_EBP;
-			break;
-		case REG_STACK:
-			op->type = OP_MEM;
-			op->offset = src->offset;
-			op->base = hardregs + REG_ESP;
-			break;
-		default:
-			break;
-		}
+static int in_storage(struct bb_state *state, pseudo_t pseudo, struct storage *storage)
+{
+	return same_storage(location(pseudo, state->pos), storage);
+}
+
+/*
+ * The scratch registers: %ecx, then the registers not used by the
+ * instruction, saved on the stack for the time of the instruction.
+ */
+static int get_scratch(struct bb_state *state)
+{
+	int reg;
+
+	if (!(state->scratch & (1 << REG_SCRATCH))) {
+		state->scratch |= 1 << REG_SCRATCH;
+		return REG_SCRATCH;
+	}
+	for (reg = 0; reg < REGNO; reg++) {
+		if ((state->busy | state->scratch) & (1 << reg))
+			continue;
+		output_insn(state, "pushl %s", hardregs[reg].name);
+		state->pushed += 4;
+		state->scratch |= 1 << reg;
+		state->borrowed[state->nr_borrowed++] = reg;
+		return reg;
 	}
-	return op;
+	die("no scratch register left");
+	return REG_SCRATCH;
 }
 
-/* Callers should be made to use the proper "operand" formats */
-static const char *generic(struct bb_state *state, pseudo_t pseudo)
+static void put_scratch(struct bb_state *state)
 {
-	struct hardreg *reg;
-	struct operand *op = get_generic_operand(state, pseudo);
-	static char buf[100];
-	const char *str;
+	while (state->nr_borrowed) {
+		int reg = state->borrowed[--state->nr_borrowed];
 
-	switch (op->type) {
+		output_insn(state, "popl %s", hardregs[reg].name);
+		state->pushed -= 4;
+	}
+	state->scratch = 0;
+}
+
+static void emit_move(struct bb_state *state, struct storage *src, struct storage *dst)
+{
+	const char *s, *d;
+
+	if (!src || !dst || same_storage(src, dst))
+		return;
+	s = show_storage_op(state, src);
+	d = show_storage_op(state, dst);
+	if (is_reg(src) && is_reg(dst)) {
+		regalloc_stats.moves++;
+	} else if (is_reg(dst)) {
+		regalloc_stats.loads++;
+	} else if (is_reg(src)) {
+		regalloc_stats.stores++;
+	} else {
+		regalloc_stats.loads++;
+		regalloc_stats.stores++;
+		output_insn(state, "pushl %s", s);
+		output_insn(state, "popl %s", d);
+		return;
+	}
+	output_insn(state, "movl %s,%s", s, d);
+}
+
+/* Copy the value of a pseudo in a register */
+static void load_reg(struct bb_state *state, pseudo_t pseudo, int reg)
+{
+	struct operand op;
+
+	pseudo_operand(state, pseudo, state->pos, &op);
+	switch (op.type) {
+	case OP_UNDEF:
+		return;
+	case OP_REG:
+		if (op.reg == hardregs + reg)
+			return;
+		regalloc_stats.moves++;
+		break;
+	case OP_MEM:
+		regalloc_stats.loads++;
+		break;
 	case OP_ADDR:
-		if (!op->offset && op->base && !op->sym)
-			return op->base->name;
-		if (op->sym && !op->base) {
-			int len = sprintf(buf, "$ %s", show_op(state, op));
-			if (op->offset)
-				sprintf(buf + len, " + %d", op->offset);
-			return buf;
+		if (op.base) {
+			output_insn(state, "leal %s,%s", show_op(state, &op), hardregs[reg].name);
+			return;
 		}
-		str = show_op(state, op);
-		put_operand(state, op);
-		reg = target_reg(state, pseudo, NULL);
-		output_insn(state, "lea %s,%s", show_op(state, op), reg->name);
-		return reg->name;		
-
+		op.type = OP_IMM;
+		break;
 	default:
-		str = show_op(state, op);
+		break;
 	}
-	put_operand(state, op);
-	return str;
+	output_insn(state, "movl %s,%s", show_op(state, &op), hardregs[reg].name);
 }
 
-static struct operand *get_address_operand(struct bb_state *state, struct instruction *memop)
+static void store_reg(struct bb_state *state, int reg, struct storage *dst)
 {
-	struct hardreg *base;
-	struct operand *op = get_generic_operand(state, memop->src);
+	if (!dst)
+		return;
+	if (is_reg(dst) && dst->regno == reg)
+		return;
+	if (is_reg(dst))
+		regalloc_stats.moves++;
+	else
+		regalloc_stats.stores++;
+	output_insn(state, "movl %s,%s", hardregs[reg].name, show_storage_op(state, dst));
+}
 
-	switch (op->type) {
+/*
+ * The value of a pseudo as source operand: an immediate, a register
+ * or a stack slot. The address of a local symbol is first computed
+ * in a scratch register.
+ */
+static const char *src_operand(struct bb_state *state, pseudo_t pseudo)
+{
+	struct operand op;
+	int reg;
+
+	pseudo_operand(state, pseudo, state->pos, &op);
+	switch (op.type) {
 	case OP_ADDR:
-		op->offset += memop->offset;
+		if (!op.base) {
+			op.type = OP_IMM;
+			break;
+		}
+		reg = get_scratch(state);
+		output_insn(state, "leal %s,%s", show_op(state, &op), hardregs[reg].name);
+		return hardregs[reg].name;
+	case OP_MEM:
+		regalloc_stats.loads++;
 		break;
 	default:
-		put_operand(state, op);
-		base = getreg(state, memop->src, NULL);
-		op->type = OP_ADDR;
-		op->base = base;
-		base->busy++;
-		op->offset = memop->offset;
-		op->sym = NULL;
+		break;
 	}
-	return op;
+	return show_op(state, &op);
 }
 
-static const char *address(struct bb_state *state, struct instruction *memop)
+/* The value of a pseudo in a register, loaded in a scratch one if needed */
+static struct hardreg *reg_operand(struct bb_state *state, pseudo_t pseudo)
 {
-	struct operand *op = get_address_operand(state, memop);
-	const char *str = show_op(state, op);
-	put_operand(state, op);
-	return str;
+	struct operand op;
+	int reg;
+
+	pseudo_operand(state, pseudo, state->pos, &op);
+	if (op.type == OP_REG)
+		return op.reg;
+	reg = get_scratch(state);
+	load_reg(state, pseudo, reg);
+	return hardregs + reg;
 }
 
+/* .. or an immediate */
 static const char *reg_or_imm(struct bb_state *state, pseudo_t pseudo)
 {
-	switch(pseudo->type) {
+	switch (pseudo->type) {
 	case PSEUDO_VAL:
 		return show_pseudo(pseudo);
 	default:
-		return getreg(state, pseudo, NULL)->name;
+		return reg_operand(state, pseudo)->name;
 	}
 }
 
-static void kill_dead_reg(struct hardreg *reg)
+/* Move the value of a pseudo to some storage */
+static void move_pseudo(struct bb_state *state, pseudo_t src, struct storage *dst)
 {
-	if (reg->dead) {
-		pseudo_t p;
-		
-		FOR_EACH_PTR(reg->contains, p) {
-			if (CURRENT_TAG(p) & TAG_DEAD) {
-				DELETE_CURRENT_PTR(p);
-				reg->dead--;
+	struct operand op;
+	int reg;
+
+	if (!dst)
+		return;
+	pseudo_operand(state, src, state->pos, &op);
+	switch (op.type) {
+	case OP_UNDEF:
+		return;
+	case OP_REG:
+	case OP_MEM:
+		emit_move(state, location(src, state->pos), dst);
+		return;
+	case OP_ADDR:
+		if (!op.base)
+			break;
+		reg = is_reg(dst) ? dst->regno : get_scratch(state);
+		load_reg(state, src, reg);
+		store_reg(state, reg, dst);
+		return;
+	default:
+		break;
+	}
+	if (!is_reg(dst))
+		regalloc_stats.stores++;
+	output_insn(state, "movl %s,%s", src_operand(state, src), show_storage_op(state, dst));
+}
+
+/*
+ * The register where to compute the result of an instruction: its
+ * target's one if it has one, otherwise a scratch one.
+ */
+static int result_reg(struct bb_state *state, struct storage *dst)
+{
+	if (is_reg(dst))
+		return dst->regno;
+	return get_scratch(state);
+}
+
+static struct move_list {
+	struct {
+		struct storage *src, *dst;
+	} *moves;
+	int nr, max;
+} edge_moves, split_moves;
+
+static void add_move(struct move_list *list, struct storage *src, struct storage *dst)
+{
+	int i;
+
+	if (!src || !dst || same_storage(src, dst))
+		return;
+	// the pseudos coalesced together have the same moves
+	for (i = 0; i < list->nr; i++) {
+		if (same_storage(list->moves[i].dst, dst))
+			return;
+	}
+	if (list->nr == list->max)
+		list->moves = grow_array(list->moves, &list->max, sizeof(*list->moves));
+	list->moves[list->nr].src = src;
+	list->moves[list->nr].dst = dst;
+	list->nr++;
+}
+
+static int is_move_source(struct move_list *list, struct storage *storage)
+{
+	int i;
+
+	for (i = 0; i < list->nr; i++) {
+		if (same_storage(list->moves[i].src, storage))
+			return 1;
+	}
+	return 0;
+}
+
+static struct storage scratch_storage = { .type = REG_REG, .regno = REG_SCRATCH };
+
+/*
+ * Do all the moves, as if at once: a move is only done once its
+ * destination isn't needed anymore as source; the cycles are
+ * broken with the scratch register.
+ */
+static void emit_moves(struct bb_state *state, struct move_list *list)
+{
+	while (list->nr) {
+		int i, done = 0;
+
+		for (i = 0; i < list->nr; ) {
+			if (is_move_source(list, list->moves[i].dst)) {
+				i++;
+				continue;
+			}
+			emit_move(state, list->moves[i].src, list->moves[i].dst);
+			list->moves[i] = list->moves[--list->nr];
+			done = 1;
+		}
+		if (!done) {
+			struct storage *src = list->moves[0].src;
+
+			emit_move(state, src, &scratch_storage);
+			for (i = 0; i < list->nr; i++) {
+				if (same_storage(list->moves[i].src, src))
+					list->moves[i].src = &scratch_storage;
 			}
-		} END_FOR_EACH_PTR(p);
-		PACK_PTR_LIST(&reg->contains);
-		assert(!reg->dead);
+		}
 	}
 }
 
-static struct hardreg *target_copy_reg(struct bb_state *state, struct hardreg *src, pseudo_t target)
+/* The moves on the edge from 'bb' to 'child' */
+static int set_up_edge_moves(struct basic_block *bb, struct basic_block *child)
 {
-	kill_dead_reg(src);
-	return copy_reg(state, src, target);
+	pseudo_t pseudo;
+
+	edge_moves.nr = 0;
+	FOR_EACH_PTR(child->needs, pseudo) {
+		struct storage *out = lookup_storage(bb, pseudo, STOR_OUT);
+		struct storage *in = lookup_storage(child, pseudo, STOR_IN);
+
+		add_move(&edge_moves, out, in);
+	} END_FOR_EACH_PTR(pseudo);
+	return edge_moves.nr;
 }
 
 static void do_binop(struct bb_state *state, struct instruction *insn, pseudo_t val1, pseudo_t val2)
 {
 	const char *op = opcodes[insn->opcode];
-	struct operand *src = get_register_operand(state, val1, insn->target);
-	struct operand *src2 = get_generic_operand(state, val2);
-	struct hardreg *dst;
+	struct storage *dst = location(insn->target, state->pos + 1);
+	int reg;
 
-	dst = target_copy_reg(state, src->reg, insn->target);
-	output_insn(state, "%s.%d %s,%s", op, insn->size, show_op(state, src2), dst->name);
-	put_operand(state, src);
-	put_operand(state, src2);
-	add_pseudo_reg(state, insn->target, dst);
+	// two-address code: don't overwrite the second source
+	if (is_reg(dst) && (val1 == val2 || !in_storage(state, val2, dst)))
+		reg = dst->regno;
+	else
+		reg = get_scratch(state);
+	load_reg(state, val1, reg);
+	output_insn(state, "%s.%d %s,%s", op, insn->size, src_operand(state, val2), hardregs[reg].name);
+	store_reg(state, reg, dst);
 }
 
 static void generate_binop(struct bb_state *state, struct instruction *insn)
 {
-	flush_cc_cache(state);
 	do_binop(state, insn, insn->src1, insn->src2);
 }
 
-static int is_dead_reg(struct bb_state *state, pseudo_t pseudo, struct hardreg *reg)
-{
-	pseudo_t p;
-	FOR_EACH_PTR(reg->contains, p) {
-		if (p == pseudo)
-			return CURRENT_TAG(p) & TAG_DEAD;
-	} END_FOR_EACH_PTR(p);
-	return 0;
-}
-
 /*
  * Commutative binops are much more flexible, since we can switch the
- * sources around to satisfy the target register, or to avoid having
- * to load one of them into a register..
+ * sources around to have the first one already in the target register.
  */
 static void generate_commutative_binop(struct bb_state *state, struct instruction *insn)
 {
-	pseudo_t src1, src2;
-	struct hardreg *reg1, *reg2;
-
-	flush_cc_cache(state);
-	src1 = insn->src1;
-	src2 = insn->src2;
-	reg2 = find_in_reg(state, src2);
-	if (!reg2)
-		goto dont_switch;
-	reg1 = find_in_reg(state, src1);
-	if (!reg1)
-		goto do_switch;
-	if (!is_dead_reg(state, src2, reg2))
-		goto dont_switch;
-	if (!is_dead_reg(state, src1, reg1))
-		goto do_switch;
-
-	/* Both are dead. Is one preferable? */
-	if (reg2 != preferred_reg(state, insn->target))
-		goto dont_switch;
-
-do_switch:
-	src1 = src2;
-	src2 = insn->src1;
-dont_switch:
+	struct storage *dst = location(insn->target, state->pos + 1);
+	pseudo_t src1 = insn->src1;
+	pseudo_t src2 = insn->src2;
+
+	if (in_storage(state, src2, dst) && !in_storage(state, src1, dst)) {
+		src1 = src2;
+		src2 = insn->src1;
+	}
 	do_binop(state, insn, src1, src2);
 }
 
-/*
- * This marks a pseudo dead. It still stays on the hardreg list (the hardreg
- * still has its value), but it's scheduled to be killed after the next
- * "sequence point" when we call "kill_read_pseudos()"
- */
-static void mark_pseudo_dead(struct bb_state *state, pseudo_t pseudo)
+static void generate_unop(struct bb_state *state, struct instruction *insn)
 {
-	int i;
-	struct storage_hash *src;
+	struct storage *dst = location(insn->target, state->pos + 1);
+	int reg = result_reg(state, dst);
 
-	if (state->cc_target == pseudo)
-		state->cc_dead = 1;
-	src = find_pseudo_storage(state, pseudo, NULL);
-	if (src)
-		src->flags |= TAG_DEAD;
-	for (i = 0; i < REGNO; i++)
-		mark_reg_dead(state, pseudo, hardregs + i);
+	load_reg(state, insn->src1, reg);
+	output_insn(state, "%s.%d %s", opcodes[insn->opcode], insn->size, hardregs[reg].name);
+	store_reg(state, reg, dst);
 }
 
-static void kill_dead_pseudos(struct bb_state *state)
+/*
+ * The address of a memory access, with its base in a register.
+ */
+static void address_operand(struct bb_state *state, struct instruction *memop, struct operand *op)
 {
-	int i;
+	struct hardreg *base;
+	long long value;
 
-	for (i = 0; i < REGNO; i++) {
-		kill_dead_reg(hardregs + i);
+	pseudo_operand(state, memop->src, state->pos, op);
+	switch (op->type) {
+	case OP_ADDR:
+		break;
+	case OP_VAL:
+		value = op->value;
+		memset(op, 0, sizeof(*op));
+		op->type = OP_MEM;
+		op->offset = value;
+		break;
+	default:
+		base = reg_operand(state, memop->src);
+		memset(op, 0, sizeof(*op));
+		op->type = OP_MEM;
+		op->base = base;
+		break;
 	}
+	op->offset += memop->offset;
 }
 
 static void generate_store(struct instruction *insn, struct bb_state *state)
 {
-	output_insn(state, "mov.%d %s,%s", insn->size, reg_or_imm(state, insn->target), address(state, insn));
+	struct operand addr;
+	const char *value;
+
+	address_operand(state, insn, &addr);
+	value = reg_or_imm(state, insn->target);
+	output_insn(state, "mov.%d %s,%s", insn->size, value, show_op(state, &addr));
 }
 
 static void generate_load(struct instruction *insn, struct bb_state *state)
 {
-	const char *input = address(state, insn);
-	struct hardreg *dst;
+	struct storage *dst = location(insn->target, state->pos + 1);
+	struct operand addr;
+	int reg;
 
-	kill_dead_pseudos(state);
-	dst = target_reg(state, insn->target, NULL);
-	output_insn(state, "mov.%d %s,%s", insn->size, input, dst->name);
+	address_operand(state, insn, &addr);
+	if (is_reg(dst))
+		reg = dst->regno;
+	else if (addr.base == hardregs + REG_SCRATCH)
+		reg = REG_SCRATCH;
+	else
+		reg = get_scratch(state);
+	output_insn(state, "mov.%d %s,%s", insn->size, show_op(state, &addr), hardregs[reg].name);
+	store_reg(state, reg, dst);
 }
 
-static void kill_pseudo(struct bb_state *state, pseudo_t pseudo)
+static void generate_copy(struct bb_state *state, struct instruction *insn)
 {
-	int i;
-	struct hardreg *reg;
+	move_pseudo(state, insn->src, location(insn->target, state->pos + 1));
+}
 
-	output_comment(state, "killing pseudo %s", show_pseudo(pseudo));
-	for (i = 0; i < REGNO; i++) {
-		pseudo_t p;
+static void generate_setval(struct bb_state *state, struct instruction *insn)
+{
+	struct storage *dst = location(insn->target, state->pos + 1);
 
-		reg = hardregs + i;
-		FOR_EACH_PTR(reg->contains, p) {
-			if (p != pseudo)
-				continue;
-			if (CURRENT_TAG(p) & TAG_DEAD)
-				reg->dead--;
-			output_comment(state, "removing pseudo %s from reg %s", 
-				show_pseudo(pseudo), reg->name);
-			DELETE_CURRENT_PTR(p);
-		} END_FOR_EACH_PTR(p);
-		PACK_PTR_LIST(&reg->contains);
-	}
+	if (!dst)
+		return;
+	if (!is_reg(dst))
+		regalloc_stats.stores++;
+	output_insn(state, "movl $<%s>,%s", show_pseudo(insn->target), show_storage_op(state, dst));
 }
 
-static void generate_copy(struct bb_state *state, struct instruction *insn)
+static void generate_symaddr(struct bb_state *state, struct instruction *insn)
 {
-	struct hardreg *src = getreg(state, insn->src, insn->target);
-	kill_pseudo(state, insn->target);
-	add_pseudo_reg(state, insn->target, src);
+	move_pseudo(state, insn->symbol, location(insn->target, state->pos + 1));
 }
 
 static void generate_cast(struct bb_state *state, struct instruction *insn)
 {
-	struct hardreg *src = getreg(state, insn->src, insn->target);
-	struct hardreg *dst;
+	struct storage *dst = location(insn->target, state->pos + 1);
 	unsigned int old = insn->orig_type ? insn->orig_type->bit_size : 0;
 	unsigned int new = insn->size;
+	int reg;
 
 	/*
 	 * Cast to smaller type? Ignore the high bits, we
-	 * just keep both pseudos in the same register.
+	 * just copy the value.
 	 */
 	if (old >= new) {
-		add_pseudo_reg(state, insn->target, src);
+		move_pseudo(state, insn->src, dst);
 		return;
 	}
 
-	dst = target_copy_reg(state, src, insn->target);
-
+	reg = result_reg(state, dst);
+	load_reg(state, insn->src, reg);
 	if (insn->orig_type && (insn->orig_type->ctype.modifiers & MOD_SIGNED)) {
-		output_insn(state, "sext.%d.%d %s", old, new, dst->name);
+		output_insn(state, "sext.%d.%d %s", old, new, hardregs[reg].name);
 	} else {
 		unsigned long long mask;
 		mask = ~(~0ULL << old);
 		mask &= ~(~0ULL << new);
-		output_insn(state, "andl.%d $%#llx,%s", insn->size, mask, dst->name);
+		output_insn(state, "andl.%d $%#llx,%s", insn->size, mask, hardregs[reg].name);
 	}
-	add_pseudo_reg(state, insn->target, dst);
+	store_reg(state, reg, dst);
 }
 
-static void generate_output_storage(struct bb_state *state);
-
 static const char *conditional[] = {
 	[OP_SET_EQ] = "e",
 	[OP_SET_NE] = "ne",
@@ -1059,49 +1633,127 @@ static const char *conditional[] = {
 	[OP_SET_BE] = "be",
 	[OP_SET_AE] = "ae"
 };
-	
+
+/*
+ * Is the result of a compare only used by the next instruction,
+ * to branch or to select? Then only the flags need to be set.
+ */
+static int cc_only(struct bb_state *state, struct instruction *insn)
+{
+	struct instruction *next = state->next;
+	pseudo_t target = insn->target;
+
+	if (!next || ptr_list_size((struct ptr_list *)target->users) != 1)
+		return 0;
+	if (next->opcode == OP_CBR)
+		return next->cond == target;
+	if (next->opcode == OP_SEL)
+		return next->src1 == target && next->src2 != target && next->src3 != target;
+	return 0;
+}
+
+static void generate_compare(struct bb_state *state, struct instruction *insn)
+{
+	struct storage *dst;
+	struct operand op1, op2;
+	const char *src1, *src2;
+	int reg;
+
+	/*
+	 * We should try to switch these around if necessary,
+	 * and update the opcode to match..
+	 */
+	pseudo_operand(state, insn->src1, state->pos, &op1);
+	pseudo_operand(state, insn->src2, state->pos, &op2);
+	if (op1.type == OP_REG || (op1.type == OP_MEM && op2.type != OP_MEM)) {
+		if (op1.type == OP_MEM)
+			regalloc_stats.loads++;
+		src1 = show_op(state, &op1);
+	} else {
+		src1 = reg_operand(state, insn->src1)->name;
+	}
+	src2 = src_operand(state, insn->src2);
+	output_insn(state, "cmp.%d %s,%s", insn->size, src2, src1);
+
+	if (cc_only(state, insn)) {
+		state->cc_target = insn->target;
+		state->cc_opcode = insn->opcode;
+		state->cc_pos = state->pos + 2;
+		return;
+	}
+	put_scratch(state);
+	dst = location(insn->target, state->pos + 1);
+	reg = result_reg(state, dst);
+	output_insn(state, "%s %s", opcodes[insn->opcode], hardregs[reg].name);
+	store_reg(state, reg, dst);
+}
+
+/* Set the flags for a condition, return the condition code to test */
+static const char *test_cond(struct bb_state *state, pseudo_t cond)
+{
+	struct operand op;
+
+	if (state->cc_target == cond && state->cc_pos == state->pos)
+		return conditional[state->cc_opcode];
+	pseudo_operand(state, cond, state->pos, &op);
+	switch (op.type) {
+	case OP_REG:
+		output_insn(state, "testl %s,%s", op.reg->name, op.reg->name);
+		break;
+	case OP_MEM:
+		regalloc_stats.loads++;
+		output_insn(state, "cmpl $0,%s", show_op(state, &op));
+		break;
+	default: {
+		struct hardreg *reg = reg_operand(state, cond);
+		output_insn(state, "testl %s,%s", reg->name, reg->name);
+	}
+	}
+	return "ne";
+}
 
 static void generate_branch(struct bb_state *state, struct instruction *br)
 {
-	const char *cond = "XXX";
-	struct basic_block *target;
+	struct basic_block *target = br->bb_true;
 
 	if (br->cond) {
-		if (state->cc_target == br->cond) {
-			cond = conditional[state->cc_opcode];
+		const char *cond = test_cond(state, br->cond);
+
+		if (set_up_edge_moves(br->bb, br->bb_true)) {
+			output_insn(state, "j%s .L%p.%p", cond, br->bb, br->bb_true);
 		} else {
-			struct hardreg *reg = getreg(state, br->cond, NULL);
-			output_insn(state, "testl %s,%s", reg->name, reg->name);
-			cond = "ne";
+			output_insn(state, "j%s .L%p", cond, br->bb_true);
+			target = NULL;
 		}
+		set_up_edge_moves(br->bb, br->bb_false);
+		emit_moves(state, &edge_moves);
+		if (br->bb_false != state->next_bb || target)
+			output_insn(state, "jmp .L%p", br->bb_false);
+		if (!target)
+			return;
+
+		// the moves of the other edge
+		output_label(state, ".L%p.%p", br->bb, target);
+		set_up_edge_moves(br->bb, target);
+	} else {
+		set_up_edge_moves(br->bb, target);
 	}
-	generate_output_storage(state);
-	target = br->bb_true;
-	if (br->cond) {
-		output_insn(state, "j%s .L%p", cond, target);
-		target = br->bb_false;
-	}
-	output_insn(state, "jmp .L%p", target);
+	emit_moves(state, &edge_moves);
+	if (target != state->next_bb || br->cond)
+		output_insn(state, "jmp .L%p", target);
 }
 
-/* We've made sure that there is a dummy reg live for the output */
+/* Our "switch" generation is very very stupid. */
 static void generate_switch(struct bb_state *state, struct instruction *insn)
 {
-	struct hardreg *reg = hardregs + SWITCH_REG;
-
-	generate_output_storage(state);
-	output_insn(state, "switch on %s", reg->name);
+	output_insn(state, "switch on %s", src_operand(state, insn->cond));
 	output_insn(state, "unimplemented: %s", show_instruction(insn));
 }
 
 static void generate_ret(struct bb_state *state, struct instruction *ret)
 {
-	if (ret->src && ret->src != VOID) {
-		struct hardreg *wants = hardregs+0;
-		struct hardreg *reg = getreg(state, ret->src, NULL);
-		if (reg != wants)
-			output_insn(state, "movl %s,%s", reg->name, wants->name);
-	}
+	if (ret->src && ret->src != VOID)
+		load_reg(state, ret->src, REG_EAX);
 	output_insn(state, "ret");
 }
 
@@ -1113,39 +1765,46 @@ static void generate_call(struct bb_state *state, struct instruction *insn)
 	int offset = 0;
 	pseudo_t arg;
 
-	FOR_EACH_PTR(insn->arguments, arg) {
-		output_insn(state, "pushl %s", generic(state, arg));
+	FOR_EACH_PTR_REVERSE(insn->arguments, arg) {
+		output_insn(state, "pushl %s", src_operand(state, arg));
+		state->pushed += 4;
+		state->scratch = 0;
 		offset += 4;
-	} END_FOR_EACH_PTR(arg);
-	flush_reg(state, hardregs+0);
-	flush_reg(state, hardregs+1);
-	flush_reg(state, hardregs+2);
-	output_insn(state, "call %s", show_pseudo(insn->func));
+	} END_FOR_EACH_PTR_REVERSE(arg);
+	if (insn->func->type == PSEUDO_SYM)
+		output_insn(state, "call %s", show_pseudo(insn->func));
+	else
+		output_insn(state, "call *%s", src_operand(state, insn->func));
 	if (offset)
 		output_insn(state, "addl $%d,%%esp", offset);
+	state->pushed -= offset;
 	if (insn->target && insn->target != VOID)
-		add_pseudo_reg(state, insn->target, hardregs+0);
+		store_reg(state, REG_EAX, location(insn->target, state->pos + 1));
 }
 
 static void generate_select(struct bb_state *state, struct instruction *insn)
 {
-	const char *cond;
-	struct hardreg *src1, *src2, *dst;
-
-	src1 = getreg(state, insn->src2, NULL);
-	dst = copy_reg(state, src1, insn->target);
-	add_pseudo_reg(state, insn->target, dst);
-	src2 = getreg(state, insn->src3, insn->target);
-
-	if (state->cc_target == insn->src1) {
-		cond = conditional[state->cc_opcode];
+	struct storage *dst = location(insn->target, state->pos + 1);
+	const char *cond, *src2;
+	struct operand op;
+	int reg;
+
+	cond = test_cond(state, insn->src1);
+	if (is_reg(dst) && !in_storage(state, insn->src2, dst))
+		reg = dst->regno;
+	else
+		reg = get_scratch(state);
+	load_reg(state, insn->src3, reg);
+
+	pseudo_operand(state, insn->src2, state->pos, &op);
+	if (op.type == OP_MEM) {
+		regalloc_stats.loads++;
+		src2 = show_op(state, &op);
 	} else {
-		struct hardreg *reg = getreg(state, insn->src1, NULL);
-		output_insn(state, "testl %s,%s", reg->name, reg->name);
-		cond = "ne";
+		src2 = reg_operand(state, insn->src2)->name;
 	}
-
-	output_insn(state, "sel%s %s,%s", cond, src2->name, dst->name);
+	output_insn(state, "cmov%s %s,%s", cond, src2, hardregs[reg].name);
+	store_reg(state, reg, dst);
 }
 
 struct asm_arg {
@@ -1177,7 +1836,7 @@ static void replace_asm_percent(const char **src_p, char **dst_p, struct asm_arg
 		if (index < nr)
 			replace_asm_arg(dst_p, args+index);
 		break;
-	}	
+	}
 	*src_p = src;
 	return;
 }
@@ -1250,27 +1909,23 @@ static struct asm_arg *generate_asm_inputs(struct bb_state *state, struct asm_co
 	FOR_EACH_PTR(list, entry) {
 		const char *constraint = entry->constraint;
 		pseudo_t pseudo = entry->pseudo;
-		struct hardreg *reg, *orig;
+		struct hardreg *reg;
 		const char *string;
 		int index;
 
 		string = "undef";
 		switch (*constraint) {
 		case 'r':
-			string = getreg(state, pseudo, NULL)->name;
+			string = reg_operand(state, pseudo)->name;
 			break;
 		case '0' ... '9':
 			index = *constraint - '0';
 			reg = asm_arguments[index].reg;
-			orig = find_in_reg(state, pseudo);
-			if (orig)
-				move_reg(state, orig, reg);
-			else
-				fill_reg(state, reg, pseudo);
+			load_reg(state, pseudo, reg - hardregs);
 			string = reg->name;
 			break;
 		default:
-			string = generic(state, pseudo);
+			string = src_operand(state, pseudo);
 			break;
 		}
 
@@ -1302,7 +1957,7 @@ static struct asm_arg *generate_asm_outputs(struct bb_state *state, struct asm_c
 		switch (*constraint) {
 		case 'r':
 		default:
-			reg = target_reg(state, pseudo, NULL);
+			reg = hardregs + result_reg(state, location(pseudo, state->pos + 1));
 			arg->pseudo = pseudo;
 			arg->reg = reg;
 			string = reg->name;
@@ -1323,34 +1978,67 @@ static void generate_asm(struct bb_state *state, struct instruction *insn)
 	const char *str = insn->string;
 
 	if (insn->asm_rules->outputs || insn->asm_rules->inputs) {
-		struct asm_arg *arg;
+		struct asm_arg *arg, *out;
 
 		arg = generate_asm_outputs(state, insn->asm_rules->outputs, asm_arguments);
+		out = arg;
 		arg = generate_asm_inputs(state, insn->asm_rules->inputs, arg);
 		str = replace_asm_args(str, asm_arguments, arg - asm_arguments);
+		output_insn(state, "%s", str);
+
+		// the outputs in a scratch register go to their place
+		for (arg = asm_arguments; arg < out; arg++)
+			store_reg(state, arg->reg - hardregs, location(arg->pseudo, state->pos + 1));
+		return;
 	}
 	output_insn(state, "%s", str);
 }
 
-static void generate_compare(struct bb_state *state, struct instruction *insn)
+static void generate_entry(struct bb_state *state, struct instruction *entry)
 {
-	struct hardreg *src;
-	const char *src2;
-	int opcode;
+	struct symbol *sym = entry->bb->ep->name;
+	const char *name = show_ident(sym->ident);
+	pseudo_t arg;
 
-	flush_cc_cache(state);
-	opcode = insn->opcode;
+	if (sym->ctype.modifiers & MOD_STATIC)
+		output_line(state, "\n\n%s:\n", name);
+	else
+		output_line(state, "\n\n.globl %s\n%s:\n", name, name);
 
-	/*
-	 * We should try to switch these around if necessary,
-	 * and update the opcode to match..
-	 */
-	src = getreg(state, insn->src1, insn->target);
-	src2 = generic(state, insn->src2);
+	// the arguments, from where they're passed to where they're allocated
+	split_moves.nr = 0;
+	FOR_EACH_PTR(entry->arg_list, arg) {
+		add_move(&split_moves, lookup_storage(entry->bb, arg, STOR_IN), location(arg, state->pos));
+	} END_FOR_EACH_PTR(arg);
+	emit_moves(state, &split_moves);
+}
+
+static struct bb_state *busy_state;
+
+static void mark_busy(struct bb_state *state, struct storage *storage)
+{
+	if (is_reg(storage))
+		state->busy |= 1 << storage->regno;
+}
+
+static void busy_def(struct basic_block *bb, pseudo_t pseudo)
+{
+	mark_busy(busy_state, location(pseudo, busy_state->pos + 1));
+}
 
-	output_insn(state, "cmp.%d %s,%s", insn->size, src2, src->name);
+static void busy_use(struct basic_block *bb, pseudo_t pseudo)
+{
+	mark_busy(busy_state, location(pseudo, busy_state->pos));
+}
 
-	add_cc_cache(state, opcode, insn->target);
+/* The registers which can't be borrowed during this instruction */
+static void set_busy_regs(struct bb_state *state, struct instruction *insn)
+{
+	state->busy = 1 << REG_SCRATCH;
+	busy_state = state;
+	track_instruction_usage(insn->bb, insn, busy_def, busy_use);
+	if (insn->opcode == OP_CALL || insn->opcode == OP_RET)
+		state->busy |= 1 << REG_EAX;
 }
 
 static void generate_one_insn(struct instruction *insn, struct bb_state *state)
@@ -1358,23 +2046,18 @@ static void generate_one_insn(struct instruction *insn, struct bb_state *state)
 	if (verbose)
 		output_comment(state, "%s", show_instruction(insn));
 
+	set_busy_regs(state, insn);
 	switch (insn->opcode) {
-	case OP_ENTRY: {
-		struct symbol *sym = insn->bb->ep->name;
-		const char *name = show_ident(sym->ident);
-		if (sym->ctype.modifiers & MOD_STATIC)
-			printf("\n\n%s:\n", name);
-		else
-			printf("\n\n.globl %s\n%s:\n", name, name);
+	case OP_ENTRY:
+		generate_entry(state, insn);
 		break;
-	}
 
-	/*
-	 * OP_SETVAL likewise doesn't actually generate any
-	 * code. On use, the "def" of the pseudo will be
-	 * looked up.
-	 */
 	case OP_SETVAL:
+		generate_setval(state, insn);
+		break;
+
+	case OP_SYMADDR:
+		generate_symaddr(state, insn);
 		break;
 
 	case OP_STORE:
@@ -1385,10 +2068,6 @@ static void generate_one_insn(struct instruction *insn, struct bb_state *state)
 		generate_load(insn, state);
 		break;
 
-	case OP_DEATHNOTE:
-		mark_pseudo_dead(state, insn->target);
-		return;
-
 	case OP_COPY:
 		generate_copy(state, insn);
 		break;
@@ -1409,6 +2088,10 @@ static void generate_one_insn(struct instruction *insn, struct bb_state *state)
 		generate_compare(state, insn);
 		break;
 
+	case OP_NOT: case OP_NEG:
+		generate_unop(state, insn);
+		break;
+
 	case OP_CAST: case OP_SCAST: case OP_FPCAST: case OP_PTRCAST:
 		generate_cast(state, insn);
 		break;
@@ -1444,338 +2127,61 @@ static void generate_one_insn(struct instruction *insn, struct bb_state *state)
 		output_insn(state, "unimplemented: %s", show_instruction(insn));
 		break;
 	}
-	kill_dead_pseudos(state);
-}
-
-#define VERY_BUSY 1000
-#define REG_FIXED 2000
-
-static void write_reg_to_storage(struct bb_state *state, struct hardreg *reg, pseudo_t pseudo, struct storage *storage)
-{
-	int i;
-	struct hardreg *out;
-
-	switch (storage->type) {
-	case REG_REG:
-		out = hardregs + storage->regno;
-		if (reg == out)
-			return;
-		output_insn(state, "movl %s,%s", reg->name, out->name);
-		return;
-	case REG_UDEF:
-		if (reg->busy < VERY_BUSY) {
-			storage->type = REG_REG;
-			storage->regno = reg - hardregs;
-			reg->busy = REG_FIXED;
-			return;
-		}
-
-		/* Try to find a non-busy register.. */
-		for (i = 0; i < REGNO; i++) {
-			out = hardregs + i;
-			if (out->contains)
-				continue;
-			output_insn(state, "movl %s,%s", reg->name, out->name);
-			storage->type = REG_REG;
-			storage->regno = i;
-			out->busy = REG_FIXED;
-			return;
-		}
-
-		/* Fall back on stack allocation ... */
-		alloc_stack(state, storage);
-		/* Fall through */
-	default:
-		output_insn(state, "movl %s,%s", reg->name, show_memop(storage));
-		return;
-	}
-}
-
-static void write_val_to_storage(struct bb_state *state, pseudo_t src, struct storage *storage)
-{
-	struct hardreg *out;
-
-	switch (storage->type) {
-	case REG_UDEF:
-		alloc_stack(state, storage);
-	default:
-		output_insn(state, "movl %s,%s", show_pseudo(src), show_memop(storage));
-		break;
-	case REG_REG:
-		out = hardregs + storage->regno;
-		output_insn(state, "movl %s,%s", show_pseudo(src), out->name);
-	}
+	put_scratch(state);
 }
 
-static void fill_output(struct bb_state *state, pseudo_t pseudo, struct storage *out)
+static void show_bb_storage(struct bb_state *state, struct basic_block *bb, enum inout_enum inout)
 {
-	int i;
-	struct storage_hash *in;
-	struct instruction *def;
+	struct storage_hash_list *list;
+	struct storage_hash *entry;
 
-	/* Is that pseudo a constant value? */
-	switch (pseudo->type) {
-	case PSEUDO_VAL:
-		write_val_to_storage(state, pseudo, out);
+	if (!verbose)
 		return;
-	case PSEUDO_REG:
-		def = pseudo->def;
-		if (def && def->opcode == OP_SETVAL) {
-			write_val_to_storage(state, pseudo, out);
-			return;
-		}
-	default:
-		break;
-	}
-
-	/* See if we have that pseudo in a register.. */
-	for (i = 0; i < REGNO; i++) {
-		struct hardreg *reg = hardregs + i;
-		pseudo_t p;
-
-		FOR_EACH_PTR(reg->contains, p) {
-			if (p == pseudo) {
-				write_reg_to_storage(state, reg, pseudo, out);
-				return;
-			}
-		} END_FOR_EACH_PTR(p);
-	}
-
-	/* Do we have it in another storage? */
-	in = find_storage_hash(pseudo, state->internal);
-	if (!in) {
-		in = find_storage_hash(pseudo, state->inputs);
-		/* Undefined? */
-		if (!in)
-			return;
-	}
-	switch (out->type) {
-	case REG_UDEF:
-		*out = *in->storage;
-		break;
-	case REG_REG:
-		output_insn(state, "movl %s,%s", show_memop(in->storage), hardregs[out->regno].name);
-		break;
-	default:
-		if (out == in->storage)
-			break;
-		if ((out->type == in->storage->type) && (out->regno == in->storage->regno))
-			break;
-		output_insn(state, "movl %s,%s", show_memop(in->storage), show_memop(out));
-		break;
-	}
-	return;
+	list = gather_storage(bb, inout);
+	FOR_EACH_PTR(list, entry) {
+		output_comment(state, "%s %s <- %s", inout == STOR_IN ? "in" : "out",
+			show_pseudo(entry->pseudo), show_storage(entry->storage));
+	} END_FOR_EACH_PTR(entry);
+	free_ptr_list(&list);
 }
 
-static int final_pseudo_flush(struct bb_state *state, pseudo_t pseudo, struct hardreg *reg)
+static void generate_bb(struct bb_state *state, int index, int *split)
 {
-	struct storage_hash *hash;
-	struct storage *out;
-	struct hardreg *dst;
-
-	/*
-	 * Since this pseudo is live at exit, we'd better have output 
-	 * storage for it..
-	 */
-	hash = find_storage_hash(pseudo, state->outputs);
-	if (!hash)
-		return 1;
-	out = hash->storage;
-
-	/* If the output is in a register, try to get it there.. */
-	if (out->type == REG_REG) {
-		dst = hardregs + out->regno;
-		/*
-		 * Two good cases: nobody is using the right register,
-		 * or we've already set it aside for output..
-		 */
-		if (!dst->contains || dst->busy > VERY_BUSY)
-			goto copy_to_dst;
-
-		/* Aiee. Try to keep it in a register.. */
-		dst = empty_reg(state);
-		if (dst)
-			goto copy_to_dst;
-
-		return 0;
-	}
+	struct basic_block *bb = blocks[index];
+	struct instruction *insn, *next = NULL;
 
-	/* If the output is undefined, let's see if we can put it in a register.. */
-	if (out->type == REG_UDEF) {
-		dst = empty_reg(state);
-		if (dst) {
-			out->type = REG_REG;
-			out->regno = dst - hardregs;
-			goto copy_to_dst;
-		}
-		/* Uhhuh. Not so good. No empty registers right now */
-		return 0;
-	}
-
-	/* If we know we need to flush it, just do so already .. */
-	output_insn(state, "movl %s,%s", reg->name, show_memop(out));
-	return 1;
-
-copy_to_dst:
-	if (reg == dst)
-		return 1;
-	output_insn(state, "movl %s,%s", reg->name, dst->name);
-	add_pseudo_reg(state, pseudo, dst);
-	return 1;
-}
-
-/*
- * This tries to make sure that we put all the pseudos that are
- * live on exit into the proper storage
- */
-static void generate_output_storage(struct bb_state *state)
-{
-	struct storage_hash *entry;
+	state->next_bb = index + 1 < nr_blocks ? blocks[index + 1] : NULL;
+	state->pos = block_from[index];
 
-	/* Go through the fixed outputs, making sure we have those regs free */
-	FOR_EACH_PTR(state->outputs, entry) {
-		struct storage *out = entry->storage;
-		if (out->type == REG_REG) {
-			struct hardreg *reg = hardregs + out->regno;
-			pseudo_t p;
-			int flushme = 0;
-
-			reg->busy = REG_FIXED;
-			FOR_EACH_PTR(reg->contains, p) {
-				if (p == entry->pseudo) {
-					flushme = -100;
-					continue;
-				}
-				if (CURRENT_TAG(p) & TAG_DEAD)
-					continue;
+	output_label(state, ".L%p", bb);
+	show_bb_storage(state, bb, STOR_IN);
 
-				/* Try to write back the pseudo to where it should go ... */
-				if (final_pseudo_flush(state, p, reg)) {
-					DELETE_CURRENT_PTR(p);
-					continue;
-				}
-				flushme++;
-			} END_FOR_EACH_PTR(p);
-			PACK_PTR_LIST(&reg->contains);
-			if (flushme > 0)
-				flush_reg(state, reg);
+	FOR_EACH_PTR(bb->insns, insn) {
+		if (!numbered_insn(insn))
+			continue;
+		if (next) {
+			state->next = insn;
+			generate_one_insn(next, state);
+			state->pos += 2;
 		}
-	} END_FOR_EACH_PTR(entry);
-
-	FOR_EACH_PTR(state->outputs, entry) {
-		fill_output(state, entry->pseudo, entry->storage);
-	} END_FOR_EACH_PTR(entry);
-}
-
-static void generate(struct basic_block *bb, struct bb_state *state)
-{
-	int i;
-	struct storage_hash *entry;
-	struct instruction *insn;
+		next = insn;
 
-	for (i = 0; i < REGNO; i++) {
-		free_ptr_list(&hardregs[i].contains);
-		hardregs[i].busy = 0;
-		hardregs[i].dead = 0;
-		hardregs[i].used = 0;
-	}
+		// the intervals split before this instruction
+		split_moves.nr = 0;
+		while (*split < nr_splits && interval_start(splits[*split]) <= state->pos) {
+			struct interval *it = splits[*split];
 
-	FOR_EACH_PTR(state->inputs, entry) {
-		struct storage *storage = entry->storage;
-		const char *name = show_storage(storage);
-		output_comment(state, "incoming %s in %s", show_pseudo(entry->pseudo), name);
-		if (storage->type == REG_REG) {
-			int regno = storage->regno;
-			add_pseudo_reg(state, entry->pseudo, hardregs + regno);
-			name = hardregs[regno].name;
+			if (interval_start(it) != block_from[index])
+				add_move(&split_moves, it->prev->storage, it->storage);
+			(*split)++;
 		}
-	} END_FOR_EACH_PTR(entry);
-
-	output_label(state, ".L%p", bb);
-	FOR_EACH_PTR(bb->insns, insn) {
-		if (!insn->bb)
-			continue;
-		generate_one_insn(insn, state);
+		emit_moves(state, &split_moves);
 	} END_FOR_EACH_PTR(insn);
-
-	if (verbose) {
-		output_comment(state, "--- in ---");
-		FOR_EACH_PTR(state->inputs, entry) {
-			output_comment(state, "%s <- %s", show_pseudo(entry->pseudo), show_storage(entry->storage));
-		} END_FOR_EACH_PTR(entry);
-		output_comment(state, "--- spill ---");
-		FOR_EACH_PTR(state->internal, entry) {
-			output_comment(state, "%s <-> %s", show_pseudo(entry->pseudo), show_storage(entry->storage));
-		} END_FOR_EACH_PTR(entry);
-		output_comment(state, "--- out ---");
-		FOR_EACH_PTR(state->outputs, entry) {
-			output_comment(state, "%s -> %s", show_pseudo(entry->pseudo), show_storage(entry->storage));
-		} END_FOR_EACH_PTR(entry);
+	if (next) {
+		state->next = NULL;
+		show_bb_storage(state, bb, STOR_OUT);
+		generate_one_insn(next, state);
 	}
-	printf("\n");
-}
-
-static void generate_list(struct basic_block_list *list, unsigned long generation)
-{
-	struct basic_block *bb;
-	FOR_EACH_PTR(list, bb) {
-		if (bb->generation == generation)
-			continue;
-		output_bb(bb, generation);
-	} END_FOR_EACH_PTR(bb);
-}
-
-/*
- * Mark all the output registers of all the parents
- * as being "used" - this does not mean that we cannot
- * re-use them, but it means that we cannot ask the
- * parents to pass in another pseudo in one of those
- * registers that it already uses for another child.
- */
-static void mark_used_registers(struct basic_block *bb, struct bb_state *state)
-{
-	struct basic_block *parent;
-
-	FOR_EACH_PTR(bb->parents, parent) {
-		struct storage_hash_list *outputs = gather_storage(parent, STOR_OUT);
-		struct storage_hash *entry;
-
-		FOR_EACH_PTR(outputs, entry) {
-			struct storage *s = entry->storage;
-			if (s->type == REG_REG) {
-				struct hardreg *reg = hardregs + s->regno;
-				reg->used = 1;
-			}
-		} END_FOR_EACH_PTR(entry);
-	} END_FOR_EACH_PTR(parent);
-}
-
-static void output_bb(struct basic_block *bb, unsigned long generation)
-{
-	struct bb_state state;
-
-	bb->generation = generation;
-
-	/* Make sure all parents have been generated first */
-	generate_list(bb->parents, generation);
-
-	state.pos = bb->pos;
-	state.inputs = gather_storage(bb, STOR_IN);
-	state.outputs = gather_storage(bb, STOR_OUT);
-	state.internal = NULL;
-	state.cc_opcode = 0;
-	state.cc_target = NULL;
-
-	/* Mark incoming registers used */
-	mark_used_registers(bb, &state);
-
-	generate(bb, &state);
-
-	free_ptr_list(&state.inputs);
-	free_ptr_list(&state.outputs);
-
-	/* Generate all children... */
-	generate_list(bb->children, generation);
 }
 
 /*
@@ -1788,6 +2194,9 @@ static void output_bb(struct basic_block *bb, unsigned long generation)
  * function that doesn't have its address taken.
  *
  * I should implement the -mregparm=X cmd line option.
+ *
+ * The allocator is told to keep the arguments where they
+ * are passed, if it can.
  */
 static void set_up_arch_entry(struct entrypoint *ep, struct instruction *entry)
 {
@@ -1804,6 +2213,7 @@ static void set_up_arch_entry(struct entrypoint *ep, struct instruction *entry)
 	offset = 0;
 	PREPARE_PTR_LIST(sym->arguments, argtype);
 	FOR_EACH_PTR(entry->arg_list, arg) {
+		struct interval *it = pseudo_interval(arg);
 		struct storage *in = lookup_storage(entry->bb, arg, STOR_IN);
 		if (!in) {
 			in = alloc_storage();
@@ -1812,6 +2222,8 @@ static void set_up_arch_entry(struct entrypoint *ep, struct instruction *entry)
 		if (i < regparm) {
 			in->type = REG_REG;
 			in->regno = i;
+			if (it && it->hint_reg < 0)
+				it->hint_reg = i;
 		} else {
 			int bits = argtype ? argtype->bit_size : 0;
 
@@ -1820,7 +2232,9 @@ static void set_up_arch_entry(struct entrypoint *ep, struct instruction *entry)
 
 			in->type = REG_FRAME;
 			in->offset = offset;
-			
+			if (it && !it->slot)
+				it->slot = in;
+
 			offset += bits_to_bytes(bits);
 		}
 		i++;
@@ -1830,44 +2244,15 @@ static void set_up_arch_entry(struct entrypoint *ep, struct instruction *entry)
 }
 
 /*
- * Set up storage information for "return"
- *
- * Not strictly necessary, since the code generator will
- * certainly move the return value to the right register,
- * but it can help register allocation if the allocator
- * sees that the target register is going to return in %eax.
+ * The return value goes in %eax: better to have it
+ * computed there directly.
  */
 static void set_up_arch_exit(struct basic_block *bb, struct instruction *ret)
 {
-	pseudo_t pseudo = ret->src;
-
-	if (pseudo && pseudo != VOID) {
-		struct storage *out = lookup_storage(bb, pseudo, STOR_OUT);
-		if (!out) {
-			out = alloc_storage();
-			add_storage(out, bb, pseudo, STOR_OUT);
-		}
-		out->type = REG_REG;
-		out->regno = 0;
-	}
-}
+	struct interval *it = pseudo_interval(ret->src);
 
-/*
- * Set up dummy/silly output storage information for a switch
- * instruction. We need to make sure that a register is available
- * when we generate code for switch, so force that by creating
- * a dummy output rule.
- */
-static void set_up_arch_switch(struct basic_block *bb, struct instruction *insn)
-{
-	pseudo_t pseudo = insn->cond;
-	struct storage *out = lookup_storage(bb, pseudo, STOR_OUT);
-	if (!out) {
-		out = alloc_storage();
-		add_storage(out, bb, pseudo, STOR_OUT);
-	}
-	out->type = REG_REG;
-	out->regno = SWITCH_REG;
+	if (it && it->hint_reg < 0)
+		it->hint_reg = REG_EAX;
 }
 
 static void arch_set_up_storage(struct entrypoint *ep)
@@ -1885,35 +2270,63 @@ static void arch_set_up_storage(struct entrypoint *ep)
 		case OP_RET:
 			set_up_arch_exit(bb, insn);
 			break;
-		case OP_SWITCH:
-			set_up_arch_switch(bb, insn);
-			break;
 		default:
 			/* nothing */;
 		}
 	} END_FOR_EACH_PTR(bb);
 }
 
+static void allocate_registers(struct entrypoint *ep)
+{
+	struct interval *it;
+
+	cur_ep = ep;
+	clear_liveness(ep);
+	number_pseudos(ep);
+	track_pseudo_liveness(ep);
+
+	intervals = alloc_pseudo_table(ep, struct interval *);
+	order_blocks(ep);
+	build_intervals(ep);
+	coalesce_copies();
+	arch_set_up_storage(ep);
+
+	nr_unhandled = 0;
+	FOR_EACH_PTR(all_intervals, it) {
+		if (it->nr && !it->leader)
+			push_unhandled(it);
+	} END_FOR_EACH_PTR(it);
+	linear_scan();
+
+	collect_splits();
+	set_up_bb_storage(ep);
+}
+
 static void output(struct entrypoint *ep)
 {
-	unsigned long generation = ++bb_generation;
+	struct bb_state state = { };
+	int i, split = 0;
+	struct regalloc_stats before = regalloc_stats;
 
-	last_reg = -1;
 	stack_offset = 0;
 
 	/* Get rid of SSA form (phinodes etc) */
 	unssa(ep);
 
-	/* Set up initial inter-bb storage links */
-	set_up_storage(ep);
-
-	/* Architecture-specific storage rules.. */
-	arch_set_up_storage(ep);
+	/* Give a place to each pseudo */
+	allocate_registers(ep);
 
 	/* Show the results ... */
-	output_bb(ep->entry->bb, generation);
-
-	/* Clear the storage hashes for the next function.. */
+	for (i = 0; i < nr_blocks; i++)
+		generate_bb(&state, i, &split);
+	output_comment(&state, "%lu loads, %lu stores, %lu moves",
+		regalloc_stats.loads - before.loads,
+		regalloc_stats.stores - before.stores,
+		regalloc_stats.moves - before.moves);
+	outbuf_flush(&out, stdout);
+
+	/* Clear the storage tables for the next function.. */
+	free_intervals();
 	free_storage();
 }
 
@@ -1927,7 +2340,7 @@ static int compile(struct symbol_list *list)
 		if (ep)
 			output(ep);
 	} END_FOR_EACH_PTR(sym);
-	
+
 	return 0;
 }
 
@@ -1937,10 +2350,13 @@ int main(int argc, char **argv)
 	char *file;
 
 	compile(sparse_initialize(argc, argv, &filelist));
-	dbg_dead = 1;
 	FOR_EACH_PTR_NOTAG(filelist, file) {
 		compile(sparse(file));
 	} END_FOR_EACH_PTR_NOTAG(file);
+
+	if (fmem_report)
+		fprintf(stderr, "%16s: %8lu loads, %8lu stores, %8lu moves\n", "register spills",
+			regalloc_stats.loads, regalloc_stats.stores, regalloc_stats.moves);
+	report_stats();
 	return 0;
 }
-
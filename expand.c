@@ -42,6 +42,7 @@
 #include "target.h"
 #include "expression.h"
 #include "expand.h"
+#include "timer.h"
 
 
 static int expand_expression(struct expression *);
@@ -1077,12 +1078,14 @@ int expand_symbol(struct symbol *sym)
 	if (!base_type)
 		return 0;
 
+	timer_start(PASS__EXPAND);
 	retval = expand_expression(sym->initializer);
 	/* expand the body of the symbol */
 	if (base_type->type == SYM_FN) {
 		if (base_type->stmt)
 			expand_statement(base_type->stmt);
 	}
+	timer_stop(PASS__EXPAND);
 	return retval;
 }
 
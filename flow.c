@@ -71,13 +71,22 @@ static int pseudo_truth_value(pseudo_t pseudo)
  */
 static int bb_depends_on(struct basic_block *target, struct basic_block *src)
 {
+	struct pseudo_set needs = { };
 	pseudo_t pseudo;
+	int depends = 0;
 
+	if (!src->defines || !target->needs)
+		return 0;
+	add_ptr_list_to_set(&needs, target->needs);
 	FOR_EACH_PTR(src->defines, pseudo) {
-		if (pseudo_in_list(target->needs, pseudo))
-			return 1;
+		if (ptr_set_contains(&needs, pseudo)) {
+			depends = 1;
+			goto out;
+		}
 	} END_FOR_EACH_PTR(pseudo);
-	return 0;
+out:
+	ptr_set_clear(&needs);
+	return depends;
 }
 
 /*
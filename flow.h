@@ -20,6 +20,9 @@ extern void pack_basic_blocks(struct entrypoint *ep);
 
 extern void convert_instruction_target(struct instruction *insn, pseudo_t src);
 extern int simplify_instruction(struct instruction *);
+extern pseudo_t eval_binop(int op, unsigned int size, long long left, long long right);
+extern pseudo_t eval_unop(int op, unsigned int size, long long val);
+extern pseudo_t eval_cast(struct instruction *insn, long long val);
 
 extern void kill_bb(struct basic_block *);
 extern void kill_use(pseudo_t *);
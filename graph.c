@@ -22,13 +22,43 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
  * THE SOFTWARE.
  */
+
+/*
+ * The callgraph of a set of files.
+ *
+ * Each file is parsed and linearized on its own, in a worker forked
+ * from the state preceding all the files, up to N of them running
+ * at once with -j N (see jobs.c), and what's needed of it
+ * is sent back as a few lines of text, the records described
+ * below. With these, the main process builds an index of all
+ * the functions and of all the calls, which it then resolves:
+ *  - the direct calls by name: to the static function of the same
+ *    file if there is one, else to the global one, else to an
+ *    external function;
+ *  - the indirect calls by type: to every function of the same type
+ *    whose address is taken somewhere, in a function or in the
+ *    initializer of a variable.
+ *
+ * The callgraph is then written with --format=
+ *  dot:	(the default) the basic blocks of each function and
+ *		the calls between them, for Graphviz;
+ *  json:	the functions and the calls;
+ *  binary:	a compact adjacency list, in the byte order of the host:
+ *		struct bin_header;
+ *		char strings[strtab_size];	// NUL-terminated, padded
+ *		struct bin_node nodes[nr_nodes];
+ *		uint32_t first[nr_nodes + 1];
+ *		struct bin_call calls[nr_calls];
+ *		The calls made by node N are calls[first[N] .. first[N+1]-1],
+ *		in the order of the source, and the names are offsets
+ *		in 'strings' ("" at offset 0 for unknown).
+ */
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
-#include <ctype.h>
-#include <unistd.h>
-#include <fcntl.h>
+#include <limits.h>
 
 #include "lib.h"
 #include "allocate.h"
@@ -37,168 +67,892 @@
 #include "symbol.h"
 #include "expression.h"
 #include "linearize.h"
+#include "liveness.h"
+#include "outbuf.h"
+#include "jobs.h"
 
+enum format {
+	FORMAT_DOT,
+	FORMAT_JSON,
+	FORMAT_BINARY,
+};
 
-/* Draw the subgraph for a given entrypoint. Includes details of loads
- * and stores for globals, and marks return bbs */
-static void graph_ep(struct entrypoint *ep)
-{
-	struct basic_block *bb;
-	struct instruction *insn;
+static enum format format = FORMAT_DOT;
 
-	const char *fname, *sname;
+/*
+ * The scanning of the files.
+ *
+ * The records, one per line, with tab-separated fields:
+ *	N span				the blocks are numbered from 0 to span - 1
+ *	F entry line static name file type	a function, the next B, C & A
+ *					records are within it
+ *	B bb line col ret nr loads&stores... (child weight)...
+ *					a basic block, for the DOT output only
+ *	C bb line col d name		a direct call
+ *	C bb line col i type		an indirect call
+ *	A name type			the function's address is taken
+ */
+static struct outbuf rec;
+static unsigned int bb_base;
 
-	fname = show_ident(ep->name->ident);
-	sname = stream_name(ep->entry->bb->pos.stream);
+DECLARE_PTR_SET(symbol_set, struct symbol);
+static struct symbol_set taken;
 
-	printf("subgraph cluster%p {\n"
-	       "    color=blue;\n"
-	       "    label=<<TABLE BORDER=\"0\" CELLBORDER=\"0\">\n"
-	       "             <TR><TD>%s</TD></TR>\n"
-	       "             <TR><TD><FONT POINT-SIZE=\"21\">%s()</FONT></TD></TR>\n"
-	       "           </TABLE>>;\n"
-	       "    file=\"%s\";\n"
-	       "    fun=\"%s\";\n"
-	       "    ep=bb%p;\n",
-	       ep, sname, fname, sname, fname, ep->entry->bb);
+/*
+ * The type of a function (or of a pointer to one), as matched for
+ * the indirect calls: its return type and the unqualified types of
+ * its arguments.
+ */
+static const char *signature(struct symbol *type)
+{
+	static struct outbuf buf;
+	const char *sep = "";
+	struct symbol *arg;
+
+	while (type && (type->type == SYM_NODE || type->type == SYM_PTR))
+		type = type->ctype.base_type;
+	if (!type || type->type != SYM_FN)
+		return NULL;
+
+	buf.len = 0;
+	outbuf_printf(&buf, "%s (", show_typename(type->ctype.base_type));
+	FOR_EACH_PTR(type->arguments, arg) {
+		outbuf_printf(&buf, "%s%s", sep, show_typename(arg->ctype.base_type));
+		sep = ", ";
+	} END_FOR_EACH_PTR(arg);
+	if (type->variadic)
+		outbuf_printf(&buf, "%s...", sep);
+	outbuf_write(&buf, ")", 2);
+	return buf.buf;
+}
 
-	FOR_EACH_PTR(ep->bbs, bb) {
-		struct basic_block *child;
-		int ret = 0;
-		const char * s = ", ls=\"[";
+static inline int is_static(struct symbol *sym)
+{
+	return !!(sym->ctype.modifiers & MOD_STATIC);
+}
 
-		/* Node for the bb */
-		printf("    bb%p [shape=ellipse,label=%d,line=%d,col=%d",
-		       bb, bb->pos.line, bb->pos.line, bb->pos.pos);
+static void address_taken(struct symbol *sym)
+{
+	if (!sym || !sym->ident || !sym->ctype.base_type || !is_func_type(sym))
+		return;
+	if (!ptr_set_add(&taken, sym))
+		return;
+	outbuf_printf(&rec, "A\t%s\t%s\n", show_ident(sym->ident), signature(sym));
+}
 
+static void use_symbol(struct basic_block *bb, pseudo_t p)
+{
+	if (p && p->type == PSEUDO_SYM)
+		address_taken(p->sym);
+}
 
-		/* List loads and stores */
-		FOR_EACH_PTR(bb->insns, insn) {
-			switch(insn->opcode) {
-			case OP_STORE:
-				if (insn->symbol->type == PSEUDO_SYM) {
-				  printf("%s store(%s)", s, show_ident(insn->symbol->sym->ident));
-				  s = ",";
-				}
-				break;
+static void def_nothing(struct basic_block *bb, pseudo_t p)
+{
+}
 
-			case OP_LOAD:
-				if (insn->symbol->type == PSEUDO_SYM) {
-				  printf("%s load(%s)", s, show_ident(insn->symbol->sym->ident));
-				  s = ",";
-				}
-				break;
+static void scan_initializer(struct expression *expr)
+{
+	struct expression *entry;
+
+	if (!expr)
+		return;
+	switch (expr->type) {
+	case EXPR_INITIALIZER:
+		FOR_EACH_PTR(expr->expr_list, entry) {
+			scan_initializer(entry);
+		} END_FOR_EACH_PTR(entry);
+		break;
+	case EXPR_POS:
+		scan_initializer(expr->init_expr);
+		break;
+	case EXPR_IDENTIFIER:
+	case EXPR_INDEX:
+		scan_initializer(expr->ident_expression);
+		break;
+	case EXPR_PREOP:
+		scan_initializer(expr->unop);
+		break;
+	case EXPR_CAST:
+	case EXPR_FORCE_CAST:
+	case EXPR_IMPLIED_CAST:
+		scan_initializer(expr->cast_expression);
+		break;
+	case EXPR_SYMBOL:
+		address_taken(expr->symbol);
+		break;
+	default:
+		break;
+	}
+}
 
-			case OP_RET:
-				ret = 1;
-				break;
+static int is_load_store(struct instruction *insn)
+{
+	switch (insn->opcode) {
+	case OP_STORE:
+	case OP_LOAD:
+		return insn->symbol->type == PSEUDO_SYM;
+	}
+	return 0;
+}
 
-			}
-		} END_FOR_EACH_PTR(insn);
-		if (s[1] == 0)
-			printf("]\"");
-		if (ret)
-			printf(",op=ret");
-		printf("];\n");
-
-		/* Edges between bbs; lower weight for upward edges */
-		FOR_EACH_PTR(bb->children, child) {
-			printf("    bb%p -> bb%p [op=br, %s];\n", bb, child,
-			       (bb->pos.line > child->pos.line) ? "weight=5" : "weight=10");
-		} END_FOR_EACH_PTR(child);
-	} END_FOR_EACH_PTR(bb);
+static void scan_bb(struct basic_block *bb)
+{
+	struct basic_block *child;
+	struct instruction *insn;
+	int ret = 0, nr = 0;
 
-	printf("}\n");
+	FOR_EACH_PTR(bb->insns, insn) {
+		if (insn->opcode == OP_RET)
+			ret = 1;
+		nr += is_load_store(insn);
+	} END_FOR_EACH_PTR(insn);
+
+	outbuf_printf(&rec, "B\t%u\t%d\t%d\t%d\t%d", bb->nr - bb_base,
+		bb->pos.line, bb->pos.pos, ret, nr);
+
+	/* List loads and stores */
+	FOR_EACH_PTR(bb->insns, insn) {
+		if (!is_load_store(insn))
+			continue;
+		outbuf_printf(&rec, "\t%s(%s)", insn->opcode == OP_STORE ? "store" : "load",
+			show_ident(insn->symbol->sym->ident));
+	} END_FOR_EACH_PTR(insn);
+
+	/* Edges between bbs; lower weight for upward edges */
+	FOR_EACH_PTR(bb->children, child) {
+		outbuf_printf(&rec, "\t%u\t%d", child->nr - bb_base,
+			(bb->pos.line > child->pos.line) ? 5 : 10);
+	} END_FOR_EACH_PTR(child);
+	outbuf_putc(&rec, '\n');
 }
 
+static void scan_call(struct basic_block *bb, struct instruction *insn)
+{
+	pseudo_t func = insn->func;
+	pseudo_t arg;
+	const char *type;
+
+	FOR_EACH_PTR(insn->arguments, arg) {
+		use_symbol(bb, arg);
+	} END_FOR_EACH_PTR(arg);
+
+	if (func->type == PSEUDO_SYM && is_func_type(func->sym)) {
+		outbuf_printf(&rec, "C\t%u\t%d\t%d\td\t%s\n", bb->nr - bb_base,
+			insn->pos.line, insn->pos.pos, show_ident(func->sym->ident));
+		return;
+	}
+
+	type = signature(first_ptr_list((struct ptr_list *)insn->fntypes));
+	if (type)
+		outbuf_printf(&rec, "C\t%u\t%d\t%d\ti\t%s\n", bb->nr - bb_base,
+			insn->pos.line, insn->pos.pos, type);
+}
 
-/* Insert edges for intra- or inter-file calls, depending on the value
- * of internal. Bold edges are used for calls with destinations;
- * dashed for calls to external functions */
-static void graph_calls(struct entrypoint *ep, int internal)
+static void scan_ep(struct entrypoint *ep)
 {
+	struct symbol *sym = ep->name;
 	struct basic_block *bb;
 	struct instruction *insn;
 
-	show_ident(ep->name->ident);
-	stream_name(ep->entry->bb->pos.stream);
+	outbuf_printf(&rec, "F\t%u\t%d\t%d\t%s\t", ep->entry->bb->nr - bb_base,
+		sym->pos.line, is_static(sym), show_ident(sym->ident));
+	outbuf_printf(&rec, "%s\t%s\n", stream_name(ep->entry->bb->pos.stream),
+		signature(sym));
 
 	FOR_EACH_PTR(ep->bbs, bb) {
-		if (!bb)
-			continue;
-		if (!bb->parents && !bb->children && !bb->insns && verbose < 2)
-			continue;
-
+		if (format == FORMAT_DOT)
+			scan_bb(bb);
 		FOR_EACH_PTR(bb->insns, insn) {
 			if (!insn->bb)
 				continue;
-			if (insn->opcode == OP_CALL &&
-			    internal == !(insn->func->sym->ctype.modifiers & MOD_EXTERN)) {
-
-				/* Find the symbol for the callee's definition */
-				struct symbol * sym;
-				if (insn->func->type == PSEUDO_SYM) {
-					for (sym = insn->func->sym->ident->symbols;
-					     sym; sym = sym->next_id) {
-						if (sym->namespace & NS_SYMBOL && sym->ep)
-							break;
-					}
-
-					if (sym)
-						printf("bb%p -> bb%p"
-						       "[label=%d,line=%d,col=%d,op=call,style=bold,weight=30];\n",
-						       bb, sym->ep->entry->bb,
-						       insn->pos.line, insn->pos.line, insn->pos.pos);
-					else
-						printf("bb%p -> \"%s\" "
-						       "[label=%d,line=%d,col=%d,op=extern,style=dashed];\n",
-						       bb, show_pseudo(insn->func),
-						       insn->pos.line, insn->pos.line, insn->pos.pos);
-				}
-			}
+			if (insn->opcode == OP_CALL)
+				scan_call(bb, insn);
+			else
+				track_instruction_usage(bb, insn, def_nothing, use_symbol);
 		} END_FOR_EACH_PTR(insn);
 	} END_FOR_EACH_PTR(bb);
 }
 
-int main(int argc, char **argv)
+static void scan_file(char *file)
 {
-	struct string_list *filelist = NULL;
-	char *file;
+	struct symbol_list *fsyms = sparse(file);
+	unsigned int top = 0;
 	struct symbol *sym;
 
-	struct symbol_list *fsyms, *all_syms=NULL;
+	FOR_EACH_PTR(fsyms, sym) {
+		expand_symbol(sym);
+		linearize_symbol(sym);
+	} END_FOR_EACH_PTR(sym);
 
-	printf("digraph call_graph {\n");
-	fsyms = sparse_initialize(argc, argv, &filelist);
-	concat_symbol_list(fsyms, &all_syms);
+	/* the blocks are numbered globally: renumber them from 0 */
+	bb_base = UINT_MAX;
+	FOR_EACH_PTR(fsyms, sym) {
+		struct basic_block *bb;
 
-	/* Linearize all symbols, graph internal basic block
-	 * structures and intra-file calls */
-	FOR_EACH_PTR_NOTAG(filelist, file) {
+		if (!sym->ep)
+			continue;
+		FOR_EACH_PTR(sym->ep->bbs, bb) {
+			if (bb->nr < bb_base)
+				bb_base = bb->nr;
+			if (bb->nr > top)
+				top = bb->nr;
+		} END_FOR_EACH_PTR(bb);
+	} END_FOR_EACH_PTR(sym);
+	outbuf_printf(&rec, "N\t%u\n", bb_base <= top ? top - bb_base + 1 : 0);
+
+	FOR_EACH_PTR(fsyms, sym) {
+		if (sym->ep)
+			scan_ep(sym->ep);
+		else if (sym->initializer)
+			scan_initializer(sym->initializer);
+	} END_FOR_EACH_PTR(sym);
+	ptr_set_clear(&taken);
+}
 
-		fsyms = sparse(file);
-		concat_symbol_list(fsyms, &all_syms);
+/* in a worker: send the records back to the main process */
+static void graph_file(char *file)
+{
+	scan_file(file);
+	outbuf_flush(&rec, stdout);
+}
 
-		FOR_EACH_PTR(fsyms, sym) {
-			expand_symbol(sym);
-			linearize_symbol(sym);
-		} END_FOR_EACH_PTR(sym);
+/*
+ * The index.
+ *
+ * All the strings are interned in one buffer and are referred to
+ * by their offset in it. The functions are found by their name and
+ * their scope: the index of the file for a static one, -1 otherwise.
+ */
+struct node {
+	unsigned int name, file, type;
+	int line;
+	int scope;
+	int entry;		/* its first basic block, for the DOT output */
+	unsigned int defined:1, taken:1;
+};
+
+struct call {
+	int caller, callee;
+	int bb, line, col;
+	int scope;
+	unsigned int target;	/* the name or the type of the callee */
+	unsigned int indirect:1;
+};
+
+struct address {
+	unsigned int name, type;
+	int scope;
+};
+
+static struct node *nodes;
+static int nr_nodes, max_nodes;
+static struct call *calls, *edges;
+static int nr_calls, max_calls, nr_edges, max_edges;
+static struct address *addresses;
+static int nr_addresses, max_addresses;
+
+static struct outbuf strings;
+static unsigned int *string_table;	/* offset + 1 of the strings */
+static unsigned int string_mask, nr_strings;
+
+static int *func_table;			/* index + 1 of the nodes */
+static unsigned int func_mask, nr_funcs;
+
+static void *grow_array(void *array, int nr, int *max, size_t size)
+{
+	if (nr < *max)
+		return array;
+	*max = *max ? *max * 2 : 256;
+	array = realloc(array, *max * size);
+	if (!array)
+		die("out of memory");
+	return array;
+}
 
-		FOR_EACH_PTR(fsyms, sym) {
-			if (sym->ep) {
-				graph_ep(sym->ep);
-				graph_calls(sym->ep, 1);
-			}
-		} END_FOR_EACH_PTR_NOTAG(sym);
+static void *alloc_table(unsigned int mask, size_t size)
+{
+	void *table = calloc(mask + 1, size);
 
-	} END_FOR_EACH_PTR_NOTAG(file);
+	if (!table)
+		die("out of memory");
+	return table;
+}
 
-	/* Graph inter-file calls */
-	FOR_EACH_PTR(all_syms, sym) {
-		if (sym->ep)
-			graph_calls(sym->ep, 0);
-	} END_FOR_EACH_PTR_NOTAG(sym);
+static unsigned int hash_string(const char *str)
+{
+	unsigned int hash = 2166136261u;
+
+	while (*str)
+		hash = (hash ^ (unsigned char)*str++) * 16777619u;
+	return hash;
+}
+
+static void grow_string_table(void)
+{
+	unsigned int *old = string_table;
+	unsigned int old_mask = string_mask;
+	unsigned int i, j;
+
+	string_mask = old ? 2 * old_mask + 1 : 4095;
+	string_table = alloc_table(string_mask, sizeof(*string_table));
+	if (!old)
+		return;
+	for (i = 0; i <= old_mask; i++) {
+		if (!old[i])
+			continue;
+		j = hash_string(strings.buf + old[i] - 1);
+		while (string_table[j & string_mask])
+			j++;
+		string_table[j & string_mask] = old[i];
+	}
+	free(old);
+}
+
+static unsigned int intern(const char *str)
+{
+	unsigned int i, offset;
+
+	if (2 * (nr_strings + 1) > string_mask)
+		grow_string_table();
+	for (i = hash_string(str); (offset = string_table[i & string_mask]); i++) {
+		if (!strcmp(strings.buf + offset - 1, str))
+			return offset - 1;
+	}
+	offset = strings.len;
+	outbuf_write(&strings, str, strlen(str) + 1);
+	string_table[i & string_mask] = offset + 1;
+	nr_strings++;
+	return offset;
+}
+
+static inline const char *string(unsigned int offset)
+{
+	return strings.buf + offset;
+}
+
+static inline unsigned int hash_func(unsigned int name, int scope)
+{
+	return name * 2654435761u + scope;
+}
+
+static void grow_func_table(void)
+{
+	int *old = func_table;
+	unsigned int old_mask = func_mask;
+	unsigned int i, j;
+
+	func_mask = old ? 2 * old_mask + 1 : 4095;
+	func_table = alloc_table(func_mask, sizeof(*func_table));
+	if (!old)
+		return;
+	for (i = 0; i <= old_mask; i++) {
+		struct node *node;
+
+		if (!old[i])
+			continue;
+		node = &nodes[old[i] - 1];
+		j = hash_func(node->name, node->scope);
+		while (func_table[j & func_mask])
+			j++;
+		func_table[j & func_mask] = old[i];
+	}
+	free(old);
+}
+
+static int lookup_func(unsigned int name, int scope)
+{
+	unsigned int i;
+	int n;
+
+	if (!func_table)
+		return -1;
+	for (i = hash_func(name, scope); (n = func_table[i & func_mask]); i++) {
+		struct node *node = &nodes[n - 1];
+
+		if (node->name == name && node->scope == scope)
+			return n - 1;
+	}
+	return -1;
+}
+
+/* a new function, which shadows no other one */
+static struct node *new_func(unsigned int name, int scope)
+{
+	unsigned int i;
+	int n = nr_nodes;
+
+	nodes = grow_array(nodes, nr_nodes, &max_nodes, sizeof(*nodes));
+	nr_nodes++;
+	memset(&nodes[n], 0, sizeof(nodes[n]));
+	nodes[n].name = name;
+	nodes[n].scope = scope;
+
+	if (2 * (nr_funcs + 1) > func_mask)
+		grow_func_table();
+	i = hash_func(name, scope);
+	while (func_table[i & func_mask])
+		i++;
+	func_table[i & func_mask] = n + 1;
+	nr_funcs++;
+	return &nodes[n];
+}
+
+/*
+ * The collect of the records.
+ */
+static struct outbuf out;
+static int file_nr;
+static int bb_offset;
+
+static void flush_out(void)
+{
+	if (out.len >= 1024 * 1024)
+		outbuf_flush(&out, stdout);
+}
+
+static char *next_field(char **line)
+{
+	char *field = *line;
+	char *end = strchr(field, '\t');
+
+	if (end) {
+		*end = '\0';
+		*line = end + 1;
+	} else {
+		*line = field + strlen(field);
+	}
+	return field;
+}
+
+static inline int int_field(char **line)
+{
+	return atoi(next_field(line));
+}
+
+static void dot_cluster(struct node *node, int id)
+{
+	const char *fname = string(node->name);
+	const char *sname = string(node->file);
+
+	outbuf_printf(&out, "subgraph cluster%d {\n"
+	       "    color=blue;\n"
+	       "    label=<<TABLE BORDER=\"0\" CELLBORDER=\"0\">\n"
+	       "             <TR><TD>%s</TD></TR>\n"
+	       "             <TR><TD><FONT POINT-SIZE=\"21\">%s()</FONT></TD></TR>\n"
+	       "           </TABLE>>;\n"
+	       "    file=\"%s\";\n"
+	       "    fun=\"%s\";\n"
+	       "    ep=bb%d;\n",
+	       id, sname, fname, sname, fname, node->entry);
+}
+
+/* Draw a basic block with its loads and stores, and its edges */
+static void dot_bb(char *line)
+{
+	int bb = bb_offset + int_field(&line);
+	int lineno = int_field(&line);
+	int col = int_field(&line);
+	int ret = int_field(&line);
+	int nr = int_field(&line);
+	const char *s = ", ls=\"[";
+
+	outbuf_printf(&out, "    bb%d [shape=ellipse,label=%d,line=%d,col=%d",
+		bb, lineno, lineno, col);
+	while (nr-- > 0) {
+		outbuf_printf(&out, "%s %s", s, next_field(&line));
+		s = ",";
+	}
+	if (s[1] == 0)
+		outbuf_puts(&out, "]\"");
+	if (ret)
+		outbuf_puts(&out, ",op=ret");
+	outbuf_puts(&out, "];\n");
+
+	while (*line) {
+		int child = bb_offset + int_field(&line);
+		int weight = int_field(&line);
+
+		outbuf_printf(&out, "    bb%d -> bb%d [op=br, weight=%d];\n", bb, child, weight);
+	}
+}
+
+static void collect_file(char *file, void *buf, size_t size)
+{
+	char *line = buf, *end = line + size;
+	struct node *func = NULL;
+	int span = 0;
+
+	while (line < end) {
+		char *next = memchr(line, '\n', end - line);
+		char *kind;
+
+		if (!next)
+			break;
+		*next = '\0';
+		kind = next_field(&line);
+
+		switch (kind[0]) {
+		case 'N':
+			span = int_field(&line);
+			break;
+		case 'F': {
+			int entry = int_field(&line);
+			int lineno = int_field(&line);
+			int scope = int_field(&line) ? file_nr : -1;
+			unsigned int name = intern(next_field(&line));
+
+			if (func && format == FORMAT_DOT)
+				outbuf_puts(&out, "}\n");
+			func = new_func(name, scope);
+			func->file = intern(next_field(&line));
+			func->type = intern(next_field(&line));
+			func->line = lineno;
+			func->entry = bb_offset + entry;
+			func->defined = 1;
+			if (format == FORMAT_DOT)
+				dot_cluster(func, func - nodes);
+			break;
+		}
+		case 'B':
+			dot_bb(line);
+			break;
+		case 'C': {
+			struct call *call;
+
+			if (!func)
+				break;
+			calls = grow_array(calls, nr_calls, &max_calls, sizeof(*calls));
+			call = &calls[nr_calls++];
+			call->caller = func - nodes;
+			call->callee = -1;
+			call->bb = bb_offset + int_field(&line);
+			call->line = int_field(&line);
+			call->col = int_field(&line);
+			call->indirect = next_field(&line)[0] == 'i';
+			call->target = intern(next_field(&line));
+			call->scope = file_nr;
+			break;
+		}
+		case 'A': {
+			struct address *addr;
+
+			addresses = grow_array(addresses, nr_addresses, &max_addresses, sizeof(*addresses));
+			addr = &addresses[nr_addresses++];
+			addr->name = intern(next_field(&line));
+			addr->type = intern(next_field(&line));
+			addr->scope = file_nr;
+			break;
+		}
+		}
+		line = next + 1;
+		flush_out();
+	}
+	if (func && format == FORMAT_DOT)
+		outbuf_puts(&out, "}\n");
+
+	file_nr++;
+	bb_offset += span;
+}
+
+/*
+ * The resolution of the calls.
+ */
+static int resolve(unsigned int name, int scope)
+{
+	int n = lookup_func(name, scope);
+
+	if (n < 0)
+		n = lookup_func(name, -1);
+	if (n < 0)
+		n = new_func(name, -1) - nodes;
+	return n;
+}
 
-	printf("}\n");
+static void add_edge(struct call *call, int callee)
+{
+	edges = grow_array(edges, nr_edges, &max_edges, sizeof(*edges));
+	edges[nr_edges] = *call;
+	edges[nr_edges].callee = callee;
+	nr_edges++;
+}
+
+static int *taken_funcs;
+static int nr_taken;
+
+static int by_type(const void *a, const void *b)
+{
+	const struct node *na = &nodes[*(const int *)a];
+	const struct node *nb = &nodes[*(const int *)b];
+
+	if (na->type != nb->type)
+		return na->type < nb->type ? -1 : 1;
+	return *(const int *)a - *(const int *)b;
+}
+
+/* the first of the functions of type 'type' whose address is taken */
+static int first_taken(unsigned int type)
+{
+	int lo = 0, hi = nr_taken;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (nodes[taken_funcs[mid]].type < type)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void resolve_calls(void)
+{
+	int i, j;
+
+	taken_funcs = calloc(nr_addresses + 1, sizeof(int));
+	if (!taken_funcs)
+		die("out of memory");
+	for (i = 0; i < nr_addresses; i++) {
+		struct address *addr = &addresses[i];
+		int n = resolve(addr->name, addr->scope);
+
+		if (nodes[n].taken)
+			continue;
+		nodes[n].taken = 1;
+		if (!nodes[n].defined)
+			nodes[n].type = addr->type;
+		taken_funcs[nr_taken++] = n;
+	}
+	if (nr_taken)
+		qsort(taken_funcs, nr_taken, sizeof(int), by_type);
+
+	for (i = 0; i < nr_calls; i++) {
+		struct call *call = &calls[i];
+
+		if (!call->indirect) {
+			add_edge(call, resolve(call->target, call->scope));
+			continue;
+		}
+		for (j = first_taken(call->target); j < nr_taken; j++) {
+			if (nodes[taken_funcs[j]].type != call->target)
+				break;
+			add_edge(call, taken_funcs[j]);
+		}
+	}
+}
+
+/*
+ * The output.
+ */
+
+/* Bold edges are used for calls with destinations, dotted for the
+ * indirect ones and dashed for calls to external functions */
+static void emit_dot(void)
+{
+	int i;
+
+	for (i = 0; i < nr_edges; i++) {
+		struct call *e = &edges[i];
+		struct node *callee = &nodes[e->callee];
+
+		if (!callee->defined)
+			outbuf_printf(&out, "bb%d -> \"%s\" "
+			       "[label=%d,line=%d,col=%d,op=extern,style=dashed];\n",
+			       e->bb, string(callee->name), e->line, e->line, e->col);
+		else if (e->indirect)
+			outbuf_printf(&out, "bb%d -> bb%d "
+			       "[label=%d,line=%d,col=%d,op=indirect,style=dotted];\n",
+			       e->bb, callee->entry, e->line, e->line, e->col);
+		else
+			outbuf_printf(&out, "bb%d -> bb%d "
+			       "[label=%d,line=%d,col=%d,op=call,style=bold,weight=30];\n",
+			       e->bb, callee->entry, e->line, e->line, e->col);
+		flush_out();
+	}
+	outbuf_puts(&out, "}\n");
+}
+
+static void put_json_string(const char *str)
+{
+	outbuf_putc(&out, '"');
+	for (; *str; str++) {
+		unsigned char c = *str;
+
+		if (c == '"' || c == '\\') {
+			outbuf_putc(&out, '\\');
+			outbuf_putc(&out, c);
+		} else if (c < ' ') {
+			outbuf_printf(&out, "\\u%04x", c);
+		} else {
+			outbuf_putc(&out, c);
+		}
+	}
+	outbuf_putc(&out, '"');
+}
+
+static void emit_json(void)
+{
+	int i;
+
+	outbuf_puts(&out, "{\"functions\": [");
+	for (i = 0; i < nr_nodes; i++) {
+		struct node *node = &nodes[i];
+
+		outbuf_printf(&out, "%s\n {\"id\": %d, \"name\": ", i ? "," : "", i);
+		put_json_string(string(node->name));
+		if (node->defined) {
+			outbuf_puts(&out, ", \"file\": ");
+			put_json_string(string(node->file));
+			outbuf_printf(&out, ", \"line\": %d", node->line);
+		}
+		if (node->type) {
+			outbuf_puts(&out, ", \"type\": ");
+			put_json_string(string(node->type));
+		}
+		outbuf_printf(&out, ", \"static\": %s, \"defined\": %s}",
+			node->scope >= 0 ? "true" : "false",
+			node->defined ? "true" : "false");
+		flush_out();
+	}
+	outbuf_puts(&out, "\n],\n\"calls\": [");
+	for (i = 0; i < nr_edges; i++) {
+		struct call *e = &edges[i];
+
+		outbuf_printf(&out, "%s\n {\"caller\": %d, \"callee\": %d, "
+			"\"line\": %d, \"col\": %d, \"kind\": \"%s\"}",
+			i ? "," : "", e->caller, e->callee, e->line, e->col,
+			e->indirect ? "indirect" : "direct");
+		flush_out();
+	}
+	outbuf_puts(&out, "\n]}\n");
+}
+
+struct bin_header {
+	char magic[4];			/* "SCG\0" */
+	uint32_t version;		/* 1 */
+	uint32_t nr_nodes;
+	uint32_t nr_calls;
+	uint32_t strtab_size;
+};
+
+struct bin_node {
+	uint32_t name, file, type;
+	uint32_t line;
+	uint32_t flags;			/* BIN_STATIC, BIN_DEFINED */
+};
+
+struct bin_call {
+	uint32_t callee;
+	uint32_t line;
+	uint16_t col;
+	uint16_t flags;			/* BIN_INDIRECT */
+};
+
+#define	BIN_STATIC	(1 << 0)
+#define	BIN_DEFINED	(1 << 1)
+#define	BIN_INDIRECT	(1 << 0)
+
+static void emit_binary(void)
+{
+	struct bin_header hdr = { "SCG", 1, nr_nodes, nr_edges };
+	uint32_t *first = calloc(nr_nodes + 1, sizeof(*first));
+	uint32_t *next = calloc(nr_nodes + 1, sizeof(*next));
+	struct bin_call *bcalls = calloc(nr_edges + 1, sizeof(*bcalls));
+	int i;
+
+	if (!first || !next || !bcalls)
+		die("out of memory");
+
+	/* pad the strings */
+	while (strings.len % 4)
+		outbuf_putc(&strings, '\0');
+	hdr.strtab_size = strings.len;
+	outbuf_write(&out, (const char *)&hdr, sizeof(hdr));
+	outbuf_write(&out, strings.buf, strings.len);
+	flush_out();
+
+	for (i = 0; i < nr_nodes; i++) {
+		struct node *node = &nodes[i];
+		struct bin_node bin = {
+			.name = node->name,
+			.file = node->file,
+			.type = node->type,
+			.line = node->line,
+		};
+
+		if (node->scope >= 0)
+			bin.flags |= BIN_STATIC;
+		if (node->defined)
+			bin.flags |= BIN_DEFINED;
+		outbuf_write(&out, (const char *)&bin, sizeof(bin));
+		flush_out();
+	}
+
+	/* group the calls by caller, keeping their order */
+	for (i = 0; i < nr_edges; i++)
+		first[edges[i].caller + 1]++;
+	for (i = 0; i < nr_nodes; i++)
+		first[i + 1] += first[i];
+	memcpy(next, first, nr_nodes * sizeof(*next));
+	for (i = 0; i < nr_edges; i++) {
+		struct call *e = &edges[i];
+		struct bin_call *bin = &bcalls[next[e->caller]++];
+
+		bin->callee = e->callee;
+		bin->line = e->line;
+		bin->col = e->col > UINT16_MAX ? UINT16_MAX : e->col;
+		bin->flags = e->indirect ? BIN_INDIRECT : 0;
+	}
+	outbuf_write(&out, (const char *)first, (nr_nodes + 1) * sizeof(*first));
+	flush_out();
+	outbuf_write(&out, (const char *)bcalls, nr_edges * sizeof(*bcalls));
+
+	free(first);
+	free(next);
+	free(bcalls);
+}
+
+int main(int argc, char **argv)
+{
+	struct string_list *filelist = NULL;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+
+		if (strncmp(arg, "--format=", 9))
+			continue;
+		arg += 9;
+		if (!strcmp(arg, "dot"))
+			format = FORMAT_DOT;
+		else if (!strcmp(arg, "json"))
+			format = FORMAT_JSON;
+		else if (!strcmp(arg, "binary"))
+			format = FORMAT_BINARY;
+		else
+			die("unknown format '%s'", arg);
+	}
+
+	sparse_initialize(argc, argv, &filelist);
+	intern("");
+
+	/* Graph the basic blocks of each file, and index the calls */
+	if (format == FORMAT_DOT)
+		outbuf_puts(&out, "digraph call_graph {\n");
+	for_each_file_job(filelist, graph_file, collect_file);
+
+	resolve_calls();
+	switch (format) {
+	case FORMAT_DOT:
+		emit_dot();
+		break;
+	case FORMAT_JSON:
+		emit_json();
+		break;
+	case FORMAT_BINARY:
+		emit_binary();
+		break;
+	}
+	outbuf_flush(&out, stdout);
 	return 0;
 }
@@ -0,0 +1,324 @@
+// SPDX-License-Identifier: MIT
+//
+// jobs.c - process the symbols or the files with a pool of workers (-j N)
+//
+// Once a file is parsed and evaluated, the processing of each
+// function (expansion, linearization, optimization and checking)
+// doesn't depend on the other ones. But the state of all these
+// phases (the allocators, the optimizer's tables, the warning
+// limits, ...) is global, so instead of threads, the workers are
+// forked processes: each of them get a private copy of the whole
+// state for free.
+//
+// The symbols are dealt round-robin to the workers which write
+// their output in a temporary file. The offsets in these files
+// of the output of each symbol are recorded in a shared table,
+// so the outputs can then be replayed in the order of the
+// symbols, independently of the number of workers or of which
+// one finished first. The limits on the number of diagnostics
+// are applied during this replay, by the parent, since they
+// depend on all the diagnostics which precede.
+//
+// The same is done for whole files, by sparse-llvm, but with a
+// worker for each file, forked from the state preceding all the
+// files, with up to N of them running at once: so each file is
+// processed from the same state, whatever the number of workers.
+// The parent then collects the outputs, again in the order of the
+// files.
+//
+// For -fmem-report and -ftime-report, each worker also leaves its
+// statistics in the shared table, for the parent to add them up.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "lib.h"
+#include "symbol.h"
+#include "jobs.h"
+
+struct output {
+	off_t start, end;
+};
+
+struct job_output {
+	struct output out, err;
+};
+
+struct worker {
+	pid_t pid;
+	int status;
+	int running;
+	int own_files;
+	FILE *out, *err;
+};
+
+/*
+ * The end of the output of an item a worker has started but not
+ * finished: it died while processing it, from a die() for example.
+ */
+#define	JOB_FAILED	((off_t)-1)
+
+static off_t position(FILE *file, int fd)
+{
+	fflush(file);
+	return lseek(fd, 0, SEEK_CUR);
+}
+
+typedef void (*job_fn_t)(void *item);
+typedef void (*collect_fn_t)(void *item, void *buf, size_t size);
+
+/*
+ * A worker only exits normally with a zero status: anything else,
+ * like the status 1 of die() or of error_die(), is a failure. Its
+ * diagnostics are tagged: their limits are applied by the parent.
+ * So are its statistics, saved in 'stats' if not NULL.
+ */
+static void run_worker(struct ptr_list *list, job_fn_t fn,
+	struct job_output *outputs, int nr, int nr_workers, struct worker *w,
+	void *stats)
+{
+	void *item;
+	int i = 0;
+
+	if (dup2(fileno(w->out), STDOUT_FILENO) < 0 ||
+	    dup2(fileno(w->err), STDERR_FILENO) < 0)
+		_exit(127);
+	tag_diagnostics = 1;
+	if (stats)
+		clear_worker_stats();
+
+	FOR_EACH_PTR_NOTAG(list, item) {
+		struct job_output *o = &outputs[i];
+
+		if (i++ % nr_workers != nr)
+			continue;
+		o->out.start = position(stdout, STDOUT_FILENO);
+		o->err.start = position(stderr, STDERR_FILENO);
+		o->out.end = o->err.end = JOB_FAILED;
+		fn(item);
+		o->out.end = position(stdout, STDOUT_FILENO);
+		o->err.end = position(stderr, STDERR_FILENO);
+	} END_FOR_EACH_PTR_NOTAG(item);
+
+	if (stats)
+		save_worker_stats(stats);
+	fflush(stdout);
+	fflush(stderr);
+	_exit(0);
+}
+
+/*
+ * Read the output of an item. For a failed item, that's what
+ * was written up to the death of its worker.
+ */
+static char *read_output(FILE *file, struct output *o, size_t *sizep)
+{
+	off_t end = o->end;
+	size_t size;
+	char *buf;
+
+	if (end == JOB_FAILED) {
+		struct stat st;
+
+		if (fstat(fileno(file), &st) < 0)
+			die("error while reading the output of a job");
+		end = st.st_size;
+	}
+	size = end - o->start;
+	buf = malloc(size ? : 1);
+	if (!buf)
+		die("out of memory");
+	if (pread(fileno(file), buf, size, o->start) != size)
+		die("error while reading the output of a job");
+	*sizep = size;
+	return buf;
+}
+
+/*
+ * Wait for 'w' or, if NULL, for any of the running workers,
+ * and return it.
+ */
+static struct worker *wait_worker(struct worker *workers, int nr_workers, struct worker *w)
+{
+	int status, i;
+	pid_t pid;
+
+	pid = waitpid(w ? w->pid : -1, &status, 0);
+	if (pid < 0)
+		die("can't wait for a job");
+	for (i = 0; i < nr_workers; i++) {
+		w = &workers[i];
+		if (w->running && w->pid == pid) {
+			w->status = status;
+			w->running = 0;
+			return w;
+		}
+	}
+	die("unknown job");
+}
+
+/*
+ * Run 'fn' on each item of 'list' with 'nr_workers' workers, the
+ * items being dealt round-robin to them, up to 'max_running' of
+ * them running at once, then
+ * give the output of each item, in order, to 'collect_fn' or, if
+ * there is none, replay it on stdout. The diagnostics are always
+ * replayed on stderr. The items can be unaligned pointers, like
+ * the names of the files, so the list is walked without tags.
+ *
+ * If a worker dies while processing an item, the outputs are
+ * replayed up to this item, the partial diagnostics of which
+ * are replayed too, and we exit like the worker did.
+ */
+static void run_jobs(struct ptr_list *list, int nr_workers, int max_running,
+	job_fn_t fn, collect_fn_t collect_fn)
+{
+	int nr = ptr_list_size(list);
+	size_t stats_size = worker_stats_size();
+	struct job_output *outputs;
+	struct worker *workers, *failed = NULL;
+	char *stats;
+	void *item;
+	size_t size, table_size;
+	int running = 0;
+	int crashed = 0;
+	int i;
+
+	/* the outputs of the items, then the statistics of the workers */
+	table_size = nr * sizeof(*outputs) + nr_workers * stats_size;
+	outputs = mmap(NULL, table_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (outputs == MAP_FAILED)
+		die("out of memory");
+	stats = (char *)(outputs + nr);
+	workers = calloc(nr_workers, sizeof(*workers));
+	if (!workers)
+		die("out of memory");
+
+	fflush(stdout);
+	fflush(stderr);
+	for (i = 0; i < nr_workers; i++) {
+		struct worker *w = &workers[i];
+
+		/*
+		 * A new worker appends to the files of the one it replaces,
+		 * unless it failed: the end of its output is then the end
+		 * of the files.
+		 */
+		if (running == max_running) {
+			struct worker *done = wait_worker(workers, i, NULL);
+
+			if (WIFEXITED(done->status) && !WEXITSTATUS(done->status)) {
+				w->out = done->out;
+				w->err = done->err;
+			}
+			running--;
+		}
+		if (!w->out) {
+			w->out = tmpfile();
+			w->err = tmpfile();
+			if (!w->out || !w->err)
+				die("can't create the output files for the jobs");
+			w->own_files = 1;
+		}
+		w->pid = fork();
+		if (w->pid < 0)
+			die("can't create a job");
+		if (w->pid == 0)
+			run_worker(list, fn, outputs, i, nr_workers, w,
+				stats_size ? stats + i * stats_size : NULL);
+		w->running = 1;
+		running++;
+	}
+
+	for (i = 0; i < nr_workers; i++) {
+		struct worker *w = &workers[i];
+
+		if (w->running)
+			wait_worker(workers, nr_workers, w);
+		if (!WIFEXITED(w->status) || WEXITSTATUS(w->status))
+			crashed = 1;
+		else if (stats_size)
+			add_worker_stats(stats + i * stats_size);
+	}
+
+	i = 0;
+	FOR_EACH_PTR_NOTAG(list, item) {
+		struct worker *w = &workers[i % nr_workers];
+		struct job_output *o = &outputs[i++];
+		char *buf;
+
+		if (o->out.end == JOB_FAILED)
+			failed = w;
+		if (!failed || !collect_fn) {
+			buf = read_output(w->out, &o->out, &size);
+			if (!failed && collect_fn)
+				collect_fn(item, buf, size);
+			else
+				fwrite(buf, 1, size, stdout);
+			free(buf);
+		}
+		fflush(stdout);
+		buf = read_output(w->err, &o->err, &size);
+		replay_diagnostics(buf, size);
+		free(buf);
+		if (failed)
+			goto out;
+	} END_FOR_EACH_PTR_NOTAG(item);
+out:
+	fflush(stdout);
+
+	for (i = 0; i < nr_workers; i++) {
+		if (!workers[i].own_files)
+			continue;
+		fclose(workers[i].out);
+		fclose(workers[i].err);
+	}
+	munmap(outputs, table_size);
+
+	if (failed && WIFEXITED(failed->status))
+		exit(WEXITSTATUS(failed->status));
+	if (crashed)
+		die("a job terminated abnormally");
+	free(workers);
+}
+
+/*
+ * Call 'fn' on each symbol of 'list', using up to 'nr_jobs'
+ * worker processes. Since each worker has its own copy of the
+ * state, 'fn' can only report its results via its output.
+ */
+void for_each_symbol_job(struct symbol_list *list, void (*fn)(struct symbol *))
+{
+	int nr = symbol_list_size(list);
+	int nr_workers = nr_jobs < nr ? nr_jobs : nr;
+
+	if (nr_workers <= 1) {
+		struct symbol *sym;
+
+		FOR_EACH_PTR(list, sym) {
+			fn(sym);
+		} END_FOR_EACH_PTR(sym);
+		return;
+	}
+	run_jobs((struct ptr_list *)list, nr_workers, nr_workers, (job_fn_t)fn, NULL);
+}
+
+/*
+ * Call 'fn' on each file of 'list', each in its own worker process,
+ * up to 'nr_jobs' of them (at least one) running at once, then
+ * 'collect' on each of them, in order, with what 'fn' has written
+ * on stdout for this file.
+ */
+void for_each_file_job(struct string_list *list, void (*fn)(char *file),
+	void (*collect)(char *file, void *buf, size_t size))
+{
+	int nr = ptr_list_size((struct ptr_list *)list);
+	int max_running = nr_jobs > 1 ? nr_jobs : 1;
+
+	if (!nr)
+		return;
+	run_jobs((struct ptr_list *)list, nr, max_running, (job_fn_t)fn, (collect_fn_t)collect);
+}
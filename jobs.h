@@ -0,0 +1,15 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stddef.h>
+
+struct symbol;
+struct symbol_list;
+struct string_list;
+
+/* jobs.c */
+void for_each_symbol_job(struct symbol_list *list, void (*fn)(struct symbol *));
+void for_each_file_job(struct string_list *list, void (*fn)(char *file),
+	void (*collect)(char *file, void *buf, size_t size));
+
+#endif
@@ -43,6 +43,7 @@
 #include "scope.h"
 #include "linearize.h"
 #include "target.h"
+#include "timer.h"
 #include "version.h"
 
 int verbose, optimize_level, optimize_size, preprocessing;
@@ -102,7 +103,27 @@ unsigned int hexval(unsigned int c)
 	return retval;
 }
 
-static void do_warn(const char *type, struct position pos, const char * fmt, va_list args)
+/*
+ * With -j, the diagnostics are written by worker processes and
+ * only replayed later, in order, by the parent (see jobs.c). The
+ * limits on their number depend on all the diagnostics preceding
+ * them, so the workers can't apply these limits: they write all
+ * their diagnostics, tagged with their kind and with the length
+ * of their position, and replay_diagnostics() applies the limits
+ * in the parent.
+ */
+int tag_diagnostics = 0;
+
+#define	DIAG_TAG	'\0'
+
+enum diag_kind {
+	DIAG_NONE,			/* not limited, never tagged */
+	DIAG_INFO = 'I',
+	DIAG_WARNING = 'W',
+	DIAG_ERROR = 'E',
+};
+
+static void do_warn(enum diag_kind kind, const char *type, struct position pos, const char * fmt, va_list args)
 {
 	static char buffer[512];
 	const char *name;
@@ -111,43 +132,138 @@ static void do_warn(const char *type, struct position pos, const char * fmt, va_
 	name = stream_name(pos.stream);
 		
 	fflush(stdout);
+	if (tag_diagnostics && kind != DIAG_NONE) {
+		int len = snprintf(NULL, 0, "%s:%d:%d: ", name, pos.line, pos.pos);
+		fprintf(stderr, "%c%c%d:", DIAG_TAG, kind, len);
+	}
 	fprintf(stderr, "%s:%d:%d: %s%s\n",
 		name, pos.line, pos.pos, type, buffer);
 }
 
 unsigned int fmax_warnings = 100;
 static int show_info = 1;
+static int nr_errors = 0;
+
+/*
+ * Apply the limits to a diagnostic: return the message to show,
+ * which can be "too many ..." instead of 'fmt', or NULL if the
+ * diagnostic must be dropped.
+ */
+static const char *limit_diagnostic(enum diag_kind kind, const char *fmt)
+{
+	static int once = 0;
+
+	switch (kind) {
+	case DIAG_INFO:
+		return show_info ? fmt : NULL;
+	case DIAG_WARNING:
+		if (!fmax_warnings || has_error) {
+			show_info = 0;
+			return NULL;
+		}
+		if (!--fmax_warnings) {
+			show_info = 0;
+			fmt = "too many warnings";
+		}
+		return fmt;
+	case DIAG_ERROR:
+		die_if_error = 1;
+		show_info = 1;
+		/* Shut up warnings after an error */
+		has_error |= ERROR_CURR_PHASE;
+		if (nr_errors > 100) {
+			show_info = 0;
+			if (once)
+				return NULL;
+			fmt = "too many errors";
+			once = 1;
+		}
+		nr_errors++;
+		return fmt;
+	default:
+		return fmt;
+	}
+}
+
+static void do_diagnostic(enum diag_kind kind, const char *type, struct position pos, const char * fmt, va_list args)
+{
+	if (tag_diagnostics) {
+		if (kind == DIAG_ERROR) {
+			die_if_error = 1;
+			has_error |= ERROR_CURR_PHASE;
+		}
+	} else {
+		fmt = limit_diagnostic(kind, fmt);
+		if (!fmt)
+			return;
+	}
+	do_warn(kind, type, pos, fmt, args);
+}
+
+static const char *diag_type(enum diag_kind kind)
+{
+	switch (kind) {
+	case DIAG_WARNING:
+		return "warning: ";
+	case DIAG_ERROR:
+		return "error: ";
+	default:
+		return "";
+	}
+}
+
+/*
+ * Write on stderr the output of a worker, as it would have been
+ * written without -j: the tagged diagnostics are subject to the
+ * limits, anything else is written as is.
+ */
+void replay_diagnostics(const char *buf, size_t size)
+{
+	const char *end = buf + size;
+
+	while (buf < end) {
+		const char *eol = memchr(buf, '\n', end - buf);
+		const char *line, *msg;
+		enum diag_kind kind;
+		unsigned long len;
+		char *pos;
+
+		eol = eol ? eol + 1 : end;
+		if (*buf != DIAG_TAG || eol - buf < 3) {
+			fwrite(buf, 1, eol - buf, stderr);
+			buf = eol;
+			continue;
+		}
+		kind = buf[1];
+		len = strtoul(buf + 2, &pos, 10);
+		line = pos + 1;
+		buf = eol;
+		if (line + len > eol)
+			continue;
+
+		msg = limit_diagnostic(kind, line);
+		if (msg == line) {
+			fwrite(line, 1, eol - line, stderr);
+		} else if (msg) {
+			fwrite(line, 1, len, stderr);
+			fprintf(stderr, "%s%s\n", diag_type(kind), msg);
+		}
+	}
+}
 
 void info(struct position pos, const char * fmt, ...)
 {
 	va_list args;
 
-	if (!show_info)
-		return;
 	va_start(args, fmt);
-	do_warn("", pos, fmt, args);
+	do_diagnostic(DIAG_INFO, "", pos, fmt, args);
 	va_end(args);
 }
 
 static void do_error(struct position pos, const char * fmt, va_list args)
 {
-	static int errors = 0;
-        die_if_error = 1;
-	show_info = 1;
-	/* Shut up warnings after an error */
-	has_error |= ERROR_CURR_PHASE;
-	if (errors > 100) {
-		static int once = 0;
-		show_info = 0;
-		if (once)
-			return;
-		fmt = "too many errors";
-		once = 1;
-	}
-
-	do_warn("error: ", pos, fmt, args);
-	errors++;
-}	
+	do_diagnostic(DIAG_ERROR, diag_type(DIAG_ERROR), pos, fmt, args);
+}
 
 void warning(struct position pos, const char * fmt, ...)
 {
@@ -160,18 +276,8 @@ void warning(struct position pos, const char * fmt, ...)
 		return;
 	}
 
-	if (!fmax_warnings || has_error) {
-		show_info = 0;
-		return;
-	}
-
-	if (!--fmax_warnings) {
-		show_info = 0;
-		fmt = "too many warnings";
-	}
-
 	va_start(args, fmt);
-	do_warn("warning: ", pos, fmt, args);
+	do_diagnostic(DIAG_WARNING, diag_type(DIAG_WARNING), pos, fmt, args);
 	va_end(args);
 }
 
@@ -197,7 +303,7 @@ void error_die(struct position pos, const char * fmt, ...)
 {
 	va_list args;
 	va_start(args, fmt);
-	do_warn("error: ", pos, fmt, args);
+	do_warn(DIAG_NONE, "error: ", pos, fmt, args);
 	va_end(args);
 	exit(1);
 }
@@ -261,11 +367,18 @@ int dbg_dead = 0;
 
 unsigned long fdump_ir;
 int fmem_report = 0;
+int fverify = 1;
+int ftime_report = 0;
+unsigned int ftime_report_functions = 0;
 unsigned long long fmemcpy_max_count = 100000;
 unsigned long fpasses = ~0UL;
 int funsigned_char = 0;
 
+unsigned int nr_jobs = 1;
+
 int preprocess_only;
+int compile_only;
+const char *output_file;
 
 static enum { STANDARD_C89,
               STANDARD_C94,
@@ -346,6 +459,13 @@ static char **handle_switch_D(char *arg, char **next)
 	return next;
 }
 
+static char **handle_switch_c(char *arg, char **next)
+{
+	if (arg[1] == '\0')
+		compile_only = 1;
+	return next;
+}
+
 static char **handle_switch_E(char *arg, char **next)
 {
 	if (arg[1] == '\0')
@@ -622,8 +742,10 @@ static char **handle_switch_o(char *arg, char **next)
 	if (!strcmp (arg, "o")) {       // "-o foo"
 		if (!*++next)
 			die("argument to '-o' is missing");
+		output_file = *next;
+	} else {			// "-ofoo"
+		output_file = arg + 1;
 	}
-	// else "-ofoo"
 
 	return next;
 }
@@ -868,6 +990,35 @@ static int handle_fdump_ir(const char *arg, const char *opt, const struct flag *
 	return handle_suboption_mask(arg, opt, dump_ir_options, &fdump_ir);
 }
 
+static int handle_ftime_report(const char *arg, const char *opt, const struct flag *flag, int options)
+{
+	if (options & OPT_INVERSE) {
+		ftime_report = 0;
+		return 1;
+	}
+	if (*opt == '\0') {
+		ftime_report = TIME_REPORT_TEXT;
+		return 1;
+	}
+	if (*opt++ != '=')
+		return 0;
+	if (!strcmp(opt, "text"))
+		ftime_report = TIME_REPORT_TEXT;
+	else if (!strcmp(opt, "json"))
+		ftime_report = TIME_REPORT_JSON;
+	else
+		die("error: wrong option '%s' for '%s'", opt, arg);
+	return 1;
+}
+
+static int handle_ftime_report_functions(const char *arg, const char *opt, const struct flag *flag, int options)
+{
+	opt_uint(arg, opt, &ftime_report_functions, 0);
+	if (!ftime_report)
+		ftime_report = TIME_REPORT_TEXT;
+	return 1;
+}
+
 static int handle_fmemcpy_max_count(const char *arg, const char *opt, const struct flag *flag, int options)
 {
 	opt_ullong(arg, opt, &fmemcpy_max_count, OPTNUM_ZERO_IS_INF|OPTNUM_UNLIMITED);
@@ -884,10 +1035,15 @@ static struct flag fflags[] = {
 	{ "dump-ir",		NULL,	handle_fdump_ir },
 	{ "max-warnings=",	NULL,	handle_fmax_warnings },
 	{ "mem-report",		&fmem_report },
+	{ "verify",		&fverify },
 	{ "memcpy-max-count=",	NULL,	handle_fmemcpy_max_count },
 	{ "tabstop=",		NULL,	handle_ftabstop },
+	{ "time-report-functions=", NULL, handle_ftime_report_functions },
+	{ "time-report",	NULL,	handle_ftime_report },
 	{ "mem2reg",		NULL,	handle_fpasses,	PASS_MEM2REG },
 	{ "optim",		NULL,	handle_fpasses,	PASS_OPTIM },
+	{ "sccp",		NULL,	handle_fpasses,	PASS_SCCP },
+	{ "dce",		NULL,	handle_fpasses,	PASS_DCE },
 	{ "signed-char",	&funsigned_char, NULL,	OPT_INVERSE },
 	{ "unsigned-char",	&funsigned_char, NULL, },
 	{ },
@@ -909,6 +1065,20 @@ static char **handle_switch_G(char *arg, char **next)
 		return next;     // "-G0" or (bogus) terminal "-G"
 }
 
+static char **handle_switch_j(char *arg, char **next)
+{
+	const char *opt = arg + 1;
+
+	if (!*opt) {			// "-j N"
+		opt = *++next;
+		if (!opt)
+			die("argument to '-j' is missing");
+	}
+	// else "-jN"
+	opt_uint(arg, opt, &nr_jobs, 0);
+	return next;
+}
+
 static char **handle_switch_a(char *arg, char **next)
 {
 	if (!strcmp (arg, "ansi"))
@@ -1036,6 +1206,7 @@ static char **handle_switch(char *arg, char **next)
 {
 	switch (*arg) {
 	case 'a': return handle_switch_a(arg, next);
+	case 'c': return handle_switch_c(arg, next);
 	case 'D': return handle_switch_D(arg, next);
 	case 'd': return handle_switch_d(arg, next);
 	case 'E': return handle_switch_E(arg, next);
@@ -1044,6 +1215,7 @@ static char **handle_switch(char *arg, char **next)
 	case 'G': return handle_switch_G(arg, next);
 	case 'I': return handle_switch_I(arg, next);
 	case 'i': return handle_switch_i(arg, next);
+	case 'j': return handle_switch_j(arg, next);
 	case 'M': return handle_switch_M(arg, next);
 	case 'm': return handle_switch_m(arg, next);
 	case 'n': return handle_switch_n(arg, next);
@@ -1228,7 +1400,9 @@ static struct symbol_list *sparse_tokenstream(struct token *token)
 	int builtin = token && !token->pos.stream;
 
 	// Preprocess the stream
+	timer_start(PASS__PREPROCESS);
 	token = preprocess(token);
+	timer_stop(PASS__PREPROCESS);
 
 	if (dump_macro_defs && !builtin)
 		dump_macro_definitions();
@@ -1255,8 +1429,10 @@ static struct symbol_list *sparse_tokenstream(struct token *token)
 	}
 
 	// Parse the resulting C code
+	timer_start(PASS__PARSE);
 	while (!eof_token(token))
 		token = external_declaration(token, &translation_unit_used_list, NULL);
+	timer_stop(PASS__PARSE);
 	return translation_unit_used_list;
 }
 
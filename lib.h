@@ -104,29 +104,56 @@ extern void warning(struct position, const char *, ...) FORMAT_ATTR(2);
 extern void sparse_error(struct position, const char *, ...) FORMAT_ATTR(2);
 extern void expression_error(struct expression *, const char *, ...) FORMAT_ATTR(2);
 
+extern int tag_diagnostics;
+extern void replay_diagnostics(const char *buf, size_t size);
+
 #define	ERROR_CURR_PHASE	(1 << 0)
 #define	ERROR_PREV_PHASE	(1 << 1)
 extern int has_error;
 
 
+/*
+ * The phases which can be dumped, disabled or, like the finer
+ * ones which have no PASS_* flag, timed by -ftime-report.
+ */
 enum phase {
+	PASS__TOKENIZE,
+	PASS__PREPROCESS,
 	PASS__PARSE,
+	PASS__EVALUATE,
+	PASS__EXPAND,
 	PASS__LINEARIZE,
 	PASS__MEM2REG,
 	PASS__OPTIM,
+	PASS__MEMOPS,
+	PASS__SCCP,
+	PASS__SIMPLIFY,
+	PASS__CSE,
+	PASS__FLOW,
+	PASS__DCE,
+	PASS__LIVENESS,
+	PASS__CHECK,
 	PASS__FINAL,
+	PASS__NR,
 };
 
 #define	PASS_PARSE		(1UL << PASS__PARSE)
 #define	PASS_LINEARIZE		(1UL << PASS__LINEARIZE)
 #define	PASS_MEM2REG		(1UL << PASS__MEM2REG)
 #define	PASS_OPTIM		(1UL << PASS__OPTIM)
+#define	PASS_SCCP		(1UL << PASS__SCCP)
+#define	PASS_DCE		(1UL << PASS__DCE)
 #define	PASS_FINAL		(1UL << PASS__FINAL)
 
+#define	TIME_REPORT_TEXT	1
+#define	TIME_REPORT_JSON	2
+
 
 extern void add_pre_buffer(const char *fmt, ...) FORMAT_ATTR(1);
 
 extern int preprocess_only;
+extern int compile_only;
+extern const char *output_file;
 
 extern int Waddress;
 extern int Waddress_space;
@@ -170,11 +197,16 @@ extern int dbg_dead;
 
 extern unsigned int fmax_warnings;
 extern int fmem_report;
+extern int fverify;
+extern int ftime_report;
+extern unsigned int ftime_report_functions;
 extern unsigned long fdump_ir;
 extern unsigned long long fmemcpy_max_count;
 extern unsigned long fpasses;
 extern int funsigned_char;
 
+extern unsigned int nr_jobs;
+
 extern int arch_m64;
 extern int arch_msize_long;
 extern int arch_big_endian;
@@ -185,6 +217,10 @@ extern struct symbol_list *__sparse(char *filename);
 extern struct symbol_list *sparse_keep_tokens(char *filename);
 extern struct symbol_list *sparse(char *filename);
 extern void report_stats(void);
+extern size_t worker_stats_size(void);
+extern void clear_worker_stats(void);
+extern void save_worker_stats(void *buf);
+extern void add_worker_stats(const void *buf);
 
 static inline int symbol_list_size(struct symbol_list *list)
 {
@@ -22,6 +22,7 @@
 #include "optimize.h"
 #include "flow.h"
 #include "target.h"
+#include "timer.h"
 
 static pseudo_t linearize_statement(struct entrypoint *ep, struct statement *stmt);
 static pseudo_t linearize_expression(struct entrypoint *ep, struct expression *expr);
@@ -777,6 +778,153 @@ pseudo_t alloc_pseudo(struct instruction *def)
 	return pseudo;
 }
 
+/*
+ * Call 'fn' on the address of each pseudo used by 'insn'.
+ */
+void for_each_use(struct instruction *insn, void (*fn)(pseudo_t *))
+{
+	struct asm_constraint *entry;
+	pseudo_t pseudo;
+
+	switch (insn->opcode) {
+	case OP_RET:
+	case OP_COMPUTEDGOTO:
+		fn(&insn->src);
+		break;
+
+	case OP_CBR:
+	case OP_SWITCH:
+		fn(&insn->cond);
+		break;
+
+	case OP_SEL:
+	case OP_RANGE:
+		fn(&insn->src3);
+		/* fall through */
+	case OP_BINARY ... OP_BINARY_END:
+	case OP_FPCMP ... OP_FPCMP_END:
+	case OP_BINCMP ... OP_BINCMP_END:
+		fn(&insn->src2);
+		/* fall through */
+	case OP_NOT: case OP_NEG: case OP_FNEG:
+	case OP_CAST:
+	case OP_SCAST:
+	case OP_FPCAST:
+	case OP_PTRCAST:
+	case OP_LOAD:
+	case OP_COPY:
+		fn(&insn->src1);
+		break;
+
+	case OP_STORE:
+		fn(&insn->src);
+		fn(&insn->target);
+		break;
+
+	case OP_SYMADDR:
+		fn(&insn->symbol);
+		break;
+
+	case OP_SLICE:
+		fn(&insn->base);
+		break;
+
+	case OP_PHI:
+		FOR_EACH_PTR(insn->phi_list, pseudo) {
+			fn(THIS_ADDRESS(pseudo));
+		} END_FOR_EACH_PTR(pseudo);
+		break;
+
+	case OP_PHISOURCE:
+		fn(&insn->phi_src);
+		break;
+
+	case OP_CALL:
+		fn(&insn->func);
+		/* fall through */
+	case OP_INLINED_CALL:
+		FOR_EACH_PTR(insn->arguments, pseudo) {
+			fn(THIS_ADDRESS(pseudo));
+		} END_FOR_EACH_PTR(pseudo);
+		break;
+
+	case OP_ASM:
+		FOR_EACH_PTR(insn->asm_rules->inputs, entry) {
+			fn(&entry->pseudo);
+		} END_FOR_EACH_PTR(entry);
+		break;
+
+	default:
+		break;
+	}
+}
+
+void number_pseudo(struct entrypoint *ep, pseudo_t pseudo)
+{
+	if (pseudo_numbered(ep, pseudo))
+		return;
+	if (ep->nr_pseudos == ep->max_pseudos) {
+		ep->max_pseudos = ep->max_pseudos ? 2 * ep->max_pseudos : 64;
+		ep->pseudos = realloc(ep->pseudos, ep->max_pseudos * sizeof(pseudo_t));
+		if (!ep->pseudos)
+			die("out of memory");
+	}
+	pseudo->id = ep->nr_pseudos++;
+	ep->pseudos[pseudo->id] = pseudo;
+}
+
+/*
+ * Number the pseudos defined by the instructions still alive,
+ * plus the arguments, in the order of their definition.
+ * After unssa(), the temporaries (which have no ->def, being
+ * defined by several copies) are numbered at their first copy.
+ */
+void number_pseudos(struct entrypoint *ep)
+{
+	struct basic_block *bb;
+	pseudo_t pseudo;
+
+	ep->nr_pseudos = 0;
+	FOR_EACH_PTR(ep->entry->arg_list, pseudo) {
+		number_pseudo(ep, pseudo);
+	} END_FOR_EACH_PTR(pseudo);
+
+	FOR_EACH_PTR(ep->bbs, bb) {
+		struct instruction *insn;
+
+		FOR_EACH_PTR(bb->insns, insn) {
+			struct asm_constraint *entry;
+
+			if (!insn->bb)
+				continue;
+			if (insn->opcode == OP_ASM) {
+				FOR_EACH_PTR(insn->asm_rules->outputs, entry) {
+					if (entry->pseudo->type == PSEUDO_REG)
+						number_pseudo(ep, entry->pseudo);
+				} END_FOR_EACH_PTR(entry);
+				continue;
+			}
+			pseudo = insn->target;
+			if (!pseudo)
+				continue;
+			if (pseudo->type != PSEUDO_REG && pseudo->type != PSEUDO_PHI)
+				continue;
+			// stores & deathnotes have a target they don't define
+			if (pseudo->def == insn || !pseudo->def)
+				number_pseudo(ep, pseudo);
+		} END_FOR_EACH_PTR(insn);
+	} END_FOR_EACH_PTR(bb);
+}
+
+void *__alloc_pseudo_table(struct entrypoint *ep, size_t size)
+{
+	void *table = calloc(ep->nr_pseudos ? : 1, size);
+
+	if (!table)
+		die("out of memory");
+	return table;
+}
+
 static pseudo_t symbol_pseudo(struct entrypoint *ep, struct symbol *sym)
 {
 	pseudo_t pseudo;
@@ -798,12 +946,13 @@ static pseudo_t symbol_pseudo(struct entrypoint *ep, struct symbol *sym)
 	return pseudo;
 }
 
+#define MAX_VAL_HASH 64
+static struct pseudo_list *value_pseudo_hash[MAX_VAL_HASH];
+
 pseudo_t value_pseudo(long long val)
 {
-#define MAX_VAL_HASH 64
-	static struct pseudo_list *prev[MAX_VAL_HASH];
 	int hash = val & (MAX_VAL_HASH-1);
-	struct pseudo_list **list = prev + hash;
+	struct pseudo_list **list = value_pseudo_hash + hash;
 	pseudo_t pseudo;
 
 	FOR_EACH_PTR(*list, pseudo) {
@@ -2222,6 +2371,54 @@ static struct entrypoint *linearize_fn(struct symbol *sym, struct symbol *base_t
 	return ep;
 }
 
+static void open_ir_arena(struct ir_arena *arena)
+{
+	mark_entrypoint_alloc(&arena->entrypoint);
+	mark_basic_block_alloc(&arena->basic_block);
+	mark_instruction_alloc(&arena->instruction);
+	mark_multijmp_alloc(&arena->multijmp);
+	mark_pseudo_alloc(&arena->pseudo);
+	mark_pseudo_user_alloc(&arena->pseudo_user);
+	mark_asm_rules_alloc(&arena->asm_rules);
+	mark_asm_constraint_alloc(&arena->asm_constraint);
+	mark_ptrlist_alloc(arena->ptrlist);
+}
+
+static void release_ir_arena(struct ir_arena *arena)
+{
+	release_ptrlist_alloc(arena->ptrlist);
+	release_asm_constraint_alloc(&arena->asm_constraint);
+	release_asm_rules_alloc(&arena->asm_rules);
+	release_pseudo_user_alloc(&arena->pseudo_user);
+	release_pseudo_alloc(&arena->pseudo);
+	release_multijmp_alloc(&arena->multijmp);
+	release_instruction_alloc(&arena->instruction);
+	release_basic_block_alloc(&arena->basic_block);
+	release_entrypoint_alloc(&arena->entrypoint);
+}
+
+/*
+ * Free all the memory used by the IR of a function.
+ *
+ * The entrypoints must be freed in the reverse order they
+ * were linearized and, of course, nothing of their IR can
+ * be used after this, including the pseudos of the symbols.
+ */
+void free_entrypoint(struct entrypoint *ep)
+{
+	struct ir_arena arena = ep->arena;
+	pseudo_t pseudo;
+
+	FOR_EACH_PTR(ep->accesses, pseudo) {
+		pseudo->sym->pseudo = NULL;
+	} END_FOR_EACH_PTR(pseudo);
+	ep->name->ep = NULL;
+	free(ep->pseudos);
+	memset(value_pseudo_hash, 0, sizeof(value_pseudo_hash));
+
+	release_ir_arena(&arena);
+}
+
 struct entrypoint *linearize_symbol(struct symbol *sym)
 {
 	struct symbol *base_type;
@@ -2232,7 +2429,21 @@ struct entrypoint *linearize_symbol(struct symbol *sym)
 	base_type = sym->ctype.base_type;
 	if (!base_type)
 		return NULL;
-	if (base_type->type == SYM_FN)
-		return linearize_fn(sym, base_type);
+	if (base_type->type == SYM_FN) {
+		struct ir_arena arena;
+		struct entrypoint *ep;
+
+		timer_start_function();
+		timer_start(PASS__LINEARIZE);
+		open_ir_arena(&arena);
+		ep = linearize_fn(sym, base_type);
+		if (ep)
+			ep->arena = arena;
+		else
+			release_ir_arena(&arena);
+		timer_stop(PASS__LINEARIZE);
+		timer_stop_function(sym);
+		return ep;
+	}
 	return NULL;
 }
@@ -3,6 +3,7 @@
 
 #include "lib.h"
 #include "allocate.h"
+#include "ptrset.h"
 #include "token.h"
 #include "opcode.h"
 #include "parse.h"
@@ -17,6 +18,7 @@ struct pseudo_user {
 
 DECLARE_ALLOCATOR(pseudo_user);
 DECLARE_PTR_LIST(pseudo_user_list, struct pseudo_user);
+DECLARE_PTR_SET(pseudo_set, struct pseudo);
 
 
 enum pseudo_type {
@@ -30,6 +32,7 @@ enum pseudo_type {
 
 struct pseudo {
 	int nr;
+	unsigned int id;		/* dense number, see number_pseudos() */
 	enum pseudo_type type;
 	struct pseudo_user_list *users;
 	struct ident *ident;
@@ -263,6 +266,8 @@ struct basic_block {
 	struct basic_block_list *children; /* destinations */
 	struct instruction_list *insns;	/* Linear list of instructions */
 	struct pseudo_list *needs, *defines;
+	struct bb_live_sets *live;	/* private to liveness.c */
+	struct bb_storage *storage;	/* private to storage.c */
 	union {
 		unsigned int nr;	/* unique id for label's names */
 		void *priv;
@@ -356,15 +361,72 @@ static inline void replace_bb_in_list(struct basic_block_list **list,
 	replace_ptr_list_entry((struct ptr_list **)list, old, new, count);
 }
 
+/*
+ * Where the allocators were before the linearization of a
+ * function: everything after it is the function's IR.
+ */
+struct ir_arena {
+	struct allocator_mark entrypoint;
+	struct allocator_mark basic_block;
+	struct allocator_mark instruction;
+	struct allocator_mark multijmp;
+	struct allocator_mark pseudo;
+	struct allocator_mark pseudo_user;
+	struct allocator_mark asm_rules;
+	struct allocator_mark asm_constraint;
+	struct allocator_mark ptrlist[PTR_LIST_ORDERS];
+};
+
 struct entrypoint {
+	struct ir_arena arena;
 	struct symbol *name;
 	struct symbol_list *syms;
 	struct pseudo_list *accesses;
 	struct basic_block_list *bbs;
 	struct basic_block *active;
 	struct instruction *entry;
+	struct pseudo **pseudos;	/* the numbered pseudos, by id */
+	unsigned int nr_pseudos, max_pseudos;
 };
 
+/*
+ * The register, phi & argument pseudos of a function can be
+ * numbered densely, from 0 to ep->nr_pseudos - 1, so that the
+ * analyses can keep their per-pseudo data in plain arrays (or in
+ * bitsets) indexed by pseudo->id, instead of in lists or hashes.
+ *
+ * The numbering is only valid until new pseudos are created or
+ * instructions killed, so it's redone after each round of
+ * optimizations; a pseudo created since is not numbered.
+ */
+extern void number_pseudos(struct entrypoint *ep);
+
+/*
+ * Number 'pseudo', after the others, if it isn't numbered yet.
+ */
+extern void number_pseudo(struct entrypoint *ep, pseudo_t pseudo);
+
+static inline int pseudo_numbered(struct entrypoint *ep, pseudo_t pseudo)
+{
+	return pseudo->id < ep->nr_pseudos && ep->pseudos[pseudo->id] == pseudo;
+}
+
+/*
+ * Side tables: an array of per-pseudo data, zero-initialized,
+ * for all the pseudos currently numbered:
+ *	struct foo *info = alloc_pseudo_table(ep, struct foo);
+ *	... info[pseudo->id] ...
+ *	free_pseudo_table(info);
+ */
+extern void *__alloc_pseudo_table(struct entrypoint *ep, size_t size);
+#define alloc_pseudo_table(ep, type) ((type *)__alloc_pseudo_table(ep, sizeof(type)))
+#define free_pseudo_table(table) free(table)
+
+/*
+ * Call 'fn' on the address of each pseudo used by 'insn'.
+ */
+extern void for_each_use(struct instruction *insn, void (*fn)(pseudo_t *));
+
 extern void insert_select(struct basic_block *bb, struct instruction *br, struct instruction *phi, pseudo_t if_true, pseudo_t if_false);
 extern void insert_branch(struct basic_block *bb, struct instruction *br, struct basic_block *target);
 
@@ -375,7 +437,19 @@ pseudo_t alloc_pseudo(struct instruction *def);
 pseudo_t value_pseudo(long long val);
 
 struct entrypoint *linearize_symbol(struct symbol *sym);
+void free_entrypoint(struct entrypoint *ep);
+
+/*
+ * unssa() returns the number of copies it has left for the function.
+ */
+struct unssa_stats {
+	unsigned long phis;		/* phi-nodes removed */
+	unsigned long copies;		/* copies left */
+	unsigned long temps;		/* temporaries for the copy cycles */
+};
+extern struct unssa_stats unssa_stats;
 int unssa(struct entrypoint *ep);
+
 void show_entry(struct entrypoint *ep);
 const char *show_pseudo(pseudo_t pseudo);
 void show_bb(struct basic_block *bb);
@@ -6,8 +6,11 @@
  */
 
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "liveness.h"
+#include "bitmap.h"
 #include "parse.h"
 #include "expression.h"
 #include "linearize.h"
@@ -43,7 +46,7 @@ static void asm_liveness(struct basic_block *bb, struct instruction *insn,
 	} END_FOR_EACH_PTR(entry);
 }
 
-static void track_instruction_usage(struct basic_block *bb, struct instruction *insn,
+void track_instruction_usage(struct basic_block *bb, struct instruction *insn,
 	void (*def)(struct basic_block *, pseudo_t),
 	void (*use)(struct basic_block *, pseudo_t))
 {
@@ -71,7 +74,7 @@ static void track_instruction_usage(struct basic_block *bb, struct instruction *
 		break;
 
 	/* Uni */
-	case OP_NOT: case OP_NEG:
+	case OP_NOT: case OP_NEG: case OP_FNEG:
 		USES(src1); DEFINES(target);
 		break;
 
@@ -115,6 +118,7 @@ static void track_instruction_usage(struct basic_block *bb, struct instruction *
 	case OP_SCAST:
 	case OP_FPCAST:
 	case OP_PTRCAST:
+	case OP_COPY:
 		USES(src); DEFINES(target);
 		break;
 
@@ -156,34 +160,80 @@ int pseudo_in_list(struct pseudo_list *list, pseudo_t pseudo)
 	return 0;
 }
 
+/*
+ * Sets mirroring bb->needs & bb->defines, to check quickly if
+ * a pseudo is already in them while computing the liveness.
+ * They are sized by the lists, not by the number of pseudos:
+ * big functions have many blocks *and* many pseudos.
+ */
+struct bb_live_sets {
+	struct pseudo_set needs, defines;
+};
+
+static struct entrypoint *live_ep;
+static struct basic_block_list *live_bbs;
+
+/*
+ * Allocated on demand: unreachable parents may not be in ep->bbs.
+ */
+static struct bb_live_sets *live_sets(struct basic_block *bb)
+{
+	if (!bb->live) {
+		bb->live = calloc(1, sizeof(*bb->live));
+		if (!bb->live)
+			die("out of memory");
+		add_bb(&live_bbs, bb);
+	}
+	return bb->live;
+}
+
 static int liveness_changed;
 
-static void add_pseudo_exclusive(struct pseudo_list **list, pseudo_t pseudo)
+static void add_pseudo_exclusive(struct pseudo_list **list, struct pseudo_set *set, pseudo_t pseudo)
 {
-	if (!pseudo_in_list(*list, pseudo)) {
+	if (ptr_set_add(set, pseudo)) {
 		liveness_changed = 1;
 		add_pseudo(list, pseudo);
 	}
 }
 
+/*
+ * The liveness is only tracked for the register & argument pseudos.
+ * They have normally been numbered by number_pseudos() but one
+ * created since, or whose definition has been dropped, is numbered
+ * now, after the others.
+ */
 static inline int trackable_pseudo(pseudo_t pseudo)
 {
-	return pseudo && (pseudo->type == PSEUDO_REG || pseudo->type == PSEUDO_ARG);
+	if (!pseudo || (pseudo->type != PSEUDO_REG && pseudo->type != PSEUDO_ARG))
+		return 0;
+	if (!pseudo_numbered(live_ep, pseudo))
+		number_pseudo(live_ep, pseudo);
+	return 1;
 }
 
+/*
+ * The instructions are walked forward, so a pseudo is needed by
+ * its block if it's used before being defined there. This doesn't
+ * depend on ->def, which the pseudos defined by several copies
+ * after unssa() don't have.
+ */
 static void insn_uses(struct basic_block *bb, pseudo_t pseudo)
 {
 	if (trackable_pseudo(pseudo)) {
+		struct bb_live_sets *live = live_sets(bb);
 		struct instruction *def = pseudo->def;
-		if (pseudo->type != PSEUDO_REG || def->bb != bb || def->opcode == OP_PHI)
-			add_pseudo_exclusive(&bb->needs, pseudo);
+
+		if (!ptr_set_contains(&live->defines, pseudo) || (def && def->opcode == OP_PHI))
+			add_pseudo_exclusive(&bb->needs, &live->needs, pseudo);
 	}
 }
 
 static void insn_defines(struct basic_block *bb, pseudo_t pseudo)
 {
 	assert(trackable_pseudo(pseudo));
-	add_pseudo(&bb->defines, pseudo);
+	if (ptr_set_add(&live_sets(bb)->defines, pseudo))
+		add_pseudo(&bb->defines, pseudo);
 }
 
 static void track_bb_liveness(struct basic_block *bb)
@@ -193,9 +243,10 @@ static void track_bb_liveness(struct basic_block *bb)
 	FOR_EACH_PTR(bb->needs, needs) {
 		struct basic_block *parent;
 		FOR_EACH_PTR(bb->parents, parent) {
-			if (!pseudo_in_list(parent->defines, needs)) {
-				add_pseudo_exclusive(&parent->needs, needs);
-			}
+			struct bb_live_sets *live = live_sets(parent);
+
+			if (!ptr_set_contains(&live->defines, needs))
+				add_pseudo_exclusive(&parent->needs, &live->needs, needs);
 		} END_FOR_EACH_PTR(parent);
 	} END_FOR_EACH_PTR(needs);
 }
@@ -222,6 +273,8 @@ void track_pseudo_liveness(struct entrypoint *ep)
 {
 	struct basic_block *bb;
 
+	live_ep = ep;
+
 	/* Add all the bb pseudo usage */
 	FOR_EACH_PTR(ep->bbs, bb) {
 		struct instruction *insn;
@@ -247,7 +300,7 @@ void track_pseudo_liveness(struct entrypoint *ep)
 		FOR_EACH_PTR(bb->defines, def) {
 			struct basic_block *child;
 			FOR_EACH_PTR(bb->children, child) {
-				if (pseudo_in_list(child->needs, def))
+				if (ptr_set_contains(&live_sets(child)->needs, def))
 					goto is_used;
 			} END_FOR_EACH_PTR(child);
 			DELETE_CURRENT_PTR(def);
@@ -256,16 +309,17 @@ is_used:
 		} END_FOR_EACH_PTR(def);
 		PACK_PTR_LIST(&bb->defines);
 	} END_FOR_EACH_PTR(bb);
-}
 
-static void merge_pseudo_list(struct pseudo_list *src, struct pseudo_list **dest)
-{
-	pseudo_t pseudo;
-	FOR_EACH_PTR(src, pseudo) {
-		add_pseudo_exclusive(dest, pseudo);
-	} END_FOR_EACH_PTR(pseudo);
+	FOR_EACH_PTR(live_bbs, bb) {
+		ptr_set_clear(&bb->live->needs);
+		ptr_set_clear(&bb->live->defines);
+		free(bb->live);
+		bb->live = NULL;
+	} END_FOR_EACH_PTR(bb);
+	free_ptr_list(&live_bbs);
 }
 
+
 static void track_phi_uses(struct instruction *insn)
 {
 	pseudo_t phi;
@@ -288,16 +342,47 @@ static void track_bb_phi_uses(struct basic_block *bb)
 	} END_FOR_EACH_PTR(insn);
 }
 
+/*
+ * The pseudos live during the walk of a block are in live_list,
+ * and in live_set, one bitset for the whole function, indexed by
+ * pseudo->id. Only the bits of the pseudos in the list are set,
+ * so it's cleared by walking the list at the end of each block.
+ */
 static struct pseudo_list **live_list;
+static struct bitset *live_set;
 static struct pseudo_list *dead_list;
 
+/*
+ * The bitset is grown for the pseudos numbered during the walk.
+ */
+static int test_and_set_live(pseudo_t pseudo)
+{
+	if (pseudo->id >= bitset_size(live_set)) {
+		struct bitset *set = alloc_bitset(live_ep->nr_pseudos);
+
+		memcpy(set->words, live_set->words, live_set->nr_words * sizeof(unsigned long));
+		free_bitset(live_set);
+		live_set = set;
+	}
+	return bitset_test_and_set(live_set, pseudo->id);
+}
+
+static void merge_pseudo_list(struct pseudo_list *src, struct pseudo_list **dest)
+{
+	pseudo_t pseudo;
+	FOR_EACH_PTR(src, pseudo) {
+		if (trackable_pseudo(pseudo) && !test_and_set_live(pseudo))
+			add_pseudo(dest, pseudo);
+	} END_FOR_EACH_PTR(pseudo);
+}
+
 static void death_def(struct basic_block *bb, pseudo_t pseudo)
 {
 }
 
 static void death_use(struct basic_block *bb, pseudo_t pseudo)
 {
-	if (trackable_pseudo(pseudo) && !pseudo_in_list(*live_list, pseudo)) {
+	if (trackable_pseudo(pseudo) && !test_and_set_live(pseudo)) {
 		add_pseudo(&dead_list, pseudo);
 		add_pseudo(live_list, pseudo);
 	}
@@ -308,6 +393,7 @@ static void track_pseudo_death_bb(struct basic_block *bb)
 	struct pseudo_list *live = NULL;
 	struct basic_block *child;
 	struct instruction *insn;
+	pseudo_t pseudo;
 
 	FOR_EACH_PTR(bb->children, child) {
 		merge_pseudo_list(child->needs, &live);
@@ -332,6 +418,10 @@ static void track_pseudo_death_bb(struct basic_block *bb)
 			free_ptr_list(&dead_list);
 		}
 	} END_FOR_EACH_PTR_REVERSE(insn);
+
+	FOR_EACH_PTR(live, pseudo) {
+		bitset_clear(live_set, pseudo->id);
+	} END_FOR_EACH_PTR(pseudo);
 	free_ptr_list(&live);
 }
 
@@ -339,11 +429,15 @@ void track_pseudo_death(struct entrypoint *ep)
 {
 	struct basic_block *bb;
 
+	live_ep = ep;
+
 	FOR_EACH_PTR(ep->bbs, bb) {
 		track_bb_phi_uses(bb);
 	} END_FOR_EACH_PTR(bb);
 
+	live_set = alloc_bitset(ep->nr_pseudos);
 	FOR_EACH_PTR(ep->bbs, bb) {
 		track_pseudo_death_bb(bb);
 	} END_FOR_EACH_PTR(bb);
+	free_bitset(live_set);
 }
@@ -2,8 +2,14 @@
 #define LIVENESS_H
 
 struct entrypoint;
+struct basic_block;
+struct instruction;
+struct pseudo;
 
 /* liveness.c */
+void track_instruction_usage(struct basic_block *bb, struct instruction *insn,
+	void (*def)(struct basic_block *, struct pseudo *),
+	void (*use)(struct basic_block *, struct pseudo *));
 void clear_liveness(struct entrypoint *ep);
 void track_pseudo_liveness(struct entrypoint *ep);
 void track_pseudo_death(struct entrypoint *ep);
@@ -11,6 +11,9 @@
 #include "liveness.h"
 #include "flow.h"
 #include "cse.h"
+#include "dce.h"
+#include "sccp.h"
+#include "timer.h"
 
 int repeat_phase;
 
@@ -40,8 +43,80 @@ static void clean_up_insns(struct entrypoint *ep)
 	} END_FOR_EACH_PTR(bb);
 }
 
+static int still_used;
+
+static void check_use(pseudo_t *pp)
+{
+	if (has_use_list(*pp))
+		still_used = 1;
+}
+
+/*
+ * Recycle a dead instruction, once it's sure that nothing can
+ * reach it anymore: its operands have all been killed (killing
+ * a use VOIDs it) and its result, if any, has no users.
+ * Otherwise, it stays allocated until the whole IR is released.
+ */
+static void recycle_insn(struct instruction *insn)
+{
+	pseudo_t target = insn->target;
+
+	// its outputs are defined by it too
+	if (insn->opcode == OP_ASM)
+		return;
+
+	still_used = 0;
+	for_each_use(insn, check_use);
+	if (still_used)
+		return;
+	if (target && target->def == insn) {
+		if (has_users(target))
+			return;
+		target->def = NULL;
+	}
+	__free_instruction(insn);
+}
+
+/*
+ * The killed instructions stay in their block, only marked with
+ * a null insn->bb, so that the walks in progress aren't upset.
+ * This is the point where they are really removed, once all the
+ * walks are done, and where the lists of instructions are packed
+ * in as few arrays as possible, for the next passes to scan.
+ * The pseudos are then renumbered for the analyses.
+ */
+static void compact_insns(struct entrypoint *ep)
+{
+	struct basic_block *bb;
+
+	FOR_EACH_PTR(ep->bbs, bb) {
+		struct instruction *insn;
+
+		FOR_EACH_PTR(bb->insns, insn) {
+			if (!insn->bb) {
+				MARK_CURRENT_DELETED(insn);
+				recycle_insn(insn);
+			}
+		} END_FOR_EACH_PTR(insn);
+		COMPACT_PTR_LIST(&bb->insns);
+	} END_FOR_EACH_PTR(bb);
+	number_pseudos(ep);
+}
+
+/*
+ * Run a pass, timing it and recording the size
+ * of the IR before and after it for -ftime-report.
+ */
+#define RUN_PASS(timer, ep, pass) do {					\
+		timer_start_pass(timer, ep);				\
+		pass;							\
+		timer_stop_pass(timer, ep);				\
+	} while (0)
+
 void optimize(struct entrypoint *ep)
 {
+	int changed;
+
 	if (fdump_ir & PASS_LINEARIZE)
 		show_entry(ep);
 
@@ -49,48 +124,64 @@ void optimize(struct entrypoint *ep)
 	 * Do trivial flow simplification - branches to
 	 * branches, kill dead basicblocks etc
 	 */
-	kill_unreachable_bbs(ep);
+	RUN_PASS(PASS__FLOW, ep, kill_unreachable_bbs(ep));
 
 	/*
 	 * Turn symbols into pseudos
 	 */
 	if (fpasses & PASS_MEM2REG)
-		simplify_symbol_usage(ep);
+		RUN_PASS(PASS__MEM2REG, ep, simplify_symbol_usage(ep));
 	if (fdump_ir & PASS_MEM2REG)
 		show_entry(ep);
 
 	if (!(fpasses & PASS_OPTIM))
 		return;
 repeat:
+	/*
+	 * Propagate the constants and remove the branches
+	 * never taken, all at once.
+	 */
+	if (fpasses & PASS_SCCP)
+		RUN_PASS(PASS__SCCP, ep, repeat_phase |= sccp(ep));
+
 	/*
 	 * Remove trivial instructions, and try to CSE
 	 * the rest.
 	 */
 	do {
-		simplify_memops(ep);
+		RUN_PASS(PASS__MEMOPS, ep, simplify_memops(ep));
 		do {
 			repeat_phase = 0;
-			clean_up_insns(ep);
+			RUN_PASS(PASS__SIMPLIFY, ep, clean_up_insns(ep));
 			if (repeat_phase & REPEAT_CFG_CLEANUP)
-				kill_unreachable_bbs(ep);
+				RUN_PASS(PASS__FLOW, ep, kill_unreachable_bbs(ep));
 
-			cse_eliminate(ep);
+			RUN_PASS(PASS__CSE, ep, cse_eliminate(ep));
 
 			if (repeat_phase & REPEAT_SYMBOL_CLEANUP)
-				simplify_memops(ep);
+				RUN_PASS(PASS__MEMOPS, ep, simplify_memops(ep));
 		} while (repeat_phase);
-		pack_basic_blocks(ep);
+		RUN_PASS(PASS__FLOW, ep, compact_insns(ep));
+		RUN_PASS(PASS__FLOW, ep, pack_basic_blocks(ep));
 		if (repeat_phase & REPEAT_CFG_CLEANUP)
-			kill_unreachable_bbs(ep);
+			RUN_PASS(PASS__FLOW, ep, kill_unreachable_bbs(ep));
 	} while (repeat_phase);
 
+	/*
+	 * Remove the dead code the simplifications can't see,
+	 * like dead cycles of phi-nodes.
+	 */
+	if (fpasses & PASS_DCE)
+		RUN_PASS(PASS__DCE, ep, dce(ep));
+	RUN_PASS(PASS__FLOW, ep, compact_insns(ep));
+
 	vrfy_flow(ep);
 
 	/* Cleanup */
 	clear_symbol_pseudos(ep);
 
 	/* And track pseudo register usage */
-	track_pseudo_liveness(ep);
+	RUN_PASS(PASS__LIVENESS, ep, track_pseudo_liveness(ep));
 
 	/*
 	 * Some flow optimizations can only effectively
@@ -98,14 +189,15 @@ repeat:
 	 * if they trigger, we need to start all over
 	 * again
 	 */
-	if (simplify_flow(ep)) {
-		clear_liveness(ep);
+	RUN_PASS(PASS__FLOW, ep, changed = simplify_flow(ep));
+	if (changed) {
+		RUN_PASS(PASS__LIVENESS, ep, clear_liveness(ep));
 		if (repeat_phase & REPEAT_CFG_CLEANUP)
-			kill_unreachable_bbs(ep);
+			RUN_PASS(PASS__FLOW, ep, kill_unreachable_bbs(ep));
 		goto repeat;
 	}
 
 	/* Finally, add deathnotes to pseudos now that we have them */
 	if (dbg_dead)
-		track_pseudo_death(ep);
+		RUN_PASS(PASS__LIVENESS, ep, track_pseudo_death(ep));
 }
@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: MIT
+//
+// outbuf.c - append-only output buffers for the backends
+//
+
+#include <stdlib.h>
+#include "outbuf.h"
+
+void __outbuf_grow(struct outbuf *ob, size_t needed)
+{
+	size_t size = ob->size ? ob->size : 64 * 1024;
+
+	while (size - ob->len < needed)
+		size *= 2;
+	ob->buf = realloc(ob->buf, size);
+	if (!ob->buf)
+		die("out of memory");
+	ob->size = size;
+}
+
+void outbuf_vprintf(struct outbuf *ob, const char *fmt, va_list args)
+{
+	size_t room = ob->size - ob->len;
+	va_list again;
+	int n;
+
+	va_copy(again, args);
+	n = vsnprintf(ob->buf + ob->len, room, fmt, args);
+	if (n >= room) {
+		// it didn't fit: retry once with enough room
+		outbuf_reserve(ob, n + 1);
+		vsnprintf(ob->buf + ob->len, n + 1, fmt, again);
+	}
+	va_end(again);
+	ob->len += n;
+}
+
+void outbuf_printf(struct outbuf *ob, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	outbuf_vprintf(ob, fmt, args);
+	va_end(args);
+}
+
+void outbuf_uint(struct outbuf *ob, unsigned long long val)
+{
+	char digits[20], *p = digits + sizeof(digits);
+
+	do {
+		*--p = '0' + val % 10;
+		val /= 10;
+	} while (val);
+	outbuf_write(ob, p, digits + sizeof(digits) - p);
+}
+
+void outbuf_int(struct outbuf *ob, long long val)
+{
+	if (val < 0) {
+		outbuf_putc(ob, '-');
+		outbuf_uint(ob, -(unsigned long long)val);
+		return;
+	}
+	outbuf_uint(ob, val);
+}
+
+/*
+ * stdio passes a big block straight to write(2), after what it
+ * may still hold, so this mixes well with printf() & friends.
+ */
+void outbuf_flush(struct outbuf *ob, FILE *file)
+{
+	if (ob->len && fwrite(ob->buf, 1, ob->len, file) != ob->len)
+		die("can't write the output");
+	ob->len = 0;
+}
+
+void outbuf_free(struct outbuf *ob)
+{
+	free(ob->buf);
+	ob->buf = NULL;
+	ob->len = ob->size = 0;
+}
@@ -0,0 +1,62 @@
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+/*
+ * Append-only output buffers, for the backends.
+ *
+ * The text of a whole function (or of any other unit of output)
+ * is built up in memory and then written at once by outbuf_flush().
+ * The buffer is kept between the flushes, so once it has grown to
+ * the size of the biggest function nothing is allocated anymore.
+ *
+ * The integers are formatted without going through printf(), which
+ * is only used for the less common lines.
+ *
+ * A zeroed outbuf is a valid empty buffer.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "lib.h"
+
+struct outbuf {
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+extern void __outbuf_grow(struct outbuf *ob, size_t needed);
+extern void outbuf_vprintf(struct outbuf *ob, const char *fmt, va_list args);
+extern void outbuf_printf(struct outbuf *ob, const char *fmt, ...) FORMAT_ATTR(2);
+extern void outbuf_uint(struct outbuf *ob, unsigned long long val);
+extern void outbuf_int(struct outbuf *ob, long long val);
+extern void outbuf_flush(struct outbuf *ob, FILE *file);
+extern void outbuf_free(struct outbuf *ob);
+
+/* Make room for 'n' more bytes and return where they go */
+static inline char *outbuf_reserve(struct outbuf *ob, size_t n)
+{
+	if (ob->size - ob->len < n)
+		__outbuf_grow(ob, n);
+	return ob->buf + ob->len;
+}
+
+static inline void outbuf_write(struct outbuf *ob, const char *str, size_t n)
+{
+	memcpy(outbuf_reserve(ob, n), str, n);
+	ob->len += n;
+}
+
+static inline void outbuf_puts(struct outbuf *ob, const char *str)
+{
+	outbuf_write(ob, str, strlen(str));
+}
+
+static inline void outbuf_putc(struct outbuf *ob, char c)
+{
+	*outbuf_reserve(ob, 1) = c;
+	ob->len++;
+}
+
+#endif
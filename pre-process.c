@@ -102,6 +102,7 @@ static struct token *alloc_token(struct position *pos)
 
 /* Expand symbol 'sym' at '*list' */
 static int expand(struct token **, struct symbol *);
+static int free_preprocessor_line(struct token *);
 
 static void replace_with_string(struct token *token, const char *str)
 {
@@ -292,6 +293,7 @@ static int collect_arguments(struct token *start, struct token *arglist, struct
 			count++;
 			goto Emany;
 		}
+		__free_token(start);	/* Free the '(' token */
 	} else {
 		for (count = 0; count < wanted; count++) {
 			struct argcount *p = &arglist->next->count;
@@ -305,6 +307,7 @@ static int collect_arguments(struct token *start, struct token *arglist, struct
 			args[count].n_normal = p->normal;
 			args[count].n_quoted = p->quoted;
 			args[count].n_str = p->str;
+			__free_token(start);	/* Free the '(' or ',' token */
 			if (match_op(next, ')')) {
 				count++;
 				break;
@@ -326,6 +329,7 @@ static int collect_arguments(struct token *start, struct token *arglist, struct
 			goto Efew;
 	}
 	what->next = next->next;
+	__free_token(next);	/* Free the ')' token */
 	return 1;
 
 Efew:
@@ -418,7 +422,13 @@ static void expand_arguments(int count, struct arg *args)
 			arg = &eof_token_entry;
 		if (args[i].n_str)
 			args[i].str = stringify(arg);
-		if (args[i].n_normal) {
+		if (!args[i].n_normal && !args[i].n_quoted) {
+			/* stringified or unused: the tokens are dead */
+			if (args[i].arg) {
+				free_preprocessor_line(args[i].arg);
+				args[i].arg = &eof_token_entry;
+			}
+		} else if (args[i].n_normal) {
 			if (!args[i].n_quoted) {
 				args[i].expanded = arg;
 				args[i].arg = NULL;
@@ -694,6 +704,7 @@ static struct token **substitute(struct token **list, struct token *body, struct
 			*list = added->next;
 			if (tail != &added->next)
 				list = tail;
+			__free_token(added);	/* merged in the previous token */
 		} else {
 			*list = added;
 			list = tail;
@@ -739,6 +750,7 @@ static int expand(struct token **list, struct symbol *sym)
 	(*list)->pos.newline = token->pos.newline;
 	(*list)->pos.whitespace = token->pos.whitespace;
 	*tail = last;
+	__free_token(token);	/* Free the macro name */
 
 	return 0;
 }
@@ -13,20 +13,153 @@
 #include "allocate.h"
 #include "compat.h"
 
-__DECLARE_ALLOCATOR(struct ptr_list, ptrlist);
-__ALLOCATOR(struct ptr_list, "ptr list", ptrlist);
+/*
+ * One allocator for each size of node, so that the nodes
+ * of the same size are kept together.
+ */
+static const struct allocator_struct ptrlist_allocator = {
+	.name = "ptr list",
+	.alignment = __alignof__(struct ptr_list),
+	.chunking = BIG_CHUNK,
+};
 
-int ptr_list_size(struct ptr_list *head)
+static inline struct allocator_struct *ptrlist_desc(int order)
 {
-	int nr = 0;
+	return get_allocator(ALLOCATOR_ptrlist + order, &ptrlist_allocator);
+}
 
-	if (head) {
-		struct ptr_list *list = head;
-		do {
-			nr += list->nr - list->rm;
-		} while ((list = list->next) != head);
+static struct ptr_list *__alloc_ptrlist(int order)
+{
+	struct ptr_list *list;
+
+	list = allocate(ptrlist_desc(order), PTR_LIST_SIZE(order));
+	list->order = order;
+	return list;
+}
+
+static void __free_ptrlist(struct ptr_list *list)
+{
+	free_one_entry(ptrlist_desc(list->order), list, PTR_LIST_SIZE(list->order));
+}
+
+void get_ptrlist_stats(struct allocator_stats *s)
+{
+	int i;
+
+	s->name = "ptr list";
+	s->allocations = 0;
+	s->reused = 0;
+	s->useful_bytes = 0;
+	s->total_bytes = 0;
+	s->peak_bytes = 0;
+	s->free_bytes = 0;
+	for (i = 0; i < PTR_LIST_ORDERS; i++) {
+		struct allocator_stats x;
+
+		get_allocator_stats(ALLOCATOR_ptrlist + i, &ptrlist_allocator, &x);
+		s->allocations += x.allocations;
+		s->reused += x.reused;
+		s->useful_bytes += x.useful_bytes;
+		s->total_bytes += x.total_bytes;
+		s->peak_bytes += x.peak_bytes;
+		s->free_bytes += x.free_bytes;
 	}
-	return nr;
+}
+
+void mark_ptrlist_alloc(struct allocator_mark *marks)
+{
+	int i;
+
+	for (i = 0; i < PTR_LIST_ORDERS; i++)
+		mark_allocations(ptrlist_desc(i), &marks[i]);
+}
+
+void release_ptrlist_alloc(struct allocator_mark *marks)
+{
+	int i;
+
+	for (i = 0; i < PTR_LIST_ORDERS; i++)
+		release_allocations(ptrlist_desc(i), &marks[i]);
+}
+
+/*
+ * Return the entry at position 'idx' (ignoring the deleted entries)
+ * or NULL if the list is too short. The nodes are walked from the
+ * nearest end of the list and skipped as a whole, so this only
+ * costs O(number of nodes) and not O(number of entries).
+ */
+void *ptr_list_nth_entry(struct ptr_list *head, unsigned int idx)
+{
+	struct ptr_list *list;
+	int i;
+
+	if (idx >= ptr_list_size(head))
+		return NULL;
+
+	if (idx < head->total / 2) {
+		list = head;
+		while (idx >= list->nr - list->rm) {
+			idx -= list->nr - list->rm;
+			list = list->next;
+		}
+	} else {
+		/* from the end, 'idx' is the position from the last entry */
+		idx = head->total - 1 - idx;
+		list = head->prev;
+		while (idx >= list->nr - list->rm) {
+			idx -= list->nr - list->rm;
+			list = list->prev;
+		}
+		idx = list->nr - list->rm - 1 - idx;
+	}
+
+	if (!list->rm)
+		return PTR_ENTRY(list, idx);
+	for (i = 0; i < list->nr; i++) {
+		void *ptr = PTR_ENTRY_NOTAG(list, i);
+
+		if (!ptr)
+			continue;
+		if (!idx--)
+			return PTR_ENTRY(list, i);
+	}
+	return NULL;
+}
+
+/*
+ * Return an array with the ptr_list_size() entries of the list.
+ * When all the entries are in a single node this is the node's
+ * own array and nothing is copied. Otherwise the entries are
+ * copied into 'buf', which must be big enough for all of them.
+ * Either way, the array is only valid until the list is modified.
+ */
+void **ptr_list_array(struct ptr_list *head, void **buf)
+{
+	struct ptr_list *list = head;
+	void **arr = buf;
+
+	if (!head)
+		return buf;
+	do {
+		if (list->nr == head->total && !list->rm)
+			return list->list;
+		if (list->nr)
+			break;
+	} while ((list = list->next) != head);
+
+	list = head;
+	do {
+		int i;
+
+		for (i = 0; i < list->nr; i++) {
+			void *ptr = PTR_ENTRY_NOTAG(list, i);
+
+			if (list->rm && !ptr)
+				continue;
+			*arr++ = ptr;
+		}
+	} while ((list = list->next) != head);
+	return buf;
 }
 
 /*
@@ -62,48 +195,145 @@ int linearize_ptr_list(struct ptr_list *head, void **arr, int max)
  * When we've walked the list and deleted entries,
  * we may need to re-pack it so that we don't have
  * any empty blocks left (empty blocks upset the
- * walking code
+ * walking code).
+ *
+ * The first block is only freed with the whole list:
+ * it holds the size of the list and it may still be
+ * used as the head of a walk in progress.
  */
 void pack_ptr_list(struct ptr_list **listp)
 {
 	struct ptr_list *head = *listp;
 
 	if (head) {
-		struct ptr_list *entry = head;
-		do {
-			struct ptr_list *next;
-restart:
-			next = entry->next;
+		struct ptr_list *entry = head->next;
+
+		while (entry != head) {
+			struct ptr_list *next = entry->next;
+
 			if (!entry->nr) {
-				struct ptr_list *prev;
-				if (next == entry) {
-					__free_ptrlist(entry);
-					*listp = NULL;
-					return;
-				}
-				prev = entry->prev;
+				struct ptr_list *prev = entry->prev;
 				prev->next = next;
 				next->prev = prev;
 				__free_ptrlist(entry);
-				if (entry == head) {
-					*listp = next;
-					head = next;
-					entry = next;
-					goto restart;
-				}
 			}
 			entry = next;
-		} while (entry != head);
+		}
+		if (!head->nr && head->next == head) {
+			__free_ptrlist(head);
+			*listp = NULL;
+		}
+	}
+}
+
+/*
+ * Is the list already as compact as it can be: no entries marked
+ * as deleted and the entries in as few nodes as possible?
+ */
+static int ptr_list_is_compact(struct ptr_list *head)
+{
+	struct ptr_list *list = head;
+
+	if (head->rm)
+		return 0;
+	if (head->next == head)
+		return 1;
+	do {
+		if (list->rm)
+			return 0;
+		if (list->next == head)
+			break;
+		if (list->order != PTR_LIST_ORDERS - 1)
+			return 0;
+		if (list->nr != ptr_list_capacity(list))
+			return 0;
+	} while ((list = list->next) != head);
+	return 1;
+}
+
+/*
+ * The smallest order of node able to hold 'nr' entries.
+ */
+static int ptr_list_order(int nr)
+{
+	int order;
+
+	for (order = 0; order < PTR_LIST_ORDERS - 1; order++) {
+		if (PTR_LIST_CAPACITY(order) >= nr)
+			break;
 	}
-}		
+	return order;
+}
 
+/*
+ * Rebuild the list with the entries in as few nodes as possible,
+ * dropping those marked as deleted: a list of up to LIST_NODE_NR
+ * entries is then a single array, walked without any jump.
+ *
+ * The first node can change, so no walk of the list can be in
+ * progress.
+ */
+void compact_ptr_list(struct ptr_list **listp)
+{
+	struct ptr_list *head = *listp;
+	struct ptr_list *list, *newhead = NULL, *last = NULL;
+	int left;
+
+	if (!head || ptr_list_is_compact(head))
+		return;
+
+	left = head->total;
+	list = head;
+	do {
+		int i;
+
+		for (i = 0; i < list->nr; i++) {
+			void *ptr = PTR_ENTRY_NOTAG(list, i);
+
+			if (list->rm && !ptr)
+				continue;
+			if (!last || last->nr == ptr_list_capacity(last)) {
+				struct ptr_list *node = __alloc_ptrlist(ptr_list_order(left));
+
+				if (!newhead) {
+					node->next = node;
+					node->prev = node;
+					newhead = node;
+				} else {
+					node->prev = last;
+					node->next = newhead;
+					newhead->prev = node;
+					last->next = node;
+				}
+				last = node;
+			}
+			last->list[last->nr++] = ptr;
+			left--;
+		}
+	} while ((list = list->next) != head);
+
+	if (newhead)
+		newhead->total = head->total;
+	__free_ptr_list(listp);
+	*listp = newhead;
+}
+
+/*
+ * Split a full node in two, to make room for an insertion.
+ * The new node is the bigger one, so that both have some room
+ * even when splitting a node of a single entry.
+ */
 void split_ptr_list_head(struct ptr_list *head)
 {
-	int old = head->nr, nr = old / 2;
-	struct ptr_list *newlist = __alloc_ptrlist(0);
+	int nr = (head->nr + 1) / 2, old = head->nr - nr;
+	int order = head->order;
+	struct ptr_list *newlist;
 	struct ptr_list *next = head->next;
+	int i;
 
-	old -= nr;
+	if (order < PTR_LIST_ORDERS - 1)
+		order++;
+	newlist = __alloc_ptrlist(order);
 	head->nr = old;
 	newlist->next = next;
 	next->prev = newlist;
@@ -112,6 +342,14 @@ void split_ptr_list_head(struct ptr_list *head)
 	newlist->nr = nr;
 	memcpy(newlist->list, head->list + old, nr * sizeof(void *));
 	memset(head->list + old, 0xf0, nr * sizeof(void *));
+
+	// the deleted entries moved along
+	for (i = 0; head->rm && i < nr; i++) {
+		if (!newlist->list[i]) {
+			head->rm--;
+			newlist->rm++;
+		}
+	}
 }
 
 void **__add_ptr_list(struct ptr_list **listp, void *ptr, unsigned long tag)
@@ -126,8 +364,19 @@ void **__add_ptr_list(struct ptr_list **listp, void *ptr, unsigned long tag)
 	assert((~3 & tag) == 0);
 	ptr = (void *)(tag | (unsigned long)ptr);
 
-	if (!list || (nr = (last = list->prev)->nr) >= LIST_NODE_NR) {
-		struct ptr_list *newlist = __alloc_ptrlist(0);
+	if (list)
+		last = list->prev;
+	if (!list || (nr = last->nr) >= ptr_list_capacity(last)) {
+		struct ptr_list *newlist;
+		int order = 0;
+
+		/* each new node is twice as big as the previous one */
+		if (list) {
+			order = last->order;
+			if (order < PTR_LIST_ORDERS - 1)
+				order++;
+		}
+		newlist = __alloc_ptrlist(order);
 		if (!list) {
 			newlist->next = newlist;
 			newlist->prev = newlist;
@@ -145,6 +394,7 @@ void **__add_ptr_list(struct ptr_list **listp, void *ptr, unsigned long tag)
 	*ret = ptr;
 	nr++;
 	last->nr = nr;
+	(*listp)->total++;
 	return ret;
 }
 
@@ -194,6 +444,7 @@ void * undo_ptr_list_last(struct ptr_list **head)
 		if (last->nr) {
 			void *ptr;
 			int nr = --last->nr;
+			first->total--;
 			ptr = last->list[nr];
 			last->list[nr] = (void *)0xf1f1f1f1;
 			return ptr;
@@ -210,8 +461,10 @@ void * delete_ptr_list_last(struct ptr_list **head)
 	if (!first)
 		return NULL;
 	last = first->prev;
-	if (last->nr)
+	if (last->nr) {
 		ptr = last->list[--last->nr];
+		first->total--;
+	}
 	if (last->nr <=0) {
 		first->prev = last->prev;
 		last->prev->next = first;
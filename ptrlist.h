@@ -22,16 +22,37 @@
  */
 #define MKTYPE(head,expr)		({ (TYPEOF(head))(expr); })
 
-#define LIST_NODE_NR (13)
+/*
+ * The nodes don't all have the same size: the first node of a
+ * list is small (most lists only have one or two entries) and
+ * each new node is twice as big as the previous one, up to
+ * PTR_LIST_SIZE(PTR_LIST_ORDERS - 1) bytes.
+ */
+#define PTR_LIST_ORDERS		5
+#define PTR_LIST_MIN_SIZE	32
+#define PTR_LIST_SIZE(order)	(PTR_LIST_MIN_SIZE << (order))
 
 struct ptr_list {
 	int nr:8;
 	int rm:8;
+	int order:8;
+	int total;		/* nbr of entries of the list, only valid in its first node */
 	struct ptr_list *prev;
 	struct ptr_list *next;
-	void *list[LIST_NODE_NR];
+	void *list[];
 };
 
+#define PTR_LIST_CAPACITY(order) \
+	((PTR_LIST_SIZE(order) - sizeof(struct ptr_list)) / sizeof(void *))
+
+/* The maximum number of entries in a node */
+#define LIST_NODE_NR PTR_LIST_CAPACITY(PTR_LIST_ORDERS - 1)
+
+static inline int ptr_list_capacity(struct ptr_list *list)
+{
+	return PTR_LIST_CAPACITY(list->order);
+}
+
 #define ptr_list_empty(x) ((x) == NULL)
 
 void * undo_ptr_list_last(struct ptr_list **head);
@@ -40,11 +61,27 @@ int delete_ptr_list_entry(struct ptr_list **, void *, int);
 int replace_ptr_list_entry(struct ptr_list **, void *old, void *new, int);
 extern void sort_list(struct ptr_list **, int (*)(const void *, const void *));
 
+struct allocator_mark;
+struct allocator_stats;
+extern void get_ptrlist_stats(struct allocator_stats *);
+extern void mark_ptrlist_alloc(struct allocator_mark *marks);
+extern void release_ptrlist_alloc(struct allocator_mark *marks);
+
 extern void **__add_ptr_list(struct ptr_list **, void *, unsigned long);
 extern void concat_ptr_list(struct ptr_list *a, struct ptr_list **b);
 extern void __free_ptr_list(struct ptr_list **);
-extern int ptr_list_size(struct ptr_list *);
 extern int linearize_ptr_list(struct ptr_list *, void **, int);
+extern void *ptr_list_nth_entry(struct ptr_list *, unsigned int idx);
+extern void **ptr_list_array(struct ptr_list *, void **buf);
+
+/*
+ * The number of entries is kept up-to-date in the first
+ * node of the list, so this is cheap.
+ */
+static inline int ptr_list_size(struct ptr_list *head)
+{
+	return head ? head->total : 0;
+}
 
 /*
  * Hey, who said that you can't do overloading in C?
@@ -96,23 +133,28 @@ static inline void *last_ptr_list(struct ptr_list *list)
 	return PTR_ENTRY(list, list->nr-1);
 }
 
-#define PTR_DEREF(__head, idx, PTR_ENTRY) ({						\
-	struct ptr_list *__list = __head;						\
-	while (__list && __list->nr == 0) {						\
-		__list = __list->next;							\
-		if (__list == __head)							\
-			__list = NULL;							\
+/*
+ * The first block of the list having some entries, NULL if none:
+ * a packed list can still start with an empty block (see
+ * pack_ptr_list()).
+ */
+#define PTR_FIRST_BLOCK(__head) ({							\
+	struct ptr_list *__block = __head;						\
+	while (__block && __block->nr == 0) {						\
+		__block = __block->next;						\
+		if (__block == __head)							\
+			__block = NULL;							\
 	}										\
-	__list ? PTR_ENTRY(__list, idx) : NULL;						\
+	__block;									\
 })
 
 #define DO_PREPARE(head, ptr, __head, __list, __nr, PTR_ENTRY)				\
 	do {										\
 		struct ptr_list *__head = (struct ptr_list *) (head);			\
-		struct ptr_list *__list = __head;					\
+		struct ptr_list *__list = PTR_FIRST_BLOCK(__head);			\
 		int __nr = 0;								\
 		CHECK_TYPE(head,ptr);							\
-		ptr = PTR_DEREF(__head, 0, PTR_ENTRY);					\
+		ptr = __list ? PTR_ENTRY(__list, 0) : NULL;				\
 
 #define DO_NEXT(ptr, __head, __list, __nr, PTR_ENTRY)					\
 		if (ptr) {								\
@@ -133,8 +175,8 @@ static inline void *last_ptr_list(struct ptr_list *list)
 #define DO_RESET(ptr, __head, __list, __nr, PTR_ENTRY)					\
 	do {										\
 		__nr = 0;								\
-		__list = __head;							\
-		if (__head) ptr = PTR_DEREF(__head, 0, PTR_ENTRY);			\
+		__list = PTR_FIRST_BLOCK(__head);					\
+		ptr = __list ? PTR_ENTRY(__list, 0) : NULL;				\
 	} while (0)
 
 #define DO_FINISH(ptr, __head, __list, __nr)						\
@@ -259,7 +301,7 @@ extern void split_ptr_list_head(struct ptr_list *);
 
 #define DO_INSERT_CURRENT(new, ptr, __head, __list, __nr) do {				\
 	void **__this, **__last;							\
-	if (__list->nr == LIST_NODE_NR)							\
+	if (__list->nr == ptr_list_capacity(__list))					\
 		DO_SPLIT(ptr, __head, __list, __nr);					\
 	__this = __list->list + __nr;							\
 	__last = __list->list + __list->nr - 1;						\
@@ -269,6 +311,7 @@ extern void split_ptr_list_head(struct ptr_list *);
 	}										\
 	*__this = (new);								\
 	__list->nr++;									\
+	__head->total++;								\
 } while (0)
 
 #define INSERT_CURRENT(new, ptr) \
@@ -283,6 +326,7 @@ extern void split_ptr_list_head(struct ptr_list *);
 	}										\
 	*__this = (void *)0xf0f0f0f0;							\
 	__list->nr--; __nr--;								\
+	__head->total--;								\
 } while (0)
 
 #define DELETE_CURRENT_PTR(ptr) \
@@ -291,18 +335,23 @@ extern void split_ptr_list_head(struct ptr_list *);
 #define REPLACE_CURRENT_PTR(ptr, new_ptr)						\
 	do { *THIS_ADDRESS(ptr) = (new_ptr); } while (0)
 
-#define DO_MARK_CURRENT_DELETED(ptr, __list) do {	\
-		REPLACE_CURRENT_PTR(ptr, NULL);		\
-		__list->rm++;				\
+#define DO_MARK_CURRENT_DELETED(ptr, __head, __list) do {	\
+		REPLACE_CURRENT_PTR(ptr, NULL);			\
+		__list->rm++;					\
+		__head->total--;				\
 	} while (0)
 
 #define MARK_CURRENT_DELETED(ptr) \
-	DO_MARK_CURRENT_DELETED(ptr, __list##ptr)
+	DO_MARK_CURRENT_DELETED(ptr, __head##ptr, __list##ptr)
 
 extern void pack_ptr_list(struct ptr_list **);
 
 #define PACK_PTR_LIST(x) pack_ptr_list((struct ptr_list **)(x))
 
+extern void compact_ptr_list(struct ptr_list **);
+
+#define COMPACT_PTR_LIST(x) compact_ptr_list((struct ptr_list **)(x))
+
 static inline void update_tag(void *p, unsigned long tag)
 {
 	unsigned long *ptr = p;
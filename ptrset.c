@@ -0,0 +1,219 @@
+// SPDX-License-Identifier: MIT
+//
+// ptrset.c - small hash-sets of pointers
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lib.h"
+#include "ptrlist.h"
+#include "ptrset.h"
+
+#define PTR_SET_MIN_SLOTS	16
+
+static inline unsigned int ptr_set_hash(const void *ptr, unsigned int mask)
+{
+	unsigned long hash = hashval(ptr);
+
+	// the low bits are mostly alignment
+	hash ^= hash >> 4;
+	hash *= 0x9e3779b1UL;
+	hash ^= hash >> 16;
+	return hash & mask;
+}
+
+/*
+ * The same table holds the sets, which have one pointer per entry,
+ * and the maps, which have two: the key then the value. Only the
+ * key is hashed and compared; 'width' is the number of pointers of
+ * an entry. The inline buffer holds PTR_SET_INLINE / width entries.
+ */
+static void **find_entry(void **table, unsigned int mask, const void *key, int width)
+{
+	unsigned int i = ptr_set_hash(key, mask);
+
+	while (table[i * width] && table[i * width] != key)
+		i = (i + 1) & mask;
+	return &table[i * width];
+}
+
+static void insert_entry(void **table, unsigned int mask, void **entry, int width)
+{
+	memcpy(find_entry(table, mask, entry[0], width), entry, width * sizeof(void *));
+}
+
+/*
+ * Move the entries to a (new) table of 'size' entries.
+ */
+static void rehash(struct ptr_set *set, unsigned int size, int width)
+{
+	void **slots = ptr_set_slots(set);
+	unsigned int nr = ptr_set_nr_slots(set);
+	void **table = calloc(size, width * sizeof(void *));
+	unsigned int i;
+
+	if (!table)
+		die("out of memory");
+	for (i = 0; i < nr; i++) {
+		if (slots[i * width])
+			insert_entry(table, size - 1, &slots[i * width], width);
+	}
+	if (set->mask)
+		free(set->table);
+	set->table = table;
+	set->mask = size - 1;
+}
+
+/*
+ * Make room for 'nr' entries, keeping the table at most half full.
+ */
+static void ptr_set_reserve(struct ptr_set *set, unsigned int nr, int width)
+{
+	unsigned int size;
+
+	if (nr <= PTR_SET_INLINE / width && !set->mask)
+		return;
+	if (set->mask && nr * 2 <= set->mask + 1)
+		return;
+	size = set->mask ? (set->mask + 1) * 2 : PTR_SET_MIN_SLOTS;
+	while (nr * 2 > size)
+		size *= 2;
+	rehash(set, size, width);
+}
+
+/*
+ * The entry of 'key', NULL if there is none.
+ */
+static void **lookup_entry(const struct ptr_set *set, const void *key, int width)
+{
+	void **entry;
+	unsigned int i;
+
+	if (!set->mask) {
+		void **slots = (void **)set->inline_table;
+
+		for (i = 0; i < set->nr; i++) {
+			if (slots[i * width] == key)
+				return &slots[i * width];
+		}
+		return NULL;
+	}
+
+	entry = find_entry(set->table, set->mask, key, width);
+	return *entry ? entry : NULL;
+}
+
+/*
+ * Add the entry, if its key isn't there yet.
+ */
+static int add_entry(struct ptr_set *set, void **entry, int width)
+{
+	if (lookup_entry(set, entry[0], width))
+		return 0;
+	ptr_set_reserve(set, set->nr + 1, width);
+	if (set->mask)
+		insert_entry(set->table, set->mask, entry, width);
+	else
+		memcpy(&set->inline_table[set->nr * width], entry, width * sizeof(void *));
+	set->nr++;
+	return 1;
+}
+
+int __ptr_set_contains(const struct ptr_set *set, const void *ptr)
+{
+	return lookup_entry(set, ptr, 1) != NULL;
+}
+
+/*
+ * Add 'ptr' to the set.
+ * Return 1 if it wasn't there yet, 0 otherwise.
+ */
+int __ptr_set_add(struct ptr_set *set, void *ptr)
+{
+	return add_entry(set, &ptr, 1);
+}
+
+/*
+ * Remove 'ptr' from the set.
+ * Return 1 if it was there, 0 otherwise.
+ */
+int __ptr_set_remove(struct ptr_set *set, const void *ptr)
+{
+	unsigned int mask = set->mask;
+	void **table = set->table;
+	unsigned int i, j;
+
+	if (!mask) {
+		for (i = 0; i < set->nr; i++) {
+			if (set->inline_table[i] != ptr)
+				continue;
+			set->inline_table[i] = set->inline_table[--set->nr];
+			set->inline_table[set->nr] = NULL;
+			return 1;
+		}
+		return 0;
+	}
+
+	i = ptr_set_hash(ptr, mask);
+	while (table[i] != ptr) {
+		if (!table[i])
+			return 0;
+		i = (i + 1) & mask;
+	}
+	set->nr--;
+
+	/*
+	 * Shift back the following entries of the cluster that
+	 * can't be found anymore once the hole is made.
+	 */
+	for (j = (i + 1) & mask; table[j]; j = (j + 1) & mask) {
+		unsigned int home = ptr_set_hash(table[j], mask);
+
+		if (((j - home) & mask) < ((j - i) & mask))
+			continue;
+		table[i] = table[j];
+		i = j;
+	}
+	table[i] = NULL;
+	return 1;
+}
+
+void __ptr_set_clear(struct ptr_set *set)
+{
+	if (set->mask)
+		free(set->table);
+	memset(set, 0, sizeof(*set));
+}
+
+void __add_ptr_list_to_set(struct ptr_set *set, struct ptr_list *list)
+{
+	void *ptr;
+
+	ptr_set_reserve(set, set->nr + ptr_list_size(list), 1);
+	FOR_EACH_PTR(list, ptr) {
+		__ptr_set_add(set, ptr);
+	} END_FOR_EACH_PTR(ptr);
+}
+
+/*
+ * Map 'key' to 'val'.
+ * Return 1 if 'key' wasn't mapped yet, 0 (and keep the old value)
+ * otherwise.
+ */
+int __ptr_map_add(struct ptr_set *map, void *key, void *val)
+{
+	void *entry[2] = { key, val };
+
+	return add_entry(map, entry, 2);
+}
+
+/*
+ * The value 'key' is mapped to, NULL if none.
+ */
+void *__ptr_map_lookup(const struct ptr_set *map, const void *key)
+{
+	void **entry = lookup_entry(map, key, 2);
+
+	return entry ? entry[1] : NULL;
+}
@@ -0,0 +1,118 @@
+#ifndef PTRSET_H
+#define PTRSET_H
+
+/*
+ * Sets of pointers, to be used next to a ptr_list when
+ * "is this pointer already in the list?" is asked too often
+ * for a linear walk of the list.
+ *
+ * Open addressing with linear probing. Small sets live
+ * entirely in the inline buffer and are simply scanned;
+ * a (power of two) table is only allocated once they grow
+ * bigger than that. NULL can't be stored in a set.
+ *
+ * A zeroed set is a valid empty set.
+ *
+ * The same tables, with a value next to each pointer, make maps
+ * from pointers to pointers (see DECLARE_PTR_MAP() below).
+ */
+
+struct ptr_list;
+
+#define PTR_SET_INLINE	6
+
+struct ptr_set {
+	unsigned int nr;
+	unsigned int mask;		/* table size - 1, 0 if inline */
+	void **table;
+	void *inline_table[PTR_SET_INLINE];
+};
+
+extern int __ptr_set_add(struct ptr_set *set, void *ptr);
+extern int __ptr_set_contains(const struct ptr_set *set, const void *ptr);
+extern int __ptr_set_remove(struct ptr_set *set, const void *ptr);
+extern void __ptr_set_clear(struct ptr_set *set);
+extern void __add_ptr_list_to_set(struct ptr_set *set, struct ptr_list *list);
+extern int __ptr_map_add(struct ptr_set *map, void *key, void *val);
+extern void *__ptr_map_lookup(const struct ptr_set *map, const void *key);
+
+static inline void **ptr_set_slots(const struct ptr_set *set)
+{
+	return set->mask ? set->table : (void **)set->inline_table;
+}
+
+static inline unsigned int ptr_set_nr_slots(const struct ptr_set *set)
+{
+	return set->mask ? set->mask + 1 : set->nr;
+}
+
+/*
+ * Typed sets, type-checked like the ptr_lists:
+ *	DECLARE_PTR_SET(pseudo_set, struct pseudo);
+ */
+#define DECLARE_PTR_SET(setname, type)					\
+	struct setname {						\
+		struct ptr_set set;					\
+		type *type_check[0];					\
+	}
+
+#define CHECK_SET_TYPE(s, ptr)						\
+	(void)sizeof((s)->type_check[0] == (ptr))
+
+#define ptr_set_add(s, ptr)						\
+	(CHECK_SET_TYPE(s, ptr), __ptr_set_add(&(s)->set, (void *)(ptr)))
+#define ptr_set_contains(s, ptr)					\
+	(CHECK_SET_TYPE(s, ptr), __ptr_set_contains(&(s)->set, (ptr)))
+#define ptr_set_remove(s, ptr)						\
+	(CHECK_SET_TYPE(s, ptr), __ptr_set_remove(&(s)->set, (ptr)))
+#define ptr_set_clear(s)		__ptr_set_clear(&(s)->set)
+#define ptr_set_size(s)			((s)->set.nr)
+
+#define add_ptr_list_to_set(s, head)					\
+	(CHECK_SET_TYPE(s, (head)->list[0]),				\
+	 __add_ptr_list_to_set(&(s)->set, (struct ptr_list *)(head)))
+
+/*
+ * Walk the set, in no particular order. The set must not be
+ * modified during the walk.
+ */
+#define FOR_EACH_PTR_SET(s, ptr) do {					\
+	void **__slots = ptr_set_slots(&(s)->set);			\
+	unsigned int __nr = ptr_set_nr_slots(&(s)->set);		\
+	unsigned int __i;						\
+	for (__i = 0; __i < __nr; __i++) {				\
+		if (!__slots[__i])					\
+			continue;					\
+		ptr = __slots[__i];
+
+#define END_FOR_EACH_PTR_SET(ptr)					\
+	}								\
+} while (0)
+
+/*
+ * Typed maps, of which only the keys can't be NULL:
+ *	DECLARE_PTR_MAP(pseudo_map, struct pseudo, struct storage);
+ * They can't be walked nor have their entries removed.
+ */
+#define DECLARE_PTR_MAP(mapname, ktype, vtype)				\
+	struct mapname {						\
+		struct ptr_set set;					\
+		ktype *key_check[0];					\
+		vtype *val_check[0];					\
+	}
+
+#define CHECK_MAP_KEY(m, key)						\
+	(void)sizeof((m)->key_check[0] == (key))
+#define CHECK_MAP_VAL(m, val)						\
+	(void)sizeof((m)->val_check[0] == (val))
+
+#define ptr_map_add(m, key, val)					\
+	(CHECK_MAP_KEY(m, key), CHECK_MAP_VAL(m, val),			\
+	 __ptr_map_add(&(m)->set, (void *)(key), (void *)(val)))
+#define ptr_map_lookup(m, key)						\
+	(CHECK_MAP_KEY(m, key),						\
+	 (__typeof__((m)->val_check[0]))__ptr_map_lookup(&(m)->set, (key)))
+#define ptr_map_clear(m)		__ptr_set_clear(&(m)->set)
+#define ptr_map_size(m)			((m)->set.nr)
+
+#endif
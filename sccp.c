@@ -0,0 +1,429 @@
+// SPDX-License-Identifier: MIT
+//
+// sccp.c - sparse conditional constant propagation
+//
+// This is the classic Wegman & Zadeck algorithm: each pseudo is
+// given a lattice value (undefined, constant or overdefined) and
+// only the instructions of the basic blocks found to be executable
+// are evaluated. Values and reachability are thus solved together,
+// constants flowing through phi-nodes and unreachable branches
+// being settled in a single pass.
+//
+// The lattice value of a pseudo is kept in its 'priv' field:
+//	NULL		undefined (top)
+//	VAL pseudo	constant
+//	OVERDEFINED	not a constant (bottom)
+// and a basic block is executable when its generation is the
+// one of the current run.
+
+#include <assert.h>
+#include "linearize.h"
+#include "flow.h"
+#include "sccp.h"
+
+static struct pseudo overdefined_pseudo;
+#define OVERDEFINED	(&overdefined_pseudo)
+
+static unsigned long generation;
+static struct basic_block_list *bb_worklist;
+static struct instruction_list *insn_worklist;
+
+/*
+ * The instructions in insn_worklist, so that each one is queued
+ * only once: revisiting a big phi-node for each of its sources
+ * would be quadratic.
+ */
+DECLARE_PTR_SET(instruction_set, struct instruction);
+static struct instruction_set insn_queued;
+
+static void queue_insn(struct instruction *insn)
+{
+	if (ptr_set_add(&insn_queued, insn))
+		add_instruction(&insn_worklist, insn);
+}
+
+static inline int is_executable(struct basic_block *bb)
+{
+	return bb->generation == generation;
+}
+
+static inline int is_const(pseudo_t val)
+{
+	return val && val != OVERDEFINED;
+}
+
+static pseudo_t lattice(pseudo_t pseudo)
+{
+	switch (pseudo->type) {
+	case PSEUDO_VAL:
+		return pseudo;
+	case PSEUDO_REG:
+	case PSEUDO_PHI:
+		return pseudo->priv;
+	default:
+		return OVERDEFINED;
+	}
+}
+
+/*
+ * Does 'insn' define its target?
+ * (OP_STORE, for example, use it as an input.)
+ */
+static inline int defines_target(struct instruction *insn)
+{
+	pseudo_t target = insn->target;
+
+	if (!target)
+		return 0;
+	if (target->type != PSEUDO_REG && target->type != PSEUDO_PHI)
+		return 0;
+	return target->def == insn;
+}
+
+static pseudo_t meet(pseudo_t a, pseudo_t b)
+{
+	if (!a)
+		return b;
+	if (!b)
+		return a;
+	if (a == b)
+		return a;
+	return OVERDEFINED;
+}
+
+static void set_lattice(struct instruction *insn, pseudo_t val)
+{
+	pseudo_t target = insn->target;
+	pseudo_t old = target->priv;
+	struct pseudo_user *pu;
+
+	val = meet(old, val);
+	if (val == old)
+		return;
+	target->priv = val;
+
+	FOR_EACH_PTR(target->users, pu) {
+		queue_insn(pu->insn);
+	} END_FOR_EACH_PTR(pu);
+}
+
+static void add_phi_users(struct basic_block *bb)
+{
+	struct instruction *insn;
+
+	FOR_EACH_PTR(bb->insns, insn) {
+		if (!insn->bb || insn->opcode != OP_PHI)
+			continue;
+		queue_insn(insn);
+	} END_FOR_EACH_PTR(insn);
+}
+
+static void mark_edge(struct basic_block *bb)
+{
+	if (is_executable(bb)) {
+		/* a new incoming edge may change its phi-nodes */
+		add_phi_users(bb);
+		return;
+	}
+	bb->generation = generation;
+	add_bb(&bb_worklist, bb);
+}
+
+static struct basic_block *switch_target(struct instruction *insn, long long val)
+{
+	struct multijmp *jmp;
+
+	FOR_EACH_PTR(insn->multijmp_list, jmp) {
+		/* Default case */
+		if (jmp->begin > jmp->end)
+			return jmp->target;
+		if (val >= jmp->begin && val <= jmp->end)
+			return jmp->target;
+	} END_FOR_EACH_PTR(jmp);
+	return NULL;
+}
+
+/*
+ * Return the only block a terminator can branch to,
+ * given the current lattice, or NULL if not known.
+ */
+static struct basic_block *branch_target(struct instruction *insn)
+{
+	pseudo_t cond;
+
+	switch (insn->opcode) {
+	case OP_BR:
+		return insn->bb_true;
+	case OP_CBR:
+		cond = lattice(insn->cond);
+		if (!is_const(cond))
+			return NULL;
+		return cond->value ? insn->bb_true : insn->bb_false;
+	case OP_SWITCH:
+		cond = lattice(insn->cond);
+		if (!is_const(cond))
+			return NULL;
+		return switch_target(insn, cond->value);
+	default:
+		return NULL;
+	}
+}
+
+static int is_child(struct basic_block *bb, struct basic_block *child)
+{
+	struct basic_block *tmp;
+
+	FOR_EACH_PTR(bb->children, tmp) {
+		if (tmp == child)
+			return 1;
+	} END_FOR_EACH_PTR(tmp);
+	return 0;
+}
+
+/*
+ * Can the value of a phi-source defined in 'src' reach 'dst'?
+ * If 'src' is not a direct parent of 'dst' we can only tell
+ * that it is executable.
+ */
+static int edge_executable(struct basic_block *src, struct basic_block *dst)
+{
+	struct instruction *br;
+	struct basic_block *target;
+
+	if (!is_executable(src))
+		return 0;
+	br = last_instruction(src->insns);
+	if (!br || !br->bb)
+		return 1;
+	target = branch_target(br);
+	if (!target || target == dst)
+		return 1;
+	return !is_child(src, dst);
+}
+
+static void visit_branch(struct instruction *insn)
+{
+	struct basic_block *target = branch_target(insn);
+	struct basic_block *child;
+
+	if (target) {
+		mark_edge(target);
+		return;
+	}
+	FOR_EACH_PTR(insn->bb->children, child) {
+		mark_edge(child);
+	} END_FOR_EACH_PTR(child);
+}
+
+static pseudo_t visit_phi(struct instruction *insn)
+{
+	pseudo_t phi, val = NULL;
+
+	FOR_EACH_PTR(insn->phi_list, phi) {
+		struct instruction *def;
+
+		if (phi == VOID)
+			continue;
+		def = phi->def;
+		if (!def->bb || def->phi_src == VOID)
+			continue;
+		if (!edge_executable(def->bb, insn->bb))
+			continue;
+		val = meet(val, lattice(phi));
+		if (val == OVERDEFINED)
+			break;
+	} END_FOR_EACH_PTR(phi);
+	return val;
+}
+
+static pseudo_t visit_select(struct instruction *insn)
+{
+	pseudo_t cond = lattice(insn->src1);
+
+	if (!cond)
+		return NULL;
+	if (cond != OVERDEFINED)
+		return lattice(cond->value ? insn->src2 : insn->src3);
+	return meet(lattice(insn->src2), lattice(insn->src3));
+}
+
+static pseudo_t visit_binop(struct instruction *insn)
+{
+	pseudo_t src1 = lattice(insn->src1);
+	pseudo_t src2 = lattice(insn->src2);
+	pseudo_t val;
+
+	if (src1 == OVERDEFINED || src2 == OVERDEFINED)
+		return OVERDEFINED;
+	if (!src1 || !src2)
+		return NULL;
+	val = eval_binop(insn->opcode, insn->size, src1->value, src2->value);
+	return val ? val : OVERDEFINED;
+}
+
+static pseudo_t visit_unop(struct instruction *insn)
+{
+	pseudo_t src = lattice(insn->src1);
+	pseudo_t val;
+
+	if (!is_const(src))
+		return src;
+	if (insn->opcode == OP_CAST || insn->opcode == OP_SCAST)
+		val = eval_cast(insn, src->value);
+	else
+		val = eval_unop(insn->opcode, insn->size, src->value);
+	return val ? val : OVERDEFINED;
+}
+
+static void visit_insn(struct instruction *insn)
+{
+	pseudo_t val;
+
+	switch (insn->opcode) {
+	case OP_BINARY ... OP_BINARY_END:
+	case OP_BINCMP ... OP_BINCMP_END:
+		val = visit_binop(insn);
+		break;
+	case OP_NOT: case OP_NEG:
+	case OP_CAST: case OP_SCAST:
+		val = visit_unop(insn);
+		break;
+	case OP_SEL:
+		val = visit_select(insn);
+		break;
+	case OP_PHI:
+		val = visit_phi(insn);
+		break;
+	case OP_PHISOURCE:
+		/* VOID phi-sources are ignored by the phi-nodes */
+		if (insn->phi_src == VOID)
+			return;
+		val = lattice(insn->phi_src);
+		break;
+	case OP_TERMINATOR ... OP_TERMINATOR_END:
+		visit_branch(insn);
+		return;
+	default:
+		val = OVERDEFINED;
+		break;
+	}
+
+	if (val && defines_target(insn))
+		set_lattice(insn, val);
+}
+
+static void visit_bb(struct basic_block *bb)
+{
+	struct instruction *insn;
+
+	FOR_EACH_PTR(bb->insns, insn) {
+		if (!insn->bb)
+			continue;
+		visit_insn(insn);
+	} END_FOR_EACH_PTR(insn);
+}
+
+static void propagate(struct entrypoint *ep)
+{
+	mark_edge(ep->entry->bb);
+
+	for (;;) {
+		struct basic_block *bb;
+		struct instruction *insn;
+
+		/* Evaluate whole blocks first, they give the best ordering */
+		bb = delete_ptr_list_last((struct ptr_list **)&bb_worklist);
+		if (bb) {
+			visit_bb(bb);
+			continue;
+		}
+		insn = delete_ptr_list_last((struct ptr_list **)&insn_worklist);
+		if (!insn)
+			break;
+		ptr_set_remove(&insn_queued, insn);
+		if (!insn->bb || !is_executable(insn->bb))
+			continue;
+		visit_insn(insn);
+	}
+	ptr_set_clear(&insn_queued);
+}
+
+static int rewrite_bb(struct basic_block *bb)
+{
+	struct instruction *insn, *br = NULL;
+	struct basic_block *target;
+	int changed = 0;
+
+	FOR_EACH_PTR(bb->insns, insn) {
+		pseudo_t val;
+
+		if (!insn->bb)
+			continue;
+		switch (insn->opcode) {
+		case OP_CBR:
+		case OP_SWITCH:
+			br = insn;
+			continue;
+		case OP_PHISOURCE:
+			val = lattice(insn->target);
+			if (!is_const(val) || insn->phi_src == val)
+				continue;
+			kill_use(&insn->phi_src);
+			use_pseudo(insn, val, &insn->phi_src);
+			changed |= REPEAT_CSE;
+			continue;
+		default:
+			if (!defines_target(insn))
+				continue;
+			val = lattice(insn->target);
+			if (!is_const(val))
+				continue;
+			convert_instruction_target(insn, val);
+			kill_instruction(insn);
+			changed |= REPEAT_CSE;
+			continue;
+		}
+	} END_FOR_EACH_PTR(insn);
+
+	if (!br || !br->bb)
+		return changed;
+	target = branch_target(br);
+	if (!target)
+		return changed;
+	insert_branch(bb, br, target);
+	return changed | REPEAT_CFG_CLEANUP;
+}
+
+static void clear_lattice(struct entrypoint *ep)
+{
+	struct basic_block *bb;
+
+	FOR_EACH_PTR(ep->bbs, bb) {
+		struct instruction *insn;
+
+		FOR_EACH_PTR(bb->insns, insn) {
+			if (insn->target && has_use_list(insn->target))
+				insn->target->priv = NULL;
+		} END_FOR_EACH_PTR(insn);
+	} END_FOR_EACH_PTR(bb);
+}
+
+int sccp(struct entrypoint *ep)
+{
+	struct basic_block *bb;
+	int changed = 0;
+
+	generation = ++bb_generation;
+	propagate(ep);
+
+	FOR_EACH_PTR(ep->bbs, bb) {
+		if (!is_executable(bb))
+			continue;
+		changed |= rewrite_bb(bb);
+	} END_FOR_EACH_PTR(bb);
+
+	clear_lattice(ep);
+	if (changed & REPEAT_CFG_CLEANUP)
+		kill_unreachable_bbs(ep);
+	return changed;
+}
@@ -0,0 +1,9 @@
+#ifndef SCCP_H
+#define SCCP_H
+
+struct entrypoint;
+
+/* sccp.c */
+int sccp(struct entrypoint *ep);
+
+#endif
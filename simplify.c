@@ -58,7 +58,7 @@ static int get_phisources(struct instruction *sources[], int nbr, struct instruc
 static int if_convert_phi(struct instruction *insn)
 {
 	struct instruction *array[2];
-	struct basic_block *parents[3];
+	struct basic_block *buf[2], **parents;
 	struct basic_block *bb, *bb1, *bb2, *source;
 	struct instruction *br;
 	pseudo_t p1, p2;
@@ -66,8 +66,9 @@ static int if_convert_phi(struct instruction *insn)
 	bb = insn->bb;
 	if (get_phisources(array, 2, insn))
 		return 0;
-	if (linearize_ptr_list((struct ptr_list *)bb->parents, (void **)parents, 3) != 2)
+	if (bb_list_size(bb->parents) != 2)
 		return 0;
+	parents = (void *)ptr_list_array((struct ptr_list *)bb->parents, (void **)buf);
 	p1 = array[0]->phi_src;
 	bb1 = array[0]->bb;
 	p2 = array[1]->phi_src;
@@ -404,12 +405,14 @@ static unsigned int operand_size(struct instruction *insn, pseudo_t pseudo)
 	return size;
 }
 
-static pseudo_t eval_insn(struct instruction *insn)
+/*
+ * Evaluate the binop or compare 'op' on the constants 'left' and 'right'.
+ * Return the value pseudo of the result or NULL if it can't
+ * be evaluated (undefined result or unhandled operation).
+ */
+pseudo_t eval_binop(int op, unsigned int size, long long left, long long right)
 {
 	/* FIXME! Verify signs and sizes!! */
-	unsigned int size = insn->size;
-	long long left = insn->src1->value;
-	long long right = insn->src2->value;
 	unsigned long long ul, ur;
 	long long res, mask, bits;
 
@@ -423,7 +426,7 @@ static pseudo_t eval_insn(struct instruction *insn)
 	ul = left & bits;
 	ur = right & bits;
 
-	switch (insn->opcode) {
+	switch (op) {
 	case OP_ADD:
 		res = left + right;
 		break;
@@ -525,6 +528,11 @@ undef:
 	return NULL;
 }
 
+static pseudo_t eval_insn(struct instruction *insn)
+{
+	return eval_binop(insn->opcode, insn->size, insn->src1->value, insn->src2->value);
+}
+
 
 static int simplify_asr(struct instruction *insn, pseudo_t pseudo, long long value)
 {
@@ -810,12 +818,16 @@ static int simplify_associative_binop(struct instruction *insn)
 	return REPEAT_CSE;
 }
 
-static int simplify_constant_unop(struct instruction *insn)
+/*
+ * Evaluate the unop 'op' on the constant 'val'.
+ * Return the value pseudo of the result or NULL if
+ * the operation can't be evaluated.
+ */
+pseudo_t eval_unop(int op, unsigned int size, long long val)
 {
-	long long val = insn->src1->value;
 	long long res, mask;
 
-	switch (insn->opcode) {
+	switch (op) {
 	case OP_NOT:
 		res = ~val;
 		break;
@@ -823,12 +835,21 @@ static int simplify_constant_unop(struct instruction *insn)
 		res = -val;
 		break;
 	default:
-		return 0;
+		return NULL;
 	}
-	mask = 1ULL << (insn->size-1);
+	mask = 1ULL << (size-1);
 	res &= mask | (mask-1);
-	
-	replace_with_pseudo(insn, value_pseudo(res));
+
+	return value_pseudo(res);
+}
+
+static int simplify_constant_unop(struct instruction *insn)
+{
+	pseudo_t res = eval_unop(insn->opcode, insn->size, insn->src1->value);
+
+	if (!res)
+		return 0;
+	replace_with_pseudo(insn, res);
 	return REPEAT_CSE;
 }
 
@@ -936,16 +957,13 @@ static long long get_cast_value(long long val, int old_size, int new_size, int s
 	return val & (mask | (mask-1));
 }
 
-static int simplify_cast(struct instruction *insn)
+/*
+ * Can this cast be removed or evaluated at all?
+ */
+static int cast_is_simplifiable(struct instruction *insn)
 {
-	struct symbol *orig_type;
-	int orig_size, size;
-	pseudo_t src;
-
-	if (dead_insn(insn, &insn->src, NULL, NULL))
-		return REPEAT_CSE;
+	struct symbol *orig_type = insn->orig_type;
 
-	orig_type = insn->orig_type;
 	if (!orig_type)
 		return 0;
 
@@ -957,15 +975,49 @@ static int simplify_cast(struct instruction *insn)
 	if (is_float_type(orig_type) && !is_float_type(insn->type))
 		return 0;
 
+	return 1;
+}
+
+static pseudo_t fold_cast(struct instruction *insn, long long val)
+{
+	struct symbol *orig_type = insn->orig_type;
+	int sign = orig_type->ctype.modifiers & MOD_SIGNED;
+
+	return value_pseudo(get_cast_value(val, orig_type->bit_size, insn->size, sign));
+}
+
+/*
+ * Evaluate the cast 'insn' on the constant 'val'.
+ * Return the value pseudo of the result or NULL if
+ * the cast must be kept.
+ */
+pseudo_t eval_cast(struct instruction *insn, long long val)
+{
+	if (!cast_is_simplifiable(insn))
+		return NULL;
+	return fold_cast(insn, val);
+}
+
+static int simplify_cast(struct instruction *insn)
+{
+	struct symbol *orig_type;
+	int orig_size, size;
+	pseudo_t src;
+
+	if (dead_insn(insn, &insn->src, NULL, NULL))
+		return REPEAT_CSE;
+
+	if (!cast_is_simplifiable(insn))
+		return 0;
+
+	orig_type = insn->orig_type;
 	orig_size = orig_type->bit_size;
 	size = insn->size;
 	src = insn->src;
 
 	/* A cast of a constant? */
 	if (constant(src)) {
-		int sign = orig_type->ctype.modifiers & MOD_SIGNED;
-		long long val = get_cast_value(src->value, orig_size, size, sign);
-		src = value_pseudo(val);
+		src = fold_cast(insn, src->value);
 		goto simplify;
 	}
 
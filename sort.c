@@ -1,10 +1,15 @@
 /*
  * sort_list: a stable sort for lists.
  *
- * Time complexity: O(n*log n)
- *   [assuming limited zero-element fragments]
+ * An adaptive merge sort: the entries are copied into an array
+ * where the runs already in order (or in strictly reverse order)
+ * are found and merged together, galloping through the parts
+ * where one run wins many times in a row. The sorted entries are
+ * then written back into the nodes of the list.
  *
- * Space complexity: O(1).
+ * Time complexity: O(n*log n), O(n) for sorted or reversed input.
+ *
+ * Space complexity: O(n).
  *
  * Stable: yes.
  */
@@ -17,7 +22,6 @@
 #include "allocate.h"
 
 #undef PARANOIA
-#undef COVERAGE
 
 #ifdef PARANOIA
 #include <assert.h>
@@ -25,266 +29,289 @@
 #define assert(x)
 #endif
 
-#ifdef COVERAGE
-static unsigned char been_there[256];
-#define BEEN_THERE(_c)					\
-  do {							\
-	if (!been_there[_c]) {				\
-		been_there[_c] = 1;			\
-		printf ("Been there: %c\n", _c);	\
-	}						\
-  } while (0)
-#else
-#define BEEN_THERE(_c) do { } while (0)
-#endif
+typedef int (*cmp_t)(const void *, const void *);
+
+/*
+ * The entries are moved with their tag but are compared without.
+ */
+#define UNTAG(p)	((void *)(~3UL & (unsigned long)(p)))
+
+static inline int compare(cmp_t cmp, void *a, void *b)
+{
+	return cmp(UNTAG(a), UNTAG(b));
+}
 
-// Sort one fragment.  LIST_NODE_NR (==29) is a bit too high for my
-// taste for something this simple.  But, hey, it's O(1).
-//
-// I would use libc qsort for this, but its comparison function
-// gets a pointer indirection extra.
-static void array_sort(void **ptr, int nr, int (*cmp)(const void *, const void *))
+// The runs shorter than this are extended with an insertion sort.
+#define MIN_RUN		16
+
+// How many wins in a row before switching to galloping.
+#define MIN_GALLOP	7
+
+static void insertion_sort(void **ptr, int start, int nr, cmp_t cmp)
 {
 	int i;
-	for (i = 1; i < nr; i++) {
+
+	for (i = start; i < nr; i++) {
 		void *p = ptr[i];
-		if (cmp(ptr[i-1],p) > 0) {
-			int j = i;
-			do {
-				ptr[j] = ptr[j-1];
-				if (!--j)
-					break;
-			} while (cmp(ptr[j-1], p) > 0);
-			ptr[j] = p;
+		int j = i;
+
+		while (j > 0 && compare(cmp, ptr[j-1], p) > 0) {
+			ptr[j] = ptr[j-1];
+			j--;
 		}
+		ptr[j] = p;
 	}
 }
 
-#ifdef PARANOIA
-static void verify_seq_sorted (struct ptr_list *l, int n,
-			       int (*cmp)(const void *, const void *))
+static void reverse(void **ptr, int nr)
 {
-	int i = 0;
-	const void *a;
-	struct ptr_list *head = l;
-
-	while (l->nr == 0) {
-		l = l->next;
-		if (--n == 0)
-			return;
-		assert (l != head);
+	int i, j;
+
+	for (i = 0, j = nr - 1; i < j; i++, j--) {
+		void *p = ptr[i];
+		ptr[i] = ptr[j];
+		ptr[j] = p;
 	}
+}
 
-	a = l->list[0];
-	while (n > 0) {
-		const void *b;
-		if (++i >= l->nr) {
-			i = 0;
-			l = l->next;
-			n--;
-			assert (l != head || n == 0);
-			continue;
-		}
-		b = l->list[i];
-		assert (cmp (a, b) <= 0);
-		a = b;
+/*
+ * Return the length of the run starting at ptr[0], after having
+ * put it in order if it was strictly descending (strictly, to
+ * keep the sort stable).
+ */
+static int find_run(void **ptr, int nr, cmp_t cmp)
+{
+	int n = 1;
+
+	if (nr < 2)
+		return nr;
+	if (compare(cmp, ptr[0], ptr[1]) > 0) {
+		while (++n < nr && compare(cmp, ptr[n-1], ptr[n]) > 0)
+			;
+		reverse(ptr, n);
+	} else {
+		while (++n < nr && compare(cmp, ptr[n-1], ptr[n]) <= 0)
+			;
 	}
+	return n;
 }
-#endif
 
+/*
+ * Number of entries of ptr[0..nr) which are less than 'key'
+ * (or less or equal if 'right'), the entries being in order.
+ * The search first gallops, by steps of 1, 3, 7, 15, ...
+ * since the answer is often near the start.
+ */
+static int gallop(void *key, void **ptr, int nr, int right, cmp_t cmp)
+{
+	int lo = 0, hi = 1;
+
+	while (hi <= nr) {
+		int c = compare(cmp, ptr[hi-1], key);
 
-#define FLUSH_TO(b)						\
-  do {								\
-	int nr = (b)->nr;					\
-	assert (nbuf >= nr);					\
-	memcpy ((b)->list, buffer, nr * sizeof (void *));	\
-	nbuf -= nr;						\
-	memmove (buffer, buffer + nr, nbuf * sizeof (void *));	\
-  } while (0)
-
-#define DUMP_TO(b)						\
-  do {								\
-        assert (nbuf <= (b)->nr);				\
-	memcpy ((b)->list, buffer, nbuf * sizeof (void *));	\
-  } while (0)
-
-
-// Merge two already-sorted sequences of blocks:
-//   (b1_1, ..., b1_n)  and  (b2_1, ..., b2_m)
-// Since we may be moving blocks around, we return the new head
-// of the merged list.
-static struct ptr_list *
-merge_block_seqs (struct ptr_list *b1, int n,
-		  struct ptr_list *b2, int m,
-		  int (*cmp)(const void *, const void *))
+		if (right ? c > 0 : c >= 0)
+			break;
+		lo = hi;
+		hi = 2 * hi + 1;
+	}
+	if (hi > nr)
+		hi = nr + 1;
+
+	// the answer is in [lo, hi - 1]
+	hi--;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		int c = compare(cmp, ptr[mid], key);
+
+		if (right ? c > 0 : c >= 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return lo;
+}
+
+/*
+ * Merge the runs ptr[0..n1) and ptr[n1..n1+n2), using tmp[]
+ * which must be able to hold n1 entries.
+ * Galloping is only kept while it pays.
+ */
+static void merge_runs(void **ptr, int n1, int n2, void **tmp, cmp_t cmp)
 {
-	int i1 = 0, i2 = 0;
-	const void *buffer[2 * LIST_NODE_NR];
-	int nbuf = 0;
-	struct ptr_list *newhead = b1;
-
-	// printf ("Merging %d blocks at %p with %d blocks at %p\n", n, b1, m, b2);
-
-	// Skip empty blocks in b2.
-	while (b2->nr == 0) {
-		BEEN_THERE('F');
-		b2 = b2->next;
-		if (--m == 0) {
-			BEEN_THERE('G');
-			return newhead;
+	void **a, **b, **dst;
+	int k, wins_a = 0, wins_b = 0;
+
+	// The start of the first run & the end of the second
+	// one which are already at their place.
+	k = gallop(ptr[n1], ptr, n1, 1, cmp);
+	ptr += k;
+	n1 -= k;
+	if (!n1)
+		return;
+	n2 = gallop(ptr[n1-1], ptr + n1, n2, 0, cmp);
+	if (!n2)
+		return;
+
+	memcpy(tmp, ptr, n1 * sizeof(void *));
+	a = tmp;
+	b = ptr + n1;
+	dst = ptr;
+	while (n1 && n2) {
+		if (compare(cmp, *a, *b) <= 0) {
+			*dst++ = *a++;
+			n1--;
+			wins_b = 0;
+			if (++wins_a < MIN_GALLOP)
+				continue;
+			k = gallop(*b, a, n1, 1, cmp);
+			memcpy(dst, a, k * sizeof(void *));
+			dst += k;
+			a += k;
+			n1 -= k;
+			if (k < MIN_GALLOP)
+				wins_a = 0;
+		} else {
+			*dst++ = *b++;
+			n2--;
+			wins_a = 0;
+			if (++wins_b < MIN_GALLOP)
+				continue;
+			k = gallop(*a, b, n2, 0, cmp);
+			memmove(dst, b, k * sizeof(void *));
+			dst += k;
+			b += k;
+			n2 -= k;
+			if (k < MIN_GALLOP)
+				wins_b = 0;
 		}
 	}
+	// what's left of the second run is already in place
+	memcpy(dst, a, n1 * sizeof(void *));
+}
+
+/*
+ * The runs waiting to be merged, kept with the lengths of the
+ * bigger ones at least the sum of the next two, like in timsort:
+ * the lengths grow at least as fast as the Fibonacci numbers
+ * and 64 runs are more than enough for any list.
+ */
+#define MAX_RUNS	64
+
+struct run {
+	int start, len;
+};
+
+// Merge the run 'i' with the next one.
+static void merge_at(void **ptr, struct run *runs, int *nr_runs, int i, void **tmp, cmp_t cmp)
+{
+	struct run *a = &runs[i], *b = &runs[i+1];
+
+	merge_runs(ptr + a->start, a->len, b->len, tmp, cmp);
+	a->len += b->len;
+	if (i + 2 < *nr_runs)
+		runs[i+1] = runs[i+2];
+	(*nr_runs)--;
+}
 
-	// Do a quick skip in case entire blocks from b1 are
-	// already less than smallest element in b2.
-	while (b1->nr == 0 ||
-	       cmp (PTR_ENTRY(b1, b1->nr - 1), PTR_ENTRY(b2,0)) < 0) {
-		// printf ("Skipping whole block.\n");
-		BEEN_THERE('H');
-		b1 = b1->next;
-		if (--n == 0) {
-			BEEN_THERE('I');
-			return newhead;	
+static void merge_collapse(void **ptr, struct run *runs, int *nr_runs, void **tmp, cmp_t cmp)
+{
+	while (*nr_runs > 1) {
+		int n = *nr_runs - 2;
+
+		if ((n > 0 && runs[n-1].len <= runs[n].len + runs[n+1].len) ||
+		    (n > 1 && runs[n-2].len <= runs[n-1].len + runs[n].len)) {
+			if (runs[n-1].len < runs[n+1].len)
+				n--;
+		} else if (runs[n].len > runs[n+1].len) {
+			break;
 		}
+		merge_at(ptr, runs, nr_runs, n, tmp, cmp);
 	}
+}
 
-	while (1) {
-		const void *d1 = PTR_ENTRY(b1,i1);
-		const void *d2 = PTR_ENTRY(b2,i2);
-
-		assert (i1 >= 0 && i1 < b1->nr);
-		assert (i2 >= 0 && i2 < b2->nr);
-		assert (b1 != b2);
-		assert (n > 0);
-		assert (m > 0);
-
-		if (cmp (d1, d2) <= 0) {
-			BEEN_THERE('J');
-			buffer[nbuf++] = d1;
-			// Element from b1 is smaller
-			if (++i1 >= b1->nr) {
-				BEEN_THERE('L');
-				FLUSH_TO(b1);
-				do {
-					b1 = b1->next;
-					if (--n == 0) {
-						BEEN_THERE('O');
-						while (b1 != b2) {
-							BEEN_THERE('P');
-							FLUSH_TO(b1);
-							b1 = b1->next;
-						}
-						assert (nbuf == i2);
-						DUMP_TO(b2);
-						return newhead;
-					}
-				} while (b1->nr == 0);
-				i1 = 0;
-			}
-		} else {
-			BEEN_THERE('K');
-			// Element from b2 is smaller
-			buffer[nbuf++] = d2;
-			if (++i2 >= b2->nr) {
-				struct ptr_list *l = b2;
-				BEEN_THERE('M');
-				// OK, we finished with b2.  Pull it out
-				// and plug it in before b1.
-
-				b2 = b2->next;
-				b2->prev = l->prev;
-				b2->prev->next = b2;
-				l->next = b1;
-				l->prev = b1->prev;
-				l->next->prev = l;
-				l->prev->next = l;
-
-				if (b1 == newhead) {
-					BEEN_THERE('N');
-					newhead = l;
-				}
-
-				FLUSH_TO(l);
-				b2 = b2->prev;
-				do {
-					b2 = b2->next;
-					if (--m == 0) {
-						BEEN_THERE('Q');
-						assert (nbuf == i1);
-						DUMP_TO(b1);
-						return newhead;
-					}
-				} while (b2->nr == 0);
-				i2 = 0;
-			}
+static void array_sort(void **ptr, int nr, void **tmp, cmp_t cmp)
+{
+	struct run runs[MAX_RUNS];
+	int nr_runs = 0;
+	int start = 0;
+
+	// Find the runs, extending the short ones, and merge them
+	// as soon as the lengths of the pending ones allow it.
+	while (start < nr) {
+		int n = find_run(ptr + start, nr - start, cmp);
+
+		if (n < MIN_RUN) {
+			int len = nr - start < MIN_RUN ? nr - start : MIN_RUN;
+
+			insertion_sort(ptr + start, n, len, cmp);
+			n = len;
 		}
+		if (nr_runs == MAX_RUNS)
+			die("sort_list(): too many runs");
+		runs[nr_runs].start = start;
+		runs[nr_runs].len = n;
+		nr_runs++;
+		start += n;
+		merge_collapse(ptr, runs, &nr_runs, tmp, cmp);
 	}
-}
 
+	// Merge what's left, from the end.
+	while (nr_runs > 1) {
+		int n = nr_runs - 2;
+
+		if (n > 0 && runs[n-1].len < runs[n+1].len)
+			n--;
+		merge_at(ptr, runs, &nr_runs, n, tmp, cmp);
+	}
+}
 
 void sort_list(struct ptr_list **plist, int (*cmp)(const void *, const void *))
 {
-	struct ptr_list *head = *plist, *list = head;
-	int blocks = 1;
+	struct ptr_list *head = *plist, *list;
+	void *small[2 * LIST_NODE_NR];
+	void **ptr, **tmp;
+	int nr = 0, i;
 
 	if (!head)
 		return;
 
-	// Sort all the sub-lists
+	// Count all the entries, deleted ones included.
+	list = head;
 	do {
-		array_sort(list->list, list->nr, cmp);
-#ifdef PARANOIA
-		verify_seq_sorted (list, 1, cmp);
-#endif
+		nr += list->nr;
+		list = list->next;
+	} while (list != head);
+
+	ptr = small;
+	if (nr > LIST_NODE_NR) {
+		ptr = malloc(2 * nr * sizeof(void *));
+		if (!ptr)
+			die("out of memory");
+	}
+	tmp = ptr + nr;
+
+	list = head;
+	i = 0;
+	do {
+		memcpy(ptr + i, list->list, list->nr * sizeof(void *));
+		i += list->nr;
 		list = list->next;
 	} while (list != head);
 
-	// Merge the damn things together
-	while (1) {
-		struct ptr_list *block1 = head;
-
-		do {
-			struct ptr_list *block2 = block1;
-			struct ptr_list *next, *newhead;
-			int i;
-
-			for (i = 0; i < blocks; i++) {
-				block2 = block2->next;
-				if (block2 == head) {
-					if (block1 == head) {
-						BEEN_THERE('A');
-						*plist = head;
-						return;
-					}
-					BEEN_THERE('B');
-					goto next_pass;
-				}						
-			}
-
-			next = block2;
-			for (i = 0; i < blocks; ) {
-				next = next->next;
-				i++;
-				if (next == head) {
-					BEEN_THERE('C');
-					break;
-				}
-				BEEN_THERE('D');
-			}
-
-			newhead = merge_block_seqs (block1, blocks,
-						    block2, i,
-						    cmp);
+	array_sort(ptr, nr, tmp, cmp);
 #ifdef PARANOIA
-			verify_seq_sorted (newhead, blocks + i, cmp);
+	for (i = 1; i < nr; i++)
+		assert(compare(cmp, ptr[i-1], ptr[i]) <= 0);
 #endif
-			if (block1 == head) {
-				BEEN_THERE('E');
-				head = newhead;
-			}
-			block1 = next;
-		} while (block1 != head);
-	next_pass:
-		blocks <<= 1;
-	}
+
+	list = head;
+	i = 0;
+	do {
+		memcpy(list->list, ptr + i, list->nr * sizeof(void *));
+		i += list->nr;
+		list = list->next;
+	} while (list != head);
+
+	if (ptr != small)
+		free(ptr);
 }
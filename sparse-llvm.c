@@ -1,14 +1,35 @@
 /*
  * Example usage:
  *	./sparse-llvm hello.c | llc | as -o hello.o
+ * or, directly:
+ *	./sparse-llvm -O2 -c hello.c [-o hello.o]
+ * or, to run it without writing anything:
+ *	./sparse-llvm [-O2] --run hello.c [-- args ...]
+ *
+ * With '-c', all the files are compiled into a single object file,
+ * so '-o' can only be omitted when there is a single file.
+ *
+ * Each file is compiled in its own module, the modules being then
+ * linked together. Each file is compiled by its own worker process,
+ * forked from the state preceding all the files, so that a file
+ * doesn't see what the previous ones have declared; with '-j N',
+ * up to N of them run at once. The verification of the resulting module can be
+ * skipped with '-fno-verify'.
  */
 
 #include <llvm-c/Core.h>
 #include <llvm-c/BitWriter.h>
 #include <llvm-c/Analysis.h>
 #include <llvm-c/Target.h>
+#include <llvm-c/Linker.h>
+#include <llvm-c/BitReader.h>
+#include <llvm-c/TargetMachine.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm-c/Transforms/PassBuilder.h>
+#include <llvm-c/LLJIT.h>
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
@@ -18,6 +39,7 @@
 #include "expression.h"
 #include "linearize.h"
 #include "flow.h"
+#include "jobs.h"
 
 struct function {
 	LLVMBuilderRef			builder;
@@ -37,6 +59,7 @@ static LLVMTypeRef sym_func_type(struct symbol *sym)
 	int n_arg = symbol_list_size(sym->arguments);
 	LLVMTypeRef *arg_type = calloc(n_arg, sizeof(LLVMTypeRef));
 	LLVMTypeRef ret_type = func_return_type(sym);
+	LLVMTypeRef ret;
 	struct symbol *arg;
 	int idx = 0;
 
@@ -46,7 +69,24 @@ static LLVMTypeRef sym_func_type(struct symbol *sym)
 		arg_type[idx++] = symbol_type(arg_sym);
 	} END_FOR_EACH_PTR(arg);
 
-	return LLVMFunctionType(ret_type, arg_type, n_arg, sym->variadic);
+	ret = LLVMFunctionType(ret_type, arg_type, n_arg, sym->variadic);
+	free(arg_type);
+	return ret;
+}
+
+/*
+ * The type of the function called via a value of type 'sym':
+ * a function or a pointer to a function.
+ */
+static LLVMTypeRef called_func_type(struct symbol *sym)
+{
+	if (sym->type == SYM_NODE)
+		sym = sym->ctype.base_type;
+	if (sym->type == SYM_PTR)
+		sym = sym->ctype.base_type;
+	if (sym->type == SYM_NODE)
+		sym = sym->ctype.base_type;
+	return sym_func_type(sym);
 }
 
 static LLVMTypeRef sym_array_type(struct symbol *sym)
@@ -65,11 +105,10 @@ static LLVMTypeRef sym_array_type(struct symbol *sym)
 	return LLVMArrayType(elem_type, sym->bit_size / base_type->bit_size);
 }
 
-#define MAX_STRUCT_MEMBERS 64
-
 static LLVMTypeRef sym_struct_type(struct symbol *sym)
 {
-	LLVMTypeRef elem_types[MAX_STRUCT_MEMBERS];
+	int n_elem = symbol_list_size(sym->symbol_list);
+	LLVMTypeRef *elem_types = calloc(n_elem, sizeof(LLVMTypeRef));
 	struct symbol *member;
 	char buffer[256];
 	LLVMTypeRef ret;
@@ -83,14 +122,13 @@ static LLVMTypeRef sym_struct_type(struct symbol *sym)
 	FOR_EACH_PTR(sym->symbol_list, member) {
 		LLVMTypeRef member_type;
 
-		assert(nr < MAX_STRUCT_MEMBERS);
-
 		member_type = symbol_type(member);
 
 		elem_types[nr++] = member_type; 
 	} END_FOR_EACH_PTR(member);
 
 	LLVMStructSetBody(ret, elem_types, nr, 0 /* packed? */); 
+	free(elem_types);
 	return ret;
 }
 
@@ -277,29 +315,28 @@ static const char *pseudo_name(pseudo_t pseudo, char *buf)
 	return buf;
 }
 
-static LLVMValueRef get_sym_value(LLVMModuleRef module, struct symbol *sym)
+static LLVMValueRef sym_value(LLVMModuleRef module, struct symbol *sym)
 {
 	const char *name = show_ident(sym->ident);
 	LLVMTypeRef type = symbol_type(sym);
 	LLVMValueRef result = NULL;
 	struct expression *expr;
 
-	assert(sym->bb_target == NULL);
-
 	expr = sym->initializer;
 	if (expr && !sym->ident) {
 		switch (expr->type) {
 		case EXPR_STRING: {
 			const char *s = expr->string->data;
 			LLVMValueRef indices[] = { LLVMConstInt(LLVMInt64Type(), 0, 0), LLVMConstInt(LLVMInt64Type(), 0, 0) };
+			LLVMTypeRef type = LLVMArrayType(LLVMInt8Type(), strlen(s) + 1);
 			LLVMValueRef data;
 
-			data = LLVMAddGlobal(module, LLVMArrayType(LLVMInt8Type(), strlen(s) + 1), ".str");
+			data = LLVMAddGlobal(module, type, ".str");
 			LLVMSetLinkage(data, LLVMPrivateLinkage);
 			LLVMSetGlobalConstant(data, 1);
 			LLVMSetInitializer(data, LLVMConstString(strdup(s), strlen(s) + 1, true));
 
-			result = LLVMConstGEP(data, indices, ARRAY_SIZE(indices));
+			result = LLVMConstGEP2(type, data, indices, ARRAY_SIZE(indices));
 			return result;
 		}
 		default:
@@ -320,6 +357,38 @@ static LLVMValueRef get_sym_value(LLVMModuleRef module, struct symbol *sym)
 	return result;
 }
 
+/*
+ * The value of a symbol is kept in its ->aux (its type is in the
+ * one of its base type) but it's only valid for the module it was
+ * created in: the one being compiled when 'module_nr' was the same.
+ */
+struct sym_value {
+	unsigned int module_nr;
+	LLVMValueRef value;
+};
+
+static unsigned int module_nr;
+
+static LLVMValueRef get_sym_value(LLVMModuleRef module, struct symbol *sym)
+{
+	struct sym_value *cache;
+
+	assert(sym->type == SYM_NODE);
+
+	cache = sym->aux;
+	if (cache && cache->module_nr == module_nr)
+		return cache->value;
+	if (!cache) {
+		cache = malloc(sizeof(*cache));
+		if (!cache)
+			die("out of memory");
+		sym->aux = cache;
+	}
+	cache->module_nr = module_nr;
+	cache->value = sym_value(module, sym);
+	return cache->value;
+}
+
 static LLVMValueRef constant_value(unsigned long long val, LLVMTypeRef dtype)
 {
 	LLVMValueRef result;
@@ -479,7 +548,7 @@ static LLVMValueRef calc_gep(LLVMBuilderRef builder, LLVMValueRef base, LLVMValu
 	/* convert base to char* type */
 	base = LLVMBuildPointerCast(builder, base, bytep, name);
 	/* addr = base + off */
-	addr = LLVMBuildInBoundsGEP(builder, base, &off, 1, name);
+	addr = LLVMBuildInBoundsGEP2(builder, LLVMInt8Type(), base, &off, 1, name);
 	/* convert back to the actual pointer type */
 	addr = LLVMBuildPointerCast(builder, addr, type, name);
 	return addr;
@@ -725,7 +794,7 @@ static void output_op_load(struct function *fn, struct instruction *insn)
 
 	/* perform load */
 	pseudo_name(insn->target, name);
-	target = LLVMBuildLoad(fn->builder, addr, name);
+	target = LLVMBuildLoad2(fn->builder, insn_symbol_type(insn), addr, name);
 
 	insn->target->priv = target;
 }
@@ -811,6 +880,7 @@ static void output_op_switch(struct function *fn, struct instruction *insn)
 static void output_op_call(struct function *fn, struct instruction *insn)
 {
 	LLVMValueRef target, func;
+	LLVMTypeRef func_type;
 	struct symbol *ctype;
 	int n_arg = 0, i;
 	struct pseudo *arg;
@@ -821,6 +891,7 @@ static void output_op_call(struct function *fn, struct instruction *insn)
 	args = calloc(n_arg, sizeof(LLVMValueRef));
 
 	PREPARE_PTR_LIST(insn->fntypes, ctype);
+	func_type = called_func_type(ctype);
 	if (insn->func->type == PSEUDO_REG || insn->func->type == PSEUDO_PHI)
 		func = get_operand(fn, ctype, insn->func);
 	else
@@ -833,7 +904,7 @@ static void output_op_call(struct function *fn, struct instruction *insn)
 	FINISH_PTR_LIST(ctype);
 
 	pseudo_name(insn->target, name);
-	target = LLVMBuildCall(fn->builder, func, args, n_arg, name);
+	target = LLVMBuildCall2(fn->builder, func_type, func, args, n_arg, name);
 
 	insn->target->priv = target;
 }
@@ -1155,7 +1226,7 @@ static void output_fn(LLVMModuleRef module, struct entrypoint *ep)
 		FOR_EACH_PTR(bb->insns, insn) {
 			LLVMBasicBlockRef entrybbr;
 			LLVMTypeRef phi_type;
-			LLVMValueRef ptr;
+			LLVMValueRef ptr, load;
 
 			if (!insn->bb || insn->opcode != OP_PHI)
 				continue;
@@ -1164,9 +1235,14 @@ static void output_fn(LLVMModuleRef module, struct entrypoint *ep)
 			LLVMPositionBuilderAtEnd(function.builder, entrybbr);
 			phi_type = insn_symbol_type(insn);
 			ptr = LLVMBuildAlloca(function.builder, phi_type, "");
-			/* emit forward load for phi */
-			LLVMClearInsertionPosition(function.builder);
-			insn->target->priv = LLVMBuildLoad(function.builder, ptr, "phi");
+			/*
+			 * emit forward load for phi: it's built in the entry
+			 * block (the builder needs a block to find the module)
+			 * and then taken out of it.
+			 */
+			load = LLVMBuildLoad2(function.builder, phi_type, ptr, "phi");
+			LLVMInstructionRemoveFromParent(load);
+			insn->target->priv = load;
 		} END_FOR_EACH_PTR(insn);
 	}
 	END_FOR_EACH_PTR(bb);
@@ -1320,34 +1396,299 @@ static void set_target(LLVMModuleRef module)
 	LLVMSetDataLayout(module, layout);
 }
 
+static LLVMModuleRef new_module(const char *name)
+{
+	LLVMModuleRef module = LLVMModuleCreateWithName(name);
+
+	set_target(module);
+	module_nr++;
+	return module;
+}
+
+/*
+ * Compile a file in its own module, NULL if it has errors.
+ */
+static LLVMModuleRef compile_file(char *file)
+{
+	struct symbol_list *symlist;
+	LLVMModuleRef module;
+
+	symlist = sparse(file);
+	if (die_if_error)
+		return NULL;
+
+	module = new_module(file);
+	compile(module, symlist);
+	return module;
+}
+
+/*
+ * The job of a worker: the bitcode of the file's module, on stdout.
+ */
+static void emit_file(char *file)
+{
+	LLVMModuleRef module = compile_file(file);
+
+	if (!module)
+		return;
+	fflush(stdout);
+	LLVMWriteBitcodeToFD(module, STDOUT_FILENO, 0, 0);
+	LLVMDisposeModule(module);
+}
+
+static void check_error(LLVMErrorRef err, const char *what)
+{
+	if (err)
+		die("%s: %s", what, LLVMGetErrorMessage(err));
+}
+
+/*
+ * Run the usual pipeline of LLVM's optimizations for -O1, -O2, ...
+ */
+static void optimize_module(LLVMModuleRef module, LLVMTargetMachineRef machine)
+{
+	int level = optimize_level < 3 ? optimize_level : 3;
+	LLVMPassBuilderOptionsRef options = LLVMCreatePassBuilderOptions();
+	char pipeline[32];
+
+	if (optimize_size)
+		snprintf(pipeline, sizeof(pipeline), "default<Os>");
+	else
+		snprintf(pipeline, sizeof(pipeline), "default<O%d>", level);
+	check_error(LLVMRunPasses(module, pipeline, machine, options),
+		"can't optimize the module");
+	LLVMDisposePassBuilderOptions(options);
+}
+
+/*
+ * A target machine for the module's target, with the optimization
+ * level given by -O, and the module's data layout set for it.
+ */
+static LLVMTargetMachineRef target_machine(LLVMModuleRef module)
+{
+	LLVMCodeGenOptLevel level;
+	const char *triple = LLVMGetTarget(module);
+	char *host_triple = NULL;
+	LLVMTargetMachineRef machine;
+	LLVMTargetDataRef layout;
+	LLVMTargetRef target;
+	char *error;
+
+	LLVMInitializeNativeTarget();
+	LLVMInitializeNativeAsmPrinter();
+
+	// no triple for an unsupported target: assume the host's one
+	if (!*triple)
+		triple = host_triple = LLVMGetDefaultTargetTriple();
+	if (LLVMGetTargetFromTriple(triple, &target, &error))
+		die("can't find the target '%s': %s", triple, error);
+
+	switch (optimize_level) {
+	case 0:	level = LLVMCodeGenLevelNone; break;
+	case 1:	level = LLVMCodeGenLevelLess; break;
+	case 2:	level = LLVMCodeGenLevelDefault; break;
+	default:level = LLVMCodeGenLevelAggressive; break;
+	}
+	machine = LLVMCreateTargetMachine(target, triple, "", "", level,
+		LLVMRelocPIC, LLVMCodeModelDefault);
+	if (!machine)
+		die("can't create a target machine for '%s'", triple);
+	layout = LLVMCreateTargetDataLayout(machine);
+	LLVMSetModuleDataLayout(module, layout);
+	LLVMDisposeTargetData(layout);
+	if (host_triple)
+		LLVMDisposeMessage(host_triple);
+	return machine;
+}
+
+/*
+ * Write the module as an object file for the module's target,
+ * like 'llc -filetype=obj' would do.
+ */
+static void emit_object(LLVMModuleRef module, const char *filename)
+{
+	LLVMTargetMachineRef machine = target_machine(module);
+	char *error;
+
+	if (optimize_level)
+		optimize_module(module, machine);
+
+	if (LLVMTargetMachineEmitToFile(machine, module, (char *)filename, LLVMObjectFile, &error))
+		die("can't write '%s': %s", filename, error);
+	LLVMDisposeTargetMachine(machine);
+}
+
+/*
+ * The default name of the object file for '-c': the name of the
+ * source file, without its directory and with '.o' as suffix, as
+ * a compiler driver would do.
+ */
+static char *object_name(const char *file)
+{
+	const char *base = strrchr(file, '/');
+	const char *dot;
+	char *name;
+	int len;
+
+	base = base ? base + 1 : file;
+	dot = strrchr(base, '.');
+	len = dot && dot != base ? dot - base : strlen(base);
+	name = malloc(len + 3);
+	if (!name)
+		die("out of memory");
+	memcpy(name, base, len);
+	strcpy(name + len, ".o");
+	return name;
+}
+
+/*
+ * Compile the module in memory and call its main() with 'args',
+ * the symbols it doesn't define being taken from our own process
+ * (so mostly from the libc). Return the exit status of main().
+ */
+static int run_module(LLVMModuleRef module, char *name, char **args)
+{
+	LLVMOrcThreadSafeContextRef context;
+	LLVMOrcDefinitionGeneratorRef host;
+	LLVMOrcJITDylibRef dylib;
+	LLVMOrcLLJITRef jit;
+	int (*entry)(int, char **);
+	uint64_t addr;
+	char **argv;
+	int argc = 0;
+	int status;
+
+	LLVMInitializeNativeTarget();
+	LLVMInitializeNativeAsmPrinter();
+
+	check_error(LLVMOrcCreateLLJIT(&jit, NULL), "can't create the JIT");
+	dylib = LLVMOrcLLJITGetMainJITDylib(jit);
+	check_error(LLVMOrcCreateDynamicLibrarySearchGeneratorForProcess(&host,
+		LLVMOrcLLJITGetGlobalPrefix(jit), NULL, NULL),
+		"can't find the symbols of the process");
+	LLVMOrcJITDylibAddGenerator(dylib, host);
+
+	LLVMSetTarget(module, LLVMOrcLLJITGetTripleString(jit));
+	LLVMSetDataLayout(module, LLVMOrcLLJITGetDataLayoutStr(jit));
+	if (optimize_level) {
+		LLVMTargetMachineRef machine = target_machine(module);
+
+		optimize_module(module, machine);
+		LLVMDisposeTargetMachine(machine);
+	}
+	context = LLVMOrcCreateNewThreadSafeContext();
+	check_error(LLVMOrcLLJITAddLLVMIRModule(jit, dylib,
+		LLVMOrcCreateNewThreadSafeModule(module, context)),
+		"can't add the module to the JIT");
+	LLVMOrcDisposeThreadSafeContext(context);
+
+	check_error(LLVMOrcLLJITLookup(jit, &addr, "main"), "can't run 'main'");
+	entry = (int (*)(int, char **))(uintptr_t)addr;
+
+	// the program's argv: the name of the (first) file, then 'args'
+	while (args[argc])
+		argc++;
+	argv = calloc(argc + 2, sizeof(char *));
+	if (!argv)
+		die("out of memory");
+	argv[0] = name;
+	memcpy(argv + 1, args, argc * sizeof(char *));
+	status = entry(argc + 1, argv);
+	fflush(stdout);
+	free(argv);
+
+	check_error(LLVMOrcDisposeLLJIT(jit), "can't dispose the JIT");
+	return status;
+}
+
+static LLVMModuleRef main_module;
+
+static void link_module(LLVMModuleRef module)
+{
+	// this also disposes 'module'
+	if (LLVMLinkModules2(main_module, module))
+		die("can't link the module of '%s'", LLVMGetModuleIdentifier(module, NULL));
+}
+
+static void link_bitcode(char *file, void *buf, size_t size)
+{
+	LLVMMemoryBufferRef mem;
+	LLVMModuleRef module;
+
+	// nothing if the file had errors
+	if (!size)
+		return;
+	mem = LLVMCreateMemoryBufferWithMemoryRange(buf, size, file, 0);
+	if (LLVMParseBitcode2(mem, &module))
+		die("can't read back the bitcode of '%s'", file);
+	LLVMDisposeMemoryBuffer(mem);
+	link_module(module);
+}
+
 int main(int argc, char **argv)
 {
 	struct string_list *filelist = NULL;
 	struct symbol_list *symlist;
-	LLVMModuleRef module;
+	char **run_args = NULL;
 	char *file;
+	int i;
+
+	// "--run": the arguments after "--" are for the program
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--run")) {
+			run_args = &argv[argc];
+		} else if (!strcmp(argv[i], "--") && run_args) {
+			argv[i] = NULL;
+			argc = i;
+			run_args = &argv[i + 1];
+			break;
+		}
+	}
 
 	symlist = sparse_initialize(argc, argv, &filelist);
 
-	module = LLVMModuleCreateWithName("sparse");
-	set_target(module);
+	main_module = new_module("sparse");
 
-	compile(module, symlist);
+	compile(main_module, symlist);
 
 	/* need ->phi_users */
 	dbg_dead = 1;
-	FOR_EACH_PTR_NOTAG(filelist, file) {
-		symlist = sparse(file);
-		if (die_if_error)
-			return 1;
-		compile(module, symlist);
-	} END_FOR_EACH_PTR_NOTAG(file);
-
-	LLVMVerifyModule(module, LLVMPrintMessageAction, NULL);
-
-	LLVMWriteBitcodeToFD(module, STDOUT_FILENO, 0, 0);
+	for_each_file_job(filelist, emit_file, link_bitcode);
+	if (die_if_error)
+		return 1;
+
+	if (fverify)
+		LLVMVerifyModule(main_module, LLVMPrintMessageAction, NULL);
+
+	if (run_args) {
+		char *name = NULL;
+		int status;
+
+		FOR_EACH_PTR_NOTAG(filelist, file) {
+			if (!name)
+				name = file;
+		} END_FOR_EACH_PTR_NOTAG(file);
+		status = run_module(main_module, name, run_args);
+
+		report_stats();
+		return status;
+	} else if (compile_only) {
+		if (!output_file) {
+			if (ptr_list_size((struct ptr_list *)filelist) != 1)
+				die("'-c' without '-o' needs a single file");
+			FOR_EACH_PTR_NOTAG(filelist, file) {
+				output_file = object_name(file);
+			} END_FOR_EACH_PTR_NOTAG(file);
+		}
+		emit_object(main_module, output_file);
+	} else if (output_file) {
+		if (LLVMWriteBitcodeToFile(main_module, output_file))
+			die("can't write '%s'", output_file);
+	} else {
+		LLVMWriteBitcodeToFD(main_module, STDOUT_FILENO, 0, 0);
+	}
 
-	LLVMDisposeModule(module);
+	LLVMDisposeModule(main_module);
 
 	report_stats();
 	return 0;
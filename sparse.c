@@ -39,6 +39,8 @@
 #include "symbol.h"
 #include "expression.h"
 #include "linearize.h"
+#include "jobs.h"
+#include "timer.h"
 
 static int context_increase(struct basic_block *bb, int entry)
 {
@@ -163,13 +165,9 @@ static void check_byte_count(struct instruction *insn, pseudo_t count)
 
 static pseudo_t argument(struct instruction *call, unsigned int argno)
 {
-	pseudo_t args[8];
 	struct ptr_list *arg_list = (struct ptr_list *) call->arguments;
 
-	argno--;
-	if (linearize_ptr_list(arg_list, (void *)args, 8) > argno)
-		return args[argno];
-	return NULL;
+	return ptr_list_nth_entry(arg_list, argno - 1);
 }
 
 static void check_memset(struct instruction *insn)
@@ -272,22 +270,26 @@ static void check_context(struct entrypoint *ep)
 	check_bb_context(ep, ep->entry->bb, in_context, out_context);
 }
 
-static void check_symbols(struct symbol_list *list)
+static void check_symbol(struct symbol *sym)
 {
-	struct symbol *sym;
-
-	FOR_EACH_PTR(list, sym) {
-		struct entrypoint *ep;
-
-		expand_symbol(sym);
-		ep = linearize_symbol(sym);
-		if (ep) {
-			if (dbg_entry)
-				show_entry(ep);
+	struct entrypoint *ep;
+
+	expand_symbol(sym);
+	ep = linearize_symbol(sym);
+	if (ep) {
+		if (dbg_entry)
+			show_entry(ep);
+
+		timer_start(PASS__CHECK);
+		check_context(ep);
+		timer_stop(PASS__CHECK);
+		free_entrypoint(ep);
+	}
+}
 
-			check_context(ep);
-		}
-	} END_FOR_EACH_PTR(sym);
+static void check_symbols(struct symbol_list *list)
+{
+	for_each_symbol_job(list, check_symbol);
 
 	if (Wsparse_error && die_if_error)
 		exit(1);
@@ -1,9 +1,10 @@
 #include <stdio.h>
+#include <string.h>
 #include "allocate.h"
+#include "bitmap.h"
 #include "linearize.h"
 #include "storage.h"
-
-__DECLARE_ALLOCATOR(struct ptr_list, ptrlist);
+#include "timer.h"
 
 
 typedef void (*get_t)(struct allocator_stats*);
@@ -16,22 +17,27 @@ static void show_stats(get_t get, struct allocator_stats * tot)
 		get(&x);
 	else
 		x = *tot;
-	fprintf(stderr, "%16s: %8d, %10ld, %10ld, %6.2f%%, %8.2f\n",
-		x.name, x.allocations, x.useful_bytes, x.total_bytes,
-		100 * (double) x.useful_bytes / (x.total_bytes ? : 1),
-		(double) x.useful_bytes / (x.allocations ? : 1));
+	fprintf(stderr, "%16s: %8d, %10ld, %10ld, %6.2f%%, %8.2f, %8d, %10ld\n",
+		x.name, x.allocations, x.useful_bytes, x.peak_bytes,
+		100 * (double) x.useful_bytes / (x.peak_bytes ? : 1),
+		(double) x.useful_bytes / (x.allocations ? : 1),
+		x.reused, x.free_bytes);
 
 	tot->allocations += x.allocations;
+	tot->reused += x.reused;
 	tot->useful_bytes += x.useful_bytes;
 	tot->total_bytes += x.total_bytes;
+	tot->peak_bytes += x.peak_bytes;
+	tot->free_bytes += x.free_bytes;
 }
 
 void show_allocation_stats(void)
 {
 	struct allocator_stats tot = { .name = "total", };
 
-	fprintf(stderr, "%16s: %8s, %10s, %10s, %7s, %8s\n", "allocator", "allocs",
-		"bytes", "total", "%usage", "average");
+	// the IR is freed after each function: its usage can be above 100%
+	fprintf(stderr, "%16s: %8s, %10s, %10s, %7s, %8s, %8s, %10s\n", "allocator", "allocs",
+		"bytes", "peak", "%usage", "average", "reused", "free");
 	show_stats(get_token_stats, &tot);
 	show_stats(get_ident_stats, &tot);
 	show_stats(get_symbol_stats, &tot);
@@ -43,6 +49,7 @@ void show_allocation_stats(void)
 	show_stats(get_pseudo_stats, &tot);
 	show_stats(get_pseudo_user_stats, &tot);
 	show_stats(get_ptrlist_stats, &tot);
+	show_stats(get_bitset_stats, &tot);
 	show_stats(get_multijmp_stats, &tot);
 	show_stats(get_asm_rules_stats, &tot);
 	show_stats(get_asm_constraint_stats, &tot);
@@ -53,10 +60,86 @@ void show_allocation_stats(void)
 	//show_stats(get_storage_hash_stats, &tot);
 
 	show_stats(NULL, &tot);
+	fprintf(stderr, "%16s: %6.2f%% of the total is on the freelists\n", "fragmentation",
+		100 * (double) tot.free_bytes / (tot.total_bytes ? : 1));
+
+	fprintf(stderr, "\n%16s: %8lu maps, %8lu unmaps, %10lu bytes mapped\n", "blobs",
+		blob_stats.maps, blob_stats.unmaps, blob_stats.mapped_bytes);
+	fprintf(stderr, "%16s  %8lu blobs, %8lu reused\n", "",
+		blob_stats.blobs, blob_stats.reused);
 }
 
 void report_stats(void)
 {
 	if (fmem_report)
 		show_allocation_stats();
+	if (ftime_report)
+		show_time_report();
+}
+
+/*
+ * The workers of -j run in their own process: they start their
+ * statistics from zero and save them at the end in a shared buffer
+ * of worker_stats_size() bytes, then the parent adds them to its own.
+ * The memory in use is the one of the parent but its peak is the one
+ * of the biggest process.
+ */
+struct worker_stats {
+	struct allocator_struct allocators[ALLOCATOR_NR];
+	struct blob_stats blobs;
+	/* followed by the timers */
+};
+
+size_t worker_stats_size(void)
+{
+	if (!fmem_report && !ftime_report)
+		return 0;
+	return sizeof(struct worker_stats) + time_stats_size();
+}
+
+void clear_worker_stats(void)
+{
+	int i;
+
+	for (i = 0; i < ALLOCATOR_NR; i++) {
+		struct allocator_struct *a = &allocators[i];
+
+		a->allocations = a->reused = 0;
+		a->useful_bytes = 0;
+		a->peak_bytes = a->total_bytes;
+	}
+	memset(&blob_stats, 0, sizeof(blob_stats));
+	clear_time_stats();
+}
+
+void save_worker_stats(void *buf)
+{
+	struct worker_stats *s = buf;
+
+	memcpy(s->allocators, allocators, sizeof(allocators));
+	s->blobs = blob_stats;
+	save_time_stats(s + 1);
+}
+
+void add_worker_stats(const void *buf)
+{
+	const struct worker_stats *s = buf;
+	int i;
+
+	for (i = 0; i < ALLOCATOR_NR; i++) {
+		const struct allocator_struct *w = &s->allocators[i];
+		struct allocator_struct *a = &allocators[i];
+
+		a->allocations += w->allocations;
+		a->reused += w->reused;
+		a->useful_bytes += w->useful_bytes;
+		if (w->peak_bytes > a->peak_bytes)
+			a->peak_bytes = w->peak_bytes;
+	}
+	blob_stats.maps += s->blobs.maps;
+	blob_stats.unmaps += s->blobs.unmaps;
+	blob_stats.mapped_bytes += s->blobs.mapped_bytes;
+	blob_stats.blobs += s->blobs.blobs;
+	blob_stats.reused += s->blobs.reused;
+	add_time_stats(s + 1);
 }
@@ -14,26 +14,39 @@
 #include "expression.h"
 #include "linearize.h"
 #include "storage.h"
+#include "ptrset.h"
 
 ALLOCATOR(storage, "storages");
 ALLOCATOR(storage_hash, "storage hash");
 
-#define MAX_STORAGE_HASH 64
-static struct storage_hash_list *storage_hash_table[MAX_STORAGE_HASH];
+/*
+ * The storages of a block: for its inputs & its outputs, the entries
+ * in a list and, to find them in constant time, in a map indexed by
+ * pseudo.
+ *
+ * Unlike a dense array per block, this stays linear in the number
+ * of entries: the big functions have many blocks *and* many pseudos.
+ */
+DECLARE_PTR_MAP(storage_map, struct pseudo, struct storage_hash);
 
-static inline unsigned int storage_hash(struct basic_block *bb, pseudo_t pseudo, enum inout_enum inout)
-{
-	unsigned hash = hashval(bb) + hashval(pseudo) + hashval(inout);
-	hash += hash / MAX_STORAGE_HASH;
-	return hash & (MAX_STORAGE_HASH-1);
-}
+struct storage_table {
+	struct storage_hash_list *list;
+	struct storage_map map;
+};
+
+struct bb_storage {
+	struct storage_table table[2];
+};
+
+/* The blocks having some storage, for free_storage() */
+static struct basic_block_list *storage_bbs;
 
 static int hash_list_cmp(const void *_a, const void *_b)
 {
 	const struct storage_hash *a = _a;
 	const struct storage_hash *b = _b;
-	if (a->pseudo != b->pseudo)
-		return a->pseudo < b->pseudo ? -1 : 1;
+	if (a->pseudo->id != b->pseudo->id)
+		return a->pseudo->id < b->pseudo->id ? -1 : 1;
 	return 0;
 }
 
@@ -42,74 +55,77 @@ static void sort_hash_list(struct storage_hash_list **listp)
 	sort_list((struct ptr_list **)listp, hash_list_cmp);
 }
 
+/*
+ * Return the storages of a block, sorted by pseudo.
+ * The list belongs to the caller.
+ */
 struct storage_hash_list *gather_storage(struct basic_block *bb, enum inout_enum inout)
 {
-	int i;
-	struct storage_hash *entry, *prev;
 	struct storage_hash_list *list = NULL;
+	struct storage_hash *entry;
 
-	for (i = 0; i < MAX_STORAGE_HASH; i++) {
-		struct storage_hash *hash;
-		FOR_EACH_PTR(storage_hash_table[i], hash) {
-			if (hash->bb == bb && hash->inout == inout)
-				add_ptr_list(&list, hash);
-		} END_FOR_EACH_PTR(hash);
-	}
-	sort_hash_list(&list);
-
-	prev = NULL;
-	FOR_EACH_PTR(list, entry) {
-		if (prev && entry->pseudo == prev->pseudo) {
-			assert(entry == prev);
-			DELETE_CURRENT_PTR(entry);
-		}
-		prev = entry;
+	if (!bb->storage)
+		return NULL;
+	FOR_EACH_PTR(bb->storage->table[inout].list, entry) {
+		add_ptr_list(&list, entry);
 	} END_FOR_EACH_PTR(entry);
-	PACK_PTR_LIST(&list);
+	sort_hash_list(&list);
 	return list;
 }
 
 static void name_storage(void)
 {
-	int i;
+	struct basic_block *bb;
 	int name = 0;
 
-	for (i = 0; i < MAX_STORAGE_HASH; i++) {
-		struct storage_hash *hash;
-		FOR_EACH_PTR(storage_hash_table[i], hash) {
-			struct storage *storage = hash->storage;
-			if (storage->name)
-				continue;
-			storage->name = ++name;
-		} END_FOR_EACH_PTR(hash);
-	}
+	FOR_EACH_PTR(storage_bbs, bb) {
+		int i;
+
+		for (i = STOR_IN; i <= STOR_OUT; i++) {
+			struct storage_hash *hash;
+			FOR_EACH_PTR(bb->storage->table[i].list, hash) {
+				struct storage *storage = hash->storage;
+				if (storage->name)
+					continue;
+				storage->name = ++name;
+			} END_FOR_EACH_PTR(hash);
+		}
+	} END_FOR_EACH_PTR(bb);
 }
 
 struct storage *lookup_storage(struct basic_block *bb, pseudo_t pseudo, enum inout_enum inout)
 {
-	struct storage_hash_list *list = storage_hash_table[storage_hash(bb,pseudo,inout)];
 	struct storage_hash *hash;
 
-	FOR_EACH_PTR(list, hash) {
-		if (hash->bb == bb && hash->pseudo == pseudo && hash->inout == inout)
-			return hash->storage;
-	} END_FOR_EACH_PTR(hash);
-	return NULL;
+	if (!bb->storage)
+		return NULL;
+	hash = ptr_map_lookup(&bb->storage->table[inout].map, pseudo);
+	return hash ? hash->storage : NULL;
 }
 
 void add_storage(struct storage *storage, struct basic_block *bb, pseudo_t pseudo, enum inout_enum inout)
 {
-	struct storage_hash_list **listp = storage_hash_table + storage_hash(bb,pseudo,inout);
-	struct storage_hash *hash = alloc_storage_hash(storage);
+	struct storage_hash *hash;
+	struct storage_table *t;
+
+	if (!bb->storage) {
+		bb->storage = calloc(1, sizeof(struct bb_storage));
+		if (!bb->storage)
+			die("out of memory");
+		add_bb(&storage_bbs, bb);
+	}
+	t = &bb->storage->table[inout];
 
+	hash = alloc_storage_hash(storage);
 	hash->bb = bb;
 	hash->pseudo = pseudo;
 	hash->inout = inout;
 
-	add_ptr_list(listp, hash);
+	if (!ptr_map_add(&t->map, pseudo, hash))
+		die("internal error: two storages for %s", show_pseudo(pseudo));
+	add_ptr_list(&t->list, hash);
 }
 
-
 static int storage_hash_cmp(const void *_a, const void *_b)
 {
 	const struct storage_hash *a = _a;
@@ -159,12 +175,21 @@ static void vrfy_storage(struct storage_hash_list **listp)
 
 void free_storage(void)
 {
-	int i;
+	struct basic_block *bb;
 
-	for (i = 0; i < MAX_STORAGE_HASH; i++) {
-		vrfy_storage(storage_hash_table + i);
-		free_ptr_list(storage_hash_table + i);
-	}
+	FOR_EACH_PTR(storage_bbs, bb) {
+		struct bb_storage *s = bb->storage;
+		int i;
+
+		for (i = STOR_IN; i <= STOR_OUT; i++) {
+			vrfy_storage(&s->table[i].list);
+			free_ptr_list(&s->table[i].list);
+			ptr_map_clear(&s->table[i].map);
+		}
+		free(s);
+		bb->storage = NULL;
+	} END_FOR_EACH_PTR(bb);
+	free_ptr_list(&storage_bbs);
 }
 
 const char *show_storage(struct storage *s)
@@ -294,6 +319,9 @@ void set_up_storage(struct entrypoint *ep)
 {
 	struct basic_block *bb;
 
+	/* gather_storage() sorts the storages by pseudo number */
+	number_pseudos(ep);
+
 	/* First set up storage for the incoming arguments */
 	set_up_argument_storage(ep, ep->entry->bb);
 
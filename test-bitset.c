@@ -0,0 +1,136 @@
+/*
+ * Check the bitsets and compare the speed of their word-parallel
+ * operations with the one of a walk bit per bit, like it's done
+ * by the iterations of a dataflow analysis over a big function.
+ *
+ *	./test-bitset [nr bits] [nr iterations]
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "lib.h"
+#include "bitmap.h"
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fill(struct bitset *set, unsigned int nr_bits, int density)
+{
+	unsigned int i;
+
+	bitset_zero(set);
+	for (i = 0; i < nr_bits; i++) {
+		if (rand() % 100 < density)
+			bitset_set(set, i);
+	}
+}
+
+static void check(unsigned int nr_bits)
+{
+	struct bitset *a = alloc_bitset(nr_bits);
+	struct bitset *b = alloc_bitset(nr_bits);
+	struct bitset *c = alloc_bitset(nr_bits);
+	struct bitset *d = alloc_bitset(nr_bits);
+	unsigned int i, nr, count;
+	int bit, last;
+
+	fill(a, nr_bits, 30);
+	fill(b, nr_bits, 30);
+	fill(c, nr_bits, 0);
+
+	// c = a | (b & ~a), bit per bit then word-parallel
+	count = 0;
+	for (i = 0; i < nr_bits; i++) {
+		if (bitset_test(a, i) || bitset_test(b, i)) {
+			bitset_set(c, i);
+			count++;
+		}
+	}
+	bitset_copy(d, a);
+	assert(bitset_or_andnot(d, b, a) == (count != bitset_count(a)));
+	assert(bitset_equal(c, d));
+	assert(!bitset_or(d, a));
+	assert(!bitset_or_andnot(d, b, a));
+	assert(bitset_count(d) == count);
+
+	// (a | b) & ~b == a & ~b
+	bitset_copy(c, a);
+	bitset_andnot(c, b);
+	bitset_copy(d, a);
+	bitset_or(d, b);
+	bitset_andnot(d, b);
+	assert(bitset_equal(c, d));
+	assert(!bitset_and(c, a));
+
+	// the walks see all the bits, in order
+	last = -1;
+	nr = 0;
+	FOR_EACH_BIT(a, bit) {
+		assert(bit > last && bitset_test(a, bit));
+		assert(bitset_next(a, last + 1) == bit);
+		last = bit;
+		nr++;
+	} END_FOR_EACH_BIT(bit);
+	assert(bitset_next(a, last + 1) == -1);
+	assert(nr == bitset_count(a));
+	assert(bitset_empty(a) == !nr);
+
+	bitset_zero(a);
+	assert(bitset_empty(a) && bitset_next(a, 0) == -1);
+
+	free_bitset(a);
+	free_bitset(b);
+	free_bitset(c);
+	free_bitset(d);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nr_bits = argc > 1 ? atoi(argv[1]) : 10000;
+	int nr_iter = argc > 2 ? atoi(argv[2]) : 10000;
+	struct bitset *in = alloc_bitset(nr_bits);
+	struct bitset *out = alloc_bitset(nr_bits);
+	struct bitset *def = alloc_bitset(nr_bits);
+	struct bitset *ref = alloc_bitset(nr_bits);
+	double start, tbit, tword;
+	unsigned int i;
+	int iter;
+
+	for (i = 0; i <= 300; i++)
+		check(i);
+	check(nr_bits);
+
+	fill(out, nr_bits, 20);
+	fill(def, nr_bits, 5);
+
+	// in |= out & ~def, the transfer function of the liveness
+	start = now();
+	for (iter = 0; iter < nr_iter; iter++) {
+		bitset_zero(in);
+		for (i = 0; i < nr_bits; i++) {
+			if (bitset_test(out, i) && !bitset_test(def, i))
+				bitset_set(in, i);
+		}
+	}
+	tbit = now() - start;
+	bitset_copy(ref, in);
+
+	start = now();
+	for (iter = 0; iter < nr_iter; iter++) {
+		bitset_zero(in);
+		bitset_or_andnot(in, out, def);
+	}
+	tword = now() - start;
+	assert(bitset_equal(in, ref));
+
+	printf("%d x %u bits: bit per bit %.4fs, word-parallel %.4fs\n",
+		nr_iter, nr_bits, tbit, tword);
+	return 0;
+}
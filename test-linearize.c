@@ -47,10 +47,11 @@ static void clean_up_symbols(struct symbol_list *list)
 
 		expand_symbol(sym);
 		ep = linearize_symbol(sym);
-		if (!(fdump_ir & PASS_FINAL))
+		if (!ep)
 			continue;
-		if (ep)
+		if (fdump_ir & PASS_FINAL)
 			show_entry(ep);
+		free_entrypoint(ep);
 	} END_FOR_EACH_PTR(sym);
 }
 
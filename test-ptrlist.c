@@ -0,0 +1,95 @@
+/*
+ * Check the walks of the ptr_lists once packed: the first block,
+ * which holds the size of the list, stays even when all its entries
+ * have been deleted, and the walks must then skip it.
+ *
+ *	./test-ptrlist [nr entries]
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lib.h"
+#include "ptrlist.h"
+
+DECLARE_PTR_LIST(int_list, int);
+
+// Check that 'list' holds vals[from] to vals[to - 1], walked in parallel with 'ref'.
+static void check_walk(struct int_list *list, struct int_list *ref, int *vals, int from, int to)
+{
+	int *ptr, *exp;
+	int pass, i;
+
+	assert(ptr_list_size((struct ptr_list *)list) == to - from);
+	for (pass = 0; pass < 2; pass++) {
+		i = from;
+		PREPARE_PTR_LIST(list, ptr);
+		PREPARE_PTR_LIST(ref, exp);
+		while (ptr) {
+			assert(i < to);
+			assert(ptr == &vals[i]);
+			assert(exp == ptr);
+			NEXT_PTR_LIST(ptr);
+			NEXT_PTR_LIST(exp);
+			i++;
+		}
+		assert(!exp);
+		assert(i == to);
+		if (!pass) {
+			RESET_PTR_LIST(ptr);
+			assert(from == to || ptr == &vals[from]);
+		}
+		FINISH_PTR_LIST(exp);
+		FINISH_PTR_LIST(ptr);
+	}
+
+	i = from;
+	FOR_EACH_PTR(list, ptr) {
+		assert(ptr == &vals[i++]);
+	} END_FOR_EACH_PTR(ptr);
+	assert(i == to);
+	assert(first_ptr_list((struct ptr_list *)list) == (from < to ? &vals[from] : NULL));
+}
+
+static void check(int *vals, int n)
+{
+	struct int_list *list = NULL, *ref = NULL;
+	int *ptr;
+	int i, first;
+
+	for (i = 0; i < n; i++) {
+		ptr = &vals[i];
+		add_ptr_list(&list, ptr);
+	}
+
+	// delete all the entries of the first block
+	first = ((struct ptr_list *)list)->nr;
+	i = 0;
+	FOR_EACH_PTR(list, ptr) {
+		if (i++ < first)
+			DELETE_CURRENT_PTR(ptr);
+	} END_FOR_EACH_PTR(ptr);
+	PACK_PTR_LIST(&list);
+	assert(first == n || ((struct ptr_list *)list)->nr == 0);
+
+	for (i = first; i < n; i++) {
+		ptr = &vals[i];
+		add_ptr_list(&ref, ptr);
+	}
+	check_walk(list, ref, vals, first, n);
+
+	free_ptr_list(&list);
+	free_ptr_list(&ref);
+}
+
+int main(int argc, char **argv)
+{
+	int max = argc > 1 ? atoi(argv[1]) : 1000;
+	int *vals = calloc(max + 1, sizeof(int));
+	int n;
+
+	for (n = 1; n <= max; n++)
+		check(vals, n);
+	printf("ok\n");
+	return 0;
+}
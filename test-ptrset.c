@@ -0,0 +1,127 @@
+/*
+ * Check the pointer sets & maps and compare their lookup time with the
+ * one of the ptr_lists, like it's done during the liveness of a
+ * big CFG: many blocks, each needing many pseudos.
+ *
+ *	./test-ptrset [nr blocks] [nr pseudos per block]
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "lib.h"
+#include "ptrlist.h"
+#include "ptrset.h"
+
+DECLARE_PTR_SET(int_set, int);
+DECLARE_PTR_MAP(int_map, int, int);
+DECLARE_PTR_LIST(int_list, int);
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int in_list(struct int_list *list, int *ptr)
+{
+	int *old;
+
+	FOR_EACH_PTR(list, old) {
+		if (old == ptr)
+			return 1;
+	} END_FOR_EACH_PTR(old);
+	return 0;
+}
+
+static void check(int *vals, int n)
+{
+	struct int_set set = { };
+	int *ptr;
+	int i, nr;
+
+	for (i = 0; i < n; i++)
+		assert(ptr_set_add(&set, &vals[i]));
+	for (i = 0; i < n; i++)
+		assert(!ptr_set_add(&set, &vals[i]));
+	assert(ptr_set_size(&set) == n);
+
+	/* remove the odd ones, in the middle of the clusters */
+	for (i = 1; i < n; i += 2)
+		assert(ptr_set_remove(&set, &vals[i]));
+	for (i = 0; i < n; i++)
+		assert(ptr_set_contains(&set, &vals[i]) == !(i & 1));
+
+	nr = 0;
+	FOR_EACH_PTR_SET(&set, ptr) {
+		assert(!((ptr - vals) & 1));
+		nr++;
+	} END_FOR_EACH_PTR_SET(ptr);
+	assert(nr == ptr_set_size(&set));
+	ptr_set_clear(&set);
+	assert(ptr_set_size(&set) == 0);
+}
+
+static void check_map(int *vals, int n)
+{
+	struct int_map map = { };
+	int i;
+
+	/* map each value to the one mirroring it */
+	for (i = 0; i < n; i++)
+		assert(ptr_map_add(&map, &vals[i], &vals[n - 1 - i]));
+	for (i = 0; i < n; i++)
+		assert(!ptr_map_add(&map, &vals[i], &vals[i]));
+	assert(ptr_map_size(&map) == n);
+	for (i = 0; i < n; i++)
+		assert(ptr_map_lookup(&map, &vals[i]) == &vals[n - 1 - i]);
+	assert(!ptr_map_lookup(&map, &vals[n]));
+	ptr_map_clear(&map);
+	assert(ptr_map_size(&map) == 0);
+}
+
+int main(int argc, char **argv)
+{
+	int nr_bbs = argc > 1 ? atoi(argv[1]) : 1000;
+	int nr_pseudos = argc > 2 ? atoi(argv[2]) : 400;
+	int *vals = calloc(nr_pseudos + 1, sizeof(int));
+	struct int_list *list = NULL;
+	struct int_set set = { };
+	double start, tlist, tset;
+	long found = 0;
+	int i, bb;
+
+	for (i = 0; i <= nr_pseudos; i++) {
+		check(vals, i);
+		check_map(vals, i);
+	}
+
+	/* the same lookups as track_bb_liveness(): one per pseudo & block */
+	start = now();
+	for (bb = 0; bb < nr_bbs; bb++) {
+		for (i = 0; i < nr_pseudos; i++) {
+			int *ptr = &vals[i];
+
+			if (!in_list(list, ptr))
+				add_ptr_list(&list, ptr);
+			found += in_list(list, &vals[nr_pseudos - 1 - i]);
+		}
+	}
+	tlist = now() - start;
+
+	start = now();
+	for (bb = 0; bb < nr_bbs; bb++) {
+		for (i = 0; i < nr_pseudos; i++) {
+			ptr_set_add(&set, &vals[i]);
+			found -= ptr_set_contains(&set, &vals[nr_pseudos - 1 - i]);
+		}
+	}
+	tset = now() - start;
+	assert(found == 0);
+
+	printf("%d x %d lookups: list %.4fs, set %.4fs\n", nr_bbs, nr_pseudos, tlist, tset);
+	return 0;
+}
@@ -2,6 +2,8 @@
 #include "allocate.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 static int
 int_cmp (const void *_a, const void *_b)
@@ -13,21 +15,118 @@ int_cmp (const void *_a, const void *_b)
 
 #define MIN(_x,_y) ((_x) < (_y) ? (_x) : (_y))
 
+/*
+ * Benchmark mode: "test-sort -b [N]" sorts N entries for each
+ * kind of input, checking that the result is sorted & stable,
+ * and reports the number of comparisons and the time taken.
+ */
+struct entry {
+  int key;
+  int seq;
+};
+
+DECLARE_PTR_LIST(entry_list, struct entry);
+
+static unsigned long nr_cmp;
+
+static int
+entry_cmp (const void *_a, const void *_b)
+{
+  const struct entry *a = _a;
+  const struct entry *b = _b;
+  nr_cmp++;
+  return (a->key > b->key) - (a->key < b->key);
+}
+
+enum input { SORTED, REVERSED, RANDOM, DUPLICATES, NEARLY_SORTED, NR_INPUTS };
+
+static const char *input_names[NR_INPUTS] = {
+  [SORTED] = "sorted",
+  [REVERSED] = "reversed",
+  [RANDOM] = "random",
+  [DUPLICATES] = "duplicates",
+  [NEARLY_SORTED] = "nearly sorted",
+};
+
+static int
+make_key (enum input input, int i, int n)
+{
+  switch (input) {
+  case SORTED:
+    return i;
+  case REVERSED:
+    return n - i;
+  case RANDOM:
+    return rand ();
+  case DUPLICATES:
+    return rand () % 8;
+  case NEARLY_SORTED:
+    return rand () % 100 ? i : rand () % n;
+  default:
+    return 0;
+  }
+}
+
+static void
+benchmark (int n)
+{
+  struct entry *entries = calloc (n, sizeof (*entries));
+  enum input input;
+
+  for (input = 0; input < NR_INPUTS; input++) {
+    struct entry_list *l = NULL;
+    struct entry *e, *prev = NULL;
+    clock_t start;
+    int i;
+
+    for (i = 0; i < n; i++) {
+      e = &entries[i];
+      e->key = make_key (input, i, n);
+      e->seq = i;
+      add_ptr_list (&l, e);
+    }
+
+    nr_cmp = 0;
+    start = clock ();
+    sort_list ((struct ptr_list **)&l, entry_cmp);
+    start = clock () - start;
+
+    FOR_EACH_PTR (l, e) {
+      if (prev && (prev->key > e->key ||
+                   (prev->key == e->key && prev->seq > e->seq)))
+        die ("%s: bad sort at key %d", input_names[input], e->key);
+      prev = e;
+    } END_FOR_EACH_PTR (e);
+
+    printf ("%14s: %8d entries, %10lu compares, %8.4fs\n",
+            input_names[input], n, nr_cmp,
+            (double) start / CLOCKS_PER_SEC);
+    free_ptr_list (&l);
+  }
+  free (entries);
+}
+
 int
 main (int argc, char **argv)
 {
   struct ptr_list *l = NULL, *l2;
-  int i, *e;
-  const int N = argv[1] ? atoi (argv[1]) : 10000;
+  int i;
+  int N;
+
+  if (argv[1] && !strcmp (argv[1], "-b")) {
+    benchmark (argv[2] ? atoi (argv[2]) : 100000);
+    return 0;
+  }
 
+  N = argv[1] ? atoi (argv[1]) : 10000;
   srand (N);
   for (i = 0; i < 1000; i++)
     (void)rand ();
 
   for (i = 0; i < N; i++) {
-    e = (int *)malloc (sizeof (int));
-    *e = rand ();
-    add_ptr_list (&l, e);
+    void *p = malloc (sizeof (int));
+    *(int *)p = rand ();
+    add_ptr_list (&l, p);
   }
   sort_list (&l, int_cmp);
   // Sort already sorted stuff.
@@ -35,7 +134,8 @@ main (int argc, char **argv)
 
   l2 = l;
   do {
-    l2->nr = MIN (l2->nr, rand () % 3);
+    int nr = rand () % 3;
+    l2->nr = MIN (l2->nr, nr);
     for (i = 0; i < l2->nr; i++)
       *((int *)(l2->list[i])) = rand();
     l2 = l2->next;
@@ -30,13 +30,17 @@ static void output_fn(struct entrypoint *ep)
 	unsigned long generation = ++bb_generation;
 	struct symbol *sym = ep->name;
 	const char *name = show_ident(sym->ident);
+	unsigned long phis;
+	int copies;
 
 	if (sym->ctype.modifiers & MOD_STATIC)
 		printf("\n\n%s:\n", name);
 	else
 		printf("\n\n.globl %s\n%s:\n", name, name);
 
-	unssa(ep);
+	phis = unssa_stats.phis;
+	copies = unssa(ep);
+	phis = unssa_stats.phis - phis;
 
 	FOR_EACH_PTR(ep->bbs, bb) {
 		if (bb->generation == generation)
@@ -44,6 +48,9 @@ static void output_fn(struct entrypoint *ep)
 		output_bb(bb, generation);
 	}
 	END_FOR_EACH_PTR(bb);
+
+	if (phis)
+		printf("# %lu phi-nodes, %d copies\n", phis, copies);
 }
 
 static int output_data(struct symbol *sym)
@@ -84,6 +91,9 @@ int main(int argc, char **argv)
 		compile(sparse(file));
 	} END_FOR_EACH_PTR_NOTAG(file);
 
+	if (fmem_report)
+		fprintf(stderr, "%16s: %8lu phi-nodes, %8lu copies, %8lu temporaries\n", "unssa",
+			unssa_stats.phis, unssa_stats.copies, unssa_stats.temps);
 	report_stats();
 	return 0;
 }
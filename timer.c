@@ -0,0 +1,342 @@
+// SPDX-License-Identifier: MIT
+//
+// timer.c - per-phase timing & IR size statistics (-ftime-report)
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "timer.h"
+#include "linearize.h"
+
+struct timer {
+	const char *name;
+	unsigned long calls;
+	unsigned int active;
+	double wall, cpu;
+
+	/* IR size, only for the optimization passes */
+	unsigned long insns_in, insns_out;
+	unsigned long bbs_in, bbs_out;
+};
+
+/*
+ * Only the phases with a name are timed: PASS__OPTIM is timed
+ * as its sub-passes and PASS__FINAL is not a pass.
+ */
+static struct timer timers[PASS__NR] = {
+	[PASS__TOKENIZE]	= { "tokenize" },
+	[PASS__PREPROCESS]	= { "preprocess" },
+	[PASS__PARSE]		= { "parse" },
+	[PASS__EVALUATE]	= { "evaluate" },
+	[PASS__EXPAND]		= { "expand" },
+	[PASS__LINEARIZE]	= { "linearize" },
+	[PASS__MEM2REG]		= { "mem2reg" },
+	[PASS__MEMOPS]		= { "memops" },
+	[PASS__SCCP]		= { "sccp" },
+	[PASS__SIMPLIFY]	= { "simplify" },
+	[PASS__CSE]		= { "cse" },
+	[PASS__FLOW]		= { "flow" },
+	[PASS__DCE]		= { "dce" },
+	[PASS__LIVENESS]	= { "liveness" },
+	[PASS__CHECK]		= { "check" },
+};
+
+#define MAX_TIMER_DEPTH	64
+
+static enum phase stack[MAX_TIMER_DEPTH];
+static int depth;
+static double last_wall, last_cpu;
+
+/*
+ * The functions are kept by name: those timed by the workers of -j
+ * must outlive them.
+ */
+struct function_time {
+	char name[64];
+	char file[192];
+	int line;
+	double wall;
+};
+
+static struct function_time *slowest;
+static unsigned int nr_slowest;
+static double function_start;
+
+static double now(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Account the time since the last event to the running timer.
+ */
+static void account(void)
+{
+	double wall = now(CLOCK_MONOTONIC);
+	double cpu = now(CLOCK_PROCESS_CPUTIME_ID);
+
+	if (depth > 0) {
+		struct timer *t = &timers[stack[depth - 1]];
+		t->wall += wall - last_wall;
+		t->cpu += cpu - last_cpu;
+	}
+	last_wall = wall;
+	last_cpu = cpu;
+}
+
+/*
+ * Don't account the time spent here to anyone.
+ */
+static void skip(void)
+{
+	last_wall = now(CLOCK_MONOTONIC);
+	last_cpu = now(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+static void count_ir(struct entrypoint *ep, unsigned long *insns, unsigned long *bbs)
+{
+	struct basic_block *bb;
+
+	FOR_EACH_PTR(ep->bbs, bb) {
+		struct instruction *insn;
+
+		FOR_EACH_PTR(bb->insns, insn) {
+			if (insn->bb)
+				(*insns)++;
+		} END_FOR_EACH_PTR(insn);
+		(*bbs)++;
+	} END_FOR_EACH_PTR(bb);
+}
+
+void __timer_start(enum phase id, struct entrypoint *ep)
+{
+	struct timer *t = &timers[id];
+
+	account();
+	if (depth >= MAX_TIMER_DEPTH)
+		die("timer stack overflow (%s)", t->name);
+	stack[depth++] = id;
+
+	/* recursive calls are only counted once */
+	if (!t->active++)
+		t->calls++;
+	if (ep) {
+		count_ir(ep, &t->insns_in, &t->bbs_in);
+		skip();
+	}
+}
+
+void __timer_stop(enum phase id, struct entrypoint *ep)
+{
+	struct timer *t = &timers[id];
+
+	account();
+	if (depth <= 0 || stack[depth - 1] != id)
+		die("unbalanced timer (%s)", t->name);
+	depth--;
+	t->active--;
+	if (ep) {
+		count_ir(ep, &t->insns_out, &t->bbs_out);
+		skip();
+	}
+}
+
+void __timer_start_function(void)
+{
+	function_start = now(CLOCK_MONOTONIC);
+}
+
+/*
+ * Keep the 'ftime_report_functions' slowest functions,
+ * sorted from the slowest to the fastest.
+ */
+static void add_function(const struct function_time *f)
+{
+	unsigned int i;
+
+	if (!slowest)
+		slowest = calloc(ftime_report_functions, sizeof(*slowest));
+	for (i = nr_slowest; i > 0; i--) {
+		if (slowest[i - 1].wall >= f->wall)
+			break;
+		if (i < ftime_report_functions)
+			slowest[i] = slowest[i - 1];
+	}
+	if (i >= ftime_report_functions)
+		return;
+	slowest[i] = *f;
+	if (nr_slowest < ftime_report_functions)
+		nr_slowest++;
+}
+
+void __timer_stop_function(struct symbol *sym)
+{
+	struct function_time f;
+
+	f.wall = now(CLOCK_MONOTONIC) - function_start;
+	snprintf(f.name, sizeof(f.name), "%s", show_ident(sym->ident));
+	snprintf(f.file, sizeof(f.file), "%s", stream_name(sym->pos.stream));
+	f.line = sym->pos.line;
+	add_function(&f);
+}
+
+/*
+ * The timers of a worker of -j: its counters, followed by
+ * its slowest functions.
+ */
+struct time_stats {
+	struct timer timers[PASS__NR];
+	unsigned int nr_slowest;
+	struct function_time slowest[];
+};
+
+size_t time_stats_size(void)
+{
+	return sizeof(struct time_stats) + ftime_report_functions * sizeof(struct function_time);
+}
+
+/*
+ * Restart the counters from zero, the running timers included.
+ */
+void clear_time_stats(void)
+{
+	int i;
+
+	for (i = 0; i < PASS__NR; i++) {
+		struct timer *t = &timers[i];
+
+		t->calls = 0;
+		t->wall = t->cpu = 0;
+		t->insns_in = t->insns_out = 0;
+		t->bbs_in = t->bbs_out = 0;
+	}
+	nr_slowest = 0;
+}
+
+void save_time_stats(void *buf)
+{
+	struct time_stats *s = buf;
+
+	memcpy(s->timers, timers, sizeof(timers));
+	s->nr_slowest = nr_slowest;
+	if (nr_slowest)
+		memcpy(s->slowest, slowest, nr_slowest * sizeof(*slowest));
+}
+
+void add_time_stats(const void *buf)
+{
+	const struct time_stats *s = buf;
+	unsigned int i;
+
+	for (i = 0; i < PASS__NR; i++) {
+		const struct timer *w = &s->timers[i];
+		struct timer *t = &timers[i];
+
+		t->calls += w->calls;
+		t->wall += w->wall;
+		t->cpu += w->cpu;
+		t->insns_in += w->insns_in;
+		t->insns_out += w->insns_out;
+		t->bbs_in += w->bbs_in;
+		t->bbs_out += w->bbs_out;
+	}
+	for (i = 0; i < s->nr_slowest; i++)
+		add_function(&s->slowest[i]);
+}
+
+static void show_text_report(void)
+{
+	struct timer tot = { .name = "total", };
+	int i;
+
+	for (i = 0; i < PASS__NR; i++) {
+		tot.wall += timers[i].wall;
+		tot.cpu += timers[i].cpu;
+	}
+
+	fprintf(stderr, "%16s: %8s, %10s, %10s, %6s, %9s, %9s, %7s, %7s\n", "phase", "calls",
+		"wall (s)", "cpu (s)", "%wall", "insns in", "insns out", "bbs in", "bbs out");
+	for (i = 0; i < PASS__NR; i++) {
+		struct timer *t = &timers[i];
+
+		if (!t->name)
+			continue;
+		fprintf(stderr, "%16s: %8lu, %10.4f, %10.4f, %5.1f%%",
+			t->name, t->calls, t->wall, t->cpu,
+			100 * t->wall / (tot.wall ? : 1));
+		if (t->insns_in || t->bbs_in)
+			fprintf(stderr, ", %9lu, %9lu, %7lu, %7lu",
+				t->insns_in, t->insns_out, t->bbs_in, t->bbs_out);
+		fprintf(stderr, "\n");
+	}
+	fprintf(stderr, "%16s: %8s, %10.4f, %10.4f\n", tot.name, "", tot.wall, tot.cpu);
+
+	if (!nr_slowest)
+		return;
+	fprintf(stderr, "\n%10s  %s\n", "wall (s)", "function");
+	for (i = 0; i < nr_slowest; i++) {
+		struct function_time *f = &slowest[i];
+
+		fprintf(stderr, "%10.4f  %s (%s:%d)\n", f->wall, f->name, f->file, f->line);
+	}
+}
+
+static void show_json_string(const char *str)
+{
+	fputc('"', stderr);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fputc('\\', stderr);
+		fputc(*str, stderr);
+	}
+	fputc('"', stderr);
+}
+
+static void show_json_report(void)
+{
+	const char *sep = "";
+	int i;
+
+	fprintf(stderr, "{\n\t\"phases\": [");
+	for (i = 0; i < PASS__NR; i++) {
+		struct timer *t = &timers[i];
+
+		if (!t->name)
+			continue;
+		fprintf(stderr, "%s\n\t\t{ \"name\": \"%s\", \"calls\": %lu, \"wall\": %.6f, \"cpu\": %.6f",
+			sep, t->name, t->calls, t->wall, t->cpu);
+		sep = ",";
+		if (t->insns_in || t->bbs_in)
+			fprintf(stderr, ", \"insns_in\": %lu, \"insns_out\": %lu, \"bbs_in\": %lu, \"bbs_out\": %lu",
+				t->insns_in, t->insns_out, t->bbs_in, t->bbs_out);
+		fprintf(stderr, " }");
+	}
+	fprintf(stderr, "\n\t],\n\t\"functions\": [");
+	for (i = 0; i < nr_slowest; i++) {
+		struct function_time *f = &slowest[i];
+
+		fprintf(stderr, "%s\n\t\t{ \"name\": ", i ? "," : "");
+		show_json_string(f->name);
+		fprintf(stderr, ", \"file\": ");
+		show_json_string(f->file);
+		fprintf(stderr, ", \"line\": %d, \"wall\": %.6f }", f->line, f->wall);
+	}
+	fprintf(stderr, "\n\t]\n}\n");
+}
+
+void show_time_report(void)
+{
+	switch (ftime_report) {
+	case TIME_REPORT_TEXT:
+		show_text_report();
+		break;
+	case TIME_REPORT_JSON:
+		show_json_report();
+		break;
+	}
+}
@@ -0,0 +1,79 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+/*
+ * Per-phase timing, used by -ftime-report, keyed by the
+ * PASS__* ids of lib.h.
+ *
+ * The time is accounted to the innermost running timer only,
+ * so the time reported for a phase doesn't include the time
+ * spent in the phases nested in it (tokenizing an included
+ * file while preprocessing, the optimization passes while
+ * linearizing, ...).
+ */
+
+#include "lib.h"
+
+struct entrypoint;
+
+extern void __timer_start(enum phase id, struct entrypoint *ep);
+extern void __timer_stop(enum phase id, struct entrypoint *ep);
+extern void __timer_start_function(void);
+extern void __timer_stop_function(struct symbol *sym);
+extern void show_time_report(void);
+
+/*
+ * To gather the timers of the workers of -j, in a buffer
+ * of time_stats_size() bytes.
+ */
+extern size_t time_stats_size(void);
+extern void clear_time_stats(void);
+extern void save_time_stats(void *buf);
+extern void add_time_stats(const void *buf);
+
+static inline void timer_start(enum phase id)
+{
+	if (ftime_report)
+		__timer_start(id, NULL);
+}
+
+static inline void timer_stop(enum phase id)
+{
+	if (ftime_report)
+		__timer_stop(id, NULL);
+}
+
+/*
+ * Same as timer_start() & timer_stop() but also record the
+ * number of instructions and basic blocks of 'ep' before
+ * and after the pass.
+ */
+static inline void timer_start_pass(enum phase id, struct entrypoint *ep)
+{
+	if (ftime_report)
+		__timer_start(id, ep);
+}
+
+static inline void timer_stop_pass(enum phase id, struct entrypoint *ep)
+{
+	if (ftime_report)
+		__timer_stop(id, ep);
+}
+
+/*
+ * Time the whole processing of a function, for the
+ * '-ftime-report-functions=N' breakdown.
+ */
+static inline void timer_start_function(void)
+{
+	if (ftime_report_functions)
+		__timer_start_function();
+}
+
+static inline void timer_stop_function(struct symbol *sym)
+{
+	if (ftime_report_functions)
+		__timer_stop_function(sym);
+}
+
+#endif
@@ -36,6 +36,7 @@
 #include "allocate.h"
 #include "token.h"
 #include "symbol.h"
+#include "timer.h"
 
 #define EOF (-1)
 
@@ -1019,9 +1020,11 @@ struct token * tokenize(const char *name, int fd, struct token *endtoken, const
 		return endtoken;
 	}
 
+	timer_start(PASS__TOKENIZE);
 	begin = setup_stream(&stream, idx, fd, buffer, 0);
 	end = tokenize_stream(&stream);
 	if (endtoken)
 		end->next = endtoken;
+	timer_stop(PASS__TOKENIZE);
 	return begin;
 }
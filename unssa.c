@@ -1,147 +1,732 @@
 /*
  * UnSSA - translate the SSA back to normal form.
  *
- * For now it's done by replacing to set of copies:
- * 1) For each phi-node, replace all their phisrc by copies to a common
- *    temporary.
- * 2) Replace all the phi-nodes by copies of the temporaries to the phi-node target.
- *    This is node to preserve the semantic of the phi-node (they should all "execute"
- *    simultaneously on entry in the basic block in which they belong).
+ * It's done in three steps:
+ * 1) Each phi-node gets its own temporary: all its phisrc are replaced
+ *    by copies to the temporary and the phi-node itself by a copy of
+ *    the temporary to the phi-node target ("Sreedhar method I").
+ *    The copies to the temporaries are not placed at the end of the
+ *    predecessor basic blocks but where the phisrc are, that is where
+ *    the phi-node operands are available. Since the temporaries are
+ *    new, nothing else can be clobbered by these copies and no edge
+ *    ever needs to be split to make room for them.
+ *    The copies made for a run of consecutive phi-nodes (or of phisrc)
+ *    form a parallel copy: they should all "execute" simultaneously.
+ * 2) The pseudos related by these copies are coalesced, as long as
+ *    their live ranges don't interfere. This removes most of the copies.
+ * 3) What's left of each parallel copy is sequentialized, a cycle of
+ *    copies (a swap, for example) being broken with a temporary, the
+ *    same one for the whole function.
  *
- * This is similar to the "Sreedhar method I" except that the copies to the
- * temporaries are not placed at the end of the predecessor basic blocks, but
- * at the place where the phi-node operands are defined.
- * This is particulary easy since these copies are essentialy already present
- * as the corresponding OP_PHISOURCE.
- *
- * While very simple this method create a lot more copies that really necessary.
- * We eliminate some of these copies but most probably most of them are still
- * useless.
- * Ideally, "Sreedhar method III" should be used:
- * "Translating Out of Static Single Assignment Form", V. C. Sreedhar, R. D.-C. Ju,
- * D. M. Gillies and V. Santhanam.  SAS'99, Vol. 1694 of Lecture Notes in Computer
- * Science, Springer-Verlag, pp. 194-210, 1999.
- * But for this we need precise liveness, on each %phi and not only on OP_PHI's
- * target pseudos.
+ * See:
+ * "Translating Out of Static Single Assignment Form", V. C. Sreedhar,
+ * R. D.-C. Ju, D. M. Gillies and V. Santhanam. SAS'99, Vol. 1694 of Lecture
+ * Notes in Computer Science, Springer-Verlag, pp. 194-210, 1999.
+ * "Revisiting Out-of-SSA Translation for Correctness, Code Quality, and
+ * Efficiency", B. Boissinot, A. Darte, F. Rastello, B. Dupont de Dinechin
+ * and C. Guillon. CGO'09.
  *
  * Copyright (C) 2005 Luc Van Oostenryck
  */
 
+#include <assert.h>
+#include <stdlib.h>
+
 #include "lib.h"
 #include "linearize.h"
 #include "allocate.h"
 #include "flow.h"
-#include <assert.h>
+#include "liveness.h"
+#include "bitmap.h"
+#include "ptrset.h"
+
+struct unssa_stats unssa_stats;
+
+DECLARE_PTR_SET(insn_set, struct instruction);
+
+static struct entrypoint *cur_ep;
+
+/* The copies made for the phi-nodes & for the phisrc */
+static struct insn_set phi_copies, src_copies;
+
+/*
+ * A parallel copy: the copies made for a run of consecutive
+ * phi-nodes, or of phisrc, of a basic block.
+ */
+struct pcopy {
+	struct basic_block *bb;
+	struct instruction_list *copies;
+	int nr;
+};
+
+static struct pcopy *pcopies;
+static int nr_pcopies, max_pcopies;
+
+/*
+ * The candidates: the pseudos related by the copies of the parallel
+ * copies, the only ones which can be coalesced. Only the interferences
+ * between them are recorded, in the conflicts lists.
+ * They're partitioned in classes of coalesced pseudos: circular lists
+ * whose root knows their size & the pseudo which stays.
+ */
+static struct bitset *candidates;
+static struct bitset *pinned;		/* used by an asm */
+static struct pseudo_list **conflicts;	/* by pseudo id */
+static int *root, *next, *size;		/* by pseudo id */
+static pseudo_t *keep;			/* by pseudo id */
 
+static pseudo_t parallel_temp;
 
-static inline int nbr_pseudo_users(pseudo_t p)
+static inline int numbered(pseudo_t p)
 {
-	return ptr_list_size((struct ptr_list *)p->users);
+	return p && (p->type == PSEUDO_REG || p->type == PSEUDO_ARG) && pseudo_numbered(cur_ep, p);
 }
 
-static int simplify_phi_node(struct instruction *phi, pseudo_t tmp)
+static inline int coalescable(pseudo_t p)
 {
-	pseudo_t target = phi->target;
-	struct pseudo_user *pu;
-	pseudo_t src;
+	return p->type == PSEUDO_REG && numbered(p) && !bitset_test(pinned, p->id);
+}
 
-	// verify if this phi can be simplified
-	FOR_EACH_PTR(phi->phi_list, src) {
-		struct instruction *def = src->def;
+static inline int candidate(pseudo_t p)
+{
+	return numbered(p) && bitset_test(candidates, p->id);
+}
 
-		if (!def)
-			continue;
-		if (def->bb == phi->bb)
-			return 0;
-	} END_FOR_EACH_PTR(src);
+static pseudo_t alloc_temp(struct ident *ident)
+{
+	pseudo_t tmp = alloc_pseudo(NULL);	// defined by several copies
 
-	// no need to make a copy of this one
-	// -> replace the target pseudo by the tmp
-	FOR_EACH_PTR(target->users, pu) {
-		use_pseudo(pu->insn, tmp, pu->userp);
-	} END_FOR_EACH_PTR(pu);
+	tmp->ident = ident;
+	return tmp;
+}
+
+static struct instruction *alloc_copy(struct instruction *model, pseudo_t target, pseudo_t src)
+{
+	struct instruction *insn = __alloc_instruction(0);
 
-	phi->bb = NULL;
-	return 1;
+	insn->opcode = OP_COPY;
+	insn->bb = model->bb;
+	insn->pos = model->pos;
+	insn->size = model->size;
+	insn->type = model->type;
+	insn->target = target;
+	use_pseudo(insn, src, &insn->src);
+	return insn;
 }
 
-static void replace_phi_node(struct instruction *phi)
+static void insert_before(struct instruction *insn, struct instruction *new)
 {
-	pseudo_t tmp;
-	pseudo_t p;
+	struct instruction *old;
 
-	tmp = alloc_pseudo(NULL);
-	tmp->type = phi->target->type;
-	tmp->ident = phi->target->ident;
-	tmp->def = NULL;		// defined by all the phisrc
+	FOR_EACH_PTR(insn->bb->insns, old) {
+		if (old == insn) {
+			INSERT_CURRENT(new, old);
+			return;
+		}
+	} END_FOR_EACH_PTR(old);
+}
 
-	// can we avoid to make of copy?
-	simplify_phi_node(phi, tmp);
+////////////////////////////////////////////////////////////////////////
+// 1) Replace the phi-nodes & the phisrc by copies
+
+static void replace_phi_node(struct instruction *phi)
+{
+	pseudo_t tmp = alloc_temp(phi->target->ident);
+	pseudo_t p;
 
-	// rewrite all it's phi_src to copy to a new tmp
 	FOR_EACH_PTR(phi->phi_list, p) {
-		struct instruction *def = p->def;
-		pseudo_t src;
+		struct instruction *def;
 
 		if (p == VOID)
 			continue;
+		def = p->def;
+		if (!def->bb)
+			continue;
+		if (def->opcode == OP_COPY) {
+			// this phisrc also feeds another phi-node
+			struct instruction *copy = alloc_copy(def, tmp, def->src);
 
-		assert(def->opcode == OP_PHISOURCE);
+			insert_before(def, copy);
+			ptr_set_add(&src_copies, copy);
+			continue;
+		}
 
+		assert(def->opcode == OP_PHISOURCE);
 		def->opcode = OP_COPY;
 		def->target = tmp;
-
-		// can we eliminate the copy?
-		src = def->phi_src;
-		if (src->type != PSEUDO_REG)
-			continue;
-		switch (nbr_pseudo_users(src)) {
-			struct instruction *insn;
-		case 1:
-			insn = src->def;
-			if (!insn)
-				break;
-			insn->target = tmp;
-		case 0:
-			kill_instruction(def);
-			def->bb = NULL;
-		}
+		ptr_set_add(&src_copies, def);
 	} END_FOR_EACH_PTR(p);
 
-	if (!phi->bb)
-		return;
-
 	// rewrite the phi node:
 	//	phi	%rt, ...
 	// to:
 	//	copy	%rt, %tmp
 	phi->opcode = OP_COPY;
 	use_pseudo(phi, tmp, &phi->src);
+	ptr_set_add(&phi_copies, phi);
+	unssa_stats.phis++;
 }
 
-static void rewrite_phi_bb(struct basic_block *bb)
+static void replace_phi_nodes(struct entrypoint *ep)
 {
+	struct instruction_list *phis = NULL;
 	struct instruction *insn;
+	struct basic_block *bb;
 
-	// Replace all the phi-nodes by copies of a temporary
-	// (which represent the set of all the %phi that feed them).
-	// The target pseudo doesn't change.
-	FOR_EACH_PTR(bb->insns, insn) {
+	FOR_EACH_PTR(ep->bbs, bb) {
+		FOR_EACH_PTR(bb->insns, insn) {
+			if (insn->bb && insn->opcode == OP_PHI)
+				add_instruction(&phis, insn);
+		} END_FOR_EACH_PTR(insn);
+	} END_FOR_EACH_PTR(bb);
+
+	FOR_EACH_PTR(phis, insn) {
+		replace_phi_node(insn);
+	} END_FOR_EACH_PTR(insn);
+	free_ptr_list(&phis);
+
+	// the phisrc not feeding any phi-node are dead
+	FOR_EACH_PTR(ep->bbs, bb) {
+		FOR_EACH_PTR(bb->insns, insn) {
+			if (insn->bb && insn->opcode == OP_PHISOURCE) {
+				remove_use(&insn->phi_src);
+				insn->bb = NULL;
+			}
+		} END_FOR_EACH_PTR(insn);
+	} END_FOR_EACH_PTR(bb);
+}
+
+static struct insn_set *copy_kind(struct instruction *insn)
+{
+	if (ptr_set_contains(&phi_copies, insn))
+		return &phi_copies;
+	if (ptr_set_contains(&src_copies, insn))
+		return &src_copies;
+	return NULL;
+}
+
+static void add_pcopy(struct basic_block *bb, struct instruction_list *copies, int nr)
+{
+	if (nr_pcopies == max_pcopies) {
+		max_pcopies = max_pcopies ? 2 * max_pcopies : 64;
+		pcopies = realloc(pcopies, max_pcopies * sizeof(*pcopies));
+		if (!pcopies)
+			die("out of memory");
+	}
+	pcopies[nr_pcopies++] = (struct pcopy) { bb, copies, nr };
+}
+
+/*
+ * Gather the runs of copies of the same kind into parallel copies,
+ * in the order of ep->bbs, which is the order they're processed in.
+ * A run is cut where a pseudo would be written twice.
+ */
+static void find_parallel_copies(struct entrypoint *ep)
+{
+	struct basic_block *bb;
+
+	FOR_EACH_PTR(ep->bbs, bb) {
+		struct instruction_list *copies = NULL;
+		struct insn_set *kind = NULL;
+		struct pseudo_set dests = { };
+		struct instruction *insn;
+		int nr = 0;
+
+		FOR_EACH_PTR(bb->insns, insn) {
+			struct insn_set *this;
+
+			if (!insn->bb)
+				continue;
+			this = copy_kind(insn);
+			if (this != kind || (this && ptr_set_contains(&dests, insn->target))) {
+				if (nr)
+					add_pcopy(bb, copies, nr);
+				copies = NULL;
+				nr = 0;
+				ptr_set_clear(&dests);
+				kind = this;
+			}
+			if (!this)
+				continue;
+			add_instruction(&copies, insn);
+			ptr_set_add(&dests, insn->target);
+			nr++;
+		} END_FOR_EACH_PTR(insn);
+		if (nr)
+			add_pcopy(bb, copies, nr);
+		ptr_set_clear(&dests);
+	} END_FOR_EACH_PTR(bb);
+}
+
+////////////////////////////////////////////////////////////////////////
+// 2) Coalesce the pseudos related by the copies
+
+static void pin_pseudo(struct basic_block *bb, pseudo_t pseudo)
+{
+	if (numbered(pseudo))
+		bitset_set(pinned, pseudo->id);
+}
+
+static void find_candidates(struct entrypoint *ep)
+{
+	struct basic_block *bb;
+	int i;
+
+	// the pseudos used or defined by an asm must stay as they are
+	FOR_EACH_PTR(ep->bbs, bb) {
+		struct instruction *insn;
+
+		FOR_EACH_PTR(bb->insns, insn) {
+			if (insn->bb && insn->opcode == OP_ASM)
+				track_instruction_usage(bb, insn, pin_pseudo, pin_pseudo);
+		} END_FOR_EACH_PTR(insn);
+	} END_FOR_EACH_PTR(bb);
+
+	for (i = 0; i < nr_pcopies; i++) {
+		struct instruction *copy;
+
+		FOR_EACH_PTR(pcopies[i].copies, copy) {
+			if (!coalescable(copy->target) || !coalescable(copy->src))
+				continue;
+			bitset_set(candidates, copy->target->id);
+			bitset_set(candidates, copy->src->id);
+		} END_FOR_EACH_PTR(copy);
+	}
+
+	for (i = 0; i < ep->nr_pseudos; i++) {
+		root[i] = next[i] = i;
+		size[i] = 1;
+		keep[i] = ep->pseudos[i];
+	}
+}
+
+static void add_conflict(pseudo_t a, pseudo_t b)
+{
+	add_pseudo(&conflicts[a->id], b);
+	add_pseudo(&conflicts[b->id], a);
+}
+
+// Only the candidates are tracked
+static struct bitset *live;
+static struct instruction *cur_insn;
+
+/*
+ * A pseudo interferes with the pseudos live where it's defined,
+ * except with the source of the copy defining it since they then
+ * hold the same value.
+ */
+static void interfere_with_live(pseudo_t pseudo, pseudo_t except)
+{
+	int nr;
+
+	if (!candidate(pseudo))
+		return;
+	FOR_EACH_BIT(live, nr) {
+		pseudo_t other = cur_ep->pseudos[nr];
+
+		if (other != pseudo && other != except)
+			add_conflict(pseudo, other);
+	} END_FOR_EACH_BIT(nr);
+}
+
+static void scan_def(struct basic_block *bb, pseudo_t pseudo)
+{
+	if (!candidate(pseudo))
+		return;
+	interfere_with_live(pseudo, cur_insn->opcode == OP_COPY ? cur_insn->src : NULL);
+	bitset_clear(live, pseudo->id);
+}
+
+static void scan_use(struct basic_block *bb, pseudo_t pseudo)
+{
+	if (candidate(pseudo))
+		bitset_set(live, pseudo->id);
+}
+
+static void scan_nothing(struct basic_block *bb, pseudo_t pseudo)
+{
+}
+
+/*
+ * The copies of a parallel copy read all their sources before
+ * writing any destination: the destinations interfere with what's
+ * live after the copy, and with each others, but not with the
+ * sources of the others copies.
+ */
+static void scan_parallel_copy(struct pcopy *pc)
+{
+	struct instruction *copy, *other;
+
+	FOR_EACH_PTR(pc->copies, copy) {
+		if (!candidate(copy->target))
+			continue;
+		interfere_with_live(copy->target, copy->src);
+		FOR_EACH_PTR(pc->copies, other) {
+			if (other == copy)
+				break;
+			if (candidate(other->target))
+				add_conflict(copy->target, other->target);
+		} END_FOR_EACH_PTR(other);
+	} END_FOR_EACH_PTR(copy);
+
+	FOR_EACH_PTR(pc->copies, copy) {
+		if (candidate(copy->target))
+			bitset_clear(live, copy->target->id);
+	} END_FOR_EACH_PTR(copy);
+	FOR_EACH_PTR(pc->copies, copy) {
+		if (candidate(copy->src))
+			bitset_set(live, copy->src->id);
+	} END_FOR_EACH_PTR(copy);
+}
+
+/*
+ * Walk the blocks backward, from what's live at their end,
+ * to find the interferences between the candidates.
+ * The parallel copies of a block are pcopies[first .. last].
+ */
+static void scan_bb(struct basic_block *bb, int first, int last)
+{
+	struct basic_block *child;
+	struct instruction *insn;
+	int skip = 0;
+
+	bitset_zero(live);
+	FOR_EACH_PTR(bb->children, child) {
+		pseudo_t needs;
+
+		FOR_EACH_PTR(child->needs, needs) {
+			if (candidate(needs))
+				bitset_set(live, needs->id);
+		} END_FOR_EACH_PTR(needs);
+	} END_FOR_EACH_PTR(child);
+
+	FOR_EACH_PTR_REVERSE(bb->insns, insn) {
+		if (skip && copy_kind(insn)) {
+			skip--;
+			continue;
+		}
 		if (!insn->bb)
 			continue;
-		if (insn->opcode != OP_PHI)
+		if (last >= first && copy_kind(insn)) {
+			// the last copy of the last parallel copy left
+			scan_parallel_copy(&pcopies[last]);
+			skip = pcopies[last].nr - 1;
+			last--;
 			continue;
-		replace_phi_node(insn);
-	} END_FOR_EACH_PTR(insn);
+		}
+		cur_insn = insn;
+		track_instruction_usage(bb, insn, scan_def, scan_nothing);
+		track_instruction_usage(bb, insn, scan_nothing, scan_use);
+	} END_FOR_EACH_PTR_REVERSE(insn);
 }
 
-int unssa(struct entrypoint *ep)
+static void find_interferences(struct entrypoint *ep)
 {
 	struct basic_block *bb;
+	int first = 0;
 
+	clear_liveness(ep);
+	track_pseudo_liveness(ep);
+
+	live = alloc_bitset(ep->nr_pseudos);
 	FOR_EACH_PTR(ep->bbs, bb) {
-		rewrite_phi_bb(bb);
+		int last = first;
+
+		while (last < nr_pcopies && pcopies[last].bb == bb)
+			last++;
+		scan_bb(bb, first, last - 1);
+		first = last;
 	} END_FOR_EACH_PTR(bb);
+	free_bitset(live);
+
+	clear_liveness(ep);
+}
 
+/*
+ * Walk the smaller of the two classes.
+ */
+static int classes_interfere(int a, int b)
+{
+	int i, tmp;
+
+	if (size[a] > size[b]) {
+		tmp = a; a = b; b = tmp;
+	}
+	i = a;
+	do {
+		pseudo_t other;
+
+		FOR_EACH_PTR(conflicts[i], other) {
+			if (root[other->id] == b)
+				return 1;
+		} END_FOR_EACH_PTR(other);
+		i = next[i];
+	} while (i != a);
 	return 0;
 }
+
+static void coalesce_copy(struct instruction *copy)
+{
+	int a, b, i, tmp;
+
+	if (!candidate(copy->target) || !candidate(copy->src))
+		return;
+	a = root[copy->target->id];
+	b = root[copy->src->id];
+	if (a == b || classes_interfere(a, b))
+		return;
+
+	// merge the smaller class into the bigger one
+	if (size[a] < size[b]) {
+		tmp = a; a = b; b = tmp;
+	}
+	i = b;
+	do {
+		root[i] = a;
+		i = next[i];
+	} while (i != b);
+	tmp = next[a];
+	next[a] = next[b];
+	next[b] = tmp;
+	size[a] += size[b];
+
+	// keep the original pseudos rather than the temporaries
+	if (!keep[a]->def)
+		keep[a] = keep[b];
+}
+
+static void rename_def(struct basic_block *bb, pseudo_t pseudo)
+{
+	if (candidate(pseudo))
+		cur_insn->target = keep[root[pseudo->id]];
+}
+
+static void rename_pseudos(struct entrypoint *ep)
+{
+	struct basic_block *bb;
+	int i;
+
+	FOR_EACH_PTR(ep->bbs, bb) {
+		struct instruction *insn;
+
+		FOR_EACH_PTR(bb->insns, insn) {
+			if (!insn->bb)
+				continue;
+			cur_insn = insn;
+			track_instruction_usage(bb, insn, rename_def, scan_nothing);
+		} END_FOR_EACH_PTR(insn);
+	} END_FOR_EACH_PTR(bb);
+
+	// the copies between two pseudos of the same class vanish here
+	for (i = 0; i < ep->nr_pseudos; i++) {
+		pseudo_t pseudo = ep->pseudos[i];
+		pseudo_t name = keep[root[i]];
+		struct pseudo_user *pu;
+
+		if (size[root[i]] == 1)
+			continue;
+		name->def = NULL;	// now defined by several instructions
+		FOR_EACH_PTR(pseudo->users, pu) {
+			struct instruction *insn = pu->insn;
+
+			if (*pu->userp != pseudo)
+				continue;
+			if (copy_kind(insn) && insn->target == name) {
+				*pu->userp = VOID;
+				insn->bb = NULL;
+				DELETE_CURRENT_PTR(pu);
+				continue;
+			}
+			if (pseudo == name)
+				continue;
+			*pu->userp = name;
+			add_ptr_list(&name->users, pu);
+		} END_FOR_EACH_PTR(pu);
+		if (pseudo == name)
+			PACK_PTR_LIST(&pseudo->users);
+		else
+			free_ptr_list(&pseudo->users);
+	}
+}
+
+static void coalesce_pseudos(struct entrypoint *ep)
+{
+	int i;
+
+	number_pseudos(ep);
+	candidates = alloc_bitset(ep->nr_pseudos);
+	pinned = alloc_bitset(ep->nr_pseudos);
+	conflicts = alloc_pseudo_table(ep, struct pseudo_list *);
+	root = alloc_pseudo_table(ep, int);
+	next = alloc_pseudo_table(ep, int);
+	size = alloc_pseudo_table(ep, int);
+	keep = alloc_pseudo_table(ep, pseudo_t);
+
+	find_candidates(ep);
+	find_interferences(ep);
+	for (i = 0; i < nr_pcopies; i++) {
+		struct instruction *copy;
+
+		FOR_EACH_PTR(pcopies[i].copies, copy) {
+			coalesce_copy(copy);
+		} END_FOR_EACH_PTR(copy);
+	}
+	rename_pseudos(ep);
+
+	for (i = 0; i < ep->nr_pseudos; i++)
+		free_ptr_list(&conflicts[i]);
+	free_bitset(candidates);
+	free_bitset(pinned);
+	free_pseudo_table(conflicts);
+	free_pseudo_table(root);
+	free_pseudo_table(next);
+	free_pseudo_table(size);
+	free_pseudo_table(keep);
+}
+
+////////////////////////////////////////////////////////////////////////
+// 3) Sequentialize the parallel copies
+
+static int *readers;			/* by pseudo id */
+static struct instruction **writer;	/* by pseudo id */
+
+static struct instruction *first_pending(struct pcopy *pc)
+{
+	struct instruction *copy;
+
+	FOR_EACH_PTR(pc->copies, copy) {
+		if (copy->bb && writer[copy->target->id] == copy)
+			return copy;
+	} END_FOR_EACH_PTR(copy);
+	return NULL;
+}
+
+/*
+ * Emit first the copies whose destination isn't needed anymore
+ * by the others. When only cycles are left, one destination is
+ * saved in the temporary, which frees its copy.
+ */
+static void sequentialize(struct pcopy *pc, struct instruction_list **list)
+{
+	struct instruction_list *ready = NULL;
+	struct instruction *copy, *other;
+	int left = 0;
+
+	FOR_EACH_PTR(pc->copies, copy) {
+		if (!copy->bb)
+			continue;
+		writer[copy->target->id] = copy;
+		if (numbered(copy->src))
+			readers[copy->src->id]++;
+		left++;
+	} END_FOR_EACH_PTR(copy);
+
+	FOR_EACH_PTR(pc->copies, copy) {
+		if (copy->bb && !readers[copy->target->id])
+			add_instruction(&ready, copy);
+	} END_FOR_EACH_PTR(copy);
+
+	while (left) {
+		while ((copy = delete_last_instruction(&ready))) {
+			pseudo_t src = copy->src;
+
+			add_instruction(list, copy);
+			writer[copy->target->id] = NULL;
+			unssa_stats.copies++;
+			left--;
+			if (numbered(src) && !--readers[src->id] && writer[src->id])
+				add_instruction(&ready, writer[src->id]);
+		}
+		if (!left)
+			break;
+
+		// only cycles are left: break one
+		copy = first_pending(pc);
+		if (!parallel_temp) {
+			parallel_temp = alloc_temp(NULL);
+			unssa_stats.temps++;
+		}
+		add_instruction(list, alloc_copy(copy, parallel_temp, copy->target));
+		unssa_stats.copies++;
+		FOR_EACH_PTR(pc->copies, other) {
+			if (other->bb && writer[other->target->id] == other && other->src == copy->target) {
+				remove_use(&other->src);
+				use_pseudo(other, parallel_temp, &other->src);
+			}
+		} END_FOR_EACH_PTR(other);
+		readers[copy->target->id] = 0;
+		add_instruction(&ready, copy);
+	}
+}
+
+static void sequentialize_bb(struct basic_block *bb, int first, int last)
+{
+	struct instruction_list *list = NULL;
+	struct instruction *insn;
+	int skip = 0;
+
+	FOR_EACH_PTR(bb->insns, insn) {
+		// a parallel copy may have been entirely coalesced away:
+		// look for its first copy, dead or not.
+		if (first <= last && insn == first_instruction(pcopies[first].copies)) {
+			sequentialize(&pcopies[first], &list);
+			skip = pcopies[first].nr - 1;
+			first++;
+			continue;
+		}
+		// the trivial copies are killed while sequentialized
+		if (skip && copy_kind(insn)) {
+			skip--;
+			continue;
+		}
+		if (!insn->bb)
+			continue;
+		add_instruction(&list, insn);
+	} END_FOR_EACH_PTR(insn);
+
+	free_ptr_list(&bb->insns);
+	bb->insns = list;
+}
+
+static void sequentialize_copies(struct entrypoint *ep)
+{
+	struct basic_block *bb;
+	int first = 0;
+
+	readers = alloc_pseudo_table(ep, int);
+	writer = alloc_pseudo_table(ep, struct instruction *);
+	FOR_EACH_PTR(ep->bbs, bb) {
+		int last = first;
+
+		while (last < nr_pcopies && pcopies[last].bb == bb)
+			last++;
+		sequentialize_bb(bb, first, last - 1);
+		first = last;
+	} END_FOR_EACH_PTR(bb);
+	free_pseudo_table(readers);
+	free_pseudo_table(writer);
+}
+
+int unssa(struct entrypoint *ep)
+{
+	unsigned long copies = unssa_stats.copies;
+	int i;
+
+	cur_ep = ep;
+	parallel_temp = NULL;
+
+	replace_phi_nodes(ep);
+	find_parallel_copies(ep);
+	if (nr_pcopies) {
+		coalesce_pseudos(ep);
+		sequentialize_copies(ep);
+	}
+
+	for (i = 0; i < nr_pcopies; i++)
+		free_ptr_list(&pcopies[i].copies);
+	nr_pcopies = 0;
+	ptr_set_clear(&phi_copies);
+	ptr_set_clear(&src_copies);
+
+	return unssa_stats.copies - copies;
+}
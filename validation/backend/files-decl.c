@@ -0,0 +1,14 @@
+int bar(int);
+
+int main(void)
+{
+	return bar(42);
+}
+
+/*
+ * check-name: files-decl
+ * check-command: sparse-llvm-dis $file
+ *
+ * check-output-ignore
+ * check-output-contains: declare i32 @bar(i32)
+ */
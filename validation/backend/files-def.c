@@ -0,0 +1,15 @@
+int bar(int y)
+{
+	return y;
+}
+
+/*
+ * check-name: files-def
+ * check-description: the declaration of bar() in the first file
+ *	doesn't reach the second one.
+ * check-command: sparse-llvm -fno-verify -c -o tmp.o backend/files-decl.c $file
+ *
+ * check-error-start
+backend/files-def.c:1:5: warning: symbol 'bar' was not declared. Should it be static?
+ * check-error-end
+ */
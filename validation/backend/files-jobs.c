@@ -0,0 +1,18 @@
+int baz(int);
+
+int baz(int z)
+{
+	return z;
+}
+
+/*
+ * check-name: files-jobs
+ * check-description: same diagnostics with '-j', and the modules
+ *	compiled by the workers are linked together.
+ * check-command: sparse-llvm -j 2 --run backend/files-decl.c backend/files-def.c $file
+ * check-exit-value: 42
+ *
+ * check-error-start
+backend/files-def.c:1:5: warning: symbol 'bar' was not declared. Should it be static?
+ * check-error-end
+ */
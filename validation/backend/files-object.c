@@ -0,0 +1,11 @@
+static int unused;
+
+/*
+ * check-name: files-object
+ * check-command: sparse-llvm -Wno-decl -c backend/files-decl.c $file
+ * check-exit-value: 1
+ *
+ * check-error-start
+'-c' without '-o' needs a single file
+ * check-error-end
+ */
@@ -0,0 +1,5 @@
+/*
+ * check-name: bitsets
+ * check-command: test-bitset 1000 10
+ * check-output-ignore
+ */
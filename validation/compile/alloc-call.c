@@ -0,0 +1,19 @@
+int g(int);
+
+int across(int a, int b)
+{
+	int x = g(a);
+
+	return x + a * b;
+}
+
+/*
+ * check-name: x86-64 values live across a call
+ * check-command: compile -m64 -Wno-decl $file
+ *
+ * check-output-ignore
+ * check-output-pattern(1): call.*g@PLT
+ * check-output-contains: movl.*%edi, %\\(ebx\\|r1[2-5]d\\)$
+ * check-output-contains: movl.*%esi, %\\(ebx\\|r1[2-5]d\\)$
+ * check-output-excludes: movl.*(%rbp)
+ */
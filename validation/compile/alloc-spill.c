@@ -0,0 +1,21 @@
+int pressure(int *p)
+{
+	int a = p[0], b = p[1], c = p[2], d = p[3], e = p[4], f = p[5], g = p[6];
+	int h = p[7], i = p[8], j = p[9], k = p[10], l = p[11], m = p[12], n = p[13];
+	int o = p[14], q = p[15];
+
+	p[16] = 0;
+	return a * b + c * d + e * f + g * h + i * j + k * l + m * n + o * q
+		+ a + b + c + d + e + f + g + h + i + j + k + l + m + n + o + q;
+}
+
+/*
+ * check-name: x86-64 spills
+ * check-command: compile -m64 -Wno-decl $file
+ *
+ * check-output-ignore
+ * check-output-contains: movq.*%r15, -[0-9]*(%rbp)
+ * check-output-contains: movl.*%eax, -[0-9]*(%rbp)
+ * check-output-contains: imull.*-[0-9]*(%rbp), %
+ * check-output-excludes: (%rsp)
+ */
@@ -0,0 +1,21 @@
+int swap(int a, int b, int n)
+{
+	while (n--) {
+		int t = a;
+		a = b;
+		b = t;
+	}
+	return a - b;
+}
+
+/*
+ * check-name: x86-64 copies of a swap
+ * check-command: compile -m64 -Wno-decl $file
+ *
+ * check-output-ignore
+ * check-output-contains: movl.*%esi, %r8d
+ * check-output-contains: movl.*%edi, %esi
+ * check-output-contains: movl.*%r8d, %edi
+ * check-output-excludes: movl.*(%rbp)
+ * check-output-excludes: xchg
+ */
@@ -0,0 +1,18 @@
+struct s {
+	int a, b;
+};
+
+int field(struct s *p) { return p->b; }
+long index(long *p, long i) { return p[i]; }
+void store(int *p) { p[4] = 0; }
+
+/*
+ * check-name: x86-64 addressing modes
+ * check-command: compile -m64 -Wno-decl $file
+ *
+ * check-output-ignore
+ * check-output-contains: movl.*4(%r[a-z0-9]*), %eax
+ * check-output-contains: movq.*(%r[a-z0-9]*,%r[a-z0-9]*,8), %rax
+ * check-output-contains: movl.*\\$0, 16(%r
+ * check-output-excludes: leaq
+ */
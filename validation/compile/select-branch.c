@@ -0,0 +1,22 @@
+int g(int);
+
+void loop(int *p, int n, int lim)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (p[i] < lim)
+			g(i);
+	}
+}
+
+/*
+ * check-name: x86-64 compare & branch
+ * check-command: compile -m64 -Wno-decl $file
+ *
+ * check-output-ignore
+ * check-output-pattern(2): cmpl
+ * check-output-pattern(2): jge
+ * check-output-excludes: set[a-z]
+ * check-output-excludes: test[lq]
+ */
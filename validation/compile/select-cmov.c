@@ -0,0 +1,17 @@
+int lt(int a, int b)
+{
+	if (a < b)
+		return 1;
+	return 2;
+}
+
+/*
+ * check-name: x86-64 select with cmov
+ * check-command: compile -m64 -Wno-decl $file
+ *
+ * check-output-ignore
+ * check-output-contains: cmpl
+ * check-output-contains: cmovll
+ * check-output-excludes: setl
+ * check-output-excludes: j[a-z]* *\\.L
+ */
@@ -0,0 +1,15 @@
+int add1(int a) { return a + 1; }
+int mul5(int a) { return a * 5; }
+unsigned int shr3(unsigned int a) { return a >> 3; }
+long and7(long a) { return a & 7; }
+
+/*
+ * check-name: x86-64 immediate operands
+ * check-command: compile -m64 -Wno-decl $file
+ *
+ * check-output-ignore
+ * check-output-contains: addl.*\\$1, %
+ * check-output-contains: imull.*\\$5, %
+ * check-output-contains: shrl.*\\$3, %
+ * check-output-contains: andq.*\\$7, %
+ */
@@ -0,0 +1,42 @@
+extern __thread int tv;
+
+int get(void)
+{
+	return tv;
+}
+
+int *addr(void)
+{
+	return &tv;
+}
+
+void set(int v)
+{
+	tv = v;
+}
+
+int ok(int a)
+{
+	return a + 1;
+}
+
+/*
+ * check-name: x86-64 thread-local variables
+ * check-description: their accesses are rejected, the functions
+ *	making them aren't emitted, and the exit status tells it.
+ * check-command: compile -m64 -Wno-decl $file
+ * check-exit-value: 1
+ *
+ * check-error-start
+compile/tls.c:5:16: error: thread-local variables are not supported
+compile/tls.c:10:17: error: thread-local variables are not supported
+compile/tls.c:15:14: error: thread-local variables are not supported
+ * check-error-end
+ *
+ * check-output-ignore
+ * check-output-excludes: tv
+ * check-output-excludes: ^get:
+ * check-output-excludes: ^addr:
+ * check-output-excludes: ^set:
+ * check-output-contains: ok:
+ */
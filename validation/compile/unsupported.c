@@ -0,0 +1,32 @@
+struct s {
+	int a, b, c, d, e;
+};
+
+int by_value(struct s s)
+{
+	return s.a;
+}
+
+long double ld(long double x)
+{
+	return x * 2;
+}
+
+int ok(int a)
+{
+	return a + 1;
+}
+
+/*
+ * check-name: x86-64 unsupported functions
+ * check-description: the functions which can't be compiled aren't
+ *	emitted, and the exit status tells it.
+ * check-command: compile -m64 -Wno-decl $file
+ * check-exit-value: 1
+ *
+ * check-error-ignore
+ * check-output-ignore
+ * check-output-excludes: ^by_value:
+ * check-output-excludes: ^ld:
+ * check-output-contains: ok:
+ */
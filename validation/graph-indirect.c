@@ -0,0 +1,53 @@
+struct ops {
+	int (*op)(int);
+	void (*done)(void);
+};
+
+extern int ext(int);
+extern int (*hook)(int);
+int run(int x);
+
+static int inc(int x) { return x + 1; }
+static int dec(int x) { return x - 1; }
+static void fin(void) { }
+
+static const struct ops ops = { .op = inc, .done = fin };
+
+static int apply(const struct ops *o, int x)
+{
+	int r = o->op(x);
+
+	o->done();
+	return r + ext(x);
+}
+
+int run(int x)
+{
+	hook = dec;
+	return apply(&ops, x) + hook(x);
+}
+
+/*
+ * check-name: graph-indirect
+ * check-command: graph --format=json $file
+ *
+ * check-output-start
+{"functions": [
+ {"id": 0, "name": "inc", "file": "graph-indirect.c", "line": 10, "type": "int (int)", "static": true, "defined": true},
+ {"id": 1, "name": "dec", "file": "graph-indirect.c", "line": 11, "type": "int (int)", "static": true, "defined": true},
+ {"id": 2, "name": "fin", "file": "graph-indirect.c", "line": 12, "type": "void ()", "static": true, "defined": true},
+ {"id": 3, "name": "apply", "file": "graph-indirect.c", "line": 16, "type": "int (struct ops const *, int)", "static": true, "defined": true},
+ {"id": 4, "name": "run", "file": "graph-indirect.c", "line": 24, "type": "int (int)", "static": false, "defined": true},
+ {"id": 5, "name": "ext", "static": false, "defined": false}
+],
+"calls": [
+ {"caller": 3, "callee": 0, "line": 18, "col": 22, "kind": "indirect"},
+ {"caller": 3, "callee": 1, "line": 18, "col": 22, "kind": "indirect"},
+ {"caller": 3, "callee": 2, "line": 20, "col": 16, "kind": "indirect"},
+ {"caller": 3, "callee": 5, "line": 21, "col": 23, "kind": "direct"},
+ {"caller": 4, "callee": 3, "line": 27, "col": 21, "kind": "direct"},
+ {"caller": 4, "callee": 0, "line": 27, "col": 37, "kind": "indirect"},
+ {"caller": 4, "callee": 1, "line": 27, "col": 37, "kind": "indirect"}
+]}
+ * check-output-end
+ */
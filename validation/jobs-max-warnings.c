@@ -0,0 +1,19 @@
+static void a(void) __attribute__((context(x,0,1)));
+
+static void f0(void) { a(); }
+static void f1(void) { a(); }
+static void f2(void) { a(); }
+static void f3(void) { a(); }
+static void f4(void) { a(); }
+static void f5(void) { a(); }
+
+/*
+ * check-name: warnings limit with -j
+ * check-command: sparse -j 3 -fmax-warnings=3 $file
+ *
+ * check-error-start
+jobs-max-warnings.c:3:13: warning: context imbalance in 'f0' - wrong count at exit
+jobs-max-warnings.c:4:13: warning: context imbalance in 'f1' - wrong count at exit
+jobs-max-warnings.c:5:13: warning: too many warnings
+ * check-error-end
+ */
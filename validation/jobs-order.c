@@ -0,0 +1,25 @@
+static void a(void) __attribute__((context(x,0,1)));
+static void r(void) __attribute__((context(x,1,0)));
+
+static void f0(void) { a(); }
+static void f1(void) { r(); }
+static void f2(void) { a(); r(); }
+static void f3(void) { a(); }
+static void f4(void) { r(); }
+static void f5(void) { a(); }
+static void f6(void) { a(); r(); }
+static void f7(void) { r(); }
+
+/*
+ * check-name: diagnostics order with -j
+ * check-command: sparse -j 3 $file
+ *
+ * check-error-start
+jobs-order.c:4:13: warning: context imbalance in 'f0' - wrong count at exit
+jobs-order.c:5:13: warning: context imbalance in 'f1' - unexpected unlock
+jobs-order.c:7:13: warning: context imbalance in 'f3' - wrong count at exit
+jobs-order.c:8:13: warning: context imbalance in 'f4' - unexpected unlock
+jobs-order.c:9:13: warning: context imbalance in 'f5' - wrong count at exit
+jobs-order.c:11:13: warning: context imbalance in 'f7' - unexpected unlock
+ * check-error-end
+ */
@@ -18,7 +18,6 @@ static int foo(int **g)
 /*
  * check-name: stray phisrc
  * check-command: test-linearize -Wno-decl $file
- * check-known-to-fail
  *
  * check-output-ignore
  * check-output-excludes: phisrc\\.
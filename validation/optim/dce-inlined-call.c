@@ -0,0 +1,23 @@
+int g(void);
+
+static inline void spin(int a, int n)
+{
+	while (n--)
+		a = a * 3 + 1;
+}
+
+void foo(int x, int n)
+{
+	g();
+	spin(x * 5, n);
+	g();
+}
+
+/*
+ * check-name: dce-inlined-call
+ * check-command: test-linearize -Wno-decl $file
+ *
+ * check-output-ignore
+ * check-output-contains: mul.32 .* <- %arg1, \\$5
+ * check-output-contains: # call .*spin, %r3
+ */
@@ -0,0 +1,18 @@
+int foo(int a)
+{
+	int x = a;
+	int i;
+
+	for (i = 0; i < a; i++)
+		x = x * 3 + 1;
+	return 0;
+}
+
+/*
+ * check-name: dce-phi-cycle
+ * check-command: test-linearize -Wno-decl $file
+ *
+ * check-output-ignore
+ * check-output-excludes: mul\\.
+ * check-output-excludes: phi\\..*(x)
+ */
@@ -0,0 +1,21 @@
+int foo(int a)
+{
+	int x = 1;
+	int i;
+
+	for (i = 0; i < a; i++) {
+		if (x != 1)
+			x = 2;
+	}
+	return x;
+}
+
+/*
+ * check-name: sccp-loop
+ * check-command: test-linearize -Wno-decl $file
+ *
+ * check-output-ignore
+ * check-output-contains: ret\\.32 *\\$1
+ * check-output-excludes: phisrc\\..*(x)
+ * check-output-excludes: setne\\.
+ */
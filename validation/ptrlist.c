@@ -0,0 +1,5 @@
+/*
+ * check-name: walks of the packed ptr_lists
+ * check-command: test-ptrlist 500
+ * check-output-ignore
+ */
@@ -0,0 +1,5 @@
+/*
+ * check-name: pointer sets
+ * check-command: test-ptrset 10 100
+ * check-output-ignore
+ */
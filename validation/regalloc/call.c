@@ -0,0 +1,23 @@
+int g(int);
+
+int live_across_call(int a, int b)
+{
+	int x = a * b;
+
+	g(a);
+	return x + b;
+}
+
+/*
+ * check-name: regalloc-call
+ * check-description: the values live across a call are kept in
+ *	registers which the call doesn't clobber.
+ * check-command: example -Wno-decl $file
+ *
+ * check-output-ignore
+ * check-output-contains: mul.32 %ebx,%esi
+ * check-output-contains: call g
+ * check-output-contains: movl %esi,%eax
+ * check-output-contains: add.32 %ebx,%eax
+ * check-output-excludes: (%esp)
+ */
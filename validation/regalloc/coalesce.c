@@ -0,0 +1,22 @@
+int coalesce(int a, int n)
+{
+	int r = a + 1;
+
+	while (n--)
+		r = r * 3;
+	return r;
+}
+
+/*
+ * check-name: regalloc-coalesce
+ * check-description: the copy of %arg2, which dies there, is coalesced
+ *	away; the one of %r4, which is then redefined, is not.
+ * check-command: example -v -Wno-decl $file
+ *
+ * check-output-ignore
+ * check-output-contains: copy.32 *%r4 <- %arg2
+ * check-output-contains: copy.32 *%r3 <- %r4
+ * check-output-pattern(1): movl %e[a-z]*,%e[a-z]*[[:space:]]*# emit_move
+ * check-output-contains: add.32 \\$1,%edx
+ * check-output-contains: mul.32 \\$3,%edx
+ */
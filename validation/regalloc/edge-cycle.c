@@ -0,0 +1,40 @@
+int g(int);
+
+int edge_cycle(int a, int b, int c, int d)
+{
+	while (a--) {
+		if (a) {
+			int t = d;
+			d = a;
+			a = t;
+		} else {
+			a = g(a);
+		}
+		{
+			int t = c;
+			c = b;
+			b = t;
+		}
+		a = g(c);
+		while (b--) {
+			int t = c;
+			c = b;
+			b = t;
+			d = g(b);
+		}
+	}
+	c = g(c) & (c * b);
+	return a + b + c + d;
+}
+
+/*
+ * check-name: regalloc-edge-cycle
+ * check-description: two pseudos swap their registers on an edge,
+ *	the cycle being broken with the scratch register %ecx.
+ * check-command: example -Wno-decl $file
+ *
+ * check-output-ignore
+ * check-output-pattern(1): movl %edx,%ecx[[:space:]]*# emit_move
+ * check-output-pattern(1): movl %eax,%edx[[:space:]]*# emit_move
+ * check-output-pattern(1): movl %ecx,%eax[[:space:]]*# emit_move
+ */
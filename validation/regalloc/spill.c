@@ -0,0 +1,19 @@
+int spill(int *p)
+{
+	int a = p[0], b = p[1], c = p[2], d = p[3];
+	int e = p[4], f = p[5], g = p[6], h = p[7];
+
+	return (a + b) * (c + d) * (e + f) * (g + h) * a * b * c * d * e * f * g * h;
+}
+
+/*
+ * check-name: regalloc-spill
+ * check-description: with more values live than registers, some
+ *	of them are spilled to the stack and used from there.
+ * check-command: example -Wno-decl $file
+ *
+ * check-output-ignore
+ * check-output-pattern(5): movl %e[a-z]*,[0-9]*(%esp)
+ * check-output-contains: mul.32 (%esp),%eax
+ * check-output-contains: mul.32 12(%esp),%eax
+ */
@@ -0,0 +1,27 @@
+int spill(int *p)
+{
+	int a = p[0], b = p[1], c = p[2], d = p[3];
+	int e = p[4], f = p[5], g = p[6], h = p[7];
+
+	return (a + b) * (c + d) * (e + f) * (g + h) * a * b * c * d * e * f * g * h;
+}
+
+int coalesce(int a, int n)
+{
+	int r = a + 1;
+
+	while (n--)
+		r = r * 3;
+	return r;
+}
+
+/*
+ * check-name: regalloc-stats
+ * check-description: with -v, the number of loads, stores and moves
+ *	added by the register allocation is given for each function.
+ * check-command: example -v -Wno-decl $file
+ *
+ * check-output-ignore
+ * check-output-contains: # 11 loads, 5 stores, 2 moves
+ * check-output-contains: # 2 loads, 0 stores, 3 moves
+ */
@@ -0,0 +1,29 @@
+int g(int);
+
+int storages(int a, int b, int c, int d, int n)
+{
+	int e = a * b, f = c * d;
+
+	while (n--) {
+		e = g(e + a);
+		f = g(f + b);
+	}
+	return a + b + c + d + e + f;
+}
+
+/*
+ * check-name: regalloc-storage
+ * check-description: the places of the pseudos at the start and at
+ *	the end of each block, more than fit in the inline storage maps.
+ * check-command: example -v -Wno-decl $file
+ *
+ * check-output-ignore
+ * check-output-pattern(25): # in %
+ * check-output-pattern(21): # out %
+ * check-output-pattern(3): # in %r3(e) <- 0(SP)
+ * check-output-pattern(3): # out %r3(e) <- 0(SP)
+ * check-output-pattern(3): # in %arg4 <- 3:12
+ * check-output-pattern(2): # out %arg4 <- 3:12
+ * check-output-pattern(2): # in %r8 <- reg1
+ * check-output-pattern(1): # out %r8 <- reg5
+ */
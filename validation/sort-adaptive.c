@@ -0,0 +1,5 @@
+/*
+ * check-name: adaptive sort of the ptr_lists
+ * check-command: test-sort -b 10000
+ * check-output-ignore
+ */
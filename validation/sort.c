@@ -0,0 +1,4 @@
+/*
+ * check-name: sort of the ptr_lists
+ * check-command: test-sort 10000
+ */
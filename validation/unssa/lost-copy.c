@@ -0,0 +1,40 @@
+int len(const char *s)
+{
+	int n = 0;
+
+	while (*s++)
+		n++;
+	return n;
+}
+
+/*
+ * check-name: unssa lost copy
+ * check-command: test-unssa -Wno-decl $file
+ *
+ * check-output-start
+
+
+.globl len
+len:
+.L0
+	<entry-point>
+	copy.32     %r4 <- $0
+	copy.64     %r1 <- %arg1
+	br          .L4
+
+.L4
+	add.64      %r2 <- %r1, $1
+	load.8      %r3 <- 0[%r1]
+	copy.64     %r1 <- %r2
+	cbr         %r3, .L1, .L5
+
+.L1
+	add.32      %r4 <- %r4, $1
+	br          .L4
+
+.L5
+	ret.32      %r4
+
+# 2 phi-nodes, 3 copies
+ * check-output-end
+ */
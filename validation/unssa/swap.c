@@ -0,0 +1,44 @@
+int swap(int a, int b, int n)
+{
+	while (n--) {
+		int t = a;
+		a = b;
+		b = t;
+	}
+	return a - b;
+}
+
+/*
+ * check-name: unssa swap
+ * check-command: test-unssa -Wno-decl $file
+ *
+ * check-output-start
+
+
+.globl swap
+swap:
+.L0
+	<entry-point>
+	copy.32     %r2 <- %arg3
+	copy.32     %r4 <- %arg2
+	copy.32     %r3 <- %arg1
+	br          .L4
+
+.L4
+	copy.32     %r1 <- %r2
+	add.32      %r2 <- %r1, $-1
+	cbr         %r1, .L1, .L3
+
+.L1
+	copy.32     %r13 <- %r3
+	copy.32     %r3 <- %r4
+	copy.32     %r4 <- %r13
+	br          .L4
+
+.L3
+	sub.32      %r8 <- %r3, %r4
+	ret.32      %r8
+
+# 3 phi-nodes, 7 copies
+ * check-output-end
+ */